@@ -0,0 +1,191 @@
+# -*- encoding: binary -*-
+# Inotify throughput and latency under file churn, run with "make bench"
+# or: ruby -I lib:tmp/ext/$ENGINE-$VERSION/ext/sleepy_penguin bench/bench_inotify.rb
+#
+# A forked writer creates, modifies or renames files round-robin across
+# many directories while this process reads events with each strategy.
+# Created and renamed files are named after the CLOCK_MONOTONIC time (in
+# nanoseconds) just before the syscall, so delivery latency to the Ruby
+# block is measured without any extra allocation.  "lost" counts events
+# dropped on queue overflow along with identical consecutive events
+# merged by the kernel.
+#
+# Environment knobs:
+#   DURATION=2     seconds of churn per run
+#   DIRS=64        directories to spread churn across
+#   RATE=0         writer operations per second, 0 for as fast as possible
+#   WORKLOADS=create,modify,rename
+#   STRATEGIES=take,take_all,take_all/16,take_all/262144,take_batch,...
+#     a "/N" suffix sets Inotify#buffer_size, "/16" forces every read(2)
+#     through the FIONREAD resize path
+require 'sleepy_penguin'
+require 'tmpdir'
+require 'fileutils'
+
+class BenchInotify
+  include SleepyPenguin
+  CLK = Process::CLOCK_MONOTONIC
+  MASKS = { create: :CREATE, modify: :MODIFY, rename: :MOVED_TO }
+  STRATEGIES = %w(take take_all take_all/16 take_all/262144
+                  take_batch take_batch/262144 hub)
+
+  def initialize
+    @duration = (ENV['DURATION'] || 2).to_f
+    @nr_dirs = (ENV['DIRS'] || 64).to_i
+    @rate = (ENV['RATE'] || 0).to_f
+    @workloads = (ENV['WORKLOADS'] || MASKS.keys.join(',')).split(',')
+    @workloads.map!(&:to_sym)
+    @strategies = ENV['STRATEGIES'] ? ENV['STRATEGIES'].split(',') : STRATEGIES
+  end
+
+  def ns
+    Process.clock_gettime(CLK, :nanosecond)
+  end
+
+  # runs in the forked writer, returns the number of operations
+  def churn(workload, dirs, paths)
+    fps = paths.map { |path| File.open(path, 'ab') } if workload == :modify
+    t0 = Process.clock_gettime(CLK)
+    stop = t0 + @duration
+    ops = 0
+    while (now = Process.clock_gettime(CLK)) < stop
+      i = ops % dirs.size
+      case workload
+      when :create
+        path = "#{dirs[i]}/#{ns}"
+        File.open(path, 'w').close
+        File.unlink(path)
+      when :modify
+        fps[i].syswrite('.')
+      when :rename
+        dst = "#{dirs[i]}/#{ns}"
+        File.rename(paths[i], dst)
+        paths[i] = dst
+      end
+      ops += 1
+      if @rate > 0 && (ahead = t0 + ops / @rate - now) > 0
+        sleep(ahead)
+      end
+    end
+    ops
+  end
+
+  # per-event accounting, must not allocate
+  def record(mask, name)
+    now = ns
+    if mask & Inotify::Q_OVERFLOW != 0
+      @overflows += 1
+    else
+      @events += 1
+      @lat[@nlat += 1] = now - name.to_i if @timed
+    end
+    @last = now
+  end
+
+  # returns [ IO to wait on, lambda reading with nonblock=true ]
+  def reader(strategy, dirs, mask)
+    name, size = strategy.split('/')
+    if name == 'hub'
+      io = Inotify::Hub.new(:CLOEXEC)
+      sub = io.subscribe { |e| record(e.mask, e.name) }
+      dirs.each { |dir| sub.add_watch(dir, mask) }
+      return [ io, lambda { io.dispatch(true) } ]
+    end
+
+    io = Inotify.new(:CLOEXEC)
+    io.buffer_size = size.to_i if size
+    dirs.each { |dir| io.add_watch(dir, mask) }
+    fn = case name
+    when 'take'
+      lambda do
+        n = 0
+        while e = io.take(true)
+          record(e.mask, e.name)
+          n += 1
+        end
+        n == 0 ? nil : n
+      end
+    when 'take_all'
+      lambda do
+        events = io.take_all(true) or return
+        events.each { |e| record(e.mask, e.name) }
+      end
+    when 'take_batch'
+      lambda do
+        batch = io.take_batch(true) or return
+        batch.each { |e| record(e.mask, e.name) }
+      end
+    else
+      abort "unknown strategy: #{strategy}"
+    end
+    [ io, fn ]
+  end
+
+  def run1(workload, strategy)
+    top = Dir.mktmpdir('bench_inotify')
+    dirs = (0...@nr_dirs).map { |i| Dir.mkdir(d = "#{top}/#{i}"); d }
+    paths = dirs.map { |dir| File.write(p = "#{dir}/f", ''); p }
+    io, poll = reader(strategy, dirs, MASKS[workload])
+    @events = @overflows = 0
+    @timed = workload != :modify
+    @lat = []
+    @nlat = -1
+    r, w = IO.pipe
+    GC.start
+    alloc0 = GC.stat(:total_allocated_objects)
+    t0 = @last = ns
+    pid = fork do
+      r.close
+      w.write(churn(workload, dirs, paths).to_s)
+      exit!(0)
+    end
+    w.close
+    done = false
+    loop do
+      next if poll.call
+      if done
+        break unless IO.select([ io ], nil, nil, 0.2)
+      else
+        done = Process.waitpid(pid, Process::WNOHANG)
+        IO.select([ io ], nil, nil, 0.01) unless done
+      end
+    end
+    allocs = GC.stat(:total_allocated_objects) - alloc0
+    ops = r.read.to_i
+    report(workload, strategy, ops, @last - t0, allocs)
+  ensure
+    r.close if r && !r.closed?
+    io.close if io
+    FileUtils.rm_rf(top) if top
+  end
+
+  def pct(sorted, q)
+    sorted.empty? ? 'n/a' : '%.1f' % (sorted[(sorted.size - 1) * q / 100] / 1e3)
+  end
+
+  def report(workload, strategy, ops, elapsed_ns, allocs)
+    lat = @lat.compact.sort!
+    lost = ops - @events
+    lost = 0 if lost < 0
+    printf("%-7s %-18s %11.0f %9d %7.2f%% %6d %9.2f %9s %9s\n",
+           workload, strategy, @events / (elapsed_ns / 1e9), @events,
+           ops > 0 ? lost * 100.0 / ops : 0, @overflows,
+           @events > 0 ? allocs.fdiv(@events) : 0,
+           pct(lat, 50), pct(lat, 99))
+  end
+
+  def run
+    max = File.read('/proc/sys/fs/inotify/max_queued_events').to_i rescue '?'
+    puts "# DURATION=#@duration DIRS=#@nr_dirs RATE=#@rate " \
+         "max_queued_events=#{max}"
+    printf("%-7s %-18s %11s %9s %8s %6s %9s %9s %9s\n", 'load', 'strategy',
+           'events/s', 'events', 'lost', 'ovfl', 'alloc/ev',
+           'p50(us)', 'p99(us)')
+    @workloads.each do |workload|
+      MASKS.include?(workload) or abort "unknown workload: #{workload}"
+      @strategies.each { |strategy| run1(workload, strategy) }
+    end
+  end
+end
+
+BenchInotify.new.run if $0 == __FILE__
@@ -0,0 +1,118 @@
+# -*- encoding: binary -*-
+# TimerFD wakeup jitter with various Sched settings, run with "make bench"
+# or: ruby -I lib:tmp/ext/$ENGINE-$VERSION/ext/sleepy_penguin bench/bench_timer_jitter.rb
+#
+# A periodic absolute TimerFD is read in a blocking loop and the
+# lateness of each wakeup (CLOCK_MONOTONIC after TimerFD#expirations
+# returns minus the scheduled expiry) is recorded.  Each configuration
+# runs in a new Thread since Sched settings only apply to the calling
+# thread, so configurations do not leak into each other.
+#
+# Configurations:
+#   default  - untouched (50us timer slack under the normal policy)
+#   slack    - Sched.timerslack = 1
+#   pinned   - slack, plus Sched.affinity = the current CPU
+#   fifo     - pinned, plus Sched.setattr(:fifo, priority: 1)
+#              (skipped without CAP_SYS_NICE)
+#
+# Environment knobs:
+#   INTERVAL=1000000  timer interval in nanoseconds
+#   COUNT=2000        wakeups per configuration
+#   BUSY=0            forked busy-looping processes to compete for CPUs
+#   CONFIGS=default,slack,pinned,fifo
+require 'sleepy_penguin'
+
+class BenchTimerJitter
+  include SleepyPenguin
+  CLK = Process::CLOCK_MONOTONIC
+  CONFIGS = %w(default slack pinned fifo)
+
+  def initialize
+    @interval = (ENV['INTERVAL'] || 1_000_000).to_i
+    @count = (ENV['COUNT'] || 2000).to_i
+    @busy = (ENV['BUSY'] || 0).to_i
+    @configs = ENV['CONFIGS'] ? ENV['CONFIGS'].split(',') : CONFIGS
+  end
+
+  def ns
+    Process.clock_gettime(CLK, :nanosecond)
+  end
+
+  # runs in the measuring thread, returns false if not permitted
+  def apply(config)
+    case config
+    when 'default'
+    when 'slack', 'pinned', 'fifo'
+      Sched.timerslack = 1
+      Sched.affinity = Sched.getcpu if config != 'slack'
+      Sched.setattr(:fifo, :reset_on_fork, priority: 1) if config == 'fifo'
+    else
+      abort "unknown config: #{config}"
+    end
+    true
+  rescue Errno::EPERM
+    false
+  end
+
+  # returns [ lateness in ns of each wakeup, overruns ] or nil
+  def measure(config)
+    apply(config) or return
+    lat = Array.new(@count, 0)
+    overruns = 0
+    tfd = TimerFD.new(:MONOTONIC)
+    expect = ns + @interval
+    tfd.rearm(expect, @interval, abstime: true)
+    @count.times do |i|
+      n = tfd.expirations
+      now = ns
+      expect += (n - 1) * @interval
+      overruns += n - 1
+      lat[i] = now - expect
+      expect += @interval
+    end
+    [ lat, overruns ]
+  ensure
+    tfd.close if tfd
+  end
+
+  def pct(sorted, q)
+    sorted[((sorted.size - 1) * q).round] / 1e3
+  end
+
+  def report(config, lat, overruns, slack)
+    sorted = lat.sort
+    mean = lat.sum.fdiv(lat.size)
+    stddev = Math.sqrt(lat.sum { |x| (x - mean) ** 2 }.fdiv(lat.size))
+    printf("%-8s %7d %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %8d\n",
+           config, slack, pct(sorted, 0.5), pct(sorted, 0.99),
+           pct(sorted, 0.999), sorted[-1] / 1e3, mean / 1e3, stddev / 1e3,
+           overruns)
+  end
+
+  def run
+    pids = Array.new(@busy) { fork { loop {} } }
+    puts "# INTERVAL=#@interval COUNT=#@count BUSY=#@busy " \
+         "cpus=#{Sched.affinity.size}"
+    printf("%-8s %7s %9s %9s %9s %9s %9s %9s %8s\n", 'config', 'slack',
+           'p50(us)', 'p99(us)', 'p99.9(us)', 'max(us)', 'mean(us)',
+           'sd(us)', 'overruns')
+    @configs.each do |config|
+      lat, overruns, slack = Thread.new do
+        rv = measure(config)
+        rv && rv << Sched.timerslack
+      end.value
+      if lat
+        report(config, lat, overruns, slack)
+      else
+        printf("%-8s skipped (EPERM)\n", config)
+      end
+    end
+  ensure
+    pids.each do |pid|
+      Process.kill(:KILL, pid)
+      Process.waitpid(pid)
+    end if pids
+  end
+end
+
+BenchTimerJitter.new.run if $0 == __FILE__
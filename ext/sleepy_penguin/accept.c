@@ -0,0 +1,123 @@
+#include "sleepy_penguin.h"
+#include "sp_copy.h"
+#ifdef HAVE_ACCEPT4
+#include <sys/socket.h>
+
+static ID id_for_fd;
+
+struct accept_args {
+	int fd;
+	int flags;
+	int *fds;
+	long max;
+	long n;
+	int err;
+	VALUE klass;
+	VALUE ary;
+};
+
+/* runs without the GVL, the listener is non-blocking */
+static void *nogvl_accept(void *ptr)
+{
+	struct accept_args *a = ptr;
+
+	while (a->n < a->max) {
+		int fd = accept4(a->fd, NULL, NULL, a->flags);
+
+		if (fd >= 0) {
+			a->fds[a->n++] = fd;
+			continue;
+		}
+		switch (errno) {
+		case ECONNABORTED: continue;
+		case EINTR: return NULL; /* checks interrupts if a->n is zero */
+		}
+		a->err = errno;
+		return NULL;
+	}
+	return NULL;
+}
+
+static VALUE wrap_fds(VALUE ptr)
+{
+	struct accept_args *a = (struct accept_args *)ptr;
+	long i;
+
+	a->ary = rb_ary_new_capa(a->n);
+	for (i = 0; i < a->n; i++) {
+		VALUE io = rb_funcall(a->klass, id_for_fd, 1, INT2NUM(a->fds[i]));
+
+		a->fds[i] = -1; /* owned by io, now */
+		rb_ary_push(a->ary, io);
+	}
+	return a->ary;
+}
+
+/* closes descriptors not wrapped yet if wrap_fds raised */
+static VALUE close_unwrapped(VALUE ptr)
+{
+	struct accept_args *a = (struct accept_args *)ptr;
+	long i;
+
+	for (i = 0; i < a->n; i++)
+		if (a->fds[i] >= 0)
+			close(a->fds[i]);
+	return Qnil;
+}
+
+/* :nodoc: */
+static VALUE accept_batch(VALUE mod, VALUE listener, VALUE max, VALUE flags,
+			VALUE klass)
+{
+	struct accept_args a;
+	VALUE tmp;
+	int retried = 0;
+
+	a.max = NUM2LONG(max);
+	if (a.max <= 0)
+		rb_raise(rb_eArgError, "max must be positive: %ld", a.max);
+	a.flags = NUM2INT(flags);
+	a.klass = klass;
+	a.ary = Qnil;
+	a.fds = ALLOCV_N(int, tmp, a.max);
+retry:
+	a.fd = rb_sp_fileno(listener);
+	rb_sp_set_nonblock(a.fd);
+	a.n = 0;
+	a.err = 0;
+	IO_RUN(nogvl_accept, &a);
+
+	if (a.n == 0) {
+		switch (a.err) {
+		case 0: /* interrupted */
+			rb_thread_check_ints();
+			goto retry;
+		case EAGAIN:
+#if defined(EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
+		case EWOULDBLOCK:
+#endif
+			ALLOCV_END(tmp);
+			return Qnil;
+		}
+		if (!retried && rb_sp_gc_for_fd(a.err)) {
+			retried = 1;
+			goto retry;
+		}
+		ALLOCV_END(tmp);
+		errno = a.err;
+		rb_sys_fail("accept4");
+	}
+	rb_ensure(wrap_fds, (VALUE)&a, close_unwrapped, (VALUE)&a);
+	ALLOCV_END(tmp);
+
+	return a.ary;
+}
+
+void sleepy_penguin_init_accept(void)
+{
+	VALUE mod = rb_define_module("SleepyPenguin");
+
+	rb_define_singleton_method(mod, "__accept_batch", accept_batch, 4);
+	id_for_fd = rb_intern("for_fd");
+}
+#endif /* HAVE_ACCEPT4 */
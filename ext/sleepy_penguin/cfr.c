@@ -2,19 +2,6 @@
 #include "sp_copy.h"
 #include <unistd.h>
 
-#ifdef __NR_copy_file_range
-static ssize_t my_cfr(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
-		       size_t len, unsigned int flags)
-{
-	long n = syscall(__NR_copy_file_range,
-			fd_in, off_in, fd_out, off_out, len, flags);
-
-	return (ssize_t)n;
-}
-#  define copy_file_range(fd_in,off_in,fd_out,off_out,len,flags) \
-		my_cfr((fd_in),(off_in),(fd_out),(off_out),(len),(flags))
-#endif
-
 #if defined(HAVE_COPY_FILE_RANGE) || \
     (defined(__linux__) && defined(__NR_copy_file_range))
 static void *nogvl_cfr(void *ptr)
@@ -43,6 +30,7 @@ static VALUE rb_sp_cfr(VALUE mod, VALUE io_in, VALUE off_in,
 		a.fd_in = rb_sp_fileno(io_in);
 		a.fd_out = rb_sp_fileno(io_out);
 		bytes = (ssize_t)IO_RUN(nogvl_cfr, &a);
+		rb_sp_stat_result(RB_SP_STAT_CFR, bytes);
 		if (bytes < 0) {
 			switch (errno) {
 			case EINTR: continue;
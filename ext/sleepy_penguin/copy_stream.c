@@ -0,0 +1,312 @@
+#include "sleepy_penguin.h"
+#include "sp_copy.h"
+#ifdef __linux__
+#include <poll.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#  include <sys/sendfile.h>
+#endif
+
+#if defined(HAVE_COPY_FILE_RANGE) || defined(__NR_copy_file_range)
+#  define CS_HAVE_CFR 1
+#endif
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#  define CS_HAVE_SENDFILE 1
+#endif
+
+/* the largest count sendfile(2) and friends will do in one call */
+#define CS_MAX_CHUNK 0x7ffff000
+
+/* in order of preference */
+enum cs_method {
+	CS_CFR,
+	CS_SENDFILE,
+	CS_SPLICE,
+	CS_SPLICE_PIPE, /* neither end is a pipe, use an internal pipe */
+	CS_RW
+};
+
+struct cs_args {
+	VALUE src;
+	VALUE dst;
+	int fd_in;
+	int fd_out;
+	int pipe[2];
+	size_t pipe_bytes; /* bytes sitting in the internal pipe or buf */
+	size_t buf_off; /* start of pipe_bytes in buf for CS_RW */
+	off_t off;
+	off_t *off_in;
+	uint64_t remain;
+	int until_eof;
+	size_t len;
+	enum cs_method method;
+	uint64_t total;
+	void *buf;
+	size_t buf_len;
+};
+
+static void *nogvl_cs_copy(void *ptr)
+{
+	struct cs_args *a = ptr;
+	ssize_t n = -1;
+
+	switch (a->method) {
+	case CS_CFR:
+#ifdef CS_HAVE_CFR
+		n = copy_file_range(a->fd_in, a->off_in, a->fd_out, NULL,
+				    a->len, 0);
+#else
+		errno = ENOSYS;
+#endif
+		break;
+	case CS_SENDFILE:
+#ifdef CS_HAVE_SENDFILE
+		n = sendfile(a->fd_out, a->fd_in, a->off_in, a->len);
+#else
+		errno = ENOSYS;
+#endif
+		break;
+	case CS_SPLICE:
+		n = splice(a->fd_in, a->off_in, a->fd_out, NULL, a->len,
+			   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		break;
+	case CS_SPLICE_PIPE:
+		n = splice(a->fd_in, a->off_in, a->pipe[1], NULL, a->len,
+			   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		break;
+	case CS_RW:
+		if (a->len > a->buf_len)
+			a->len = a->buf_len;
+		n = a->off_in ? pread(a->fd_in, a->buf, a->len, *a->off_in)
+			      : read(a->fd_in, a->buf, a->len);
+		if (n > 0 && a->off_in)
+			*a->off_in += n;
+		break;
+	}
+	return (void *)n;
+}
+
+/* moves everything sitting in our internal pipe (or buffer) into dst */
+static void *nogvl_cs_flush(void *ptr)
+{
+	struct cs_args *a = ptr;
+
+	if (a->method == CS_RW)
+		return (void *)write(a->fd_out, (char *)a->buf + a->buf_off,
+				     a->pipe_bytes);
+
+	return (void *)splice(a->pipe[0], NULL, a->fd_out, NULL,
+			      a->pipe_bytes, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+}
+
+static int cs_readable(int fd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, 0) == 1;
+}
+
+static void cs_stat(struct cs_args *a, ssize_t n)
+{
+	switch (a->method) {
+	case CS_CFR:
+		rb_sp_stat_result(RB_SP_STAT_CFR, n);
+		break;
+	case CS_SENDFILE:
+		rb_sp_stat_result(RB_SP_STAT_SENDFILE, n);
+		break;
+	case CS_SPLICE:
+	case CS_SPLICE_PIPE:
+		rb_sp_stat_result(RB_SP_STAT_SPLICE, n);
+		break;
+	case CS_RW:
+		break;
+	}
+}
+
+/* waits on whichever side made us hit EAGAIN */
+static void cs_wait(struct cs_args *a, int writer)
+{
+	if (!writer && a->method == CS_SPLICE && cs_readable(a->fd_in))
+		writer = 1;
+	if (writer)
+		rb_thread_fd_writable(a->fd_out);
+	else
+		rb_thread_wait_fd(a->fd_in);
+	a->fd_in = rb_sp_fileno(a->src);
+	a->fd_out = rb_sp_fileno(a->dst);
+}
+
+static void cs_flush(struct cs_args *a)
+{
+	a->buf_off = 0;
+	while (a->pipe_bytes > 0) {
+		ssize_t n = (ssize_t)IO_RUN(nogvl_cs_flush, a);
+
+		cs_stat(a, n);
+		if (n > 0) {
+			a->pipe_bytes -= n;
+			a->buf_off += n;
+		} else if (n < 0 && errno == EAGAIN) {
+			cs_wait(a, 1);
+		} else if (n < 0 && errno != EINTR) {
+			rb_sys_fail(a->method == CS_RW ? "write" : "splice");
+		}
+	}
+}
+
+/* true if it makes sense to try the next method for +err+ */
+static int cs_fallback_p(struct cs_args *a, int err)
+{
+	switch (err) {
+	case EINVAL:
+	case EXDEV:
+	case ENOSYS:
+	case EOPNOTSUPP:
+#if defined(ENOTSUP) && (ENOTSUP != EOPNOTSUPP)
+	case ENOTSUP:
+#endif
+	case EBADF: /* copy_file_range on O_APPEND */
+	case ESPIPE:
+		break;
+	default:
+		return 0;
+	}
+	switch (a->method) {
+	case CS_CFR:
+		rb_sp_stat(RB_SP_STAT_CFR)->fallback++;
+		a->method = CS_SENDFILE;
+		return 1;
+	case CS_SENDFILE:
+		rb_sp_stat(RB_SP_STAT_SENDFILE)->fallback++;
+		a->method = CS_RW;
+		return 1;
+	case CS_SPLICE:
+	case CS_SPLICE_PIPE:
+		rb_sp_stat(RB_SP_STAT_SPLICE)->fallback++;
+		a->method = CS_RW;
+		return 1;
+	case CS_RW:
+		break;
+	}
+	return 0;
+}
+
+static enum cs_method cs_pick(int fd_in, int fd_out)
+{
+	struct stat si, so;
+
+	if (fstat(fd_in, &si) < 0)
+		rb_sys_fail("fstat(src)");
+	if (fstat(fd_out, &so) < 0)
+		rb_sys_fail("fstat(dst)");
+
+	if (S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode))
+		return CS_SPLICE;
+	if (S_ISREG(si.st_mode) && S_ISREG(so.st_mode))
+		return CS_CFR;
+	if (S_ISREG(si.st_mode) || S_ISBLK(si.st_mode))
+		return CS_SENDFILE;
+	return CS_SPLICE_PIPE;
+}
+
+static void cs_pipe_open(struct cs_args *a)
+{
+	int rc = pipe2(a->pipe, O_CLOEXEC);
+
+	if (rc < 0 && rb_sp_gc_for_fd(errno))
+		rc = pipe2(a->pipe, O_CLOEXEC);
+	if (rc < 0)
+		rb_sys_fail("pipe2");
+}
+
+static VALUE cs_run(VALUE p)
+{
+	struct cs_args *a = (struct cs_args *)p;
+
+	a->method = cs_pick(a->fd_in, a->fd_out);
+	while (a->until_eof || a->remain > 0) {
+		ssize_t n;
+
+		if (a->method == CS_SPLICE_PIPE && a->pipe[0] < 0)
+			cs_pipe_open(a);
+		if (a->method == CS_RW && !a->buf) {
+			a->buf_len = 0x10000;
+			a->buf = rb_sp_gettlsbuf(&a->buf_len);
+		}
+
+		a->len = a->until_eof || a->remain > CS_MAX_CHUNK ?
+			 CS_MAX_CHUNK : (size_t)a->remain;
+		n = (ssize_t)IO_RUN(nogvl_cs_copy, a);
+		cs_stat(a, n);
+		if (n == 0)
+			break;
+		if (n < 0) {
+			int err = errno;
+
+			if (err == EINTR)
+				continue;
+			if (err == EAGAIN) {
+				/* the internal pipe is drained, so it's src */
+				cs_wait(a, a->method == CS_SENDFILE ||
+					   a->method == CS_CFR);
+				continue;
+			}
+			if (cs_fallback_p(a, err))
+				continue;
+			errno = err;
+			rb_sys_fail("copy_stream");
+		}
+		if (a->method == CS_SPLICE_PIPE || a->method == CS_RW) {
+			a->pipe_bytes = (size_t)n;
+			cs_flush(a);
+		}
+		a->total += n;
+		if (!a->until_eof)
+			a->remain -= n;
+	}
+	return ULL2NUM(a->total);
+}
+
+static VALUE cs_ensure(VALUE p)
+{
+	struct cs_args *a = (struct cs_args *)p;
+
+	if (a->pipe[0] >= 0) {
+		close(a->pipe[0]);
+		close(a->pipe[1]);
+	}
+	return rb_sp_puttlsbuf((VALUE)a->buf);
+}
+
+/* :nodoc: */
+static VALUE rb_sp_copy_stream(VALUE mod, VALUE src, VALUE dst,
+				VALUE len, VALUE offset)
+{
+	struct cs_args a;
+
+	a.src = src;
+	a.dst = dst;
+	a.fd_in = rb_sp_fileno(src);
+	a.fd_out = rb_sp_fileno(dst);
+	a.pipe[0] = a.pipe[1] = -1;
+	a.pipe_bytes = 0;
+	a.off_in = NIL_P(offset) ? NULL : (a.off = NUM2OFFT(offset), &a.off);
+	a.until_eof = NIL_P(len);
+	a.remain = a.until_eof ? 0 : NUM2ULL(len);
+	a.total = 0;
+	a.buf = NULL;
+	a.buf_len = 0;
+
+	return rb_ensure(cs_run, (VALUE)&a, cs_ensure, (VALUE)&a);
+}
+
+void sleepy_penguin_init_copy_stream(void)
+{
+	VALUE mod = rb_define_module("SleepyPenguin");
+
+	rb_define_singleton_method(mod, "__copy_stream", rb_sp_copy_stream, 4);
+}
+#endif /* __linux__ */
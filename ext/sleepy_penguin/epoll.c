@@ -2,6 +2,7 @@
 #ifdef HAVE_SYS_EPOLL_H
 #include <sys/epoll.h>
 #include <time.h>
+#include <poll.h>
 #include "missing_clock_gettime.h"
 #include "missing_epoll.h"
 #include "missing_rb_thread_fd_close.h"
@@ -125,6 +126,20 @@ static VALUE epctl(VALUE self, VALUE _op, VALUE io, VALUE events)
 	return Qnil;
 }
 
+/*
+ * true if +io+ still has an error after its zerocopy completions were
+ * reaped, poll(2) does not clear sk_err as SO_ERROR would
+ */
+static int err_pending_p(VALUE io)
+{
+	struct pollfd pfd;
+
+	pfd.fd = rb_sp_fileno(io);
+	pfd.events = 0;
+	pfd.revents = 0;
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLERR);
+}
+
 static VALUE epwait_result(struct ep_per_thread *ept, int n)
 {
 	int i;
@@ -139,8 +154,20 @@ static VALUE epwait_result(struct ep_per_thread *ept, int n)
 	}
 
 	for (i = n; --i >= 0; epoll_event++) {
-		obj_events = UINT2NUM(epoll_event->events);
 		obj = unpack_event_data(epoll_event);
+
+		/*
+		 * zerocopy completions show up as EPOLLERR, consume them
+		 * here and hide the event if that's all there was.  A real
+		 * socket error may arrive with them, and EPOLLET or
+		 * EPOLLONESHOT would never report it again
+		 */
+		if ((epoll_event->events & EPOLLERR) &&
+		    rb_sp_zerocopy_reap(obj) > 0 &&
+		    epoll_event->events == EPOLLERR &&
+		    !err_pending_p(obj))
+			continue;
+		obj_events = UINT2NUM(epoll_event->events);
 		rb_yield_values(2, obj_events, obj);
 	}
 
@@ -1,6 +1,75 @@
 #ifdef HAVE_SYS_EVENTFD_H
 #include "sleepy_penguin.h"
 #include <sys/eventfd.h>
+#include <sys/mman.h>
+#include "sp_doorbell.h"
+
+/* not a kernel flag, keep it away from the EFD_* bits */
+#define EFD_SP_SHARED (1 << 30)
+#define EFD_SP_MAX 0xfffffffffffffffeULL
+#ifdef EFD_SEMAPHORE
+#  define EFD_SP_SEMAPHORE EFD_SEMAPHORE
+#else
+#  define EFD_SP_SEMAPHORE 0
+#endif
+
+static ID id_ivar_shm;
+
+/*
+ * Counter for EventFD::SHARED, in memory shared with forked children.
+ * The kernel eventfd is only a doorbell: a reader about to sleep drains
+ * it, sets +sleeping+ and rechecks +count+, and the writer which clears
+ * +sleeping+ rings it once.  The doorbell is only drained by readers
+ * about to sleep, so it stays readable for every sleeper until one of
+ * them goes back to sleep.
+ */
+struct efd_shm {
+	uint64_t count;
+	uint32_t sleeping;
+	uint32_t rung; /* doorbell writes, so readers may skip read(2) */
+	int semaphore; /* constant */
+};
+
+static void shm_free(void *ptr)
+{
+	munmap(ptr, sizeof(struct efd_shm));
+}
+
+static size_t shm_memsize(const void *ptr)
+{
+	return sizeof(struct efd_shm);
+}
+
+static const rb_data_type_t shm_type = {
+	"sleepy_penguin_eventfd_shm",
+	{ 0, shm_free, shm_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static struct efd_shm *shm_get(VALUE self)
+{
+	VALUE tmp = rb_attr_get(self, id_ivar_shm);
+
+	return NIL_P(tmp) ? 0 : rb_check_typeddata(tmp, &shm_type);
+}
+
+static VALUE shm_new(unsigned initval, int semaphore)
+{
+	void *ptr = mmap(NULL, sizeof(struct efd_shm), PROT_READ|PROT_WRITE,
+			 MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	struct efd_shm *shm;
+
+	if (ptr == MAP_FAILED)
+		rb_sys_fail("mmap");
+	shm = ptr;
+	shm->count = initval;
+	/* a non-zero initial count starts with the doorbell rung */
+	shm->sleeping = initval ? 0 : 1;
+	shm->rung = initval ? 1 : 0;
+	shm->semaphore = semaphore;
+
+	return TypedData_Wrap_Struct(rb_cObject, &shm_type, shm);
+}
 
 /*
  * call-seq:
@@ -17,10 +86,19 @@
  *
  * Since Linux 2.6.30, +flags+ may also include:
  * - :SEMAPHORE - provides semaphore-like semantics (see EventFD#value)
+ *
+ * +flags+ may also include :SHARED to keep the counter in memory shared
+ * with processes forked afterwards, where EventFD#incr and EventFD#value
+ * update it atomically without system calls.  The kernel eventfd is
+ * only written to when a reader is blocked in EventFD#value, or has
+ * found the counter zero with +nonblock+ and may be waiting in Epoll.
+ * The counter is not shared with processes started by exec(2), which
+ * only see the kernel eventfd.  The descriptor is always non-blocking
+ * with :SHARED.
  */
 static VALUE s_new(int argc, VALUE *argv, VALUE klass)
 {
-	VALUE _initval, _flags, rv;
+	VALUE _initval, _flags, rv, shm = Qnil;
 	unsigned initval;
 	int flags;
 	int fd;
@@ -28,6 +106,12 @@ static VALUE s_new(int argc, VALUE *argv, VALUE klass)
 	rb_scan_args(argc, argv, "11", &_initval, &_flags);
 	initval = NUM2UINT(_initval);
 	flags = rb_sp_get_flags(klass, _flags, RB_SP_CLOEXEC(EFD_CLOEXEC));
+	if (flags & EFD_SP_SHARED) {
+		flags &= ~EFD_SP_SHARED;
+		shm = shm_new(initval, flags & EFD_SP_SEMAPHORE);
+		flags &= ~EFD_SP_SEMAPHORE; /* the doorbell drains at once */
+		initval = initval ? 1 : 0;
+	}
 
 	fd = eventfd(initval, flags);
 	if (fd < 0) {
@@ -38,7 +122,87 @@ static VALUE s_new(int argc, VALUE *argv, VALUE klass)
 	}
 
 	rv = INT2FIX(fd);
-	return rb_call_super(1, &rv);
+	rv = rb_call_super(1, &rv);
+	if (!NIL_P(shm)) {
+		rb_sp_set_nonblock(fd);
+		rb_ivar_set(rv, id_ivar_shm, shm);
+	}
+	return rv;
+}
+
+static void shm_ring(struct efd_shm *shm, int fd)
+{
+	/* after writing, so a reader seeing +rung+ always drains the write */
+	if (sp_bell_ring(&shm->sleeping, fd))
+		__atomic_add_fetch(&shm->rung, 1, __ATOMIC_RELEASE);
+}
+
+static VALUE shm_incr(VALUE self, struct efd_shm *shm, VALUE value,
+			VALUE nonblock)
+{
+	uint64_t n = (uint64_t)NUM2ULL(value);
+	uint64_t cur = __atomic_load_n(&shm->count, __ATOMIC_RELAXED);
+
+	do {
+		while (n > EFD_SP_MAX - cur) {
+			if (RTEST(nonblock))
+				return Qfalse;
+			/* nobody is woken by reads, poll for the rare overflow */
+			rb_thread_wait_for(rb_time_interval(DBL2NUM(0.001)));
+			cur = __atomic_load_n(&shm->count, __ATOMIC_RELAXED);
+		}
+	} while (!__atomic_compare_exchange_n(&shm->count, &cur, cur + n, 1,
+					__ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+	shm_ring(shm, rb_sp_fileno(self));
+
+	return Qtrue;
+}
+
+static uint64_t shm_take(struct efd_shm *shm)
+{
+	uint64_t cur = __atomic_load_n(&shm->count, __ATOMIC_ACQUIRE);
+
+	if (!shm->semaphore)
+		return cur ? __atomic_exchange_n(&shm->count, 0,
+						__ATOMIC_ACQ_REL) : 0;
+	do {
+		if (!cur)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&shm->count, &cur, cur - 1, 1,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	return 1;
+}
+
+/* drains the doorbell and announces sleep, then checks once more */
+static uint64_t shm_arm(struct efd_shm *shm, int fd)
+{
+	uint64_t buf;
+
+	if (__atomic_load_n(&shm->rung, __ATOMIC_ACQUIRE) &&
+	    __atomic_exchange_n(&shm->rung, 0, __ATOMIC_ACQ_REL) &&
+	    read(fd, &buf, sizeof(buf)) < 0 && errno != EAGAIN)
+		rb_sys_fail("read(eventfd)");
+	__atomic_store_n(&shm->sleeping, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	return shm_take(shm);
+}
+
+static VALUE shm_value(VALUE self, struct efd_shm *shm, VALUE nonblock)
+{
+	int fd = rb_sp_fileno(self);
+
+	for (;;) {
+		uint64_t n = shm_take(shm);
+
+		if (n || (n = shm_arm(shm, fd)))
+			return ULL2NUM(n);
+		if (RTEST(nonblock))
+			return Qnil;
+		errno = EAGAIN;
+		if (!rb_sp_wait(rb_io_wait_readable, self, &fd))
+			rb_sys_fail("read(eventfd)");
+	}
 }
 
 struct efd_args {
@@ -76,11 +240,14 @@ static VALUE efd_read(void *_args)
  */
 static VALUE incr(int argc, VALUE *argv, VALUE self)
 {
+	struct efd_shm *shm;
 	struct efd_args x;
 	ssize_t w;
 	VALUE value, nonblock;
 
 	rb_scan_args(argc, argv, "11", &value, &nonblock);
+	if ((shm = shm_get(self)))
+		return shm_incr(self, shm, value, nonblock);
 	x.fd = rb_sp_fileno(self);
 	if (RTEST(nonblock))
 		rb_sp_set_nonblock(x.fd);
@@ -115,11 +282,14 @@ retry:
  */
 static VALUE getvalue(int argc, VALUE *argv, VALUE self)
 {
+	struct efd_shm *shm;
 	struct efd_args x;
 	ssize_t w;
 	VALUE nonblock;
 
 	rb_scan_args(argc, argv, "01", &nonblock);
+	if ((shm = shm_get(self)))
+		return shm_value(self, shm, nonblock);
 	x.fd = rb_sp_fileno(self);
 	if (RTEST(nonblock))
 		rb_sp_set_nonblock(x.fd);
@@ -158,7 +328,7 @@ void sleepy_penguin_init_eventfd(void)
 	 * the maximum value that may be stored in an EventFD,
 	 * currently 0xfffffffffffffffe
 	 */
-	rb_define_const(cEventFD, "MAX", ULL2NUM(0xfffffffffffffffeULL));
+	rb_define_const(cEventFD, "MAX", ULL2NUM(EFD_SP_MAX));
 
 #ifdef EFD_NONBLOCK
 	NODOC_CONST(cEventFD, "NONBLOCK", INT2NUM(EFD_NONBLOCK));
@@ -169,7 +339,10 @@ void sleepy_penguin_init_eventfd(void)
 #ifdef EFD_SEMAPHORE
 	NODOC_CONST(cEventFD, "SEMAPHORE", INT2NUM(EFD_SEMAPHORE));
 #endif
+	NODOC_CONST(cEventFD, "SHARED", INT2NUM(EFD_SP_SHARED));
 	rb_define_method(cEventFD, "value", getvalue, -1);
 	rb_define_method(cEventFD, "incr", incr, -1);
+
+	id_ivar_shm = rb_intern("@__sp_shm");
 }
 #endif /* HAVE_SYS_EVENTFD_H */
@@ -7,6 +7,9 @@ end
 have_header('sys/mount.h')
 have_header('sys/eventfd.h')
 have_header('sys/sendfile.h')
+have_header('linux/errqueue.h')
+have_header('linux/tls.h')
+have_header('linux/filter.h')
 
 # it's impossible to use signalfd reliably with Ruby since Ruby currently
 # manages # (and overrides) all signal handling
@@ -14,6 +17,7 @@ have_header('sys/sendfile.h')
 
 have_header('sys/timerfd.h')
 have_header('sys/inotify.h')
+have_header('sys/fanotify.h')
 have_header('ruby/io.h') and have_struct_member('rb_io_t', 'fd', 'ruby/io.h')
 unless have_macro('CLOCK_MONOTONIC', 'time.h')
   have_func('CLOCK_MONOTONIC', 'time.h')
@@ -21,6 +25,11 @@ end
 have_type('clockid_t', 'time.h')
 have_func('clock_gettime', 'time.h')
 have_func('copy_file_range')
+have_func('memfd_create', %w(sys/mman.h))
+have_func('accept4', %w(sys/socket.h))
+have_func('recvmmsg', %w(sys/socket.h))
+have_func('sendmmsg', %w(sys/socket.h))
+have_func('sendfile', %w(sys/sendfile.h))
 have_func('epoll_create1', %w(sys/epoll.h))
 have_func('inotify_init1', %w(sys/inotify.h))
 have_func('splice', %w(fcntl.h))
@@ -35,4 +44,5 @@ have_func('rb_update_max_fd')
 have_func('rb_fd_fix_cloexec')
 have_func('rb_io_get_io')
 have_func('rb_struct_size')
+have_func('rb_enc_interned_str', 'ruby/encoding.h')
 create_makefile('sleepy_penguin_ext')
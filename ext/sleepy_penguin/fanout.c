@@ -0,0 +1,701 @@
+#include "sleepy_penguin.h"
+#include "sp_copy.h"
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE)
+#include <poll.h>
+#include <sys/ioctl.h>
+
+#ifndef F_LINUX_SPECIFIC_BASE
+#  define F_LINUX_SPECIFIC_BASE 1024
+#endif
+#ifndef F_GETPIPE_SZ
+#  define F_SETPIPE_SZ    (F_LINUX_SPECIFIC_BASE + 7)
+#  define F_GETPIPE_SZ    (F_LINUX_SPECIFIC_BASE + 8)
+#endif
+
+static VALUE cStat, sym_EAGAIN, sym_block, sym_skip, sym_drop;
+
+enum fo_policy {
+	FO_BLOCK = 0,
+	FO_SKIP = 1,
+	FO_DROP = 2
+};
+
+struct fo_sub {
+	VALUE io;
+	enum fo_policy policy;
+	int dropped;
+	uint64_t bytes;
+	uint64_t skipped;
+};
+
+struct fanout {
+	VALUE src;
+	int scratch[2]; /* private pipe for finishing partial tee(2)s */
+	size_t scratch_sz; /* capacity of scratch, chunks never exceed it */
+	int devnull;
+	int publishing;
+	long nsubs;
+	long capa;
+	struct fo_sub *subs;
+};
+
+/* per-call snapshot of subscriber descriptors, lives in the TLS buffer */
+struct fo_out {
+	VALUE io;
+	int fd;
+	ssize_t r;
+};
+
+struct fo_per_thread {
+	int src_fd;
+	long n;
+	size_t len;
+	struct fo_out out[FLEX_ARRAY];
+};
+
+static void fo_mark(void *ptr)
+{
+	struct fanout *fo = ptr;
+	long i;
+
+	rb_gc_mark(fo->src);
+	for (i = 0; i < fo->nsubs; i++)
+		rb_gc_mark(fo->subs[i].io);
+}
+
+static void fo_close_fds(struct fanout *fo)
+{
+	if (fo->scratch[0] >= 0) {
+		close(fo->scratch[0]);
+		close(fo->scratch[1]);
+		fo->scratch[0] = fo->scratch[1] = -1;
+	}
+	if (fo->devnull >= 0) {
+		close(fo->devnull);
+		fo->devnull = -1;
+	}
+}
+
+static void fo_free(void *ptr)
+{
+	struct fanout *fo = ptr;
+
+	fo_close_fds(fo);
+	xfree(fo->subs);
+	xfree(fo);
+}
+
+static size_t fo_memsize(const void *ptr)
+{
+	const struct fanout *fo = ptr;
+
+	return sizeof(*fo) + fo->capa * sizeof(struct fo_sub);
+}
+
+static const rb_data_type_t fo_type = {
+	"sleepy_penguin_fanout",
+	{ fo_mark, fo_free, fo_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+/* grows the scratch pipe to match +src_fd+, keeps it as-is on failure */
+static void fo_scratch_grow(struct fanout *fo, int src_fd)
+{
+	int want = fcntl(src_fd, F_GETPIPE_SZ);
+	int rc;
+
+	if (want <= 0 || (size_t)want <= fo->scratch_sz)
+		return;
+	rc = fcntl(fo->scratch[1], F_SETPIPE_SZ, want);
+	if (rc > 0)
+		fo->scratch_sz = (size_t)rc;
+}
+
+static VALUE fo_alloc(VALUE klass)
+{
+	struct fanout *fo;
+	VALUE self = TypedData_Make_Struct(klass, struct fanout, &fo_type, fo);
+
+	fo->src = Qnil;
+	fo->scratch[0] = fo->scratch[1] = fo->devnull = -1;
+
+	return self;
+}
+
+static struct fanout *fo_get(VALUE self)
+{
+	struct fanout *fo;
+
+	TypedData_Get_Struct(self, struct fanout, &fo_type, fo);
+	if (fo->devnull < 0)
+		rb_raise(rb_eIOError, "closed fanout");
+	return fo;
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::Fanout.new(src)	-> Fanout object
+ *
+ * Creates a Fanout object which broadcasts data read from the +src+
+ * pipe to every subscribed pipe.  +src+ must be the read end of a pipe.
+ */
+static VALUE fo_init(VALUE self, VALUE src)
+{
+	struct fanout *fo;
+	int src_fd = rb_sp_fileno(src);
+	int rc;
+
+	TypedData_Get_Struct(self, struct fanout, &fo_type, fo);
+	rc = pipe2(fo->scratch, O_CLOEXEC);
+	if (rc < 0 && rb_sp_gc_for_fd(errno))
+		rc = pipe2(fo->scratch, O_CLOEXEC);
+	if (rc < 0)
+		rb_sys_fail("pipe2");
+
+	/* the scratch pipe should hold anything the source pipe holds */
+	rc = fcntl(fo->scratch[1], F_GETPIPE_SZ);
+	fo->scratch_sz = rc > 0 ? (size_t)rc : 4096;
+	fo_scratch_grow(fo, src_fd);
+
+	fo->devnull = open("/dev/null", O_WRONLY|O_CLOEXEC);
+	if (fo->devnull < 0) {
+		int err = errno;
+
+		fo_close_fds(fo);
+		errno = err;
+		rb_sys_fail("open(/dev/null)");
+	}
+	fo->src = src;
+
+	return self;
+}
+
+static enum fo_policy fo_policy_get(VALUE policy)
+{
+	if (NIL_P(policy) || policy == sym_skip)
+		return FO_SKIP;
+	if (policy == sym_block)
+		return FO_BLOCK;
+	if (policy == sym_drop)
+		return FO_DROP;
+	rb_raise(rb_eArgError, "policy must be :block, :skip or :drop");
+	return FO_SKIP;
+}
+
+/*
+ * call-seq:
+ *	fanout.subscribe(io[, policy])	-> io
+ *
+ * Adds +io+, the write end of a pipe, to the list of subscribers.
+ * +policy+ decides what happens when +io+ cannot take a chunk without
+ * blocking:
+ *
+ * - :skip - the chunk is skipped for +io+ (the default)
+ * - :drop - +io+ is dropped from further publishing
+ * - :block - publishing waits until +io+ has taken the whole chunk
+ *
+ * Only :block subscribers can stall other subscribers.
+ */
+static VALUE fo_subscribe(int argc, VALUE *argv, VALUE self)
+{
+	struct fanout *fo = fo_get(self);
+	VALUE io, policy;
+	struct fo_sub *sub;
+	enum fo_policy p;
+
+	rb_scan_args(argc, argv, "11", &io, &policy);
+	p = fo_policy_get(policy);
+	(void)rb_sp_fileno(io); /* raises on closed or non-IO objects */
+
+	if (fo->nsubs == fo->capa) {
+		fo->capa = fo->capa ? fo->capa * 2 : 8;
+		REALLOC_N(fo->subs, struct fo_sub, fo->capa);
+	}
+	sub = &fo->subs[fo->nsubs++];
+	sub->io = io;
+	sub->policy = p;
+	sub->dropped = 0;
+	sub->bytes = sub->skipped = 0;
+
+	return io;
+}
+
+/*
+ * call-seq:
+ *	fanout.unsubscribe(io)	-> io or nil
+ *
+ * Removes +io+ from the list of subscribers, including dropped ones.
+ * Returns +nil+ if +io+ was not subscribed.
+ */
+static VALUE fo_unsubscribe(VALUE self, VALUE io)
+{
+	struct fanout *fo = fo_get(self);
+	long i;
+
+	for (i = 0; i < fo->nsubs; i++) {
+		if (fo->subs[i].io != io)
+			continue;
+		fo->nsubs--;
+		MEMMOVE(&fo->subs[i], &fo->subs[i + 1], struct fo_sub,
+			fo->nsubs - i);
+		return io;
+	}
+	return Qnil;
+}
+
+static void *nogvl_tee_all(void *ptr)
+{
+	struct fo_per_thread *fpt = ptr;
+	long i;
+
+	for (i = 0; i < fpt->n; i++) {
+		struct fo_out *o = &fpt->out[i];
+
+		o->r = tee(fpt->src_fd, o->fd, fpt->len, SPLICE_F_NONBLOCK);
+		if (o->r < 0)
+			o->r = -errno;
+	}
+	return NULL;
+}
+
+struct fo_splice {
+	int fd_in;
+	int fd_out;
+	size_t len;
+	unsigned flags;
+};
+
+static void *nogvl_fo_splice(void *ptr)
+{
+	struct fo_splice *a = ptr;
+
+	return (void *)splice(a->fd_in, NULL, a->fd_out, NULL,
+				a->len, a->flags);
+}
+
+static void *nogvl_fo_tee(void *ptr)
+{
+	struct fo_splice *a = ptr;
+
+	return (void *)tee(a->fd_in, a->fd_out, a->len, a->flags);
+}
+
+/* moves +len+ bytes out of the pipe at +fd+ into /dev/null */
+static void fo_discard(struct fanout *fo, int fd, size_t len)
+{
+	struct fo_splice a;
+
+	a.fd_in = fd;
+	a.fd_out = fo->devnull;
+	a.flags = 0;
+	while (len > 0) {
+		ssize_t n;
+
+		a.len = len;
+		n = (ssize_t)IO_RUN(nogvl_fo_splice, &a);
+		rb_sp_stat_result(RB_SP_STAT_SPLICE, n);
+		if (n > 0) {
+			len -= n;
+		} else if (n == 0) {
+			rb_raise(rb_eRuntimeError, "BUG: pipe emptied under us");
+		} else if (errno != EINTR) {
+			rb_sys_fail("splice(/dev/null)");
+		}
+	}
+}
+
+/*
+ * delivers the tail (after +off+ bytes were tee-ed) of the current
+ * +len+-byte chunk by way of the scratch pipe.  Returns the number of
+ * bytes from the tail which were not delivered.
+ */
+static size_t fo_finish(struct fanout *fo, struct fo_per_thread *fpt,
+			VALUE io, enum fo_policy policy, size_t off)
+{
+	struct fo_splice a;
+	size_t left;
+	ssize_t n;
+
+	a.fd_in = fpt->src_fd;
+	a.fd_out = fo->scratch[1];
+	a.len = fpt->len;
+	a.flags = SPLICE_F_NONBLOCK;
+	do {
+		n = (ssize_t)IO_RUN(nogvl_fo_tee, &a);
+		rb_sp_stat_result(RB_SP_STAT_TEE, n);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		rb_sys_fail("tee(scratch)");
+	if ((size_t)n != fpt->len) {
+		/* partially-filled source pages may need more pipe slots */
+		fo_discard(fo, fo->scratch[0], (size_t)n);
+		rb_raise(rb_eIOError,
+			"scratch pipe took %zd of %zu bytes, "
+			"publish smaller chunks", n, fpt->len);
+	}
+
+	fo_discard(fo, fo->scratch[0], off);
+	left = fpt->len - off;
+
+	a.fd_in = fo->scratch[0];
+	a.flags = SPLICE_F_NONBLOCK;
+	while (left > 0) {
+		a.fd_out = rb_sp_fileno(io);
+		a.len = left;
+		n = (ssize_t)IO_RUN(nogvl_fo_splice, &a);
+		rb_sp_stat_result(RB_SP_STAT_SPLICE, n);
+		if (n > 0) {
+			left -= n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN && policy == FO_BLOCK) {
+			int fd;
+
+			if (rb_sp_wait(rb_io_wait_writable, io, &fd))
+				continue;
+		}
+		if (n < 0 && errno != EAGAIN && errno != EPIPE)
+			rb_sys_fail("splice(subscriber)");
+		break;
+	}
+
+	/* leave the scratch pipe empty for the next laggard */
+	if (left > 0)
+		fo_discard(fo, fo->scratch[0], left);
+	return left;
+}
+
+static struct fo_sub *fo_find(struct fanout *fo, VALUE io)
+{
+	long i;
+
+	for (i = 0; i < fo->nsubs; i++)
+		if (fo->subs[i].io == io)
+			return &fo->subs[i];
+	return NULL;
+}
+
+/* applies the subscriber policy after a short (or failed) tee(2) */
+static void fo_lagging(struct fanout *fo, struct fo_per_thread *fpt,
+			struct fo_sub *sub, ssize_t r)
+{
+	size_t done = r > 0 ? (size_t)r : 0;
+	size_t left = fpt->len - done;
+	VALUE io = sub->io;
+
+	if (r == -EPIPE) { /* reader went away, nothing to do but drop */
+		sub->dropped = 1;
+		sub->skipped += left;
+		return;
+	}
+	if (r < 0 && r != -EAGAIN) {
+		errno = (int)-r;
+		rb_sys_fail("tee(subscriber)");
+	}
+	if (done == 0 && sub->policy != FO_BLOCK) {
+		sub->skipped += left;
+		sub->dropped = sub->policy == FO_DROP;
+		return;
+	}
+
+	left = fo_finish(fo, fpt, io, sub->policy, done);
+
+	/* fo->subs may be reallocated while :block subscribers wait */
+	sub = fo_find(fo, io);
+	if (!sub)
+		return;
+	sub->bytes += fpt->len - left;
+	if (left) {
+		sub->skipped += left;
+		sub->dropped = sub->policy != FO_SKIP;
+	}
+}
+
+/* returns the number of readable bytes in +src+, 0 at EOF, -1 if empty */
+static long fo_readable(struct fanout *fo, int fd)
+{
+	struct pollfd pfd;
+	int avail;
+
+	if (ioctl(fd, FIONREAD, &avail) < 0)
+		rb_sys_fail("ioctl(FIONREAD)");
+	if (avail > 0)
+		return (long)avail;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) < 0)
+		rb_sys_fail("poll");
+
+	/* writers are gone and the pipe is drained */
+	return (pfd.revents & POLLHUP) ? 0 : -1;
+}
+
+struct fo_publish {
+	struct fanout *fo;
+	struct fo_per_thread *fpt;
+	size_t len;
+	int nonblock;
+};
+
+static VALUE do_publish(VALUE p)
+{
+	struct fo_publish *pub = (struct fo_publish *)p;
+	struct fanout *fo = pub->fo;
+	struct fo_per_thread *fpt = pub->fpt;
+	long avail, i, j;
+
+	fpt->src_fd = rb_sp_fileno(fo->src);
+	for (i = 0; i < fpt->n; i++)
+		fpt->out[i].fd = rb_sp_fileno(fpt->out[i].io);
+
+	for (;;) {
+		avail = fo_readable(fo, fpt->src_fd);
+		if (avail == 0)
+			return Qnil;
+		if (avail > 0)
+			break;
+		if (pub->nonblock)
+			return sym_EAGAIN;
+		errno = EAGAIN;
+		if (!rb_sp_wait(rb_io_wait_readable, fo->src, &fpt->src_fd))
+			rb_sys_fail("wait_readable(fanout source)");
+	}
+	fpt->len = (size_t)avail < pub->len ? (size_t)avail : pub->len;
+
+	/* the source pipe may have grown (F_SETPIPE_SZ) since we started */
+	if (fpt->len > fo->scratch_sz) {
+		fo_scratch_grow(fo, fpt->src_fd);
+		if (fpt->len > fo->scratch_sz)
+			fpt->len = fo->scratch_sz;
+	}
+
+	if (fpt->n > 0)
+		IO_RUN(nogvl_tee_all, fpt);
+
+	/*
+	 * subscribers may have changed while we were without the GVL,
+	 * match results up by object since ordering is stable
+	 */
+	for (i = j = 0; i < fpt->n; i++) {
+		struct fo_out *o = &fpt->out[i];
+		long k;
+
+		for (k = j; k < fo->nsubs && fo->subs[k].io != o->io; k++)
+			;
+		if (o->r < 0)
+			errno = (int)-o->r;
+		rb_sp_stat_result(RB_SP_STAT_TEE, o->r < 0 ? -1 : o->r);
+		if (k == fo->nsubs)
+			continue;
+		j = k + 1;
+		if (o->r == (ssize_t)fpt->len)
+			fo->subs[k].bytes += fpt->len;
+		else
+			fo_lagging(fo, fpt, &fo->subs[k], o->r);
+	}
+
+	fo_discard(fo, fpt->src_fd, fpt->len);
+
+	return SIZET2NUM(fpt->len);
+}
+
+static struct fo_per_thread *fpt_get(struct fanout *fo)
+{
+	struct fo_per_thread *fpt;
+	size_t size = sizeof(struct fo_per_thread) +
+			sizeof(struct fo_out) * fo->nsubs;
+	long i;
+
+	fpt = rb_sp_gettlsbuf(&size);
+	fpt->n = 0;
+	fpt->src_fd = -1;
+	for (i = 0; i < fo->nsubs; i++) {
+		struct fo_sub *sub = &fo->subs[i];
+		struct fo_out *o;
+
+		if (sub->dropped)
+			continue;
+		o = &fpt->out[fpt->n++];
+		o->io = sub->io;
+		o->fd = -1;
+	}
+	return fpt;
+}
+
+static VALUE fo_publish_done(VALUE p)
+{
+	struct fo_publish *pub = (struct fo_publish *)p;
+
+	pub->fo->publishing = 0;
+	return rb_sp_puttlsbuf((VALUE)pub->fpt);
+}
+
+/*
+ * call-seq:
+ *	fanout.publish([len[, nonblock]])	-> Integer, nil or :EAGAIN
+ *
+ * Duplicates up to +len+ (default: 65536) bytes buffered in the source
+ * pipe into every subscriber with tee(2), then consumes them from the
+ * source.  The copying happens entirely in the kernel with a single
+ * pass over the subscribers, so the cost in Ruby is the same regardless
+ * of the number of subscribers.
+ *
+ * Chunks never exceed the capacity of an internal pipe used to finish
+ * partial deliveries, which follows the size of the source pipe if
+ * F_SETPIPE_SZ allows.
+ *
+ * Returns the number of bytes consumed from the source pipe, +nil+ when
+ * the source pipe is at EOF, and :EAGAIN if +nonblock+ is true and
+ * nothing is buffered in the source pipe.
+ */
+static VALUE fo_publish(int argc, VALUE *argv, VALUE self)
+{
+	struct fo_publish pub;
+	VALUE len, nonblock;
+
+	rb_scan_args(argc, argv, "02", &len, &nonblock);
+	pub.fo = fo_get(self);
+	pub.len = NIL_P(len) ? 65536 : NUM2SIZET(len);
+	pub.nonblock = RTEST(nonblock);
+	if (pub.fo->publishing)
+		rb_raise(rb_eRuntimeError, "concurrent publish on fanout");
+	pub.fo->publishing = 1;
+	pub.fpt = fpt_get(pub.fo);
+
+	return rb_ensure(do_publish, (VALUE)&pub,
+			 fo_publish_done, (VALUE)&pub);
+}
+
+static VALUE fo_policy_sym(enum fo_policy policy)
+{
+	switch (policy) {
+	case FO_BLOCK: return sym_block;
+	case FO_DROP: return sym_drop;
+	case FO_SKIP: break;
+	}
+	return sym_skip;
+}
+
+/*
+ * call-seq:
+ *	fanout.stats	-> [ Fanout::Stat, ... ]
+ *
+ * Returns a Fanout::Stat for every subscriber.
+ */
+static VALUE fo_stats(VALUE self)
+{
+	struct fanout *fo = fo_get(self);
+	VALUE rv = rb_ary_new2(fo->nsubs);
+	long i;
+
+	for (i = 0; i < fo->nsubs; i++) {
+		struct fo_sub *sub = &fo->subs[i];
+		int lag = 0;
+
+		if (!rb_sp_io_closed(sub->io) &&
+		    ioctl(rb_sp_fileno(sub->io), FIONREAD, &lag) < 0)
+			lag = 0;
+
+		rb_ary_push(rv, rb_struct_new(cStat, sub->io,
+				fo_policy_sym(sub->policy),
+				ULL2NUM(sub->bytes), ULL2NUM(sub->skipped),
+				INT2NUM(lag), sub->dropped ? Qtrue : Qfalse));
+	}
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	fanout.close	-> nil
+ *
+ * Releases the internal descriptors.  Neither the source nor the
+ * subscribers are closed.  Raises RuntimeError while another thread
+ * is inside Fanout#publish.
+ */
+static VALUE fo_close(VALUE self)
+{
+	struct fanout *fo = fo_get(self);
+
+	/* publish may be using the descriptors without the GVL */
+	if (fo->publishing)
+		rb_raise(rb_eRuntimeError, "close during publish on fanout");
+	fo_close_fds(fo);
+	fo->nsubs = 0;
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *	fanout.closed?	-> true or false
+ */
+static VALUE fo_closed_p(VALUE self)
+{
+	struct fanout *fo;
+
+	TypedData_Get_Struct(self, struct fanout, &fo_type, fo);
+	return fo->devnull < 0 ? Qtrue : Qfalse;
+}
+
+void sleepy_penguin_init_fanout(void)
+{
+	VALUE mSleepyPenguin, cFanout;
+
+	mSleepyPenguin = rb_define_module("SleepyPenguin");
+
+	/*
+	 * Document-class: SleepyPenguin::Fanout
+	 *
+	 * Fanout broadcasts one pipe stream to any number of subscriber
+	 * pipes using tee(2) and splice(2), so data never enters userspace.
+	 * Each subscriber has its own backpressure policy so a slow
+	 * consumer need not stall the others.
+	 *
+	 *	rd, wr = IO.pipe
+	 *	fanout = SleepyPenguin::Fanout.new(rd)
+	 *	fanout.subscribe(sub_a_wr)
+	 *	fanout.subscribe(sub_b_wr, :block)
+	 *	while fanout.publish
+	 *	end
+	 *
+	 * A subscriber pipe which fills up in the middle of a chunk gets
+	 * the remainder of the chunk if possible (:skip and :drop) or
+	 * once it is writable (:block).  Set the subscriber pipe size
+	 * (F_SETPIPE_SZ) larger than the chunk size to keep :skip
+	 * subscribers from seeing a truncated chunk.
+	 */
+	cFanout = rb_define_class_under(mSleepyPenguin, "Fanout", rb_cObject);
+	rb_define_alloc_func(cFanout, fo_alloc);
+	rb_define_method(cFanout, "initialize", fo_init, 1);
+	rb_define_method(cFanout, "subscribe", fo_subscribe, -1);
+	rb_define_method(cFanout, "unsubscribe", fo_unsubscribe, 1);
+	rb_define_method(cFanout, "publish", fo_publish, -1);
+	rb_define_method(cFanout, "stats", fo_stats, 0);
+	rb_define_method(cFanout, "close", fo_close, 0);
+	rb_define_method(cFanout, "closed?", fo_closed_p, 0);
+
+	/*
+	 * Document-class: SleepyPenguin::Fanout::Stat
+	 *
+	 * Returned by Fanout#stats.  It is a Struct with the following
+	 * elements:
+	 *
+	 * - io - the subscribed IO object
+	 * - policy - :block, :skip or :drop
+	 * - bytes - bytes delivered
+	 * - skipped - bytes not delivered due to backpressure
+	 * - lag - bytes sitting unread in the subscriber pipe
+	 * - dropped - true if the subscriber was dropped
+	 */
+	cStat = rb_struct_define(NULL, "io", "policy", "bytes", "skipped",
+				"lag", "dropped", NULL);
+	cStat = rb_define_class_under(cFanout, "Stat", cStat);
+
+	sym_EAGAIN = ID2SYM(rb_intern("EAGAIN"));
+	sym_block = ID2SYM(rb_intern("block"));
+	sym_skip = ID2SYM(rb_intern("skip"));
+	sym_drop = ID2SYM(rb_intern("drop"));
+}
+#endif /* HAVE_SPLICE && HAVE_TEE */
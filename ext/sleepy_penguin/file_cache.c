@@ -0,0 +1,677 @@
+#ifdef HAVE_SYS_INOTIFY_H
+#include "sleepy_penguin.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <ruby/st.h>
+#include "missing_inotify.h"
+
+/*
+ * An LRU of open Files kept coherent by an Inotify watch on each
+ * cached inode.  Everything is plain C data (no Ruby Hash or Array) so
+ * rb_sp_file_cache_shed may drop entries from any cache, even one
+ * which is no longer reachable, without calling into Ruby.
+ */
+static ID id_ivar_fc;
+static VALUE cFileCache, cEntry;
+static VALUE sym_hits, sym_misses, sym_invalidated, sym_evicted;
+
+/* anything which could make a cached descriptor or stat stale */
+#define FC_MASK (IN_MODIFY|IN_ATTRIB|IN_MOVE_SELF|IN_DELETE_SELF)
+
+struct fc_node {
+	struct fc_node *prev; /* more recently used */
+	struct fc_node *next; /* less recently used */
+	struct fc_node *wd_next; /* other paths of the same inode */
+	int wd;
+	VALUE entry;
+	char path[FLEX_ARRAY];
+};
+
+struct file_cache {
+	struct file_cache *link_prev; /* every live cache, for shedding */
+	struct file_cache *link_next;
+	st_table *paths; /* node->path => struct fc_node * */
+	st_table *wds; /* wd => first struct fc_node * (NULL after shed) */
+	struct fc_node *head; /* most recently used */
+	struct fc_node *tail; /* least recently used */
+	long nr;
+	long max;
+	int autosync;
+	int shed; /* wds may have NULL entries needing inotify_rm_watch */
+	size_t hits;
+	size_t misses;
+	size_t invalidated;
+	size_t evicted;
+};
+
+static struct file_cache *all_caches;
+
+static void fc_mark(void *ptr)
+{
+	struct file_cache *fc = ptr;
+	struct fc_node *n;
+
+	for (n = fc->head; n; n = n->next)
+		rb_gc_mark(n->entry);
+}
+
+static void fc_free(void *ptr)
+{
+	struct file_cache *fc = ptr;
+	struct fc_node *n, *next;
+
+	for (n = fc->head; n; n = next) {
+		next = n->next;
+		xfree(n);
+	}
+	if (fc->link_prev)
+		fc->link_prev->link_next = fc->link_next;
+	else
+		all_caches = fc->link_next;
+	if (fc->link_next)
+		fc->link_next->link_prev = fc->link_prev;
+	st_free_table(fc->paths);
+	st_free_table(fc->wds);
+	xfree(fc);
+}
+
+static size_t fc_memsize(const void *ptr)
+{
+	const struct file_cache *fc = ptr;
+
+	return sizeof(struct file_cache) + st_memsize(fc->paths) +
+		st_memsize(fc->wds) + fc->nr * sizeof(struct fc_node);
+}
+
+static const rb_data_type_t fc_type = {
+	"sleepy_penguin_file_cache",
+	{ fc_mark, fc_free, fc_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static struct file_cache *fc_get(VALUE self)
+{
+	return rb_check_typeddata(rb_ivar_get(self, id_ivar_fc), &fc_type);
+}
+
+static void lru_unlink(struct file_cache *fc, struct fc_node *n)
+{
+	if (n->prev)
+		n->prev->next = n->next;
+	else
+		fc->head = n->next;
+	if (n->next)
+		n->next->prev = n->prev;
+	else
+		fc->tail = n->prev;
+}
+
+static void lru_push(struct file_cache *fc, struct fc_node *n)
+{
+	n->prev = NULL;
+	n->next = fc->head;
+	if (fc->head)
+		fc->head->prev = n;
+	else
+		fc->tail = n;
+	fc->head = n;
+}
+
+/*
+ * forgets +n+ without any syscalls, its File is closed by GC once the
+ * caller (if any) is done with it.  Returns 1 if no other path
+ * references the watch of +n+ anymore.
+ */
+static int node_drop(struct file_cache *fc, struct fc_node *n)
+{
+	st_data_t key = (st_data_t)n->path;
+	st_data_t val;
+	struct fc_node *head, **pp;
+
+	lru_unlink(fc, n);
+	st_delete(fc->paths, &key, 0);
+	fc->nr--;
+
+	head = st_lookup(fc->wds, (st_data_t)n->wd, &val) ?
+		(struct fc_node *)val : NULL;
+	for (pp = &head; *pp; pp = &(*pp)->wd_next) {
+		if (*pp == n) {
+			*pp = n->wd_next;
+			break;
+		}
+	}
+	st_insert(fc->wds, (st_data_t)n->wd, (st_data_t)head);
+	xfree(n);
+
+	return head == NULL;
+}
+
+static void watch_release(VALUE self, struct file_cache *fc, int wd)
+{
+	st_data_t key = (st_data_t)wd;
+
+	st_delete(fc->wds, &key, 0);
+	/* EINVAL if the kernel already removed it */
+	(void)inotify_rm_watch(rb_sp_fileno(self), wd);
+}
+
+static void node_evict(VALUE self, struct file_cache *fc, struct fc_node *n)
+{
+	int wd = n->wd;
+
+	if (node_drop(fc, n))
+		watch_release(self, fc, wd);
+	fc->evicted++;
+}
+
+/* drops every path of the inode behind +wd+, returns how many */
+static long wd_drop(struct file_cache *fc, int wd)
+{
+	st_data_t val;
+	long n = 0;
+
+	while (st_lookup(fc->wds, (st_data_t)wd, &val) && val) {
+		node_drop(fc, (struct fc_node *)val);
+		n++;
+	}
+	return n;
+}
+
+static int wd_collect_i(st_data_t key, st_data_t val, st_data_t arg)
+{
+	rb_ary_push((VALUE)arg, INT2NUM((int)key));
+	return ST_CONTINUE;
+}
+
+static long fc_clear(VALUE self, struct file_cache *fc)
+{
+	long n = fc->nr;
+	VALUE wds = rb_ary_new_capa((long)fc->wds->num_entries);
+	long i;
+
+	while (fc->tail)
+		node_drop(fc, fc->tail);
+	st_foreach(fc->wds, wd_collect_i, (st_data_t)wds);
+	for (i = 0; i < RARRAY_LEN(wds); i++)
+		watch_release(self, fc, NUM2INT(rb_ary_entry(wds, i)));
+
+	return n;
+}
+
+/*
+ * Called by rb_sp_gc_for_fd when we run out of descriptors: drops the
+ * least recently used half of every cache so GC may close their Files.
+ * Watches are left for fc_sweep to release, since the Inotify
+ * descriptor of an unreachable cache may already be closed.
+ */
+long rb_sp_file_cache_shed(void)
+{
+	struct file_cache *fc;
+	long n = 0;
+
+	for (fc = all_caches; fc; fc = fc->link_next) {
+		long drop = (fc->nr + 1) / 2;
+
+		fc->evicted += drop;
+		n += drop;
+		while (drop--)
+			node_drop(fc, fc->tail);
+		fc->shed = 1;
+	}
+	return n;
+}
+
+static int wd_sweep_i(st_data_t key, st_data_t val, st_data_t arg)
+{
+	if (val)
+		return ST_CONTINUE;
+	/* EINVAL if the kernel already removed it */
+	(void)inotify_rm_watch((int)arg, (int)key);
+	return ST_DELETE;
+}
+
+/* releases watches left behind by rb_sp_file_cache_shed */
+static void fc_sweep(VALUE self, struct file_cache *fc)
+{
+	if (!fc->shed)
+		return;
+	fc->shed = 0;
+	st_foreach(fc->wds, wd_sweep_i, (st_data_t)rb_sp_fileno(self));
+}
+
+/* decodes events for FileCache#sync, see rb_sp_inotify_take */
+static VALUE fc_event(VALUE self, const struct inotify_event *e)
+{
+	struct file_cache *fc = fc_get(self);
+	long n;
+
+	if (e->mask & IN_Q_OVERFLOW) {
+		n = fc_clear(self, fc);
+	} else if (st_lookup(fc->wds, (st_data_t)e->wd, 0)) {
+		n = wd_drop(fc, e->wd);
+		if (e->mask & IN_IGNORED) {
+			st_data_t key = (st_data_t)e->wd;
+
+			st_delete(fc->wds, &key, 0);
+		} else {
+			watch_release(self, fc, e->wd);
+		}
+	} else {
+		return Qundef; /* IN_IGNORED from watch_release */
+	}
+	fc->invalidated += n;
+
+	return LONG2FIX(n);
+}
+
+/*
+ * call-seq:
+ *	cache.sync([nonblock]) -> Integer or nil
+ *
+ * Reads pending Inotify events and drops every cached entry whose file
+ * was modified, had its attributes changed, or was renamed or
+ * unlinked.  Returns the number of entries dropped, or +nil+ if
+ * +nonblock+ is +true+ and there was nothing to read.
+ *
+ * Call it whenever the cache is readable, from an Epoll loop or by
+ * FileCache#run in a Thread.  FileCache#fetch calls this with
+ * +nonblock+ if autosync is enabled.
+ */
+static VALUE fc_sync(int argc, VALUE *argv, VALUE self)
+{
+	VALUE rv;
+	long i, n = 0;
+
+	fc_sweep(self, fc_get(self));
+	rv = rb_sp_inotify_take(self, argc, argv, 1, fc_event, self);
+
+	if (NIL_P(rv))
+		return Qnil;
+	for (i = 0; i < RARRAY_LEN(rv); i++)
+		n += FIX2LONG(rb_ary_entry(rv, i));
+
+	return LONG2NUM(n);
+}
+
+/*
+ * call-seq:
+ *	cache.run -> never returns
+ *
+ * Calls FileCache#sync in a blocking fashion forever, usually in a
+ * dedicated Thread when the cache is not watched with Epoll.
+ */
+static VALUE fc_run(VALUE self)
+{
+	VALUE argv = Qfalse;
+
+	while (1)
+		fc_sync(1, &argv, self);
+
+	return self;
+}
+
+static int fc_open(const char *path)
+{
+	return open(path, O_RDONLY|O_CLOEXEC|O_NOCTTY|O_NONBLOCK);
+}
+
+/*
+ * watches the inode behind +fd+ rather than +path+, so a rename
+ * between open(2) and inotify_add_watch(2) cannot leave us watching a
+ * different file
+ */
+static int fc_add_watch(VALUE self, int fd, const char *path)
+{
+	char proc[sizeof("/proc/self/fd/") + 3 * sizeof(int)];
+	int ifd = rb_sp_fileno(self);
+	int wd;
+
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	wd = inotify_add_watch(ifd, proc, FC_MASK);
+	if (wd < 0 && errno == ENOENT) /* /proc not mounted */
+		wd = inotify_add_watch(ifd, path, FC_MASK);
+
+	return wd;
+}
+
+static VALUE fc_load(VALUE self, struct file_cache *fc, VALUE path)
+{
+	const char *cpath = StringValueCStr(path);
+	size_t len = strlen(cpath) + 1;
+	struct fc_node *n;
+	struct stat st;
+	st_data_t val;
+	VALUE io;
+	int fd, wd, err = 0;
+
+	/* before inotify_add_watch, which may return a wd we would release */
+	fc_sweep(self, fc);
+	while (fc->nr >= fc->max && fc->tail)
+		node_evict(self, fc, fc->tail);
+
+	fd = fc_open(cpath);
+	if (fd < 0 && rb_sp_gc_for_fd(errno))
+		fd = fc_open(cpath);
+	if (fd < 0)
+		rb_sys_fail_str(path);
+	if (fstat(fd, &st) < 0)
+		err = errno;
+	else if (!S_ISREG(st.st_mode))
+		err = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+	if (err) {
+		close(fd);
+		errno = err;
+		rb_sys_fail_str(path);
+	}
+	io = rb_io_fdopen(fd, O_RDONLY, cpath);
+	wd = fc_add_watch(self, fd, cpath);
+	if (wd < 0)
+		rb_sys_fail("inotify_add_watch");
+
+	/* stat after the watch is added, so no change goes unnoticed */
+	if (fstat(fd, &st) < 0)
+		rb_sys_fail_str(path);
+
+	n = xmalloc(offsetof(struct fc_node, path) + len);
+	memcpy(n->path, cpath, len);
+	n->wd = wd;
+	n->entry = rb_struct_new(cEntry, rb_str_new_frozen(path), io,
+				 rb_stat_new(&st));
+	rb_obj_freeze(n->entry);
+	if (!st_lookup(fc->wds, (st_data_t)wd, &val))
+		val = 0;
+	n->wd_next = (struct fc_node *)val;
+	st_insert(fc->wds, (st_data_t)wd, (st_data_t)n);
+	st_insert(fc->paths, (st_data_t)n->path, (st_data_t)n);
+	lru_push(fc, n);
+	fc->nr++;
+
+	return n->entry;
+}
+
+/*
+ * call-seq:
+ *	cache.fetch(path) -> FileCache::Entry
+ *
+ * Returns the Entry for the regular file at +path+, opening it and
+ * caching its File::Stat on a miss.  Raises Errno::* exceptions like
+ * File.open, and Errno::EISDIR or Errno::EINVAL for anything but a
+ * regular file.
+ *
+ * A hit makes no syscalls, so changes to the file are only noticed
+ * once FileCache#sync reads their events (see FileCache#autosync=).
+ *
+ * The returned Entry stays usable after it is dropped from the cache,
+ * its File is closed by GC.  Entries are keyed by the +path+ String as
+ * given, renaming a parent directory does not invalidate them.
+ */
+static VALUE fc_fetch(VALUE self, VALUE path)
+{
+	struct file_cache *fc = fc_get(self);
+	st_data_t val;
+
+	if (fc->autosync) {
+		VALUE nonblock = Qtrue;
+
+		fc_sync(1, &nonblock, self);
+	}
+	if (st_lookup(fc->paths, (st_data_t)StringValueCStr(path), &val)) {
+		struct fc_node *n = (struct fc_node *)val;
+
+		if (fc->head != n) {
+			lru_unlink(fc, n);
+			lru_push(fc, n);
+		}
+		fc->hits++;
+		return n->entry;
+	}
+	fc->misses++;
+
+	return fc_load(self, fc, path);
+}
+
+/*
+ * call-seq:
+ *	cache.delete(path) -> FileCache::Entry or nil
+ *
+ * Drops the entry for +path+, if any.
+ */
+static VALUE fc_delete(VALUE self, VALUE path)
+{
+	struct file_cache *fc = fc_get(self);
+	st_data_t val;
+	struct fc_node *n;
+	VALUE rv;
+	int wd;
+
+	if (!st_lookup(fc->paths, (st_data_t)StringValueCStr(path), &val))
+		return Qnil;
+	n = (struct fc_node *)val;
+	rv = n->entry;
+	wd = n->wd;
+	if (node_drop(fc, n))
+		watch_release(self, fc, wd);
+
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	cache.clear -> Integer
+ *
+ * Drops every entry and watch, returns the number of entries dropped.
+ */
+static VALUE fc_clear_m(VALUE self)
+{
+	return LONG2NUM(fc_clear(self, fc_get(self)));
+}
+
+/*
+ * call-seq:
+ *	cache.size -> Integer
+ *
+ * Returns the number of cached entries.
+ */
+static VALUE fc_size(VALUE self)
+{
+	return LONG2NUM(fc_get(self)->nr);
+}
+
+/*
+ * call-seq:
+ *	cache.max_files -> Integer
+ *
+ * Returns the maximum number of entries (and thus descriptors) cached.
+ */
+static VALUE fc_max_get(VALUE self)
+{
+	return LONG2NUM(fc_get(self)->max);
+}
+
+/*
+ * call-seq:
+ *	cache.max_files = Integer
+ *
+ * Sets the maximum number of entries cached, evicting the least
+ * recently used ones if there are more.
+ */
+static VALUE fc_max_set(VALUE self, VALUE max)
+{
+	struct file_cache *fc = fc_get(self);
+	long n = NUM2LONG(max);
+
+	if (n <= 0)
+		rb_raise(rb_eArgError, "max_files must be positive");
+	fc->max = n;
+	while (fc->nr > fc->max)
+		node_evict(self, fc, fc->tail);
+
+	return max;
+}
+
+/*
+ * call-seq:
+ *	cache.autosync? -> true or false
+ *
+ * Returns whether FileCache#fetch reads pending events first.
+ */
+static VALUE fc_autosync_p(VALUE self)
+{
+	return fc_get(self)->autosync ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *	cache.autosync = true or false
+ *
+ * Enables or disables (the default) reading pending events in
+ * FileCache#fetch.  Enabling it saves calling FileCache#sync from an
+ * Epoll loop or a Thread, but costs every fetch, hits included, a
+ * read(2) of the Inotify descriptor.
+ */
+static VALUE fc_autosync_set(VALUE self, VALUE val)
+{
+	fc_get(self)->autosync = RTEST(val);
+
+	return val;
+}
+
+/*
+ * call-seq:
+ *	cache.stats -> Hash
+ *
+ * Returns a Hash with the number of :hits, :misses, entries
+ * :invalidated by Inotify events and entries :evicted to stay within
+ * FileCache#max_files or to free descriptors.
+ */
+static VALUE fc_stats(VALUE self)
+{
+	struct file_cache *fc = fc_get(self);
+	VALUE rv = rb_hash_new();
+
+	rb_hash_aset(rv, sym_hits, SIZET2NUM(fc->hits));
+	rb_hash_aset(rv, sym_misses, SIZET2NUM(fc->misses));
+	rb_hash_aset(rv, sym_invalidated, SIZET2NUM(fc->invalidated));
+	rb_hash_aset(rv, sym_evicted, SIZET2NUM(fc->evicted));
+
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::FileCache.new([max_files[, flags]]) -> FileCache
+ *
+ * Creates a cache of up to +max_files+ (default: 1024) open files.
+ * +flags+ are passed to Inotify.new, the descriptor is always
+ * non-blocking.
+ */
+static VALUE fc_s_new(int argc, VALUE *argv, VALUE klass)
+{
+	VALUE max, flags, rv, tmp;
+	struct file_cache *fc;
+
+	rb_scan_args(argc, argv, "02", &max, &flags);
+	rv = rb_call_super(1, &flags);
+	rb_sp_set_nonblock(rb_sp_fileno(rv));
+
+	tmp = TypedData_Make_Struct(rb_cObject, struct file_cache, &fc_type,
+				    fc);
+	fc->paths = st_init_strtable();
+	fc->wds = st_init_numtable();
+	fc->max = 1024;
+	fc->link_next = all_caches;
+	if (all_caches)
+		all_caches->link_prev = fc;
+	all_caches = fc;
+	rb_ivar_set(rv, id_ivar_fc, tmp);
+	if (!NIL_P(max))
+		fc_max_set(rv, max);
+
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	entry.to_io -> File
+ *
+ * Returns the open File, so an Entry may be passed to
+ * SleepyPenguin.linux_sendfile and other methods taking an IO.
+ */
+static VALUE entry_to_io(VALUE self)
+{
+	return rb_struct_aref(self, INT2FIX(1));
+}
+
+void sleepy_penguin_init_file_cache(void)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+	VALUE cInotify = rb_const_get(mSleepyPenguin, rb_intern("Inotify"));
+
+	/*
+	 * Document-class: SleepyPenguin::FileCache
+	 *
+	 * Caches open Files and their File::Stat for serving static
+	 * files, so a hit needs no open(2), fstat(2) or close(2).  Each
+	 * cached inode is watched with Inotify and its entries are
+	 * dropped as soon as the file is modified, has its attributes
+	 * changed, or is renamed or unlinked.
+	 *
+	 *	cache = SleepyPenguin::FileCache.new(4096)
+	 *	ep.add(cache, :IN) # call cache.sync(true) when readable
+	 *	entry = cache.fetch("/srv/www/index.html")
+	 *	SleepyPenguin.linux_sendfile(sock, entry, entry.stat.size)
+	 *
+	 * The number of cached descriptors is bounded by
+	 * FileCache#max_files, and when a SleepyPenguin method fails
+	 * with EMFILE or ENFILE every cache drops half its entries
+	 * before the garbage collector runs to close them.
+	 *
+	 * A FileCache is an Inotify object, and stale entries are only
+	 * dropped by FileCache#sync, so watch it with Epoll (or run
+	 * FileCache#run in a Thread) to call it when readable.  Hits then
+	 * make no syscalls at all.
+	 */
+	cFileCache = rb_define_class_under(mSleepyPenguin, "FileCache",
+					   cInotify);
+	rb_define_singleton_method(cFileCache, "new", fc_s_new, -1);
+	rb_define_method(cFileCache, "fetch", fc_fetch, 1);
+	rb_define_method(cFileCache, "delete", fc_delete, 1);
+	rb_define_method(cFileCache, "clear", fc_clear_m, 0);
+	rb_define_method(cFileCache, "sync", fc_sync, -1);
+	rb_define_method(cFileCache, "run", fc_run, 0);
+	rb_define_method(cFileCache, "size", fc_size, 0);
+	rb_define_method(cFileCache, "max_files", fc_max_get, 0);
+	rb_define_method(cFileCache, "max_files=", fc_max_set, 1);
+	rb_define_method(cFileCache, "autosync?", fc_autosync_p, 0);
+	rb_define_method(cFileCache, "autosync=", fc_autosync_set, 1);
+	rb_define_method(cFileCache, "stats", fc_stats, 0);
+	rb_undef_method(cFileCache, "add_watch");
+	rb_undef_method(cFileCache, "rm_watch");
+	rb_undef_method(cFileCache, "take");
+	rb_undef_method(cFileCache, "take_all");
+	rb_undef_method(cFileCache, "take_batch");
+	rb_undef_method(cFileCache, "each");
+	rb_undef_method(cFileCache, "each_batch");
+	rb_undef_method(cFileCache, "coalesce_window=");
+	rb_undef_method(cFileCache, "coalesce_window");
+	rb_undef_method(cFileCache, "coalesce_timer");
+	rb_undef_method(cFileCache, "flush");
+
+	/*
+	 * Document-class: SleepyPenguin::FileCache::Entry
+	 *
+	 * A frozen Struct of the +path+, open +io+ and +stat+ of a cached
+	 * file, returned by FileCache#fetch.
+	 */
+	cEntry = rb_struct_define_under(cFileCache, "Entry",
+					"path", "io", "stat", NULL);
+	rb_define_method(cEntry, "to_io", entry_to_io, 0);
+
+	id_ivar_fc = rb_intern("@__sp_fc");
+	sym_hits = ID2SYM(rb_intern("hits"));
+	sym_misses = ID2SYM(rb_intern("misses"));
+	sym_invalidated = ID2SYM(rb_intern("invalidated"));
+	sym_evicted = ID2SYM(rb_intern("evicted"));
+}
+#endif /* HAVE_SYS_INOTIFY_H */
@@ -0,0 +1,3 @@
+#ifndef MY_GIT_VERSION
+#define MY_GIT_VERSION "3.5.2"
+#endif /* MY_GIT_VERSION */
@@ -37,20 +37,42 @@ void sleepy_penguin_init_epoll(void);
 
 #ifdef HAVE_SYS_TIMERFD_H
 void sleepy_penguin_init_timerfd(void);
+void sleepy_penguin_init_timer_wheel(void);
 #else
 #  define sleepy_penguin_init_timerfd() for(;0;)
+#  define sleepy_penguin_init_timer_wheel() for(;0;)
 #endif
 
 #ifdef HAVE_SYS_EVENTFD_H
 void sleepy_penguin_init_eventfd(void);
+void sleepy_penguin_init_event_queue(void);
 #else
 #  define sleepy_penguin_init_eventfd() for(;0;)
+#  define sleepy_penguin_init_event_queue() for(;0;)
 #endif
 
 #ifdef HAVE_SYS_INOTIFY_H
 void sleepy_penguin_init_inotify(void);
+void sleepy_penguin_init_inotify_tree(void);
+void sleepy_penguin_init_inotify_hub(void);
+void sleepy_penguin_init_file_cache(void);
 #else
 #  define sleepy_penguin_init_inotify() for(;0;)
+#  define sleepy_penguin_init_inotify_tree() for(;0;)
+#  define sleepy_penguin_init_inotify_hub() for(;0;)
+#  define sleepy_penguin_init_file_cache() for(;0;)
+#endif
+
+#if defined(HAVE_SYS_INOTIFY_H) && defined(HAVE_SYS_TIMERFD_H)
+void sleepy_penguin_init_inotify_coalesce(void);
+#else
+#  define sleepy_penguin_init_inotify_coalesce() for(;0;)
+#endif
+
+#ifdef HAVE_SYS_FANOTIFY_H
+void sleepy_penguin_init_fanotify(void);
+#else
+#  define sleepy_penguin_init_fanotify() for(;0;)
 #endif
 
 #ifdef HAVE_SYS_SIGNALFD_H
@@ -72,8 +94,57 @@ void sleepy_penguin_init_cfr(void);
 #  define sleepy_penguin_init_cfr() for (;0;)
 #endif
 
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE)
+void sleepy_penguin_init_fanout(void);
+#else
+#  define sleepy_penguin_init_fanout() for (;0;)
+#endif
+
+#if defined(__linux__) && defined(HAVE_LINUX_ERRQUEUE_H)
+void sleepy_penguin_init_zerocopy(void);
+#else
+#  define sleepy_penguin_init_zerocopy() for (;0;)
+#endif
+
+#ifdef __linux__
+void sleepy_penguin_init_copy_stream(void);
+void sleepy_penguin_init_sched(void);
+void sleepy_penguin_init_memfd(void);
+void sleepy_penguin_init_pidfd(void);
+#else
+#  define sleepy_penguin_init_copy_stream() for (;0;)
+#  define sleepy_penguin_init_sched() for (;0;)
+#  define sleepy_penguin_init_memfd() for (;0;)
+#  define sleepy_penguin_init_pidfd() for (;0;)
+#endif
+
+#ifdef HAVE_LINUX_TLS_H
+void sleepy_penguin_init_ktls(void);
+#else
+#  define sleepy_penguin_init_ktls() for (;0;)
+#endif
+
+#ifdef HAVE_ACCEPT4
+void sleepy_penguin_init_accept(void);
+#else
+#  define sleepy_penguin_init_accept() for (;0;)
+#endif
+
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+void sleepy_penguin_init_mmsg(void);
+#else
+#  define sleepy_penguin_init_mmsg() for (;0;)
+#endif
+
+#if defined(__linux__) && defined(HAVE_LINUX_FILTER_H)
+void sleepy_penguin_init_reuseport(void);
+#else
+#  define sleepy_penguin_init_reuseport() for (;0;)
+#endif
+
 /* everyone */
 void sleepy_penguin_init_sendfile(void);
+void sleepy_penguin_init_stats(void);
 
 static size_t l1_cache_line_size_detect(void)
 {
@@ -190,10 +261,28 @@ void Init_sleepy_penguin_ext(void)
 	sleepy_penguin_init_kqueue();
 	sleepy_penguin_init_epoll();
 	sleepy_penguin_init_timerfd();
+	sleepy_penguin_init_timer_wheel();
 	sleepy_penguin_init_eventfd();
+	sleepy_penguin_init_event_queue();
 	sleepy_penguin_init_inotify();
+	sleepy_penguin_init_inotify_tree();
+	sleepy_penguin_init_inotify_hub();
+	sleepy_penguin_init_inotify_coalesce();
+	sleepy_penguin_init_file_cache();
+	sleepy_penguin_init_fanotify();
 	sleepy_penguin_init_signalfd();
 	sleepy_penguin_init_splice();
 	sleepy_penguin_init_cfr();
+	sleepy_penguin_init_fanout();
+	sleepy_penguin_init_zerocopy();
+	sleepy_penguin_init_copy_stream();
+	sleepy_penguin_init_ktls();
+	sleepy_penguin_init_sched();
+	sleepy_penguin_init_memfd();
+	sleepy_penguin_init_pidfd();
+	sleepy_penguin_init_accept();
+	sleepy_penguin_init_mmsg();
+	sleepy_penguin_init_reuseport();
 	sleepy_penguin_init_sendfile();
+	sleepy_penguin_init_stats();
 }
@@ -2,10 +2,20 @@
 #include "sleepy_penguin.h"
 #include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <limits.h>
 #include "missing_inotify.h"
+#ifdef HAVE_RB_ENC_INTERNED_STR
+#  include <ruby/encoding.h>
+#endif
 
-static ID id_inotify_tmp, id_mask;
-static VALUE cEvent, checks;
+/* enough for a few dozen events with names */
+#define INOTIFY_BUFSIZE 16384
+
+/* distinct masks are few in practice, this bounds pathological cases */
+#define EVENTS_CACHE_MAX 1024
+
+static ID id_inotify_tmp, id_inotify_bufsize, id_coalesce, id_uminus;
+static VALUE cInotify, cEvent, cBatch, checks, events_cache;
 
 /*
  * call-seq:
@@ -35,6 +45,7 @@ static VALUE s_new(int argc, VALUE *argv, VALUE klass)
 	rv = INT2FIX(fd);
 	rv = rb_call_super(1, &rv);
 	rb_ivar_set(rv, id_inotify_tmp, rb_ary_new());
+	rb_ivar_set(rv, id_inotify_bufsize, SIZET2NUM(INOTIFY_BUFSIZE));
 
 	return rv;
 }
@@ -115,7 +126,7 @@ static size_t event_len(struct inotify_event *e)
 	return sizeof(struct inotify_event) + e->len;
 }
 
-static VALUE event_new(struct inotify_event *e)
+static VALUE event_new(VALUE klass, const struct inotify_event *e)
 {
 	VALUE wd = INT2NUM(e->wd);
 	VALUE mask = UINT2NUM(e->mask);
@@ -130,16 +141,19 @@ static VALUE event_new(struct inotify_event *e)
 	 */
 	name = e->len ? rb_str_new2(e->name) : Qnil;
 
-	return rb_struct_new(cEvent, wd, mask, cookie, name);
+	return rb_struct_new(klass, wd, mask, cookie, name);
 }
 
 struct inread_args {
 	VALUE self;
 	int fd;
 	int nonblock_p;
+	int all_p; /* return every event from one read(2) as an Array */
 	size_t size;
 	VALUE tmp;
 	void *buf;
+	rb_sp_inotify_fn *fn;
+	VALUE arg;
 };
 
 static VALUE inread(void *ptr)
@@ -163,6 +177,7 @@ static void resize_internal_buffer(struct inread_args *args)
 		args->size = (size_t)newlen;
 		rb_sp_puttlsbuf((VALUE)args->buf);
 		args->buf = rb_sp_gettlsbuf(&args->size);
+		return;
 	}
 
 	if (newlen == 0) /* race: some other thread grabbed the data */
@@ -194,69 +209,172 @@ static VALUE do_take(VALUE p)
 					&args->fd))
 				rb_sys_fail("read(inotify)");
 		} else {
-			/* buffer in userspace to minimize read() calls */
 			end = (struct inotify_event *)((char *)args->buf + r);
+			if (args->all_p)
+				rv = rb_ary_new();
 			for (e = args->buf; e < end; ) {
-				VALUE event = event_new(e);
-				if (NIL_P(rv))
+				VALUE event = args->fn(args->arg, e);
+				if (event == Qundef)
+					; /* filtered out */
+				else if (args->all_p)
+					rb_ary_push(rv, event);
+				else if (NIL_P(rv))
 					rv = event;
-				else
+				else /* buffer in userspace for the next take */
 					rb_ary_push(args->tmp, event);
 				e = (struct inotify_event *)
 				    ((char *)e + event_len(e));
 			}
+			if (args->all_p && RARRAY_LEN(rv) == 0)
+				rv = Qnil;
 		}
 	} while (NIL_P(rv));
 
 	return rv;
 }
 
+static VALUE take_ensure(VALUE p)
+{
+	struct inread_args *args = (struct inread_args *)p;
+
+	return rb_sp_puttlsbuf((VALUE)args->buf);
+}
+
 /*
- * call-seq:
- *	ino.take([nonblock]) -> Inotify::Event or nil
- *
- * Returns the next Inotify::Event processed.  May return +nil+ if +nonblock+
- * is +true+.
+ * returns events decoded but not returned by an earlier Inotify#take,
+ * or Qundef if there are none
  */
-static VALUE take(int argc, VALUE *argv, VALUE self)
+VALUE rb_sp_inotify_leftovers(VALUE self, int all_p)
+{
+	VALUE tmp = rb_ivar_get(self, id_inotify_tmp);
+	VALUE rv;
+
+	if (RARRAY_LEN(tmp) == 0)
+		return Qundef;
+	if (!all_p)
+		return rb_ary_shift(tmp);
+	rv = rb_ary_dup(tmp);
+	rb_ary_clear(tmp);
+	return rv;
+}
+
+/*
+ * shared by Inotify and Inotify::Tree: +fn+ decodes each event with
+ * +arg+ and may return Qundef to drop it
+ */
+VALUE rb_sp_inotify_take(VALUE self, int argc, VALUE *argv, int all_p,
+			rb_sp_inotify_fn *fn, VALUE arg)
 {
 	struct inread_args args;
-	VALUE nonblock;
+	VALUE nonblock, size;
+	VALUE rv = rb_sp_inotify_leftovers(self, all_p);
 
+	if (rv != Qundef)
+		return rv;
 	args.tmp = rb_ivar_get(self, id_inotify_tmp);
-	if (RARRAY_LEN(args.tmp) > 0)
-		return rb_ary_shift(args.tmp);
 
 	rb_scan_args(argc, argv, "01", &nonblock);
 
+	size = rb_ivar_get(self, id_inotify_bufsize);
 	args.self = self;
 	args.fd = rb_sp_fileno(self);
-	args.size = 128;
+	args.size = NIL_P(size) ? INOTIFY_BUFSIZE : NUM2SIZET(size);
 	args.nonblock_p = RTEST(nonblock);
+	args.all_p = all_p;
+	args.fn = fn;
+	args.arg = arg;
 
 	if (args.nonblock_p)
 		rb_sp_set_nonblock(args.fd);
 
 	args.buf = 0;
-	return rb_ensure(do_take, (VALUE)&args,
-			 rb_sp_puttlsbuf, (VALUE)args.buf);
+	return rb_ensure(do_take, (VALUE)&args, take_ensure, (VALUE)&args);
 }
 
 /*
  * call-seq:
- *	inotify_event.events => [ :MOVED_TO, ... ]
+ *	ino.take([nonblock]) -> Inotify::Event or nil
  *
- * Returns an array of symbolic event names based on the contents of
- * the +mask+ field.
+ * Returns the next Inotify::Event processed.  May return +nil+ if +nonblock+
+ * is +true+.
  */
-static VALUE events(VALUE self)
+static VALUE take(int argc, VALUE *argv, VALUE self)
+{
+	VALUE rv = rb_sp_inotify_coalesce_take(self, argc, argv, 0);
+
+	if (rv != Qundef)
+		return rv;
+	return rb_sp_inotify_take(self, argc, argv, 0, event_new, cEvent);
+}
+
+/*
+ * call-seq:
+ *	ino.take_all([nonblock]) -> [ Inotify::Event, ... ] or nil
+ *
+ * Returns an Array of every Inotify::Event decoded from a single
+ * read(2), which reads up to Inotify#buffer_size bytes.  Events left
+ * over from a previous call to Inotify#take are returned first, without
+ * reading.  May return +nil+ if +nonblock+ is +true+.
+ *
+ * This is cheaper than calling Inotify#take once per event when
+ * events arrive in bursts.
+ */
+static VALUE take_all(int argc, VALUE *argv, VALUE self)
+{
+	VALUE rv = rb_sp_inotify_coalesce_take(self, argc, argv, 1);
+
+	if (rv != Qundef)
+		return rv;
+	return rb_sp_inotify_take(self, argc, argv, 1, event_new, cEvent);
+}
+
+/*
+ * call-seq:
+ *	ino.buffer_size -> Integer
+ *
+ * Returns the minimum number of bytes Inotify#take and Inotify#take_all
+ * attempt to read(2) at once.
+ */
+static VALUE bufsize_get(VALUE self)
+{
+	VALUE size = rb_ivar_get(self, id_inotify_bufsize);
+
+	return NIL_P(size) ? SIZET2NUM(INOTIFY_BUFSIZE) : size;
+}
+
+/*
+ * call-seq:
+ *	ino.buffer_size = bytes
+ *
+ * Sets the minimum number of bytes Inotify#take and Inotify#take_all
+ * attempt to read(2) at once.  Raising this allows a single read(2) to
+ * drain a large burst of events (as reported by the FIONREAD ioctl).
+ * Buffers are per-thread and shared with other methods in
+ * SleepyPenguin, so this only grows memory usage of threads which
+ * read from this object.
+ */
+static VALUE bufsize_set(VALUE self, VALUE size)
+{
+	size_t n = NUM2SIZET(size);
+
+	/* the kernel returns EINVAL if the next event does not fit */
+	if (n < sizeof(struct inotify_event))
+		rb_raise(rb_eArgError, "buffer_size too small: %lu",
+			 (unsigned long)n);
+	if (n >= UINT32_MAX)
+		rb_raise(rb_eArgError, "buffer_size too large: %lu",
+			 (unsigned long)n);
+
+	return rb_ivar_set(self, id_inotify_bufsize, SIZET2NUM(n));
+}
+
+static VALUE mask_events(uint32_t event_mask)
 {
 	long len = RARRAY_LEN(checks);
 	long i;
 	VALUE sym;
 	VALUE rv = rb_ary_new();
 	uint32_t mask;
-	uint32_t event_mask = NUM2UINT(rb_funcall(self, id_mask, 0));
 
 	for (i = 0; i < len; ) {
 		sym = rb_ary_entry(checks, i++);
@@ -268,6 +386,28 @@ static VALUE events(VALUE self)
 	return rv;
 }
 
+/*
+ * call-seq:
+ *	inotify_event.events => [ :MOVED_TO, ... ]
+ *
+ * Returns an array of symbolic event names based on the contents of
+ * the +mask+ field.
+ */
+static VALUE events(VALUE self)
+{
+	VALUE mask = rb_struct_aref(self, INT2FIX(1));
+	VALUE rv = rb_hash_lookup(events_cache, mask);
+
+	if (NIL_P(rv)) {
+		rv = mask_events(NUM2UINT(mask));
+		if (RHASH_SIZE(events_cache) >= EVENTS_CACHE_MAX)
+			return rv;
+		rb_hash_aset(events_cache, mask, rb_obj_freeze(rv));
+	}
+
+	return rb_ary_dup(rv);
+}
+
 /*
  * call-seq:
  *	ino.each { |event| ... } -> ino
@@ -284,9 +424,213 @@ static VALUE each(VALUE self)
 	return self;
 }
 
+/*
+ * call-seq:
+ *	ino.each_batch { |events| ... } -> ino
+ *
+ * Yields an Array of every Inotify::Event received by each read(2)
+ * in a blocking fashion.  See Inotify#take_all.
+ */
+static VALUE each_batch(VALUE self)
+{
+	VALUE argv = Qfalse;
+
+	while (1)
+		rb_yield(take_all(0, &argv, self));
+
+	return self;
+}
+
+/*
+ * raw events from a single read(2) retained by Inotify#take_batch,
+ * Inotify::Event objects are only created for events yielded
+ */
+struct batch {
+	size_t len;
+	size_t capa;
+	long nr;
+	char *buf;
+};
+
+static void batch_free(void *ptr)
+{
+	struct batch *b = ptr;
+
+	xfree(b->buf);
+	xfree(b);
+}
+
+static size_t batch_memsize(const void *ptr)
+{
+	const struct batch *b = ptr;
+
+	return sizeof(struct batch) + b->capa;
+}
+
+static const rb_data_type_t batch_type = {
+	"sleepy_penguin_inotify_batch",
+	{ NULL, batch_free, batch_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static void batch_push(struct batch *b, const struct inotify_event *e)
+{
+	size_t n = sizeof(struct inotify_event) + e->len;
+
+	if (b->len + n > b->capa) {
+		size_t capa = b->capa ? b->capa * 2 : INOTIFY_BUFSIZE;
+
+		while (capa < b->len + n)
+			capa *= 2;
+		REALLOC_N(b->buf, char, capa);
+		b->capa = capa;
+	}
+	memcpy(b->buf + b->len, e, n);
+	b->len += n;
+	b->nr++;
+}
+
+/* re-encodes an Inotify::Event left over from Inotify#take */
+static void batch_push_event(struct batch *b, VALUE event)
+{
+	union {
+		struct inotify_event e;
+		char buf[sizeof(struct inotify_event) + NAME_MAX + 1 +
+			 sizeof(struct inotify_event)];
+	} u;
+	VALUE name = rb_struct_aref(event, INT2FIX(3));
+	size_t len = 0;
+
+	memset(&u, 0, sizeof(u));
+	u.e.wd = NUM2INT(rb_struct_aref(event, INT2FIX(0)));
+	u.e.mask = NUM2UINT(rb_struct_aref(event, INT2FIX(1)));
+	u.e.cookie = NUM2UINT(rb_struct_aref(event, INT2FIX(2)));
+	if (!NIL_P(name)) {
+		len = (size_t)RSTRING_LEN(name);
+		if (len > NAME_MAX)
+			rb_raise(rb_eArgError, "name too long");
+		memcpy(u.e.name, RSTRING_PTR(name), len);
+
+		/* zero-padded like the kernel does */
+		u.e.len = (uint32_t)((len + sizeof(struct inotify_event)) &
+				     ~(sizeof(struct inotify_event) - 1));
+	}
+	batch_push(b, &u.e);
+}
+
+static VALUE batch_add(VALUE batch, const struct inotify_event *e)
+{
+	struct batch *b = DATA_PTR(batch);
+	int first = b->nr == 0;
+
+	batch_push(b, e);
+
+	/* one non-Qundef return ends rb_sp_inotify_take after this read */
+	return first ? batch : Qundef;
+}
+
+/*
+ * call-seq:
+ *	ino.take_batch([nonblock]) -> Inotify::Batch or nil
+ *
+ * Like Inotify#take_all, but returns every event from a single read(2)
+ * as an Inotify::Batch without creating an Inotify::Event for each one.
+ * May return +nil+ if +nonblock+ is +true+.
+ *
+ * This is useful for high-volume watchers which filter most events on
+ * their mask alone, see Inotify::Batch#each.  It may not be used while
+ * coalescing is enabled with Inotify#coalesce_window=.
+ */
+static VALUE take_batch(int argc, VALUE *argv, VALUE self)
+{
+	VALUE tmp = rb_ivar_get(self, id_inotify_tmp);
+	VALUE batch;
+	struct batch *b;
+
+	if (!NIL_P(rb_attr_get(self, id_coalesce)))
+		rb_raise(rb_eRuntimeError, "take_batch used with coalescing");
+
+	batch = TypedData_Make_Struct(cBatch, struct batch, &batch_type, b);
+	if (RARRAY_LEN(tmp) > 0) {
+		long i;
+
+		for (i = 0; i < RARRAY_LEN(tmp); i++)
+			batch_push_event(b, rb_ary_entry(tmp, i));
+		rb_ary_clear(tmp);
+		return batch;
+	}
+
+	if (NIL_P(rb_sp_inotify_take(self, argc, argv, 1, batch_add, batch)))
+		return Qnil;
+	return batch;
+}
+
+/* names repeat heavily in practice, so share frozen copies */
+static VALUE batch_name(const struct inotify_event *e)
+{
+	if (!e->len)
+		return Qnil;
+#ifdef HAVE_RB_ENC_INTERNED_STR
+	return rb_enc_interned_str(e->name, (long)strlen(e->name),
+				   rb_ascii8bit_encoding());
+#else
+	return rb_funcall(rb_str_new2(e->name), id_uminus, 0);
+#endif
+}
+
+/*
+ * call-seq:
+ *	batch.each([mask]) { |event| ... } -> batch
+ *
+ * Yields an Inotify::Event for each event in the batch in the order
+ * they were read.  If +mask+ is given as an Array of Symbols or
+ * Integer, only events matching any of its flags are yielded and no
+ * objects are allocated for the rest.
+ *
+ * Event names are frozen and deduplicated strings.
+ */
+static VALUE batch_each(int argc, VALUE *argv, VALUE self)
+{
+	struct batch *b = rb_check_typeddata(self, &batch_type);
+	VALUE vmask;
+	uint32_t mask;
+	size_t off;
+
+	RETURN_ENUMERATOR(self, argc, argv);
+	rb_scan_args(argc, argv, "01", &vmask);
+	mask = NIL_P(vmask) ? ~(uint32_t)0 : rb_sp_get_uflags(cInotify, vmask);
+
+	/* the buffer is never modified once take_batch returns */
+	for (off = 0; off < b->len; ) {
+		struct inotify_event *e = (void *)(b->buf + off);
+
+		off += event_len(e);
+		if (!(e->mask & mask))
+			continue;
+		rb_yield(rb_struct_new(cEvent, INT2NUM(e->wd),
+				       UINT2NUM(e->mask), UINT2NUM(e->cookie),
+				       batch_name(e)));
+	}
+
+	return self;
+}
+
+/*
+ * call-seq:
+ *	batch.size -> Integer
+ *
+ * Returns the number of events in the batch.
+ */
+static VALUE batch_size(VALUE self)
+{
+	struct batch *b = rb_check_typeddata(self, &batch_type);
+
+	return LONG2NUM(b->nr);
+}
+
 void sleepy_penguin_init_inotify(void)
 {
-	VALUE mSleepyPenguin, cInotify;
+	VALUE mSleepyPenguin, cRename;
 
 	mSleepyPenguin = rb_define_module("SleepyPenguin");
 
@@ -314,7 +658,12 @@ void sleepy_penguin_init_inotify(void)
 	rb_define_method(cInotify, "add_watch", add_watch, 2);
 	rb_define_method(cInotify, "rm_watch", rm_watch, 1);
 	rb_define_method(cInotify, "take", take, -1);
+	rb_define_method(cInotify, "take_all", take_all, -1);
 	rb_define_method(cInotify, "each", each, 0);
+	rb_define_method(cInotify, "each_batch", each_batch, 0);
+	rb_define_method(cInotify, "buffer_size", bufsize_get, 0);
+	rb_define_method(cInotify, "buffer_size=", bufsize_set, 1);
+	rb_define_method(cInotify, "take_batch", take_batch, -1);
 
 	/*
 	 * Document-class: SleepyPenguin::Inotify::Event
@@ -341,9 +690,48 @@ void sleepy_penguin_init_inotify(void)
 	cEvent = rb_struct_define("Event", "wd", "mask", "cookie", "name", 0);
 	cEvent = rb_define_class_under(cInotify, "Event", cEvent);
 	rb_define_method(cEvent, "events", events, 0);
+
+	/*
+	 * Document-class: SleepyPenguin::Inotify::Rename
+	 *
+	 * Returned by SleepyPenguin::Inotify#take in place of an
+	 * IN_MOVED_FROM and IN_MOVED_TO pair when coalescing is enabled,
+	 * see Inotify#coalesce_window=.  It is a Struct with the elements
+	 * of Inotify::Event describing the destination, and:
+	 *
+	 * - from_wd   - watch descriptor of the source directory
+	 * - from_name - name in the source directory
+	 *
+	 * The mask includes both :MOVED_FROM and :MOVED_TO.
+	 */
+	cRename = rb_struct_define(NULL, "wd", "mask", "cookie", "name",
+				   "from_wd", "from_name", 0);
+	cRename = rb_define_class_under(cInotify, "Rename", cRename);
+	rb_define_method(cRename, "events", events, 0);
+
+	/*
+	 * Document-class: SleepyPenguin::Inotify::Batch
+	 *
+	 * Returned by SleepyPenguin::Inotify#take_batch.  It retains the
+	 * raw events from a single read(2) and only decodes them into
+	 * Inotify::Event objects as they are yielded by Batch#each.
+	 *
+	 *	ino.take_batch.each([:CREATE, :MOVED_TO]) do |event|
+	 *	  p event.name
+	 *	end
+	 */
+	cBatch = rb_define_class_under(cInotify, "Batch", rb_cObject);
+	rb_undef_alloc_func(cBatch);
+	rb_include_module(cBatch, rb_mEnumerable);
+	rb_define_method(cBatch, "each", batch_each, -1);
+	rb_define_method(cBatch, "size", batch_size, 0);
 	rb_define_singleton_method(cInotify, "new", s_new, -1);
 	id_inotify_tmp = rb_intern("@inotify_tmp");
-	id_mask = rb_intern("mask");
+	id_inotify_bufsize = rb_intern("@inotify_bufsize");
+	id_coalesce = rb_intern("@__sp_coalesce");
+	id_uminus = rb_intern("-@");
+	events_cache = rb_hash_new();
+	rb_global_variable(&events_cache);
 	checks = rb_ary_new();
 	rb_global_variable(&checks);
 #define IN(x) rb_define_const(cInotify,#x,UINT2NUM(IN_##x))
@@ -0,0 +1,492 @@
+#if defined(HAVE_SYS_INOTIFY_H) && defined(HAVE_SYS_TIMERFD_H)
+#include "sleepy_penguin.h"
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <string.h>
+#include <time.h>
+#include <ruby/st.h>
+#include "missing_inotify.h"
+#include "value2timespec.h"
+
+/*
+ * Coalesces bursts of Inotify events.  Events are queued in arrival
+ * order, and events for a (wd, name) pair already queued are merged
+ * into the queued one.  A queued event is returned by Inotify#take
+ * once the window since its first occurrence has elapsed, an internal
+ * TimerFD is armed for the oldest queued event so blocking callers
+ * (and Epoll users) wake up in time.
+ */
+static ID id_coalesce, id_inotify_tmp;
+static VALUE cEvent, cRename, cTimerFD;
+static VALUE sym_MONOTONIC, sym_CLOEXEC, sym_NONBLOCK;
+
+/* wd and name identify a coalescing key */
+struct co_key {
+	int wd;
+	size_t len;
+	const char *name;
+};
+
+struct co_entry {
+	struct co_entry *prev;
+	struct co_entry *next;
+	uint64_t deadline; /* CLOCK_MONOTONIC nanoseconds, 0: ASAP */
+	struct co_key key;
+	uint32_t mask;
+	uint32_t cookie;
+	int keyed; /* in co->keys */
+	int renaming; /* unpaired IN_MOVED_FROM, in co->cookies */
+	int from_wd;
+	char *from_name; /* non-NULL for paired renames */
+};
+
+struct coalesce {
+	uint64_t window;
+	VALUE timer;
+	struct co_entry head; /* list sentinel */
+	st_table *keys; /* struct co_key * => struct co_entry * */
+	st_table *cookies; /* cookie => struct co_entry * */
+};
+
+static int key_cmp(st_data_t a, st_data_t b)
+{
+	const struct co_key *x = (const struct co_key *)a;
+	const struct co_key *y = (const struct co_key *)b;
+
+	return !(x->wd == y->wd && x->len == y->len &&
+		 memcmp(x->name, y->name, x->len) == 0);
+}
+
+static st_index_t key_hash(st_data_t a)
+{
+	const struct co_key *k = (const struct co_key *)a;
+
+	return st_hash(k->name, k->len, (st_index_t)k->wd);
+}
+
+static const struct st_hash_type co_key_type = { key_cmp, key_hash };
+
+static void entry_free(struct co_entry *ent)
+{
+	xfree((void *)ent->key.name);
+	xfree(ent->from_name);
+	xfree(ent);
+}
+
+static void entry_unlink(struct coalesce *co, struct co_entry *ent)
+{
+	ent->prev->next = ent->next;
+	ent->next->prev = ent->prev;
+	if (ent->keyed) {
+		st_data_t k = (st_data_t)&ent->key;
+
+		st_delete(co->keys, &k, NULL);
+	}
+	if (ent->renaming) {
+		st_data_t k = (st_data_t)ent->cookie;
+
+		st_delete(co->cookies, &k, NULL);
+	}
+}
+
+static void co_mark(void *ptr)
+{
+	struct coalesce *co = ptr;
+
+	rb_gc_mark(co->timer);
+}
+
+static void co_free(void *ptr)
+{
+	struct coalesce *co = ptr;
+	struct co_entry *ent = co->head.next;
+
+	while (ent != &co->head) {
+		struct co_entry *next = ent->next;
+
+		entry_free(ent);
+		ent = next;
+	}
+	st_free_table(co->keys);
+	st_free_table(co->cookies);
+	xfree(co);
+}
+
+static size_t co_memsize(const void *ptr)
+{
+	const struct coalesce *co = ptr;
+
+	return sizeof(struct coalesce) + st_memsize(co->keys) +
+		st_memsize(co->cookies);
+}
+
+static const rb_data_type_t co_type = {
+	"sleepy_penguin_inotify_coalesce",
+	{ co_mark, co_free, co_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static struct coalesce *co_lookup(VALUE self)
+{
+	VALUE tmp = rb_attr_get(self, id_coalesce);
+
+	return NIL_P(tmp) ? NULL : rb_check_typeddata(tmp, &co_type);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		rb_sys_fail("clock_gettime");
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* arms the timer for the oldest queued event, or disarms it */
+static void co_arm(struct coalesce *co)
+{
+	struct itimerspec its;
+	uint64_t ns = 0;
+
+	memset(&its, 0, sizeof(its));
+	if (co->head.next != &co->head) {
+		ns = co->head.next->deadline;
+		if (ns == 0)
+			ns = 1; /* a zero it_value disarms */
+	}
+	its.it_value.tv_sec = ns / 1000000000ULL;
+	its.it_value.tv_nsec = ns % 1000000000ULL;
+	if (timerfd_settime(rb_sp_fileno(co->timer), TFD_TIMER_ABSTIME,
+			    &its, NULL) < 0)
+		rb_sys_fail("timerfd_settime");
+}
+
+static struct co_entry *
+entry_push(struct coalesce *co, const struct inotify_event *e,
+		uint64_t deadline)
+{
+	struct co_entry *ent = ALLOC(struct co_entry);
+	size_t len = e->len ? strlen(e->name) : 0;
+	char *name = ALLOC_N(char, len + 1);
+
+	memcpy(name, e->len ? e->name : "", len + 1);
+	ent->deadline = deadline;
+	ent->key.wd = e->wd;
+	ent->key.len = len;
+	ent->key.name = name;
+	ent->mask = e->mask;
+	ent->cookie = e->cookie;
+	ent->keyed = ent->renaming = 0;
+	ent->from_wd = -1;
+	ent->from_name = NULL;
+
+	ent->next = &co->head;
+	ent->prev = co->head.prev;
+	co->head.prev->next = ent;
+	co->head.prev = ent;
+	return ent;
+}
+
+/* decodes raw events into the queue, see rb_sp_inotify_take */
+static VALUE co_event(VALUE self, const struct inotify_event *e)
+{
+	struct coalesce *co = co_lookup(self);
+	struct co_entry *ent;
+	struct co_key key;
+	st_data_t val, cookie = (st_data_t)e->cookie;
+
+	if (e->mask & (IN_Q_OVERFLOW|IN_IGNORED|IN_UNMOUNT)) {
+		/* things changed under us, flush everything in order */
+		for (ent = co->head.next; ent != &co->head; ent = ent->next)
+			ent->deadline = 0;
+		entry_push(co, e, 0);
+		return Qundef;
+	}
+
+	if ((e->mask & IN_MOVED_TO) && e->cookie &&
+	    st_delete(co->cookies, &cookie, &val)) {
+		size_t len = e->len ? strlen(e->name) : 0;
+
+		/* turn the queued MOVED_FROM into a rename */
+		ent = (struct co_entry *)val;
+		ent->renaming = 0;
+		ent->from_wd = ent->key.wd;
+		ent->from_name = (char *)ent->key.name;
+		ent->key.wd = e->wd;
+		ent->key.len = len;
+		ent->key.name = ALLOC_N(char, len + 1);
+		memcpy((char *)ent->key.name, e->name, len + 1);
+		ent->mask |= e->mask;
+		return Qundef;
+	}
+
+	if ((e->mask & IN_MOVED_FROM) && e->cookie) {
+		ent = entry_push(co, e, now_ns() + co->window);
+		st_insert(co->cookies, cookie, (st_data_t)ent);
+		ent->renaming = 1;
+		return Qundef;
+	}
+
+	key.wd = e->wd;
+	key.len = e->len ? strlen(e->name) : 0;
+	key.name = e->name;
+	if (st_lookup(co->keys, (st_data_t)&key, &val)) {
+		ent = (struct co_entry *)val;
+		ent->mask |= e->mask;
+	} else {
+		ent = entry_push(co, e, now_ns() + co->window);
+		st_insert(co->keys, (st_data_t)&ent->key, (st_data_t)ent);
+		ent->keyed = 1;
+	}
+	return Qundef;
+}
+
+static VALUE entry_value(struct co_entry *ent)
+{
+	VALUE wd = INT2NUM(ent->key.wd);
+	VALUE mask = UINT2NUM(ent->mask);
+	VALUE cookie = UINT2NUM(ent->cookie);
+	VALUE name = ent->key.len ? rb_str_new(ent->key.name, ent->key.len)
+				  : Qnil;
+
+	if (ent->from_name)
+		return rb_struct_new(cRename, wd, mask, cookie, name,
+				     INT2NUM(ent->from_wd),
+				     *ent->from_name ?
+				     rb_str_new2(ent->from_name) : Qnil);
+
+	return rb_struct_new(cEvent, wd, mask, cookie, name);
+}
+
+/* removes ripe events from the queue, appending them to +dst+ */
+static void co_ripe(struct coalesce *co, uint64_t now, VALUE dst, int all_p)
+{
+	while (co->head.next != &co->head) {
+		struct co_entry *ent = co->head.next;
+		VALUE event;
+
+		if (ent->deadline > now)
+			return;
+		event = entry_value(ent); /* may raise, so unlink after */
+		entry_unlink(co, ent);
+		entry_free(ent);
+		rb_ary_push(dst, event);
+		if (!all_p)
+			return;
+	}
+}
+
+struct co_wait_args {
+	int max;
+	rb_fdset_t fds;
+};
+
+static VALUE co_select(VALUE p)
+{
+	struct co_wait_args *a = (struct co_wait_args *)p;
+
+	if (rb_thread_fd_select(a->max, &a->fds, NULL, NULL, NULL) < 0)
+		rb_sys_fail("select");
+	return Qnil;
+}
+
+static VALUE co_select_done(VALUE p)
+{
+	struct co_wait_args *a = (struct co_wait_args *)p;
+
+	rb_fd_term(&a->fds);
+	return Qnil;
+}
+
+/* sleeps until new events arrive or the oldest queued event is due */
+static void co_wait(VALUE self, struct coalesce *co)
+{
+	struct co_wait_args a;
+	int ifd = rb_sp_fileno(self);
+	int tfd = rb_sp_fileno(co->timer);
+
+	a.max = (ifd > tfd ? ifd : tfd) + 1;
+	rb_fd_init(&a.fds);
+	rb_fd_set(ifd, &a.fds);
+	rb_fd_set(tfd, &a.fds);
+	rb_ensure(co_select, (VALUE)&a, co_select_done, (VALUE)&a);
+}
+
+/*
+ * Inotify#take and Inotify#take_all call this first,
+ * returns Qundef if coalescing is disabled
+ */
+VALUE rb_sp_inotify_coalesce_take(VALUE self, int argc, VALUE *argv, int all_p)
+{
+	struct coalesce *co = co_lookup(self);
+	VALUE nonblock, rv;
+	VALUE t = Qtrue;
+
+	if (!co)
+		return Qundef;
+
+	rb_scan_args(argc, argv, "01", &nonblock);
+	rv = rb_ary_new();
+	for (;;) {
+		/* leftovers from before coalescing was enabled */
+		VALUE left = rb_sp_inotify_leftovers(self, all_p);
+
+		if (left != Qundef)
+			return left;
+
+		rb_sp_inotify_take(self, 1, &t, 1, co_event, self);
+		co_ripe(co, now_ns(), rv, all_p);
+		co_arm(co);
+		if (RARRAY_LEN(rv) > 0)
+			return all_p ? rv : rb_ary_entry(rv, 0);
+		if (RTEST(nonblock))
+			return Qnil;
+		co_wait(self, co);
+	}
+}
+
+/*
+ * call-seq:
+ *	ino.coalesce_window = seconds
+ *
+ * Enables coalescing of events with a window of +seconds+ (Float or
+ * Integer), or disables it if +nil+.
+ *
+ * When enabled, Inotify#take and Inotify#take_all merge all events for
+ * the same watch descriptor and name seen within +seconds+ of the first
+ * one into a single Inotify::Event with the union of their masks.  An
+ * IN_MOVED_FROM and IN_MOVED_TO pair with the same cookie becomes one
+ * Inotify::Rename event.  Each event is returned once +seconds+ have
+ * elapsed since it was first seen, or immediately when IN_Q_OVERFLOW,
+ * IN_IGNORED or IN_UNMOUNT is seen.
+ *
+ * Event loops using Epoll or IO.select must also watch
+ * Inotify#coalesce_timer, which becomes readable when a coalesced event
+ * is due, and call Inotify#take_all with +nonblock+ when either is
+ * readable.
+ *
+ * Events still queued when coalescing is disabled are returned by the
+ * next Inotify#take or Inotify#take_all call.
+ */
+static VALUE set_window(VALUE self, VALUE seconds)
+{
+	struct coalesce *co = co_lookup(self);
+	struct timespec ts;
+
+	if (NIL_P(seconds)) {
+		if (co) {
+			VALUE tmp = rb_ivar_get(self, id_inotify_tmp);
+			VALUE timer = co->timer;
+
+			co_ripe(co, UINT64_MAX, tmp, 1);
+			rb_ivar_set(self, id_coalesce, Qnil);
+			rb_io_close(timer);
+		}
+		return seconds;
+	}
+
+	value2timespec(&ts, seconds);
+	if (ts.tv_sec < 0)
+		rb_raise(rb_eArgError, "negative window");
+	if (!co) {
+		VALUE flags = rb_ary_new3(2, sym_CLOEXEC, sym_NONBLOCK);
+		VALUE timer = rb_funcall(cTimerFD, rb_intern("new"), 2,
+					 sym_MONOTONIC, flags);
+		VALUE tmp = TypedData_Make_Struct(rb_cObject, struct coalesce,
+						  &co_type, co);
+
+		co->head.next = co->head.prev = &co->head;
+		co->keys = st_init_table(&co_key_type);
+		co->cookies = st_init_numtable();
+		co->timer = timer;
+		rb_ivar_set(self, id_coalesce, tmp);
+	}
+	co->window = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	return seconds;
+}
+
+/*
+ * call-seq:
+ *	ino.coalesce_window -> Float or nil
+ *
+ * Returns the coalescing window in seconds, or +nil+ if disabled.
+ */
+static VALUE get_window(VALUE self)
+{
+	struct coalesce *co = co_lookup(self);
+
+	return co ? DBL2NUM((double)co->window / 1e9) : Qnil;
+}
+
+/*
+ * call-seq:
+ *	ino.coalesce_timer -> TimerFD or nil
+ *
+ * Returns the internal TimerFD used for coalescing, see
+ * Inotify#coalesce_window=.  It must not be modified.
+ */
+static VALUE get_timer(VALUE self)
+{
+	struct coalesce *co = co_lookup(self);
+
+	return co ? co->timer : Qnil;
+}
+
+/*
+ * call-seq:
+ *	ino.flush -> [ Inotify::Event, ... ]
+ *
+ * Returns all events queued for coalescing without waiting for their
+ * window to elapse.  Returns an empty Array if coalescing is disabled.
+ */
+static VALUE flush(VALUE self)
+{
+	struct coalesce *co = co_lookup(self);
+	VALUE rv = rb_ary_new();
+	VALUE t = Qtrue;
+
+	if (co) {
+		VALUE tmp = rb_ivar_get(self, id_inotify_tmp);
+
+		/* leftovers from before coalescing was enabled come first */
+		rb_ary_concat(rv, tmp);
+		rb_ary_clear(tmp);
+		rb_sp_inotify_take(self, 1, &t, 1, co_event, self);
+		co_ripe(co, UINT64_MAX, rv, 1);
+		co_arm(co);
+	}
+	return rv;
+}
+
+void sleepy_penguin_init_inotify_coalesce(void)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+	VALUE cInotify = rb_const_get(mSleepyPenguin, rb_intern("Inotify"));
+	VALUE cTree;
+	int i;
+
+	cEvent = rb_const_get(cInotify, rb_intern("Event"));
+	cRename = rb_const_get(cInotify, rb_intern("Rename"));
+	cTimerFD = rb_const_get(mSleepyPenguin, rb_intern("TimerFD"));
+	rb_define_method(cInotify, "coalesce_window=", set_window, 1);
+	rb_define_method(cInotify, "coalesce_window", get_window, 0);
+	rb_define_method(cInotify, "coalesce_timer", get_timer, 0);
+	rb_define_method(cInotify, "flush", flush, 0);
+
+	/* Inotify::Tree and Inotify::Hub decode their own events */
+	for (i = 0; i < 2; i++) {
+		cTree = rb_const_get(cInotify, rb_intern(i ? "Hub" : "Tree"));
+		rb_undef_method(cTree, "coalesce_window=");
+		rb_undef_method(cTree, "coalesce_window");
+		rb_undef_method(cTree, "coalesce_timer");
+		rb_undef_method(cTree, "flush");
+	}
+
+	id_coalesce = rb_intern("@__sp_coalesce");
+	id_inotify_tmp = rb_intern("@inotify_tmp");
+	sym_MONOTONIC = ID2SYM(rb_intern("MONOTONIC"));
+	sym_CLOEXEC = ID2SYM(rb_intern("CLOEXEC"));
+	sym_NONBLOCK = ID2SYM(rb_intern("NONBLOCK"));
+}
+#endif /* HAVE_SYS_INOTIFY_H && HAVE_SYS_TIMERFD_H */
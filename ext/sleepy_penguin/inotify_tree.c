@@ -0,0 +1,1595 @@
+#ifdef HAVE_SYS_INOTIFY_H
+#include "sleepy_penguin.h"
+#include "sp_copy.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <string.h>
+#include <ruby/st.h>
+#include "missing_inotify.h"
+
+/*
+ * A directory tree watched by one Inotify descriptor.  Each watched
+ * directory is one tree_node keyed by its watch descriptor, storing
+ * only the parent wd and the last path component.  Full paths are
+ * only built when Tree::Event#path or Tree#path is called.
+ */
+#define TREE_ROOT (-1) /* name is the full path given to add_tree */
+#define TREE_DETACHED (-2) /* moved away, waiting for IN_MOVED_TO */
+
+/* events we need regardless of what the user asked for */
+#define TREE_MASK (IN_CREATE|IN_MOVED_FROM|IN_MOVED_TO)
+
+/* delivered regardless of the user mask, as with plain Inotify */
+#define TREE_SPECIAL (IN_IGNORED|IN_UNMOUNT|IN_Q_OVERFLOW)
+
+#define TREE_DENTS 8192 /* getdents64 buffer for each open directory */
+
+#ifndef IFTODT
+#  define IFTODT(mode) (((mode) & 0170000) >> 12)
+#endif
+
+static ID id_tree, id_ivar_tree, id_inotify_tmp;
+static VALUE cTreeEvent;
+
+/* one directory entry in a snapshot */
+struct snap_ent {
+	uint64_t ino; /* 0 if only known from an event */
+	unsigned char type; /* DT_* */
+	unsigned char len;
+	char name[FLEX_ARRAY]; /* NUL-terminated */
+};
+
+/*
+ * contents of a watched directory as of its last listing, kept current
+ * with IN_CREATE, IN_DELETE and IN_MOVED_* events, see Tree#snapshot=
+ */
+struct tree_snap {
+	uint64_t ino;
+	struct timespec mtime;
+	long nr;
+	long capa;
+	struct snap_ent **ents; /* sorted by name */
+};
+
+struct tree_node {
+	int parent;
+	uint32_t umask; /* events the user asked for */
+	struct tree_snap *snap; /* NULL unless Tree#snapshot is enabled */
+	size_t len;
+	char name[FLEX_ARRAY];
+};
+
+struct tree_pending {
+	int parent;
+	uint32_t umask;
+	VALUE name;
+};
+
+struct tree {
+	st_table *nodes; /* wd => struct tree_node * */
+	long phead; /* pending[phead...npending] are queued */
+	long npending;
+	long capa;
+	struct tree_pending *pending; /* new subdirectories to walk */
+	int dirty; /* some nodes may be detached */
+	int snapshot; /* keep a tree_snap for directories walked */
+	int overflow; /* IN_Q_OVERFLOW seen, rescan before returning */
+};
+
+/*
+ * snapshots are built without the GVL, so everything here uses
+ * malloc(3) and reports ENOMEM by returning -1 or NULL
+ */
+static struct tree_snap *snap_new(void)
+{
+	return calloc(1, sizeof(struct tree_snap));
+}
+
+static void snap_free(struct tree_snap *snap)
+{
+	long i;
+
+	for (i = 0; i < snap->nr; i++)
+		free(snap->ents[i]);
+	free(snap->ents);
+	free(snap);
+}
+
+static struct snap_ent *
+snap_ent_new(const char *name, uint64_t ino, unsigned char type)
+{
+	size_t len = strlen(name);
+	struct snap_ent *ent;
+
+	if (len > 255) { /* NAME_MAX on every Linux filesystem */
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	ent = malloc(sizeof(struct snap_ent) + len + 1);
+	if (ent) {
+		ent->ino = ino;
+		ent->type = type;
+		ent->len = (unsigned char)len;
+		memcpy(ent->name, name, len + 1);
+	}
+	return ent;
+}
+
+static int snap_reserve(struct tree_snap *snap)
+{
+	if (snap->nr == snap->capa) {
+		long n = snap->capa ? snap->capa * 2 : 16;
+		struct snap_ent **ents = realloc(snap->ents, n * sizeof(*ents));
+
+		if (!ents)
+			return -1;
+		snap->ents = ents;
+		snap->capa = n;
+	}
+	return 0;
+}
+
+/* appends without sorting, for listings, see snap_sort */
+static int
+snap_push(struct tree_snap *snap, const char *name, uint64_t ino,
+	unsigned char type)
+{
+	struct snap_ent *ent;
+
+	if (snap_reserve(snap) < 0)
+		return -1;
+	ent = snap_ent_new(name, ino, type);
+	if (!ent)
+		return -1;
+	snap->ents[snap->nr++] = ent;
+	return 0;
+}
+
+static int ent_cmp(const void *a, const void *b)
+{
+	const struct snap_ent *x = *(const struct snap_ent **)a;
+	const struct snap_ent *y = *(const struct snap_ent **)b;
+
+	return strcmp(x->name, y->name);
+}
+
+static void snap_sort(struct tree_snap *snap)
+{
+	qsort(snap->ents, snap->nr, sizeof(struct snap_ent *), ent_cmp);
+}
+
+/* binary search, sets *idx to where +name+ is or would be inserted */
+static int snap_find(const struct tree_snap *snap, const char *name, long *idx)
+{
+	long lo = 0, hi = snap->nr;
+
+	while (lo < hi) {
+		long mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(snap->ents[mid]->name, name);
+
+		if (cmp == 0) {
+			*idx = mid;
+			return 1;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*idx = lo;
+	return 0;
+}
+
+/* updates a snapshot from an event, called with the GVL */
+static void snap_add(struct tree_snap *snap, const char *name, int dir_p)
+{
+	unsigned char type = dir_p ? DT_DIR : DT_UNKNOWN;
+	struct snap_ent *ent;
+	long i;
+
+	if (snap_find(snap, name, &i)) { /* replaced, inode unknown */
+		snap->ents[i]->ino = 0;
+		snap->ents[i]->type = type;
+		return;
+	}
+	ent = snap_ent_new(name, 0, type);
+	if (!ent || snap_reserve(snap) < 0) {
+		free(ent);
+		rb_memerror();
+	}
+	MEMMOVE(snap->ents + i + 1, snap->ents + i, struct snap_ent *,
+		snap->nr - i);
+	snap->ents[i] = ent;
+	snap->nr++;
+}
+
+static void snap_del(struct tree_snap *snap, const char *name)
+{
+	long i;
+
+	if (!snap_find(snap, name, &i))
+		return;
+	free(snap->ents[i]);
+	snap->nr--;
+	MEMMOVE(snap->ents + i, snap->ents + i + 1, struct snap_ent *,
+		snap->nr - i);
+}
+
+static void node_release(struct tree_node *node)
+{
+	if (node->snap)
+		snap_free(node->snap);
+	free(node);
+}
+
+static int node_free_i(st_data_t key, st_data_t val, st_data_t arg)
+{
+	node_release((struct tree_node *)val);
+	return ST_CONTINUE;
+}
+
+static void tree_mark(void *ptr)
+{
+	struct tree *t = ptr;
+	long i;
+
+	for (i = t->phead; i < t->npending; i++)
+		rb_gc_mark(t->pending[i].name);
+}
+
+static void tree_free(void *ptr)
+{
+	struct tree *t = ptr;
+
+	if (t->nodes) {
+		st_foreach(t->nodes, node_free_i, 0);
+		st_free_table(t->nodes);
+	}
+	xfree(t->pending);
+	xfree(t);
+}
+
+static size_t tree_memsize(const void *ptr)
+{
+	const struct tree *t = ptr;
+
+	return sizeof(struct tree) + t->capa * sizeof(struct tree_pending) +
+		(t->nodes ? st_memsize(t->nodes) : 0);
+}
+
+static const rb_data_type_t tree_type = {
+	"sleepy_penguin_inotify_tree",
+	{ tree_mark, tree_free, tree_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static struct tree *tree_get(VALUE self)
+{
+	struct tree *t;
+	VALUE tmp = rb_ivar_get(self, id_ivar_tree);
+
+	if (!NIL_P(tmp))
+		return rb_check_typeddata(tmp, &tree_type);
+
+	tmp = TypedData_Make_Struct(rb_cObject, struct tree, &tree_type, t);
+	t->nodes = st_init_numtable();
+	rb_ivar_set(self, id_ivar_tree, tmp);
+	return t;
+}
+
+static struct tree_node *tree_lookup(struct tree *t, int wd)
+{
+	st_data_t val;
+
+	return st_lookup(t->nodes, (st_data_t)wd, &val) ?
+		(struct tree_node *)val : NULL;
+}
+
+static void tree_store(struct tree *t, int wd, struct tree_node *node)
+{
+	st_data_t key = (st_data_t)wd;
+	st_data_t old;
+
+	if (st_lookup(t->nodes, key, &old))
+		node_release((struct tree_node *)old);
+	st_insert(t->nodes, key, (st_data_t)node);
+}
+
+static struct tree_node *
+node_new(int parent, uint32_t umask, const char *name, size_t len)
+{
+	struct tree_node *node = malloc(sizeof(struct tree_node) + len);
+
+	if (node) {
+		node->parent = parent;
+		node->umask = umask;
+		node->snap = NULL;
+		node->len = len;
+		memcpy(node->name, name, len);
+	}
+	return node;
+}
+
+/*
+ * returns the length of the full path of the directory watched by
+ * +wd+ with +name+ appended if non-NULL, or -1 if +wd+ is no longer
+ * in the tree
+ */
+static long path_len(struct tree *t, int wd, const char *name)
+{
+	long len = name ? (long)strlen(name) : -1; /* no trailing slash */
+	struct tree_node *node;
+	int cur;
+
+	for (cur = wd; cur != TREE_ROOT; cur = node->parent) {
+		node = tree_lookup(t, cur);
+		if (!node || node->parent == TREE_DETACHED)
+			return -1;
+		len += node->len + 1;
+	}
+	return len;
+}
+
+/* fills +dst+ backwards, +len+ is from path_len */
+static void path_fill(struct tree *t, int wd, const char *name, char *dst,
+			long len)
+{
+	struct tree_node *node;
+	int cur;
+
+	dst += len;
+	if (name) {
+		size_t nlen = strlen(name);
+
+		dst -= nlen;
+		memcpy(dst, name, nlen);
+		*--dst = '/';
+	}
+	for (cur = wd; cur != TREE_ROOT; cur = node->parent) {
+		node = tree_lookup(t, cur);
+		dst -= node->len;
+		memcpy(dst, node->name, node->len);
+		if (node->parent != TREE_ROOT)
+			*--dst = '/';
+	}
+}
+
+/*
+ * returns the full path of the directory watched by +wd+, with +name+
+ * appended if non-NULL, or Qnil if +wd+ is no longer in the tree
+ */
+static VALUE tree_path(struct tree *t, int wd, const char *name)
+{
+	long len = path_len(t, wd, name);
+	VALUE rv;
+
+	if (len < 0)
+		return Qnil;
+	rv = rb_str_new(NULL, len);
+	path_fill(t, wd, name, RSTRING_PTR(rv), len);
+	return rv;
+}
+
+/* Linux-specific, glibc only gained a wrapper in 2.30 */
+struct tree_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[FLEX_ARRAY];
+};
+
+struct tree_frame {
+	int fd;
+	int wd;
+	struct tree_snap *snap; /* being listed */
+	size_t pathlen;
+	long pos;
+	long end;
+	char buf[TREE_DENTS];
+};
+
+struct tree_walk {
+	int ifd;
+	uint32_t umask;
+	uint32_t tmask; /* TREE_MASK plus IN_DELETE for snapshots */
+	int snapshot;
+	int cancel;
+	int err;
+	const char *errfn;
+	char *path;
+	size_t pathcapa;
+	long depth;
+	long depth_capa;
+	struct tree_frame **stack;
+	long nadded;
+	long added_capa;
+	int *added_wd;
+	struct tree_node **added;
+	long nsnaps;
+	long snaps_capa;
+	int *snap_wd;
+	struct tree_snap **snaps;
+};
+
+static int walk_fail(struct tree_walk *w, const char *fn)
+{
+	w->err = errno;
+	w->errfn = fn;
+	return -1;
+}
+
+/* errors from things disappearing or being unreadable while we walk */
+static int walk_skippable(int err)
+{
+	switch (err) {
+	case ENOENT:
+	case ENOTDIR:
+	case EACCES:
+	case EPERM:
+	case ELOOP:
+	case ENAMETOOLONG:
+		return 1;
+	}
+	return 0;
+}
+
+static int walk_add(struct tree_walk *w, int wd, struct tree_node *node)
+{
+	if (!node) {
+		errno = ENOMEM;
+		return walk_fail(w, "malloc");
+	}
+	if (w->nadded == w->added_capa) {
+		long n = w->added_capa ? w->added_capa * 2 : 64;
+		int *wds = realloc(w->added_wd, n * sizeof(int));
+		struct tree_node **nodes;
+
+		if (wds)
+			w->added_wd = wds;
+		nodes = wds ? realloc(w->added, n * sizeof(*nodes)) : NULL;
+		if (!nodes) {
+			free(node);
+			errno = ENOMEM;
+			return walk_fail(w, "realloc");
+		}
+		w->added = nodes;
+		w->added_capa = n;
+	}
+	w->added_wd[w->nadded] = wd;
+	w->added[w->nadded++] = node;
+	return 0;
+}
+
+/* stores a finished listing for walk_commit */
+static int walk_add_snap(struct tree_walk *w, int wd, struct tree_snap *snap)
+{
+	if (w->nsnaps == w->snaps_capa) {
+		long n = w->snaps_capa ? w->snaps_capa * 2 : 64;
+		int *wds = realloc(w->snap_wd, n * sizeof(int));
+		struct tree_snap **snaps;
+
+		if (wds)
+			w->snap_wd = wds;
+		snaps = wds ? realloc(w->snaps, n * sizeof(*snaps)) : NULL;
+		if (!snaps) {
+			snap_free(snap);
+			errno = ENOMEM;
+			return walk_fail(w, "realloc");
+		}
+		w->snaps = snaps;
+		w->snaps_capa = n;
+	}
+	snap_sort(snap);
+	w->snap_wd[w->nsnaps] = wd;
+	w->snaps[w->nsnaps++] = snap;
+	return 0;
+}
+
+/* fstat before listing, so changes made while listing are rescanned */
+static struct tree_snap *snap_start(int fd)
+{
+	struct tree_snap *snap = snap_new();
+	struct stat sb;
+
+	if (snap) {
+		if (fstat(fd, &sb) < 0) {
+			free(snap);
+			return NULL;
+		}
+		snap->ino = (uint64_t)sb.st_ino;
+		snap->mtime = sb.st_mtim;
+	}
+	return snap;
+}
+
+static int walk_push(struct tree_walk *w, int fd, int wd, size_t pathlen)
+{
+	struct tree_frame *f;
+
+	if (w->depth == w->depth_capa) {
+		long n = w->depth_capa ? w->depth_capa * 2 : 16;
+		struct tree_frame **stack = realloc(w->stack, n * sizeof(f));
+
+		if (!stack) {
+			close(fd);
+			errno = ENOMEM;
+			return walk_fail(w, "realloc");
+		}
+		w->stack = stack;
+		w->depth_capa = n;
+	}
+	f = malloc(sizeof(struct tree_frame));
+	if (!f) {
+		close(fd);
+		errno = ENOMEM;
+		return walk_fail(w, "malloc");
+	}
+	f->fd = fd;
+	f->wd = wd;
+	f->snap = NULL;
+	f->pathlen = pathlen;
+	f->pos = f->end = 0;
+	w->stack[w->depth++] = f;
+	if (w->snapshot) {
+		f->snap = snap_start(fd);
+		if (!f->snap)
+			return walk_fail(w, "fstat");
+	}
+	return 0;
+}
+
+/* +done+ if the directory was listed completely */
+static void walk_pop(struct tree_walk *w, int done)
+{
+	struct tree_frame *f = w->stack[--w->depth];
+
+	if (f->snap) {
+		if (done)
+			walk_add_snap(w, f->wd, f->snap);
+		else
+			snap_free(f->snap);
+	}
+	close(f->fd);
+	free(f);
+}
+
+/*
+ * returns the DT_* type of +d+ in +dirfd+, or -1 for "." and ".." and
+ * entries which disappeared
+ */
+static int dent_type(int dirfd, const struct tree_dirent64 *d)
+{
+	struct stat sb;
+
+	if (d->d_name[0] == '.' && (d->d_name[1] == 0 ||
+	    (d->d_name[1] == '.' && d->d_name[2] == 0)))
+		return -1;
+	if (d->d_type != DT_UNKNOWN)
+		return d->d_type;
+
+	/* some filesystems do not fill in d_type */
+	if (fstatat(dirfd, d->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0)
+		return -1;
+	return IFTODT(sb.st_mode);
+}
+
+static int walk_path_append(struct tree_walk *w, size_t off, const char *name)
+{
+	size_t len = strlen(name);
+	size_t need = off + 1 + len + 1;
+
+	if (need > w->pathcapa) {
+		size_t n = need * 2;
+		char *path = realloc(w->path, n);
+
+		if (!path) {
+			errno = ENOMEM;
+			return walk_fail(w, "realloc");
+		}
+		w->path = path;
+		w->pathcapa = n;
+	}
+	w->path[off] = '/';
+	memcpy(w->path + off + 1, name, len + 1);
+	return 0;
+}
+
+/* watches and descends into +name+ under the top frame */
+static int walk_child(struct tree_walk *w, const char *name)
+{
+	struct tree_frame *f = w->stack[w->depth - 1];
+	size_t pathlen = f->pathlen + 1 + strlen(name);
+	int wd, fd;
+
+	if (walk_path_append(w, f->pathlen, name) < 0)
+		return -1;
+	wd = inotify_add_watch(w->ifd, w->path,
+			       w->umask|w->tmask|IN_ONLYDIR|IN_DONT_FOLLOW);
+	if (wd < 0)
+		return walk_skippable(errno) ? 0 :
+			walk_fail(w, "inotify_add_watch");
+	if (walk_add(w, wd, node_new(f->wd, w->umask, name, strlen(name))) < 0)
+		return -1;
+	fd = openat(f->fd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	if (fd < 0)
+		return walk_skippable(errno) ? 0 : walk_fail(w, "openat");
+	return walk_push(w, fd, wd, pathlen);
+}
+
+/* runs without the GVL until the walk is done, fails, or is interrupted */
+static void *nogvl_walk(void *ptr)
+{
+	struct tree_walk *w = ptr;
+
+	while (w->depth > 0 && !w->cancel && !w->err) {
+		struct tree_frame *f = w->stack[w->depth - 1];
+		struct tree_dirent64 *d;
+		int type;
+
+		if (f->pos >= f->end) {
+			long n = syscall(SYS_getdents64, f->fd, f->buf,
+					 sizeof(f->buf));
+			if (n == 0) {
+				walk_pop(w, 1);
+			} else if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				if (walk_skippable(errno))
+					walk_pop(w, 0);
+				else
+					walk_fail(w, "getdents64");
+			} else {
+				f->pos = 0;
+				f->end = n;
+			}
+			continue;
+		}
+		d = (struct tree_dirent64 *)(f->buf + f->pos);
+		f->pos += d->d_reclen;
+
+		type = dent_type(f->fd, d);
+		if (type < 0)
+			continue;
+		if (f->snap && snap_push(f->snap, d->d_name, d->d_ino,
+					 (unsigned char)type) < 0) {
+			walk_fail(w, "malloc");
+			continue;
+		}
+		if (type == DT_DIR)
+			walk_child(w, d->d_name);
+	}
+	return NULL;
+}
+
+static void walk_ubf(void *ptr)
+{
+	struct tree_walk *w = ptr;
+
+	w->cancel = 1;
+}
+
+static void walk_commit(struct tree *t, struct tree_walk *w)
+{
+	long i;
+
+	for (i = 0; i < w->nadded; i++)
+		tree_store(t, w->added_wd[i], w->added[i]);
+	w->nadded = 0;
+	for (i = 0; i < w->nsnaps; i++) {
+		struct tree_node *node = tree_lookup(t, w->snap_wd[i]);
+
+		if (node) {
+			if (node->snap)
+				snap_free(node->snap);
+			node->snap = w->snaps[i];
+		} else {
+			snap_free(w->snaps[i]);
+		}
+	}
+	w->nsnaps = 0;
+}
+
+struct walk_args {
+	VALUE self;
+	struct tree *t;
+	struct tree_walk w;
+};
+
+static VALUE walk_run(VALUE p)
+{
+	struct walk_args *a = (struct walk_args *)p;
+	struct tree_walk *w = &a->w;
+
+	for (;;) {
+		WITHOUT_GVL(nogvl_walk, w, walk_ubf, w);
+		walk_commit(a->t, w);
+		if (w->err) {
+			errno = w->err;
+			rb_sys_fail(w->errfn);
+		}
+		if (w->depth == 0)
+			return Qnil;
+		w->cancel = 0;
+		rb_thread_check_ints();
+		w->ifd = rb_sp_fileno(a->self);
+	}
+}
+
+static VALUE walk_ensure(VALUE p)
+{
+	struct walk_args *a = (struct walk_args *)p;
+	struct tree_walk *w = &a->w;
+	long i;
+
+	while (w->depth > 0)
+		walk_pop(w, 0);
+	for (i = 0; i < w->nadded; i++)
+		free(w->added[i]);
+	free(w->added);
+	free(w->added_wd);
+	for (i = 0; i < w->nsnaps; i++)
+		snap_free(w->snaps[i]);
+	free(w->snaps);
+	free(w->snap_wd);
+	free(w->stack);
+	free(w->path);
+	return Qnil;
+}
+
+/*
+ * watches the directory behind +fd+ rather than +path+, so the watch
+ * and the walk cannot end up on different inodes if +path+ is replaced
+ */
+static int
+tree_add_watch(int ifd, int fd, const char *path, uint32_t mask, int nofollow)
+{
+	char proc[sizeof("/proc/self/fd/") + 3 * sizeof(int)];
+	int wd;
+
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	wd = inotify_add_watch(ifd, proc, mask);
+	if (wd < 0 && errno == ENOENT) /* /proc not mounted */
+		wd = inotify_add_watch(ifd, path,
+				       mask | (nofollow ? IN_DONT_FOLLOW : 0));
+	return wd;
+}
+
+/*
+ * watches +path+ (named +name+ under +parent+) and every directory
+ * below it, returns the watch descriptor of +path+ or -1 if it is gone
+ */
+static int
+tree_walk(VALUE self, struct tree *t, VALUE path, int parent, VALUE name,
+	uint32_t umask)
+{
+	struct walk_args a;
+	struct tree_node *node;
+	int wd, fd;
+	int oflags = O_RDONLY|O_DIRECTORY|O_CLOEXEC;
+	const char *cpath = StringValueCStr(path);
+
+	memset(&a, 0, sizeof(a));
+	a.self = self;
+	a.t = t;
+	a.w.ifd = rb_sp_fileno(self);
+	a.w.umask = umask;
+	a.w.snapshot = t->snapshot;
+	a.w.tmask = TREE_MASK | (t->snapshot ? IN_DELETE : 0);
+
+	/* a directory created inside the tree may be swapped for a symlink */
+	if (parent != TREE_ROOT)
+		oflags |= O_NOFOLLOW;
+	fd = open(cpath, oflags);
+	if (fd < 0 && rb_sp_gc_for_fd(errno))
+		fd = open(cpath, oflags);
+	if (fd < 0) {
+		if (parent != TREE_ROOT && walk_skippable(errno))
+			return -1;
+		rb_sys_fail(cpath);
+	}
+	wd = tree_add_watch(a.w.ifd, fd, cpath,
+			    umask|a.w.tmask|IN_ONLYDIR, oflags & O_NOFOLLOW);
+	if (wd < 0) {
+		int err = errno;
+
+		close(fd);
+		if (parent != TREE_ROOT && walk_skippable(err))
+			return -1;
+		errno = err;
+		rb_sys_fail(cpath);
+	}
+	node = node_new(parent, umask, RSTRING_PTR(name), RSTRING_LEN(name));
+	if (!node) {
+		close(fd);
+		rb_memerror();
+	}
+	tree_store(t, wd, node);
+
+	a.w.pathcapa = RSTRING_LEN(path) + 256;
+	a.w.path = malloc(a.w.pathcapa);
+	if (!a.w.path) {
+		close(fd);
+		rb_memerror();
+	}
+	memcpy(a.w.path, cpath, RSTRING_LEN(path) + 1);
+
+	/* walk_run raises if this fails, walk_ensure cleans up */
+	walk_push(&a.w, fd, wd, RSTRING_LEN(path));
+	rb_ensure(walk_run, (VALUE)&a, walk_ensure, (VALUE)&a);
+
+	return wd;
+}
+
+/*
+ * call-seq:
+ *	tree.add_tree(path, flags) -> Integer
+ *
+ * Watches the directory at +path+ and every directory below it for
+ * the events in +flags+ (see Inotify#add_watch), returns the watch
+ * descriptor of +path+.  Directories created in or moved into the tree
+ * later are watched automatically.
+ *
+ * The directory walk is done with openat(2) and getdents64(2) without
+ * holding the GVL.  Symbolic links below +path+ are never followed.
+ */
+static VALUE add_tree(VALUE self, VALUE path, VALUE vmask)
+{
+	uint32_t umask = rb_sp_get_uflags(self, vmask);
+	VALUE name = rb_str_dup(StringValue(path));
+	long len = RSTRING_LEN(name);
+
+	/* "/foo/" => "/foo" so Tree#path doesn't return "/foo//bar" */
+	while (len > 1 && RSTRING_PTR(name)[len - 1] == '/')
+		len--;
+	rb_str_set_len(name, len);
+
+	return INT2NUM(tree_walk(self, tree_get(self), path, TREE_ROOT, name,
+				 umask));
+}
+
+static void tree_pend(struct tree *t, int parent, uint32_t umask, VALUE name)
+{
+	if (t->npending == t->capa) {
+		if (t->phead && t->phead >= t->capa / 2) { /* reuse flushed */
+			t->npending -= t->phead;
+			MEMMOVE(t->pending, t->pending + t->phead,
+				struct tree_pending, t->npending);
+			t->phead = 0;
+		} else {
+			t->capa = t->capa ? t->capa * 2 : 16;
+			REALLOC_N(t->pending, struct tree_pending, t->capa);
+		}
+	}
+	t->pending[t->npending].parent = parent;
+	t->pending[t->npending].umask = umask;
+	t->pending[t->npending++].name = name;
+}
+
+struct detach_args {
+	int parent;
+	const char *name;
+	size_t len;
+};
+
+static int detach_i(st_data_t key, st_data_t val, st_data_t arg)
+{
+	struct tree_node *node = (struct tree_node *)val;
+	struct detach_args *a = (struct detach_args *)arg;
+
+	if (node->parent == a->parent && node->len == a->len &&
+	    memcmp(node->name, a->name, a->len) == 0) {
+		node->parent = TREE_DETACHED;
+		return ST_STOP;
+	}
+	return ST_CONTINUE;
+}
+
+/*
+ * a subdirectory was moved away, its IN_MOVED_TO may put it back into
+ * the tree under a new name; if not, Tree#take will remove its watches
+ */
+static void tree_detach(struct tree *t, int parent, const char *name)
+{
+	struct detach_args a;
+
+	a.parent = parent;
+	a.name = name;
+	a.len = strlen(name);
+	st_foreach(t->nodes, detach_i, (st_data_t)&a);
+	t->dirty = 1;
+}
+
+/* decodes events for Inotify::Tree, see rb_sp_inotify_take */
+static VALUE tree_event(VALUE self, const struct inotify_event *e)
+{
+	struct tree *t = tree_get(self);
+	struct tree_node *node = tree_lookup(t, e->wd);
+	uint32_t umask = node ? node->umask : 0;
+	VALUE name, rv;
+
+	/* e->name is zero-padded, see event_new in inotify.c */
+	name = e->len ? rb_str_new2(e->name) : Qnil;
+	if (node && (e->mask & IN_ISDIR) && e->len) {
+		if (e->mask & (IN_CREATE|IN_MOVED_TO))
+			tree_pend(t, e->wd, umask, name);
+		else if (e->mask & IN_MOVED_FROM)
+			tree_detach(t, e->wd, e->name);
+	}
+	if (node && node->snap && e->len) {
+		if (e->mask & (IN_CREATE|IN_MOVED_TO))
+			snap_add(node->snap, e->name, e->mask & IN_ISDIR);
+		else if (e->mask & (IN_DELETE|IN_MOVED_FROM))
+			snap_del(node->snap, e->name);
+	}
+	if (node && (e->mask & IN_IGNORED)) {
+		st_data_t key = (st_data_t)e->wd;
+
+		st_delete(t->nodes, &key, NULL);
+		node_release(node);
+	}
+	if ((e->mask & IN_Q_OVERFLOW) && t->snapshot)
+		t->overflow = 1;
+	if (!(e->mask & umask & IN_ALL_EVENTS) && !(e->mask & TREE_SPECIAL))
+		return Qundef;
+
+	rv = rb_struct_new(cTreeEvent, INT2NUM(e->wd), UINT2NUM(e->mask),
+			   UINT2NUM(e->cookie), name);
+	rb_ivar_set(rv, id_tree, self);
+	return rv;
+}
+
+struct orphan_args {
+	VALUE self;
+	struct tree *t;
+	long nr;
+	long capa;
+	int *wds;
+};
+
+static int orphan_p(struct tree *t, struct tree_node *node)
+{
+	while (node->parent != TREE_ROOT) {
+		if (node->parent == TREE_DETACHED)
+			return 1;
+		node = tree_lookup(t, node->parent);
+		if (!node)
+			return 1;
+	}
+	return 0;
+}
+
+static int orphan_i(st_data_t key, st_data_t val, st_data_t arg)
+{
+	struct orphan_args *a = (struct orphan_args *)arg;
+
+	if (!orphan_p(a->t, (struct tree_node *)val))
+		return ST_CONTINUE;
+	if (a->nr == a->capa) {
+		a->capa = a->capa ? a->capa * 2 : 64;
+		REALLOC_N(a->wds, int, a->capa);
+	}
+	a->wds[a->nr++] = (int)key;
+	return ST_CONTINUE;
+}
+
+static VALUE orphan_rm(VALUE p)
+{
+	struct orphan_args *a = (struct orphan_args *)p;
+	long i;
+	int fd = rb_sp_fileno(a->self);
+
+	st_foreach(a->t->nodes, orphan_i, (st_data_t)a);
+	for (i = 0; i < a->nr; i++) {
+		st_data_t key = (st_data_t)a->wds[i];
+		st_data_t val;
+
+		if (st_delete(a->t->nodes, &key, &val))
+			node_release((struct tree_node *)val);
+		inotify_rm_watch(fd, a->wds[i]); /* EINVAL if already gone */
+	}
+	return Qnil;
+}
+
+static VALUE orphan_ensure(VALUE p)
+{
+	struct orphan_args *a = (struct orphan_args *)p;
+
+	xfree(a->wds);
+	return Qnil;
+}
+
+/*
+ * removes watches of directories which left the tree, their
+ * IN_IGNORED events will have no path
+ */
+static void tree_prune(VALUE self, struct tree *t)
+{
+	struct orphan_args a;
+
+	t->dirty = 0;
+	a.self = self;
+	a.t = t;
+	a.nr = a.capa = 0;
+	a.wds = NULL;
+	rb_ensure(orphan_rm, (VALUE)&a, orphan_ensure, (VALUE)&a);
+}
+
+/* watches new subdirectories seen by tree_event */
+static void tree_flush(VALUE self, struct tree *t)
+{
+	while (t->phead < t->npending) {
+		struct tree_pending p = t->pending[t->phead++];
+		VALUE path;
+
+		if (t->phead == t->npending)
+			t->phead = t->npending = 0;
+		path = tree_path(t, p.parent, RSTRING_PTR(p.name));
+		if (!NIL_P(path))
+			tree_walk(self, t, path, p.parent, p.name, p.umask);
+		RB_GC_GUARD(p.name);
+	}
+	if (t->dirty)
+		tree_prune(self, t);
+}
+
+struct rescan_job {
+	int wd;
+	int gone; /* removed or replaced, or no longer a directory */
+	char *path;
+	uint64_t ino;
+	struct timespec mtime;
+	struct tree_snap *snap; /* new listing if changed */
+};
+
+struct rescan {
+	VALUE self;
+	struct tree *t;
+	VALUE events;
+	long nr;
+	long capa;
+	long pos;
+	struct rescan_job *jobs;
+	char *buf;
+	int cancel;
+	int err;
+	const char *errfn;
+};
+
+static int rescan_i(st_data_t key, st_data_t val, st_data_t arg)
+{
+	struct rescan *r = (struct rescan *)arg;
+	struct tree_node *node = (struct tree_node *)val;
+	struct rescan_job *job;
+	long len;
+
+	if (!node->snap)
+		return ST_CONTINUE;
+	len = path_len(r->t, (int)key, NULL);
+	if (len < 0)
+		return ST_CONTINUE;
+	if (r->nr == r->capa) {
+		r->capa = r->capa ? r->capa * 2 : 64;
+		REALLOC_N(r->jobs, struct rescan_job, r->capa);
+	}
+	job = &r->jobs[r->nr];
+	job->path = ALLOC_N(char, len + 1);
+	path_fill(r->t, (int)key, NULL, job->path, len);
+	job->path[len] = 0;
+	job->wd = (int)key;
+	job->gone = 0;
+	job->ino = node->snap->ino;
+	job->mtime = node->snap->mtime;
+	job->snap = NULL;
+	r->nr++;
+	return ST_CONTINUE;
+}
+
+static int rescan_fail(struct rescan *r, const char *fn)
+{
+	r->err = errno;
+	r->errfn = fn;
+	return -1;
+}
+
+/* lists the directory of +job+ if it changed since its snapshot */
+static int rescan_job(struct rescan *r, struct rescan_job *job)
+{
+	struct stat sb;
+	struct tree_snap *snap;
+	int fd;
+
+	if (lstat(job->path, &sb) < 0) {
+		if (errno == ENOENT || errno == ENOTDIR)
+			job->gone = 1;
+		return 0; /* unreadable, leave it alone */
+	}
+	if (!S_ISDIR(sb.st_mode) || (uint64_t)sb.st_ino != job->ino) {
+		job->gone = 1;
+		return 0;
+	}
+	if (sb.st_mtim.tv_sec == job->mtime.tv_sec &&
+	    sb.st_mtim.tv_nsec == job->mtime.tv_nsec)
+		return 0;
+
+	fd = open(job->path, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	if (fd < 0) {
+		if (errno == ENOENT || errno == ENOTDIR || errno == ELOOP)
+			job->gone = 1;
+		return walk_skippable(errno) ? 0 : rescan_fail(r, "open");
+	}
+	snap = snap_start(fd);
+	if (!snap) {
+		close(fd);
+		return rescan_fail(r, "fstat");
+	}
+	for (;;) {
+		long n = syscall(SYS_getdents64, fd, r->buf, TREE_DENTS);
+		long pos;
+
+		if (n == 0)
+			break;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			snap_free(snap);
+			close(fd);
+			if (walk_skippable(errno))
+				return 0;
+			return rescan_fail(r, "getdents64");
+		}
+		for (pos = 0; pos < n; ) {
+			struct tree_dirent64 *d = (void *)(r->buf + pos);
+			int type = dent_type(fd, d);
+
+			pos += d->d_reclen;
+			if (type >= 0 && snap_push(snap, d->d_name, d->d_ino,
+						   (unsigned char)type) < 0) {
+				snap_free(snap);
+				close(fd);
+				return rescan_fail(r, "malloc");
+			}
+		}
+	}
+	close(fd);
+	snap_sort(snap);
+	job->snap = snap;
+	return 0;
+}
+
+static void *nogvl_rescan(void *ptr)
+{
+	struct rescan *r = ptr;
+
+	while (r->pos < r->nr && !r->cancel) {
+		if (rescan_job(r, &r->jobs[r->pos]) < 0)
+			break;
+		r->pos++;
+	}
+	return NULL;
+}
+
+static void rescan_ubf(void *ptr)
+{
+	struct rescan *r = ptr;
+
+	r->cancel = 1;
+}
+
+static void
+rescan_emit(struct rescan *r, struct tree_node *node, int wd, uint32_t mask,
+		const struct snap_ent *ent)
+{
+	VALUE name;
+	VALUE event;
+
+	if (ent->type == DT_DIR)
+		mask |= IN_ISDIR;
+	if (!(mask & node->umask & IN_ALL_EVENTS))
+		return;
+	name = rb_str_new(ent->name, ent->len);
+	event = rb_struct_new(cTreeEvent, INT2NUM(wd), UINT2NUM(mask),
+			      INT2FIX(0), name);
+	rb_ivar_set(event, id_tree, r->self);
+	rb_ary_push(r->events, event);
+}
+
+static void
+rescan_created(struct rescan *r, struct tree_node *node, int wd,
+		const struct snap_ent *ent)
+{
+	rescan_emit(r, node, wd, IN_CREATE, ent);
+	if (ent->type == DT_DIR)
+		tree_pend(r->t, wd, node->umask,
+			  rb_str_new(ent->name, ent->len));
+}
+
+/* merges the sorted old and new listings into synthetic events */
+static void
+rescan_diff(struct rescan *r, struct tree_node *node, int wd,
+		const struct tree_snap *old, const struct tree_snap *cur)
+{
+	long i = 0, j = 0;
+
+	while (i < old->nr || j < cur->nr) {
+		const struct snap_ent *a = i < old->nr ? old->ents[i] : NULL;
+		const struct snap_ent *b = j < cur->nr ? cur->ents[j] : NULL;
+		int cmp = !a ? 1 : !b ? -1 : strcmp(a->name, b->name);
+
+		if (cmp < 0) {
+			rescan_emit(r, node, wd, IN_DELETE, a);
+			i++;
+		} else if (cmp > 0) {
+			rescan_created(r, node, wd, b);
+			j++;
+		} else {
+			/* inode 0 means we only know the name from an event */
+			if (a->ino && a->ino != b->ino) {
+				if (a->type == DT_DIR || b->type == DT_DIR) {
+					rescan_emit(r, node, wd, IN_DELETE, a);
+					rescan_created(r, node, wd, b);
+				} else {
+					rescan_emit(r, node, wd, IN_MODIFY, b);
+				}
+			}
+			i++;
+			j++;
+		}
+	}
+}
+
+static VALUE rescan_run(VALUE p)
+{
+	struct rescan *r = (struct rescan *)p;
+	long i;
+
+	st_foreach(r->t->nodes, rescan_i, (st_data_t)r);
+	r->buf = ALLOC_N(char, TREE_DENTS);
+	for (;;) {
+		WITHOUT_GVL(nogvl_rescan, r, rescan_ubf, r);
+		if (r->err) {
+			errno = r->err;
+			rb_sys_fail(r->errfn);
+		}
+		if (r->pos == r->nr)
+			break;
+		r->cancel = 0;
+		rb_thread_check_ints();
+	}
+
+	for (i = 0; i < r->nr; i++) {
+		struct rescan_job *job = &r->jobs[i];
+		struct tree_node *node = tree_lookup(r->t, job->wd);
+
+		if (!node || !node->snap)
+			continue;
+		if (job->gone) {
+			node->parent = TREE_DETACHED;
+			r->t->dirty = 1;
+		} else if (job->snap) {
+			rescan_diff(r, node, job->wd, node->snap, job->snap);
+			snap_free(node->snap);
+			node->snap = job->snap;
+			job->snap = NULL;
+		}
+	}
+
+	/* watch directories which appeared, drop those which are gone */
+	tree_flush(r->self, r->t);
+	return r->events;
+}
+
+static VALUE rescan_ensure(VALUE p)
+{
+	struct rescan *r = (struct rescan *)p;
+	long i;
+
+	for (i = 0; i < r->nr; i++) {
+		if (r->jobs[i].snap)
+			snap_free(r->jobs[i].snap);
+		xfree(r->jobs[i].path);
+	}
+	xfree(r->jobs);
+	xfree(r->buf);
+	return Qnil;
+}
+
+static VALUE tree_rescan(VALUE self, struct tree *t)
+{
+	struct rescan r;
+
+	memset(&r, 0, sizeof(r));
+	r.self = self;
+	r.t = t;
+	r.events = rb_ary_new();
+	t->overflow = 0;
+
+	return rb_ensure(rescan_run, (VALUE)&r, rescan_ensure, (VALUE)&r);
+}
+
+/*
+ * call-seq:
+ *	tree.rescan -> [ Inotify::Tree::Event, ... ]
+ *
+ * Resynchronizes with the filesystem after events were lost, which
+ * Tree#take and Tree#take_all do automatically after IN_Q_OVERFLOW.
+ * Requires Tree#snapshot= to be enabled before Tree#add_tree.
+ *
+ * Every watched directory is checked with lstat(2) without holding
+ * the GVL, and only those whose mtime or inode changed are listed
+ * again.  The listing is compared with the snapshot to return
+ * synthetic IN_CREATE, IN_DELETE (both with IN_ISDIR for
+ * directories) and IN_MODIFY events, filtered by the flags given to
+ * Tree#add_tree.  IN_MODIFY means a file was replaced by another inode
+ * under the same name; changes to file contents are not detected.
+ *
+ * New directories are watched and directories which disappeared are
+ * unwatched, but no events are generated for entries inside new
+ * directories.  Changes already reported by events read after the
+ * overflow may be reported again.
+ */
+static VALUE tree_rescan_m(VALUE self)
+{
+	return tree_rescan(self, tree_get(self));
+}
+
+static int snap_drop_i(st_data_t key, st_data_t val, st_data_t arg)
+{
+	struct tree_node *node = (struct tree_node *)val;
+
+	if (node->snap) {
+		snap_free(node->snap);
+		node->snap = NULL;
+	}
+	return ST_CONTINUE;
+}
+
+/*
+ * call-seq:
+ *	tree.snapshot = true or false
+ *
+ * Enables keeping a snapshot of the entries of every directory walked
+ * by Tree#add_tree afterwards, needed by Tree#rescan.  Snapshots are
+ * kept current with IN_CREATE, IN_DELETE and IN_MOVED_* events, which
+ * are watched internally regardless of the flags given.  Each entry
+ * costs roughly 40 bytes plus its name.
+ *
+ * Disabling discards all snapshots.
+ */
+static VALUE tree_snapshot_set(VALUE self, VALUE val)
+{
+	struct tree *t = tree_get(self);
+
+	t->snapshot = RTEST(val);
+	if (!t->snapshot)
+		st_foreach(t->nodes, snap_drop_i, 0);
+	return val;
+}
+
+/*
+ * call-seq:
+ *	tree.snapshot? -> true or false
+ *
+ * Returns whether directory snapshots are kept, see Tree#snapshot=.
+ */
+static VALUE tree_snapshot_p(VALUE self)
+{
+	return tree_get(self)->snapshot ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *	tree.take([nonblock]) -> Inotify::Tree::Event or nil
+ *
+ * Returns the next Inotify::Tree::Event for any directory in the tree,
+ * see Inotify#take.  Only events matching the +flags+ given to
+ * Tree#add_tree are returned, along with IN_IGNORED, IN_UNMOUNT and
+ * IN_Q_OVERFLOW.
+ */
+static VALUE tree_take(int argc, VALUE *argv, VALUE self)
+{
+	struct tree *t = tree_get(self);
+	VALUE rv;
+
+	tree_flush(self, t); /* in case it raised last time */
+	rv = rb_sp_inotify_take(self, argc, argv, 0, tree_event, self);
+	tree_flush(self, t);
+	if (t->overflow) /* returned after leftovers from this read */
+		rb_ary_concat(rb_ivar_get(self, id_inotify_tmp),
+			      tree_rescan(self, t));
+
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	tree.take_all([nonblock]) -> [ Inotify::Tree::Event, ... ] or nil
+ *
+ * Returns every Inotify::Tree::Event decoded from a single read(2),
+ * see Inotify#take_all and Tree#take.
+ */
+static VALUE tree_take_all(int argc, VALUE *argv, VALUE self)
+{
+	struct tree *t = tree_get(self);
+	VALUE rv;
+
+	tree_flush(self, t);
+	rv = rb_sp_inotify_take(self, argc, argv, 1, tree_event, self);
+	tree_flush(self, t);
+	if (t->overflow) {
+		VALUE synthetic = tree_rescan(self, t);
+
+		rv = NIL_P(rv) ? synthetic : rb_ary_concat(rv, synthetic);
+	}
+
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	tree.each { |event| ... } -> tree
+ *
+ * Yields each Inotify::Tree::Event received in a blocking fashion.
+ */
+static VALUE tree_each(VALUE self)
+{
+	VALUE argv = Qfalse;
+
+	while (1)
+		rb_yield(tree_take(0, &argv, self));
+
+	return self;
+}
+
+/*
+ * call-seq:
+ *	tree.each_batch { |events| ... } -> tree
+ *
+ * Yields an Array of Inotify::Tree::Event objects for each read(2)
+ * in a blocking fashion.
+ */
+static VALUE tree_each_batch(VALUE self)
+{
+	VALUE argv = Qfalse;
+
+	while (1)
+		rb_yield(tree_take_all(0, &argv, self));
+
+	return self;
+}
+
+/*
+ * call-seq:
+ *	tree.path(wd[, name]) -> String or nil
+ *
+ * Returns the full path of the directory watched by +wd+, with
+ * +name+ appended if given.  Returns +nil+ if +wd+ is not watched by
+ * this tree (anymore).
+ */
+static VALUE tree_path_m(int argc, VALUE *argv, VALUE self)
+{
+	VALUE wd, name;
+
+	rb_scan_args(argc, argv, "11", &wd, &name);
+
+	return tree_path(tree_get(self), NUM2INT(wd),
+			 NIL_P(name) ? NULL : StringValueCStr(name));
+}
+
+/*
+ * call-seq:
+ *	tree.watches -> Integer
+ *
+ * Returns the number of directories watched.
+ */
+static VALUE tree_watches(VALUE self)
+{
+	return LONG2NUM((long)tree_get(self)->nodes->num_entries);
+}
+
+/*
+ * call-seq:
+ *	tree.rm_watch(wd) -> 0
+ *
+ * Removes the watch on the directory +wd+ and every directory below it.
+ */
+static VALUE tree_rm_watch(VALUE self, VALUE vwd)
+{
+	struct tree *t = tree_get(self);
+	int wd = NUM2INT(vwd);
+	struct tree_node *node = tree_lookup(t, wd);
+
+	if (!node) {
+		errno = EINVAL;
+		rb_sys_fail("inotify_rm_watch");
+	}
+	node->parent = TREE_DETACHED;
+	tree_prune(self, t);
+
+	return INT2FIX(0);
+}
+
+/*
+ * call-seq:
+ *	event.path -> String or nil
+ *
+ * Returns the full path of the file or directory this event is
+ * about.  The path is built from the current state of the tree when
+ * this method is called, so it reflects renames of parent directories
+ * processed since the event was read.  Returns +nil+ if the watched
+ * directory is no longer in the tree, or for IN_Q_OVERFLOW.
+ */
+static VALUE event_path(VALUE self)
+{
+	VALUE tree = rb_ivar_get(self, id_tree);
+	VALUE name = rb_struct_aref(self, INT2FIX(3));
+
+	if (NIL_P(tree))
+		return Qnil;
+	return tree_path(tree_get(tree), NUM2INT(rb_struct_aref(self,
+				INT2FIX(0))),
+			 NIL_P(name) ? NULL : RSTRING_PTR(name));
+}
+
+void sleepy_penguin_init_inotify_tree(void)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+	VALUE cInotify = rb_const_get(mSleepyPenguin, rb_intern("Inotify"));
+	VALUE cTree;
+
+	/*
+	 * Document-class: SleepyPenguin::Inotify::Tree
+	 *
+	 * An Inotify object which watches entire directory trees.  It
+	 * keeps a compact table mapping each watch descriptor to its
+	 * parent directory and name, adds watches to new subdirectories
+	 * automatically, and returns Inotify::Tree::Event objects which
+	 * know their full path.
+	 *
+	 *	tree = SleepyPenguin::Inotify::Tree.new
+	 *	tree.add_tree("/path/to/src", [ :CLOSE_WRITE, :MOVED_TO ])
+	 *	tree.each do |event|
+	 *	  p event.path
+	 *	end
+	 *
+	 * Files created inside a new subdirectory before it is watched
+	 * generate no events.  A watch is needed for every directory, so
+	 * the fs.inotify.max_user_watches sysctl may need raising.
+	 *
+	 * With Tree#snapshot= enabled, IN_Q_OVERFLOW no longer requires
+	 * rescanning the whole tree: it is followed by the synthetic
+	 * events from Tree#rescan.  Raising Inotify#buffer_size and the
+	 * fs.inotify.max_queued_events sysctl makes overflows less likely.
+	 */
+	cTree = rb_define_class_under(cInotify, "Tree", cInotify);
+	rb_define_method(cTree, "add_tree", add_tree, 2);
+	rb_define_method(cTree, "take", tree_take, -1);
+	rb_define_method(cTree, "take_all", tree_take_all, -1);
+	rb_define_method(cTree, "each", tree_each, 0);
+	rb_define_method(cTree, "each_batch", tree_each_batch, 0);
+	rb_define_method(cTree, "path", tree_path_m, -1);
+	rb_define_method(cTree, "watches", tree_watches, 0);
+	rb_define_method(cTree, "rm_watch", tree_rm_watch, 1);
+	rb_define_method(cTree, "rescan", tree_rescan_m, 0);
+	rb_define_method(cTree, "snapshot=", tree_snapshot_set, 1);
+	rb_define_method(cTree, "snapshot?", tree_snapshot_p, 0);
+	rb_undef_method(cTree, "add_watch");
+	rb_undef_method(cTree, "take_batch");
+
+	/*
+	 * Document-class: SleepyPenguin::Inotify::Tree::Event
+	 *
+	 * An Inotify::Event returned by Inotify::Tree, which also
+	 * responds to Event#path
+	 */
+	cTreeEvent = rb_const_get(cInotify, rb_intern("Event"));
+	cTreeEvent = rb_define_class_under(cTree, "Event", cTreeEvent);
+	rb_define_method(cTreeEvent, "path", event_path, 0);
+
+	id_tree = rb_intern("@tree");
+	id_ivar_tree = rb_intern("@__sp_tree");
+	id_inotify_tmp = rb_intern("@inotify_tmp");
+}
+#endif /* HAVE_SYS_INOTIFY_H */
@@ -0,0 +1,163 @@
+#include "sleepy_penguin.h"
+#ifdef HAVE_LINUX_TLS_H
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#include <string.h>
+
+#ifndef SOL_TLS
+#  define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#  define TCP_ULP 31
+#endif
+
+static VALUE sym_cipher, sym_version, sym_key, sym_iv, sym_salt, sym_rec_seq;
+
+union ktls_crypto_info {
+	struct tls_crypto_info info;
+	struct tls12_crypto_info_aes_gcm_128 aes_gcm_128;
+#ifdef TLS_CIPHER_AES_GCM_256
+	struct tls12_crypto_info_aes_gcm_256 aes_gcm_256;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	struct tls12_crypto_info_chacha20_poly1305 chacha20_poly1305;
+#endif
+};
+
+/* copies the String in +params+[+sym+], which must be exactly +len+ bytes */
+static void
+ktls_fill(unsigned char *dst, size_t len, VALUE params, VALUE sym)
+{
+	VALUE str = rb_hash_aref(params, sym);
+
+	if (len == 0 && NIL_P(str))
+		return;
+	if (NIL_P(str))
+		rb_raise(rb_eArgError, "%"PRIsVALUE" missing", sym);
+	StringValue(str);
+	if ((size_t)RSTRING_LEN(str) != len)
+		rb_raise(rb_eArgError,
+			"%"PRIsVALUE" must be %lu bytes (got %ld)",
+			sym, (unsigned long)len, RSTRING_LEN(str));
+	memcpy(dst, RSTRING_PTR(str), len);
+}
+
+#define FILL(ci,params) do { \
+	ktls_fill((ci).key, sizeof((ci).key), (params), sym_key); \
+	ktls_fill((ci).iv, sizeof((ci).iv), (params), sym_iv); \
+	ktls_fill((ci).rec_seq, sizeof((ci).rec_seq), (params), sym_rec_seq); \
+} while (0)
+
+static socklen_t
+ktls_pack(union ktls_crypto_info *ci, unsigned cipher, VALUE params)
+{
+	switch (cipher) {
+	case TLS_CIPHER_AES_GCM_128:
+		FILL(ci->aes_gcm_128, params);
+		ktls_fill(ci->aes_gcm_128.salt, sizeof(ci->aes_gcm_128.salt),
+			  params, sym_salt);
+		return sizeof(ci->aes_gcm_128);
+#ifdef TLS_CIPHER_AES_GCM_256
+	case TLS_CIPHER_AES_GCM_256:
+		FILL(ci->aes_gcm_256, params);
+		ktls_fill(ci->aes_gcm_256.salt, sizeof(ci->aes_gcm_256.salt),
+			  params, sym_salt);
+		return sizeof(ci->aes_gcm_256);
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case TLS_CIPHER_CHACHA20_POLY1305:
+		FILL(ci->chacha20_poly1305, params);
+		ktls_fill(ci->chacha20_poly1305.salt,
+			  sizeof(ci->chacha20_poly1305.salt), params, sym_salt);
+		return sizeof(ci->chacha20_poly1305);
+#endif
+	}
+	rb_raise(rb_eArgError, "unsupported cipher: %u", cipher);
+	return 0;
+}
+
+/* :nodoc: */
+static VALUE ktls_ulp(VALUE mod, VALUE io)
+{
+	static const char ulp[] = "tls";
+	int fd = rb_sp_fileno(io);
+
+	/* EEXIST: the ULP is already attached, that's fine */
+	if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, ulp, sizeof(ulp) - 1) < 0 &&
+	    errno != EEXIST)
+		rb_sys_fail("setsockopt(TCP_ULP, \"tls\")");
+
+	return Qnil;
+}
+
+/* :nodoc: */
+static VALUE ktls_set(VALUE mod, VALUE io, VALUE dir, VALUE params)
+{
+	union ktls_crypto_info ci;
+	socklen_t len;
+	int fd;
+
+	Check_Type(params, T_HASH);
+	memset(&ci, 0, sizeof(ci));
+	ci.info.version = NUM2USHORT(rb_hash_aref(params, sym_version));
+	ci.info.cipher_type = NUM2USHORT(rb_hash_aref(params, sym_cipher));
+	len = ktls_pack(&ci, ci.info.cipher_type, params);
+
+	fd = rb_sp_fileno(io);
+	if (setsockopt(fd, SOL_TLS, NUM2INT(dir), &ci, len) < 0)
+		rb_sys_fail("setsockopt(SOL_TLS)");
+
+	return Qnil;
+}
+
+void sleepy_penguin_init_ktls(void)
+{
+	VALUE mod = rb_define_module("SleepyPenguin");
+
+	/*
+	 * Document-module: SleepyPenguin::KTLS
+	 *
+	 * Constants used by SleepyPenguin.ktls_enable
+	 */
+	VALUE mKTLS = rb_define_module_under(mod, "KTLS");
+
+	rb_define_singleton_method(mod, "__ktls_ulp", ktls_ulp, 1);
+	rb_define_singleton_method(mod, "__ktls_set", ktls_set, 3);
+
+	/* for the transmit direction */
+	rb_define_const(mKTLS, "TX", INT2NUM(TLS_TX));
+
+	/* for the receive direction */
+	rb_define_const(mKTLS, "RX", INT2NUM(TLS_RX));
+
+	/* TLS 1.2 record protocol version */
+	rb_define_const(mKTLS, "TLS_1_2", UINT2NUM(TLS_1_2_VERSION));
+#ifdef TLS_1_3_VERSION
+	/* TLS 1.3 record protocol version (Linux 5.1+) */
+	rb_define_const(mKTLS, "TLS_1_3", UINT2NUM(TLS_1_3_VERSION));
+#endif
+
+	/* 16-byte key, 8-byte iv, 4-byte salt, 8-byte rec_seq */
+	rb_define_const(mKTLS, "AES_GCM_128",
+			UINT2NUM(TLS_CIPHER_AES_GCM_128));
+#ifdef TLS_CIPHER_AES_GCM_256
+	/* 32-byte key, 8-byte iv, 4-byte salt, 8-byte rec_seq (Linux 5.1+) */
+	rb_define_const(mKTLS, "AES_GCM_256",
+			UINT2NUM(TLS_CIPHER_AES_GCM_256));
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	/* 32-byte key, 12-byte iv, 8-byte rec_seq, no salt (Linux 5.11+) */
+	rb_define_const(mKTLS, "CHACHA20_POLY1305",
+			UINT2NUM(TLS_CIPHER_CHACHA20_POLY1305));
+#endif
+
+	sym_cipher = ID2SYM(rb_intern("cipher"));
+	sym_version = ID2SYM(rb_intern("version"));
+	sym_key = ID2SYM(rb_intern("key"));
+	sym_iv = ID2SYM(rb_intern("iv"));
+	sym_salt = ID2SYM(rb_intern("salt"));
+	sym_rec_seq = ID2SYM(rb_intern("rec_seq"));
+}
+#endif /* HAVE_LINUX_TLS_H */
@@ -95,6 +95,7 @@ again:
 	a.src_fd = rb_sp_fileno(src);
 	a.dst_fd = rb_sp_fileno(dst);
 	bytes = (ssize_t)rb_sp_fd_region(nogvl_sf, &a, a.dst_fd);
+	rb_sp_stat_result(RB_SP_STAT_SENDFILE, bytes);
 	if (bytes < 0) {
 		switch (errno) {
 		case EAGAIN:
@@ -104,6 +105,7 @@ again:
 			if (!retried) {
 				rb_gc();
 				retried = 1;
+				rb_sp_stat(RB_SP_STAT_SENDFILE)->fallback++;
 				goto again;
 			}
 		}
@@ -66,6 +66,48 @@ VALUE rb_sp_puttlsbuf(VALUE);
 
 int rb_sp_gc_for_fd(int err);
 
+enum rb_sp_stat_op {
+	RB_SP_STAT_SPLICE,
+	RB_SP_STAT_TEE,
+	RB_SP_STAT_SENDFILE,
+	RB_SP_STAT_CFR,
+	RB_SP_STAT_MAX
+};
+
+struct rb_sp_stat {
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t eagain;
+	uint64_t eintr;
+	uint64_t fallback;
+};
+
+struct rb_sp_stat *rb_sp_stat(enum rb_sp_stat_op);
+void rb_sp_stat_result(enum rb_sp_stat_op, ssize_t);
+
+#if defined(__linux__) && defined(HAVE_LINUX_ERRQUEUE_H)
+long rb_sp_zerocopy_reap(VALUE io);
+#else
+#  define rb_sp_zerocopy_reap(io) (0L)
+#endif
+
+#ifdef HAVE_SYS_INOTIFY_H
+struct inotify_event;
+typedef VALUE rb_sp_inotify_fn(VALUE arg, const struct inotify_event *);
+VALUE rb_sp_inotify_take(VALUE self, int argc, VALUE *argv, int all_p,
+			rb_sp_inotify_fn *fn, VALUE arg);
+VALUE rb_sp_inotify_leftovers(VALUE self, int all_p);
+long rb_sp_file_cache_shed(void);
+#  ifdef HAVE_SYS_TIMERFD_H
+VALUE rb_sp_inotify_coalesce_take(VALUE self, int argc, VALUE *argv,
+				int all_p);
+#  else
+#    define rb_sp_inotify_coalesce_take(self,argc,argv,all_p) (Qundef)
+#  endif
+#else
+#  define rb_sp_file_cache_shed() (0L)
+#endif
+
 #ifndef HAVE_COPY_FILE_RANGE
 #  include <sys/syscall.h>
 #  if !defined(__NR_copy_file_range) && defined(__linux__)
@@ -31,3 +31,17 @@ struct copy_args {
 	size_t len;
 	unsigned flags;
 };
+
+#if !defined(HAVE_COPY_FILE_RANGE) && defined(__NR_copy_file_range)
+static inline ssize_t
+my_cfr(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+	size_t len, unsigned int flags)
+{
+	long n = syscall(__NR_copy_file_range,
+			fd_in, off_in, fd_out, off_out, len, flags);
+
+	return (ssize_t)n;
+}
+#  define copy_file_range(fd_in,off_in,fd_out,off_out,len,flags) \
+		my_cfr((fd_in),(off_in),(fd_out),(off_out),(len),(flags))
+#endif
@@ -0,0 +1,74 @@
+/*
+ * eventfd doorbells which are only rung when the other side sleeps,
+ * shared by event_queue.c, eventfd.c and memfd.c
+ *
+ * A waiter sets the +sleeping+ word (which may be in memory shared with
+ * other processes) before it waits on the eventfd and rechecks whatever
+ * it waits for, while the other side publishes its change before
+ * checking +sleeping+.  Only the side which clears +sleeping+ writes to
+ * the eventfd, so a busy waiter costs its peers no syscalls.
+ */
+#ifndef SP_DOORBELL_H
+#define SP_DOORBELL_H
+
+/* waiter-local state, a doorbell has one waiter */
+struct sp_bell {
+	uint64_t tokens; /* eventfd writes not yet read */
+	int armed;
+};
+
+static inline void sp_bell_write(int fd)
+{
+	uint64_t one = 1;
+
+	/* EAGAIN: the counter is about to overflow, the waiter will wake */
+	if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		rb_sys_fail("write(eventfd)");
+}
+
+/*
+ * called after publishing a change, wakes the waiter if it sleeps,
+ * returns non-zero if this wrote to the eventfd
+ */
+static inline int sp_bell_ring(uint32_t *sleeping, int fd)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(sleeping, __ATOMIC_RELAXED) ||
+	    !__atomic_exchange_n(sleeping, 0, __ATOMIC_SEQ_CST))
+		return 0;
+	sp_bell_write(fd);
+	return 1;
+}
+
+/*
+ * announces the waiter is about to sleep, the caller must recheck
+ * before waiting on the eventfd (and call sp_bell_disarm if it won't)
+ */
+static inline void sp_bell_arm(struct sp_bell *b, uint32_t *sleeping)
+{
+	b->armed = 1;
+	__atomic_store_n(sleeping, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* stops announcing sleep and drains eventfd writes */
+static inline void
+sp_bell_disarm(struct sp_bell *b, uint32_t *sleeping, int fd)
+{
+	uint64_t n;
+
+	b->armed = 0;
+	if (__atomic_exchange_n(sleeping, 0, __ATOMIC_SEQ_CST) == 0)
+		b->tokens++; /* the other side rang, or is about to */
+	if (b->tokens && read(fd, &n, sizeof(n)) == (ssize_t)sizeof(n))
+		b->tokens = n >= b->tokens ? 0 : b->tokens - n;
+}
+
+/* rings while armed, for a change the other side may have missed */
+static inline void sp_bell_self_ring(struct sp_bell *b, int fd)
+{
+	sp_bell_write(fd);
+	b->tokens++;
+}
+
+#endif /* SP_DOORBELL_H */
@@ -52,6 +52,7 @@ static VALUE my_splice(VALUE mod, VALUE io_in, VALUE off_in,
 		a.fd_in = check_fileno(io_in);
 		a.fd_out = check_fileno(io_out);
 		bytes = (ssize_t)IO_RUN(nogvl_splice, &a);
+		rb_sp_stat_result(RB_SP_STAT_SPLICE, bytes);
 		if (bytes == 0) return Qnil;
 		if (bytes < 0) {
 			switch (errno) {
@@ -93,6 +94,7 @@ static VALUE my_tee(VALUE mod, VALUE io_in, VALUE io_out,
 		a.fd_in = check_fileno(io_in);
 		a.fd_out = check_fileno(io_out);
 		bytes = (ssize_t)IO_RUN(nogvl_tee, &a);
+		rb_sp_stat_result(RB_SP_STAT_TEE, bytes);
 		if (bytes == 0) return Qnil;
 		if (bytes < 0) {
 			switch (errno) {
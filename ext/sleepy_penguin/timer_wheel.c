@@ -0,0 +1,564 @@
+#ifdef HAVE_SYS_TIMERFD_H
+#include "sleepy_penguin.h"
+#include <sys/timerfd.h>
+#include "value2timespec.h"
+
+/*
+ * A hierarchical timing wheel: WHEEL_LEVELS levels of WHEEL_SLOTS
+ * doubly-linked lists, where a slot of level N covers WHEEL_SLOTS**N
+ * ticks.  Timers are placed on the lowest level whose range covers
+ * them and cascade down as time advances, so insert and cancel are
+ * O(1).  Each level has a bitmap of non-empty slots to find the next
+ * tick to process (and arm the TimerFD to) without scanning lists.
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1U << WHEEL_BITS)
+#define WHEEL_MASK ((uint64_t)WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 6
+#define WHEEL_MAX (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) /* in ticks */
+
+static ID id_ivar_wheel;
+static VALUE cTimerWheel, cTimer;
+
+struct wlist {
+	struct wlist *prev;
+	struct wlist *next;
+};
+
+struct wheel {
+	uint64_t tick_ns;
+	uint64_t now; /* last tick processed */
+	uint64_t armed; /* tick the TimerFD fires at, 0 if disarmed */
+	size_t nr;
+	uint64_t bitmap[WHEEL_LEVELS];
+	struct wlist slots[WHEEL_LEVELS * WHEEL_SLOTS];
+};
+
+struct wtimer {
+	struct wlist node; /* points to itself unless pending */
+	struct wheel *wheel;
+	VALUE self;
+	VALUE wheel_io; /* the TimerWheel */
+	VALUE obj;
+	uint64_t expires; /* in ticks */
+	unsigned slot; /* level * WHEEL_SLOTS + index */
+};
+
+#define node2timer(n) \
+	((struct wtimer *)((char *)(n) - offsetof(struct wtimer, node)))
+
+static void wlist_init(struct wlist *h)
+{
+	h->prev = h->next = h;
+}
+
+static int wlist_empty(const struct wlist *h)
+{
+	return h->next == h;
+}
+
+static void wlist_add_tail(struct wlist *h, struct wlist *n)
+{
+	n->prev = h->prev;
+	n->next = h;
+	h->prev->next = n;
+	h->prev = n;
+}
+
+static void wlist_del(struct wlist *n)
+{
+	n->prev->next = n->next;
+	n->next->prev = n->prev;
+	wlist_init(n);
+}
+
+/* moves every node of +from+ to the empty +to+ */
+static void wlist_move(struct wlist *from, struct wlist *to)
+{
+	if (wlist_empty(from)) {
+		wlist_init(to);
+		return;
+	}
+	*to = *from;
+	to->next->prev = to;
+	to->prev->next = to;
+	wlist_init(from);
+}
+
+static void wheel_mark(void *ptr)
+{
+	struct wheel *w = ptr;
+	unsigned i;
+
+	for (i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) {
+		struct wlist *n;
+
+		for (n = w->slots[i].next; n != &w->slots[i]; n = n->next)
+			rb_gc_mark(node2timer(n)->self);
+	}
+}
+
+/* pending timers may outlive us if both become garbage at once */
+static void wheel_free(void *ptr)
+{
+	struct wheel *w = ptr;
+	unsigned i;
+
+	for (i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) {
+		while (!wlist_empty(&w->slots[i])) {
+			struct wlist *n = w->slots[i].next;
+
+			wlist_del(n);
+			node2timer(n)->wheel = NULL;
+		}
+	}
+	xfree(w);
+}
+
+static size_t wheel_memsize(const void *ptr)
+{
+	return sizeof(struct wheel);
+}
+
+static const rb_data_type_t wheel_type = {
+	"sleepy_penguin_timer_wheel",
+	{ wheel_mark, wheel_free, wheel_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static void wheel_unlink(struct wheel *w, struct wtimer *t)
+{
+	wlist_del(&t->node);
+	if (wlist_empty(&w->slots[t->slot]))
+		w->bitmap[t->slot / WHEEL_SLOTS] &=
+				~(1ULL << (t->slot % WHEEL_SLOTS));
+	w->nr--;
+}
+
+static void timer_mark(void *ptr)
+{
+	struct wtimer *t = ptr;
+
+	rb_gc_mark(t->wheel_io);
+	rb_gc_mark(t->obj);
+}
+
+static void timer_free(void *ptr)
+{
+	struct wtimer *t = ptr;
+
+	if (t->wheel && !wlist_empty(&t->node))
+		wheel_unlink(t->wheel, t);
+	xfree(t);
+}
+
+static size_t timer_memsize(const void *ptr)
+{
+	return sizeof(struct wtimer);
+}
+
+static const rb_data_type_t timer_type = {
+	"sleepy_penguin_timer_wheel_timer",
+	{ timer_mark, timer_free, timer_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static struct wheel *wheel_get(VALUE self)
+{
+	return rb_check_typeddata(rb_ivar_get(self, id_ivar_wheel),
+				  &wheel_type);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		rb_sys_fail("clock_gettime");
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t num2ns(VALUE num)
+{
+	struct timespec ts;
+
+	value2timespec(&ts, num);
+	if (ts.tv_sec < 0)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * places +t+ on the lowest level covering it, ticks before +min+ are
+ * treated as +min+ (the current tick while cascading, the next one for
+ * new timers)
+ */
+static void wheel_place(struct wheel *w, struct wtimer *t, uint64_t min)
+{
+	uint64_t tick = t->expires < min ? min : t->expires;
+	uint64_t delta = tick - w->now;
+	unsigned level = 0;
+	unsigned idx;
+
+	/* re-placed on every cascade until it is in range */
+	if (delta >= WHEEL_MAX) {
+		delta = WHEEL_MAX - 1;
+		tick = w->now + delta;
+	}
+	while (delta >= (1ULL << (WHEEL_BITS * (level + 1))))
+		level++;
+	idx = (unsigned)((tick >> (WHEEL_BITS * level)) & WHEEL_MASK);
+	t->slot = level * WHEEL_SLOTS + idx;
+	wlist_add_tail(&w->slots[t->slot], &t->node);
+	w->bitmap[level] |= 1ULL << idx;
+}
+
+/*
+ * returns the next tick with work: expiring a level 0 slot or cascading
+ * a higher one.  A slot at or below the current index of its level is
+ * only reached on the next revolution of that level.
+ */
+static uint64_t wheel_next(const struct wheel *w)
+{
+	uint64_t best = UINT64_MAX;
+	unsigned level;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		unsigned shift = WHEEL_BITS * level;
+		uint64_t bits = w->bitmap[level];
+		uint64_t base, cur, above, tick;
+
+		if (!bits)
+			continue;
+		base = w->now >> shift;
+		cur = base & WHEEL_MASK;
+		above = cur == WHEEL_MASK ? 0 : bits & (~0ULL << (cur + 1));
+		if (above)
+			tick = (base - cur + __builtin_ctzll(above)) << shift;
+		else
+			tick = (base - cur + WHEEL_SLOTS +
+				__builtin_ctzll(bits)) << shift;
+		if (tick < best)
+			best = tick;
+	}
+	return best;
+}
+
+static void wheel_cascade(struct wheel *w)
+{
+	unsigned level;
+
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		unsigned shift = WHEEL_BITS * level;
+		unsigned idx;
+		struct wlist tmp;
+
+		if (w->now & ((1ULL << shift) - 1))
+			break;
+		idx = (unsigned)((w->now >> shift) & WHEEL_MASK);
+		wlist_move(&w->slots[level * WHEEL_SLOTS + idx], &tmp);
+		w->bitmap[level] &= ~(1ULL << idx);
+		while (!wlist_empty(&tmp)) {
+			struct wlist *n = tmp.next;
+
+			wlist_del(n);
+			wheel_place(w, node2timer(n), w->now);
+		}
+	}
+}
+
+/* runs the wheel up to +target+, returns an Array of expired values */
+static VALUE wheel_run(struct wheel *w, uint64_t target)
+{
+	VALUE rv = Qnil;
+
+	while (w->nr > 0) {
+		uint64_t tick = wheel_next(w);
+		struct wlist *slot;
+
+		if (tick > target)
+			break;
+		w->now = tick;
+		wheel_cascade(w);
+		slot = &w->slots[tick & WHEEL_MASK];
+		while (!wlist_empty(slot)) {
+			struct wtimer *t = node2timer(slot->next);
+			VALUE obj = t->obj;
+
+			wheel_unlink(w, t);
+			if (NIL_P(rv))
+				rv = rb_ary_new();
+			rb_ary_push(rv, obj);
+		}
+	}
+	if (target > w->now)
+		w->now = target;
+
+	return rv;
+}
+
+/* arms the TimerFD for the next tick with work, if it changed */
+static void wheel_arm(VALUE self, struct wheel *w)
+{
+	uint64_t tick = w->nr > 0 ? wheel_next(w) : 0;
+	struct itimerspec its;
+
+	if (tick == w->armed)
+		return;
+	memset(&its, 0, sizeof(its));
+	if (tick) {
+		uint64_t ns = tick * w->tick_ns;
+
+		its.it_value.tv_sec = (time_t)(ns / 1000000000ULL);
+		its.it_value.tv_nsec = (long)(ns % 1000000000ULL);
+	}
+	if (timerfd_settime(rb_sp_fileno(self), TFD_TIMER_ABSTIME,
+			    &its, NULL) < 0)
+		rb_sys_fail("timerfd_settime");
+	w->armed = tick;
+}
+
+/* schedules +t+ +ns+ nanoseconds from now, never early */
+static void timer_schedule(struct wtimer *t, uint64_t ns)
+{
+	struct wheel *w = t->wheel;
+
+	t->expires = (now_ns() + ns + w->tick_ns - 1) / w->tick_ns;
+	wheel_place(w, t, w->now + 1);
+	w->nr++;
+	if (!w->armed || wheel_next(w) < w->armed)
+		wheel_arm(t->wheel_io, w);
+}
+
+/*
+ * call-seq:
+ *	wheel.add(delay[, obj]) -> TimerWheel::Timer
+ *
+ * Schedules a timer to expire in +delay+ seconds, rounded up to the
+ * tick of the wheel.  TimerWheel#expire returns +obj+ when it does, or
+ * the Timer itself if +obj+ is not given.
+ */
+static VALUE wheel_add(int argc, VALUE *argv, VALUE self)
+{
+	struct wheel *w = wheel_get(self);
+	struct wtimer *t;
+	VALUE delay, obj, rv;
+
+	rb_scan_args(argc, argv, "11", &delay, &obj);
+	rv = TypedData_Make_Struct(cTimer, struct wtimer, &timer_type, t);
+	wlist_init(&t->node);
+	t->wheel = w;
+	t->self = rv;
+	t->wheel_io = self;
+	t->obj = argc == 1 ? rv : obj;
+	timer_schedule(t, num2ns(delay));
+
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	wheel.expire([nonblock]) -> Array or nil
+ *
+ * Returns an Array of the values of every timer which expired, in the
+ * order they expired (timers expiring on the same tick are returned in
+ * the order they were added).  This blocks until at least one timer
+ * expires unless +nonblock+ is +true+, in which case +nil+ is returned
+ * if no timer expired.
+ *
+ * This is usually called when an Epoll object watching the wheel
+ * reports it readable.
+ */
+static VALUE wheel_expire(int argc, VALUE *argv, VALUE self)
+{
+	struct wheel *w = wheel_get(self);
+	VALUE nonblock, rv;
+	int fd = rb_sp_fileno(self);
+
+	rb_scan_args(argc, argv, "01", &nonblock);
+	while (1) {
+		uint64_t buf;
+		ssize_t r = read(fd, &buf, sizeof(buf));
+
+		if (r == (ssize_t)sizeof(buf))
+			w->armed = 0; /* it fired, must be armed again */
+		else if (r < 0 && errno != EAGAIN && errno != EINTR)
+			rb_sys_fail("read(timerfd)");
+		rv = wheel_run(w, now_ns() / w->tick_ns);
+		wheel_arm(self, w);
+		if (!NIL_P(rv) || RTEST(nonblock))
+			return rv;
+		errno = EAGAIN;
+		if (!rb_sp_wait(rb_io_wait_readable, self, &fd))
+			rb_sys_fail("read(timerfd)");
+	}
+}
+
+/*
+ * call-seq:
+ *	wheel.size -> Integer
+ *
+ * Returns the number of pending timers.
+ */
+static VALUE wheel_size(VALUE self)
+{
+	return SIZET2NUM(wheel_get(self)->nr);
+}
+
+/*
+ * call-seq:
+ *	wheel.tick -> Integer or Float
+ *
+ * Returns the granularity of the wheel in seconds.
+ */
+static VALUE wheel_tick(VALUE self)
+{
+	uint64_t ns = wheel_get(self)->tick_ns;
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)(ns / 1000000000ULL);
+	ts.tv_nsec = (long)(ns % 1000000000ULL);
+	return timespec2num(&ts);
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::TimerWheel.new([tick[, flags]]) -> TimerWheel
+ *
+ * Creates a wheel with a granularity of +tick+ seconds (default: 0.001)
+ * on a single CLOCK_MONOTONIC TimerFD.  +flags+ may be :CLOEXEC as
+ * for TimerFD.new, the descriptor is always non-blocking.
+ */
+static VALUE wheel_s_new(int argc, VALUE *argv, VALUE klass)
+{
+	VALUE tick, flags, args[2], rv, tmp;
+	struct wheel *w;
+	unsigned i;
+	uint64_t tick_ns;
+
+	rb_scan_args(argc, argv, "02", &tick, &flags);
+	tick_ns = NIL_P(tick) ? 1000000 : num2ns(tick);
+	if (tick_ns == 0)
+		rb_raise(rb_eArgError, "tick must be positive");
+
+	args[0] = ID2SYM(rb_intern("MONOTONIC"));
+	args[1] = flags;
+	rv = rb_call_super(2, args);
+	rb_sp_set_nonblock(rb_sp_fileno(rv));
+
+	tmp = TypedData_Make_Struct(rb_cObject, struct wheel, &wheel_type, w);
+	for (i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++)
+		wlist_init(&w->slots[i]);
+	w->tick_ns = tick_ns;
+	w->now = now_ns() / tick_ns;
+	rb_ivar_set(rv, id_ivar_wheel, tmp);
+
+	return rv;
+}
+
+static struct wtimer *timer_get(VALUE self)
+{
+	return rb_check_typeddata(self, &timer_type);
+}
+
+/*
+ * call-seq:
+ *	timer.cancel -> true or false
+ *
+ * Removes a pending timer from its wheel, returns +false+ if it already
+ * expired or was cancelled.  The TimerFD is not rearmed, so this may
+ * cause a TimerWheel#expire call which finds nothing to expire.
+ */
+static VALUE timer_cancel(VALUE self)
+{
+	struct wtimer *t = timer_get(self);
+
+	if (!t->wheel || wlist_empty(&t->node))
+		return Qfalse;
+	wheel_unlink(t->wheel, t);
+	return Qtrue;
+}
+
+/*
+ * call-seq:
+ *	timer.pending? -> true or false
+ *
+ * Returns whether the timer has neither expired nor been cancelled.
+ */
+static VALUE timer_pending_p(VALUE self)
+{
+	struct wtimer *t = timer_get(self);
+
+	return t->wheel && !wlist_empty(&t->node) ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *	timer.reset(delay) -> timer
+ *
+ * Reschedules the timer to expire in +delay+ seconds, whether or not it
+ * is still pending.  This is cheaper than cancelling it and adding a new
+ * one, e.g. for idle timeouts which are pushed back on every request.
+ */
+static VALUE timer_reset(VALUE self, VALUE delay)
+{
+	struct wtimer *t = timer_get(self);
+	uint64_t ns = num2ns(delay);
+
+	if (!t->wheel)
+		rb_raise(rb_eIOError, "TimerWheel was garbage collected");
+	if (!wlist_empty(&t->node))
+		wheel_unlink(t->wheel, t);
+	timer_schedule(t, ns);
+
+	return self;
+}
+
+void sleepy_penguin_init_timer_wheel(void)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+	VALUE cTimerFD = rb_const_get(mSleepyPenguin, rb_intern("TimerFD"));
+
+	/*
+	 * Document-class: SleepyPenguin::TimerWheel
+	 *
+	 * Multiplexes any number of timers onto a single TimerFD, for
+	 * per-connection timeouts without a descriptor per timer.  Adding
+	 * and cancelling timers is O(1), and the TimerFD is armed with
+	 * TimerFD::ABSTIME for the next tick with a timer due.
+	 *
+	 *	wheel = SleepyPenguin::TimerWheel.new(0.01)
+	 *	timer = wheel.add(30, client)
+	 *	ep.add(wheel, :IN)
+	 *	...
+	 *	# when ep reports wheel readable:
+	 *	wheel.expire(true)&.each { |client| client.close }
+	 *
+	 * Timers expire at most one tick late, and never early.
+	 */
+	cTimerWheel = rb_define_class_under(mSleepyPenguin, "TimerWheel",
+					    cTimerFD);
+	rb_define_singleton_method(cTimerWheel, "new", wheel_s_new, -1);
+	rb_define_method(cTimerWheel, "add", wheel_add, -1);
+	rb_define_method(cTimerWheel, "expire", wheel_expire, -1);
+	rb_define_method(cTimerWheel, "size", wheel_size, 0);
+	rb_define_method(cTimerWheel, "tick", wheel_tick, 0);
+	rb_undef_method(cTimerWheel, "settime");
+	rb_undef_method(cTimerWheel, "rearm");
+	rb_undef_method(cTimerWheel, "__rearm");
+	rb_undef_method(cTimerWheel, "expirations");
+
+	/*
+	 * Document-class: SleepyPenguin::TimerWheel::Timer
+	 *
+	 * Returned by TimerWheel#add to cancel or reschedule a timer.
+	 */
+	cTimer = rb_define_class_under(cTimerWheel, "Timer", rb_cObject);
+	rb_undef_alloc_func(cTimer);
+	rb_define_method(cTimer, "cancel", timer_cancel, 0);
+	rb_define_method(cTimer, "pending?", timer_pending_p, 0);
+	rb_define_method(cTimer, "reset", timer_reset, 1);
+
+	id_ivar_wheel = rb_intern("@__sp_wheel");
+}
+#endif /* HAVE_SYS_TIMERFD_H */
@@ -1,6 +1,8 @@
 #ifdef HAVE_SYS_TIMERFD_H
 #include "sleepy_penguin.h"
+#include "sp_copy.h"
 #include <sys/timerfd.h>
+#include <poll.h>
 #include "value2timespec.h"
 
 /*
@@ -76,6 +78,22 @@ static VALUE settime(VALUE self, VALUE fl, VALUE interval, VALUE value)
 	return itimerspec2ary(&old);
 }
 
+/* :nodoc: */
+static VALUE rearm(VALUE self, VALUE value, VALUE interval, VALUE abstime)
+{
+	int fd = rb_sp_fileno(self);
+	struct itimerspec new;
+
+	value2timespec_ns(&new.it_value, value);
+	value2timespec_ns(&new.it_interval, interval);
+
+	if (timerfd_settime(fd, RTEST(abstime) ? TFD_TIMER_ABSTIME : 0,
+			    &new, NULL) < 0)
+		rb_sys_fail("timerfd_settime");
+
+	return Qnil;
+}
+
 /*
  * call-seq:
  *	tfd#gettime	-> [ interval, value ]
@@ -133,6 +151,88 @@ retry:
 	return ULL2NUM(buf);
 }
 
+struct batch_args {
+	struct pollfd *pfds;
+	uint64_t *counts;
+	long nr;
+	int err;
+};
+
+static void *nogvl_batch(void *ptr)
+{
+	struct batch_args *a = ptr;
+	long i;
+
+	if (poll(a->pfds, (nfds_t)a->nr, 0) < 0) {
+		a->err = errno;
+		return 0;
+	}
+	for (i = 0; i < a->nr; i++) {
+		a->counts[i] = 0;
+		if (a->pfds[i].revents & POLLNVAL) {
+			a->err = EBADF;
+			return 0;
+		}
+		if (!(a->pfds[i].revents & POLLIN))
+			continue;
+		if (read(a->pfds[i].fd, &a->counts[i], sizeof(uint64_t)) < 0) {
+			a->counts[i] = 0;
+
+			/* another thread may have read it since poll */
+			if (errno != EAGAIN && !a->err)
+				a->err = errno;
+		}
+	}
+	return 0;
+}
+
+/*
+ * call-seq:
+ *	TimerFD.expirations_batch(timers) -> [ Integer or nil, ... ]
+ *
+ * Reads the expiration counts of every TimerFD in the +timers+ Array
+ * with one poll(2) and a read(2) for each expired timer, all without
+ * holding the GVL.  Returns an Array in the same order as +timers+, with
+ * +nil+ for timers which have not expired.  This never blocks: every
+ * timer is switched to non-blocking I/O first, so one read by another
+ * thread between poll(2) and read(2) cannot stall the rest.  It is
+ * meant to be called after Epoll#wait reports several timers readable.
+ *
+ * Errors reading any timer (e.g. Errno::ECANCELED for timers armed with
+ * TimerFD::CANCEL_ON_SET) are raised after all timers were read, the
+ * counts read from the other timers are lost.
+ */
+static VALUE expirations_batch(VALUE klass, VALUE timers)
+{
+	struct batch_args a;
+	VALUE tmp, rv;
+	long i;
+
+	timers = rb_convert_type(timers, T_ARRAY, "Array", "to_ary");
+	a.nr = RARRAY_LEN(timers);
+	a.err = 0;
+	a.pfds = ALLOCV(tmp, a.nr * (sizeof(struct pollfd) + sizeof(uint64_t)));
+	a.counts = (uint64_t *)(a.pfds + a.nr);
+	for (i = 0; i < a.nr; i++) {
+		a.pfds[i].fd = rb_sp_fileno(rb_ary_entry(timers, i));
+		rb_sp_set_nonblock(a.pfds[i].fd);
+		a.pfds[i].events = POLLIN;
+		a.pfds[i].revents = 0;
+	}
+	WITHOUT_GVL(nogvl_batch, &a, RUBY_UBF_IO, 0);
+	if (a.err) {
+		ALLOCV_END(tmp);
+		errno = a.err;
+		rb_sys_fail("read(timerfd)");
+	}
+	rv = rb_ary_new_capa(a.nr);
+	for (i = 0; i < a.nr; i++)
+		rb_ary_push(rv, a.counts[i] ? ULL2NUM(a.counts[i]) : Qnil);
+	ALLOCV_END(tmp);
+
+	return rv;
+}
+
 void sleepy_penguin_init_timerfd(void)
 {
 	VALUE mSleepyPenguin, cTimerFD;
@@ -164,7 +264,10 @@ void sleepy_penguin_init_timerfd(void)
 	NODOC_CONST(cTimerFD, "CLOEXEC", UINT2NUM(TFD_CLOEXEC));
 #endif
 
+	rb_define_singleton_method(cTimerFD, "expirations_batch",
+				   expirations_batch, 1);
 	rb_define_method(cTimerFD, "settime", settime, 3);
+	rb_define_method(cTimerFD, "__rearm", rearm, 3);
 	rb_define_method(cTimerFD, "gettime", gettime, 0);
 	rb_define_method(cTimerFD, "expirations", expirations, -1);
 }
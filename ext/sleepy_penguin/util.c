@@ -161,6 +161,10 @@ int rb_sp_gc_for_fd(int err)
 {
 	if (err == EMFILE || err == ENFILE || err == ENOMEM) {
 		rb_gc();
+
+		/* a full GC leaves no dead caches behind, see file_cache.c */
+		if (rb_sp_file_cache_shed())
+			rb_gc();
 		return 1;
 	}
 	return 0;
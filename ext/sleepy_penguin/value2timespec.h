@@ -49,6 +49,25 @@ static struct timespec *value2timespec(struct timespec *ts, VALUE num)
 	return NULL;
 }
 
+/* Integers are nanoseconds, anything else is seconds */
+static inline struct timespec *
+value2timespec_ns(struct timespec *ts, VALUE num)
+{
+	if (RB_INTEGER_TYPE_P(num)) {
+		long long ns = NUM2LL(num);
+
+		if (ns < 0)
+			rb_raise(rb_eArgError, "negative time: %lld", ns);
+		ts->tv_sec = (time_t)(ns / 1000000000LL);
+		ts->tv_nsec = (long)(ns % 1000000000LL);
+		return ts;
+	}
+	value2timespec(ts, num);
+	if (ts->tv_sec < 0)
+		rb_raise(rb_eArgError, "negative time");
+	return ts;
+}
+
 #ifndef TIMET2NUM
 #  define TIMET2NUM(n) LONG2NUM(n)
 #endif
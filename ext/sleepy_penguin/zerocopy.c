@@ -0,0 +1,249 @@
+#include "sleepy_penguin.h"
+#if defined(__linux__) && defined(HAVE_LINUX_ERRQUEUE_H)
+#include "sp_copy.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#  define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#  define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#  define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#  define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+/*
+ * zerocopy is a net loss for small buffers, this is also large enough
+ * to ensure we never pin an embedded String which GC compaction may move
+ */
+#define ZC_MIN_LEN 16384
+
+static ID id_zerocopy;
+static VALUE sym_wait_writable;
+
+struct zc_state {
+	uint32_t next; /* sequence number of the next zerocopy send */
+	int copying; /* kernel copied (or refused), so we copy, too */
+	long pending;
+	VALUE pins; /* Hash: sequence number => frozen String */
+};
+
+static void zc_mark(void *ptr)
+{
+	struct zc_state *st = ptr;
+
+	rb_gc_mark(st->pins);
+}
+
+static size_t zc_memsize(const void *ptr)
+{
+	return sizeof(struct zc_state);
+}
+
+static const rb_data_type_t zc_type = {
+	"sleepy_penguin_zerocopy",
+	{ zc_mark, RUBY_TYPED_DEFAULT_FREE, zc_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static struct zc_state *zc_lookup(VALUE io)
+{
+	VALUE tmp;
+
+	if (!RB_TYPE_P(io, T_FILE) || !rb_ivar_defined(io, id_zerocopy))
+		return NULL;
+	tmp = rb_ivar_get(io, id_zerocopy);
+	return RTYPEDDATA_P(tmp) ? rb_check_typeddata(tmp, &zc_type) : NULL;
+}
+
+static struct zc_state *zc_get(VALUE io, int fd)
+{
+	struct zc_state *st = zc_lookup(io);
+	int on = 1;
+	VALUE tmp;
+
+	if (st)
+		return st;
+
+	tmp = TypedData_Make_Struct(rb_cObject, struct zc_state, &zc_type, st);
+	st->pins = rb_hash_new();
+
+	/* old kernels and non-TCP/UDP sockets: just copy */
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0)
+		st->copying = 1;
+
+	rb_ivar_set(io, id_zerocopy, tmp);
+	return st;
+}
+
+struct zc_send {
+	int fd;
+	int flags;
+	const void *buf;
+	size_t len;
+};
+
+static void *nogvl_send(void *ptr)
+{
+	struct zc_send *a = ptr;
+
+	return (void *)send(a->fd, a->buf, a->len, a->flags);
+}
+
+/* :nodoc: */
+static VALUE send_zerocopy(VALUE mod, VALUE io, VALUE str, VALUE flags)
+{
+	struct zc_send a;
+	struct zc_state *st;
+	ssize_t n;
+	VALUE pin;
+
+	StringValue(str);
+	io = rb_io_get_io(io);
+	a.fd = rb_sp_fileno(io);
+	a.flags = NUM2INT(flags);
+	st = zc_get(io, a.fd);
+
+	/*
+	 * a frozen copy shares the buffer with +str+, so the caller may
+	 * continue modifying +str+ and Ruby will CoW it instead of
+	 * scribbling over memory the kernel has not released, yet
+	 */
+	if (RSTRING_LEN(str) >= ZC_MIN_LEN && !st->copying) {
+		pin = rb_str_new_frozen(str);
+		a.flags |= MSG_ZEROCOPY;
+	} else {
+		pin = str;
+	}
+retry:
+	a.buf = RSTRING_PTR(pin);
+	a.len = RSTRING_LEN(pin);
+	n = (ssize_t)IO_RUN(nogvl_send, &a);
+	if (n < 0) {
+		switch (errno) {
+		case EINTR:
+			a.fd = rb_sp_fileno(io);
+			goto retry;
+		case ENOBUFS: /* optmem_max exceeded, copy this one */
+			if (a.flags & MSG_ZEROCOPY) {
+				a.flags &= ~MSG_ZEROCOPY;
+				goto retry;
+			}
+			break;
+		case EAGAIN:
+			return sym_wait_writable;
+		}
+		rb_sys_fail("send");
+	}
+	if (a.flags & MSG_ZEROCOPY) {
+		rb_hash_aset(st->pins, UINT2NUM(st->next++), pin);
+		st->pending++;
+	}
+	RB_GC_GUARD(pin);
+
+	return SSIZET2NUM(n);
+}
+
+static void zc_release(struct zc_state *st, uint32_t lo, uint32_t hi)
+{
+	uint32_t seq = lo;
+
+	for (;;) {
+		if (!NIL_P(rb_hash_delete(st->pins, UINT2NUM(seq))))
+			st->pending--;
+		if (seq++ == hi) /* hi may be < lo if the counter wrapped */
+			break;
+	}
+}
+
+/*
+ * reaps zerocopy completions from the socket error queue,
+ * returns the number of notifications processed
+ */
+long rb_sp_zerocopy_reap(VALUE io)
+{
+	struct zc_state *st = zc_lookup(io);
+	long nr = 0;
+	int fd;
+
+	if (!st || st->pending == 0 || rb_sp_io_closed(io))
+		return 0;
+
+	fd = rb_sp_fileno(io);
+	for (;;) {
+		char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+				CMSG_SPACE(sizeof(struct sockaddr_in6))];
+		struct msghdr msg;
+		struct cmsghdr *cm;
+		struct sock_extended_err *serr;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE|MSG_DONTWAIT) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			rb_sys_fail("recvmsg(MSG_ERRQUEUE)");
+		}
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!((cm->cmsg_level == SOL_IP &&
+			       cm->cmsg_type == IP_RECVERR) ||
+			      (cm->cmsg_level == SOL_IPV6 &&
+			       cm->cmsg_type == IPV6_RECVERR)))
+				continue;
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_errno != 0 ||
+			    serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			zc_release(st, serr->ee_info, serr->ee_data);
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				st->copying = 1;
+			nr++;
+		}
+	}
+	return nr;
+}
+
+/* :nodoc: */
+static VALUE zc_reap(VALUE mod, VALUE io)
+{
+	return LONG2NUM(rb_sp_zerocopy_reap(io));
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin.zerocopy_pending(io)	-> Integer
+ *
+ * Returns the number of zerocopy sends on +io+ the kernel has not
+ * yet confirmed completion of.  The Strings used by those sends
+ * remain referenced until then.
+ */
+static VALUE zc_pending(VALUE mod, VALUE io)
+{
+	struct zc_state *st = zc_lookup(rb_io_get_io(io));
+
+	return LONG2NUM(st ? st->pending : 0);
+}
+
+void sleepy_penguin_init_zerocopy(void)
+{
+	VALUE mod = rb_define_module("SleepyPenguin");
+
+	rb_define_singleton_method(mod, "__send_zerocopy", send_zerocopy, 3);
+	rb_define_singleton_method(mod, "__zerocopy_reap", zc_reap, 1);
+	rb_define_singleton_method(mod, "zerocopy_pending", zc_pending, 1);
+
+	id_zerocopy = rb_intern("@__sp_zerocopy");
+	sym_wait_writable = ID2SYM(rb_intern("wait_writable"));
+}
+#endif /* __linux__ && HAVE_LINUX_ERRQUEUE_H */
@@ -12,6 +12,18 @@ if defined?(SleepyPenguin::Inotify) &&
     def take(*args)
       Rubinius.synchronize(@inotify_tmp) { __take(*args) }
     end
+
+    alias __take_all take_all
+    undef_method :take_all
+    def take_all(*args)
+      Rubinius.synchronize(@inotify_tmp) { __take_all(*args) }
+    end
+
+    alias __take_batch take_batch
+    undef_method :take_batch
+    def take_batch(*args)
+      Rubinius.synchronize(@inotify_tmp) { __take_batch(*args) }
+    end
     # :startdoc
   end
 end
@@ -21,6 +33,9 @@ module SleepyPenguin
   require_relative 'sleepy_penguin/cfr' if respond_to?(:__cfr)
   require_relative 'sleepy_penguin/epoll' if const_defined?(:Epoll)
   require_relative 'sleepy_penguin/kqueue' if const_defined?(:Kqueue)
+  if const_defined?(:Inotify) && respond_to?(:__copy_stream)
+    require_relative 'sleepy_penguin/follow'
+  end
 
   # Copies +len+ bytes from +src+ to +dst+, where +src+ refers to
   # an open, mmap(2)-able File and +dst+ refers to a Socket.
@@ -42,4 +57,241 @@ module SleepyPenguin
   def self.linux_sendfile(dst, src, len, offset: nil)
     __lsf(dst, src, offset, len)
   end
+
+  # Copies +len+ bytes from +src+ to +dst+, or until EOF on +src+ if
+  # +len+ is +nil+.  +src+ and +dst+ may be any combination of File,
+  # Socket or pipe objects (or Integer file descriptors).  An optional
+  # +offset+ keyword may be specified for a seekable +src+, in which case
+  # the file offset of +src+ itself is not changed.
+  #
+  # The fastest method available for the pair of descriptors is picked
+  # automatically: copy_file_range(2) between regular files, sendfile(2)
+  # from regular files, splice(2) when either end is a pipe, and splice(2)
+  # through an internal pipe between sockets.  Methods the kernel refuses
+  # fall back to the next one, and finally to read(2)/write(2).  The
+  # whole copy happens in C and non-blocking descriptors are waited on
+  # as needed.
+  #
+  # Returns the number of bytes copied, which is only less than +len+
+  # if +src+ reached EOF.
+  #
+  # As with splice, userspace buffering done by Ruby is not taken into
+  # account.
+  def self.copy_stream(src, dst, len = nil, offset: nil)
+    __copy_stream(src, dst, len, offset)
+  end if respond_to?(:__copy_stream)
+
+  class TimerFD
+    # Like TimerFD#settime, but returns +nil+ instead of allocating an
+    # Array of the old values, for timers which are rearmed often
+    # (e.g. per-request deadlines).  +value+ and +interval+ are
+    # nanoseconds if Integers, avoiding Float conversions, or seconds
+    # if Floats.  If +abstime+ is true, +value+ is an absolute time on
+    # the clock of the timer.  A zero +value+ disarms the timer.
+    def rearm(value, interval = 0, abstime: false)
+      __rearm(value, interval, abstime)
+    end
+  end if const_defined?(:TimerFD)
+
+  # Sends the contents of String +buf+ over the Socket +dst+ with
+  # MSG_ZEROCOPY, avoiding the copy into kernel memory done by send(2).
+  # +flags+ may be an Integer mask of other send(2) flags.
+  #
+  # The kernel reads +buf+ after this method returns, so a reference to
+  # +buf+ is kept until the kernel reports completion.  +buf+ may still
+  # be modified by the caller, Ruby will copy it on write.  Completions
+  # are reaped automatically when Epoll reports Epoll::ERR on +dst+, or
+  # explicitly with SleepyPenguin.zerocopy_reap.
+  #
+  # Buffers smaller than 16K, sockets which do not support SO_ZEROCOPY,
+  # and sockets the kernel reported copying for (e.g. loopback) fall
+  # back to a regular send(2).
+  #
+  # Returns the number of bytes written on success, or :wait_writable
+  # if the +dst+ Socket is non-blocking and the operation would block.
+  #
+  # This requires Linux 4.14+ for TCP and Linux 5.0+ for UDP.
+  def self.send_zerocopy(dst, buf, flags = 0)
+    __send_zerocopy(dst, buf, flags)
+  end if respond_to?(:__send_zerocopy)
+
+  # Processes zerocopy completion notifications pending in the error
+  # queue of +io+, releasing references to completed buffers.  Returns
+  # the number of notifications processed.  Epoll#wait calls this
+  # automatically for watched sockets.
+  def self.zerocopy_reap(io)
+    __zerocopy_reap(io.to_io)
+  end if respond_to?(:__zerocopy_reap)
+
+  # Switches the connected TCP +sock+ to kernel TLS (Linux 4.13+), so
+  # records are encrypted and decrypted by the kernel.  Once enabled,
+  # the existing zero-copy entry points (linux_sendfile, splice, tee,
+  # copy_stream) work unchanged on +sock+, as do plain reads and writes.
+  #
+  # The handshake must already be done in userspace (e.g. by OpenSSL)
+  # and +tx+ and +rx+ are Hashes of the negotiated session parameters
+  # for each direction; either may be omitted:
+  #
+  # - :cipher - :aes_gcm_128, :aes_gcm_256 or :chacha20_poly1305
+  #   (or the SleepyPenguin::KTLS constant of the same name)
+  # - :version - :tls_1_2 (default) or :tls_1_3
+  # - :key, :iv, :salt, :rec_seq - binary Strings of the exact sizes
+  #   required by the cipher (see SleepyPenguin::KTLS)
+  #
+  # Raises Errno::ENOENT if the "tls" module is not available in the
+  # kernel.  Returns +sock+.
+  def self.ktls_enable(sock, tx: nil, rx: nil)
+    __ktls_ulp(sock)
+    __ktls_set(sock, KTLS::TX, __ktls_params(tx)) if tx
+    __ktls_set(sock, KTLS::RX, __ktls_params(rx)) if rx
+    sock
+  end if respond_to?(:__ktls_set)
+
+  def self.__ktls_params(params) # :nodoc:
+    params = params.dup
+    params[:version] ||= KTLS::TLS_1_2
+    [ :cipher, :version ].each do |k|
+      v = params[k]
+      params[k] = KTLS.const_get(v.to_s.upcase) if Symbol === v
+    end
+    params
+  end if respond_to?(:__ktls_set)
+
+  module Sched
+    # Sets the scheduling +policy+ and its parameters for the calling
+    # thread with sched_setattr(2).  +policy+ is a Sched constant or
+    # its name as a lower-case Symbol (e.g. :fifo), +flags+ may be an
+    # Integer mask, a Symbol or an Array of Symbols (e.g.
+    # :reset_on_fork).  Only the keywords relevant to +policy+ are used:
+    #
+    # - :nice - for :other and :batch
+    # - :priority - 1 (lowest) to 99 (highest) for :fifo and :rr
+    # - :runtime, :deadline, :period - for :deadline; Integers are
+    #   nanoseconds, Floats are seconds.  +period+ defaults to
+    #   +deadline+.
+    #
+    #	Sched.setattr(:fifo, priority: 10)
+    #	Sched.setattr(:deadline, runtime: 100_000,
+    #	              deadline: 1_000_000, period: 1_000_000)
+    #
+    # Realtime policies require CAP_SYS_NICE (or RLIMIT_RTPRIO), and
+    # the :deadline policy requires the thread to be allowed on every
+    # CPU of its root domain.  Returns +nil+.
+    def self.setattr(policy, flags = 0, nice: 0, priority: 0,
+                     runtime: 0, deadline: 0, period: 0)
+      policy = const_get(policy.to_s.upcase) if Symbol === policy
+      flags = Array(flags).inject(0) do |mask, f|
+        mask | (Symbol === f ? const_get(f.to_s.upcase) : f)
+      end
+      __setattr(policy, flags, nice, priority, runtime, deadline, period)
+    end
+  end if const_defined?(:Sched)
+
+  if respond_to?(:__accept_batch)
+    require 'socket'
+
+    # Accepts up to +max+ pending connections on +listener+ with
+    # accept4(2) in one call, without the GVL, and returns them as an
+    # Array, or +nil+ if none are pending.  This never blocks, so it is
+    # meant to be called when Epoll reports +listener+ readable, in
+    # place of an accept_nonblock loop.
+    #
+    # Connections are TCPSocket objects for a TCPServer +listener+,
+    # UNIXSocket objects for a UNIXServer, and Socket objects otherwise.
+    # +flags+ may be an Integer mask of Socket::SOCK_* constants, or
+    # :CLOEXEC, :NONBLOCK or an Array of both (the default).
+    #
+    # If +epoll+ is given, every connection is added to it with
+    # +events+ (default: :IN) before returning.
+    #
+    #	while socks = SleepyPenguin.accept_batch(srv, 64, epoll: ep)
+    #	  socks.each { |s| clients[s.fileno] = Client.new(s) }
+    #	end
+    def self.accept_batch(listener, max = 64, flags: [ :CLOEXEC, :NONBLOCK ],
+                          epoll: nil, events: :IN)
+      flags = Array(flags).inject(0) do |mask, f|
+        mask | (Symbol === f ? Socket.const_get("SOCK_#{f}") : f)
+      end
+      klass = case listener
+              when TCPServer then TCPSocket
+              when UNIXServer then UNIXSocket
+              else Socket
+              end
+      socks = __accept_batch(listener, max, flags, klass) or return
+      socks.each { |s| epoll.add(s, events) } if epoll
+      socks
+    end
+  end
+
+  # Receives up to +count+ (at most 1024) datagrams from +sock+ with
+  # one recvmmsg(2) call made without the GVL, so one Epoll wakeup may
+  # move a whole burst.  Datagrams are received into a reusable
+  # per-thread buffer of +count+ slots of +buf_size+ bytes, and
+  # returned as an Array of Strings, longer datagrams are truncated.
+  # This never blocks: :wait_readable is returned if nothing is queued.
+  #
+  # If +addrs+ is an Array, it is replaced with the packed source
+  # address of each datagram (as for Addrinfo.new or
+  # Socket.unpack_sockaddr_in).  If +segments+ is an Array, it is
+  # replaced with the GRO segment size of each datagram, or zero for
+  # datagrams the kernel did not coalesce.  Coalescing is enabled with
+  # <code>sock.setsockopt(Socket::SOL_UDP, SleepyPenguin::UDP_GRO, 1)</code>
+  # (Linux 5.0+) and needs a +buf_size+ of 65535 to avoid truncation.
+  # Reusing both Arrays across calls avoids allocating them.
+  #
+  #	addrs = []
+  #	while Array === (msgs = SleepyPenguin.recvmmsg(sock, 64, 1500,
+  #	                                                addrs: addrs))
+  #	  msgs.each_with_index { |msg, i| handle(msg, addrs[i]) }
+  #	end
+  def self.recvmmsg(sock, count, buf_size, addrs: nil, segments: nil)
+    __recvmmsg(sock, count, buf_size, addrs, segments)
+  end if respond_to?(:__recvmmsg)
+
+  # Sends an Array of String +msgs+ (at most 1024) on +sock+ with one
+  # sendmmsg(2) call made without the GVL.  The messages are copied
+  # first, so other threads may modify them meanwhile.  +addrs+ is
+  # required for unconnected sockets, it is an Array of destinations
+  # for each message, either packed socket addresses or Addrinfo
+  # objects.
+  #
+  # Returns the number of messages sent, which may be fewer than given,
+  # or :wait_writable if +sock+ could not send any without blocking.
+  def self.sendmmsg(sock, msgs, addrs = nil)
+    __sendmmsg(sock, msgs, addrs)
+  end if respond_to?(:__sendmmsg)
+
+  # Attaches a classic BPF +program+ with SO_ATTACH_REUSEPORT_CBPF to
+  # the SO_REUSEPORT group +sock+ belongs to (Linux 4.5+).  The
+  # program picks the socket in the group for each new connection (or
+  # datagram): its return value is an index into the group, in the
+  # order sockets joined it.  The kernel falls back to hashing if the
+  # index is out of range.
+  #
+  # +program+ is an Array of [code, jt, jf, k] instructions, as in
+  # struct sock_filter from linux/filter.h, or those structs already
+  # packed into a String.  See SleepyPenguin.reuseport_steer_by_cpu
+  # for a prebuilt program.  Returns +nil+.
+  def self.reuseport_attach_cbpf(sock, program)
+    unless String === program
+      program = program.map { |insn| insn.pack('SCCL') }.join
+    end
+    __reuseport_attach_cbpf(sock, program)
+  end if respond_to?(:__reuseport_attach_cbpf)
+
+  class PidFD
+    # Sends +sig+ to the process with pidfd_send_signal(2), which never
+    # signals another process which reused its PID.  +sig+ may be an
+    # Integer or a signal name as for Process.kill (e.g. :TERM or
+    # "SIGTERM").  Returns +nil+, raises Errno::ESRCH if the process
+    # has already exited.
+    def send_signal(sig)
+      unless Integer === sig
+        name = sig.to_s.delete_prefix('SIG')
+        sig = Signal.list[name] or
+          raise ArgumentError, "unsupported signal '#{sig}'"
+      end
+      __send_signal(sig)
+    end
+  end if const_defined?(:PidFD)
 end
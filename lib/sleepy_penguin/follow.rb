@@ -0,0 +1,231 @@
+# -*- encoding: binary -*-
+
+# Follows growing files like "tail -F" and forwards appended data to
+# another descriptor (usually a Socket or pipe) with
+# SleepyPenguin.copy_stream, so the data is never copied into Ruby
+# Strings.  Offsets may be persisted in a checkpoint file to resume
+# where a previous process left off.
+#
+#	follow = SleepyPenguin::Follow.new(sock, checkpoint: "/var/lib/ship")
+#	follow.add("/var/log/app.log")
+#	follow.add("/var/log/other.log", other_sock)
+#	follow.run
+#
+# Rotation is detected with IN_MOVE_SELF and IN_ATTRIB (dropping the
+# last link) on each file, and IN_CREATE and IN_MOVED_TO on its
+# directory.  IN_DELETE_SELF is of no use, the kernel only sends it
+# once Follow closes the file.  A renamed file is drained until its
+# replacement receives data, since writers usually keep writing to the
+# old file until they reopen the path.  A deleted file may never be
+# replaced, so it is drained and closed as soon as its removal is seen,
+# data written to it afterwards is not forwarded.  Files truncated in
+# place (e.g. by "copytruncate") are followed again from the beginning.
+#
+# Follow#to_io returns the underlying Inotify object, which may be
+# watched with Epoll or IO.select before calling Follow#poll with
+# +nonblock+.
+class SleepyPenguin::Follow
+  # :stopdoc:
+  Inotify = SleepyPenguin::Inotify
+  FILE_MASK = Inotify::MODIFY | Inotify::MOVE_SELF | Inotify::ATTRIB
+  DIR_MASK = Inotify::CREATE | Inotify::MOVED_TO | Inotify::ONLYDIR
+  Entry = Struct.new(:path, :dst, :io, :dev, :ino, :offset, :wd, :rotated)
+  # :startdoc:
+
+  # path of the checkpoint file, if any
+  attr_reader :checkpoint
+
+  # Creates a new Follow object forwarding to +dst+ by default.  If
+  # +checkpoint+ is a path, offsets recorded there by Follow#save are
+  # used when files are added, and Follow#run saves offsets every
+  # +interval+ seconds.
+  def initialize(dst = nil, checkpoint: nil, interval: 1.0)
+    @dst = dst
+    @checkpoint = checkpoint
+    @interval = interval
+    @ino = Inotify.new(:CLOEXEC)
+    @paths = {} # path => Entry
+    @files = {} # file wd => Entry
+    @dirs = {} # directory wd => { name => Entry }
+    @saved = checkpoint ? load_checkpoint : {}
+    @saved_at = now
+  end
+
+  # Returns the Inotify object, for use with Epoll or IO.select.
+  def to_io
+    @ino
+  end
+
+  # Starts following +path+, forwarding its data to +dst+.  +path+ need
+  # not exist yet.  Data already in the file is forwarded starting
+  # from the offset in the checkpoint if it refers to the same inode,
+  # otherwise from the beginning if +from+ is :start or the current
+  # end if +from+ is :end.  Returns the number of bytes forwarded.
+  def add(path, dst = @dst, from: :end)
+    dst or raise ArgumentError, "no destination for #{path}"
+    path = File.expand_path(path)
+    @paths.include?(path) and raise ArgumentError, "#{path} already added"
+    e = Entry.new(path, dst, nil, nil, nil, 0, nil, [])
+    dir, name = File.split(path)
+    (@dirs[@ino.add_watch(dir, DIR_MASK)] ||= {})[name] = e
+    @paths[path] = e
+    open_entry(e) or return 0
+    saved = @saved[path]
+    if saved && saved[0] == e.dev && saved[1] == e.ino
+      e.offset = saved[2]
+    elsif from == :end
+      e.offset = e.io.stat.size
+    end
+    forward(e)
+  end
+
+  # Reads events (see Inotify#take_all) and forwards any data appended
+  # to the files they refer to.  Returns the number of bytes forwarded,
+  # or +nil+ if +nonblock+ is true and there was nothing to do.
+  def poll(nonblock = false)
+    events = @ino.take_all(nonblock) or return
+    events.inject(0) { |bytes, event| bytes + process(event) }
+  end
+
+  # Calls Follow#poll forever, saving the checkpoint (if any) at most
+  # every +interval+ seconds given to Follow.new.
+  def run
+    loop do
+      poll
+      if @checkpoint && (now - @saved_at) >= @interval
+        save
+        @saved_at = now
+      end
+    end
+  end
+
+  # Returns a Hash of each followed path to the offset forwarded so far,
+  # or +nil+ if the file does not exist (yet).
+  def offsets
+    @paths.each_value.with_object({}) do |e, h|
+      h[e.path] = e.io ? e.offset : nil
+    end
+  end
+
+  # Atomically writes the offset of every followed file to the
+  # checkpoint file given to Follow.new, recording the device and inode
+  # so an offset is never applied to a different file.
+  def save
+    tmp = "#@checkpoint.#$$.tmp"
+    File.open(tmp, 'wb') do |fp|
+      @paths.each_value do |e|
+        fp.write("#{e.dev} #{e.ino} #{e.offset} #{e.path}\n") if e.io
+      end
+      fp.fsync
+    end
+    File.rename(tmp, @checkpoint)
+  end
+
+  # Saves the checkpoint (if any) and closes all descriptors.
+  def close
+    save if @checkpoint
+    @paths.each_value do |e|
+      e.io.close if e.io
+      e.rotated.each { |io, _, _| io.close }
+    end
+    @ino.close
+  end
+
+  private
+
+  def now
+    Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  end
+
+  def load_checkpoint
+    File.readlines(@checkpoint).each_with_object({}) do |line, h|
+      dev, ino, off, path = line.chomp.split(' ', 4)
+      h[path] = [ dev.to_i, ino.to_i, off.to_i ]
+    end
+  rescue Errno::ENOENT
+    {}
+  end
+
+  def open_entry(e)
+    io = File.open(e.path, 'rb')
+    st = io.stat
+    e.io, e.dev, e.ino, e.offset = io, st.dev, st.ino, 0
+    e.wd = @ino.add_watch(e.path, FILE_MASK)
+    @files[e.wd] = e
+  rescue Errno::ENOENT
+    nil
+  end
+
+  def copy(io, dst, off, size)
+    size > off ? SleepyPenguin.copy_stream(io, dst, size - off, offset: off) : 0
+  end
+
+  # forwards data from rotated files first, they stop being drained
+  # once the new file receives data or they are deleted
+  def forward(e)
+    bytes = 0
+    e.rotated.delete_if do |r| # [ io, offset, wd ]
+      st = r[0].stat
+      n = copy(r[0], e.dst, r[1], st.size)
+      r[1] += n
+      bytes += n
+      (st.nlink == 0 || (e.io && e.io.stat.size > 0)) or next false
+      unwatch(r[2])
+      r[0].close
+      true
+    end
+    return bytes unless e.io
+
+    size = e.io.stat.size
+    e.offset = 0 if size < e.offset # truncated
+    n = copy(e.io, e.dst, e.offset, size)
+    e.offset += n
+    bytes + n
+  end
+
+  def unwatch(wd)
+    @files.delete(wd)
+    @ino.rm_watch(wd)
+  rescue Errno::EINVAL # already gone with IN_IGNORED
+  end
+
+  # the file at e.path was replaced (or removed), keep draining the old
+  # one (still watched for IN_MODIFY) and switch to the new one if it
+  # exists already
+  def rotate(e)
+    if e.io
+      forward(e)
+      e.rotated << [ e.io, e.offset, e.wd ]
+      e.io = e.wd = nil
+    end
+    open_entry(e)
+    forward(e)
+  end
+
+  def replaced?(e)
+    st = File.stat(e.path)
+    st.ino != e.ino || st.dev != e.dev
+  rescue Errno::ENOENT
+    true
+  end
+
+  def process(event)
+    mask = event.mask
+    if mask & Inotify::Q_OVERFLOW != 0 # events were lost, check everything
+      return @paths.each_value.inject(0) do |bytes, e|
+        bytes + (e.io && !replaced?(e) ? forward(e) : rotate(e))
+      end
+    end
+
+    if e = @files[event.wd]
+      return forward(e) if event.wd != e.wd # a rotated file
+      return rotate(e) if mask & Inotify::MOVE_SELF != 0 ||
+                          (mask & Inotify::ATTRIB != 0 && e.io.stat.nlink == 0)
+      return forward(e) if mask & Inotify::MODIFY != 0
+      @files.delete(event.wd) if mask & Inotify::IGNORED != 0
+    elsif event.name && (names = @dirs[event.wd]) && (e = names[event.name])
+      return rotate(e) if !e.io || replaced?(e)
+    end
+    0
+  end
+end
@@ -0,0 +1,87 @@
+require_relative 'helper'
+require 'fcntl'
+require 'socket'
+require 'tmpdir'
+
+class TestAcceptBatch < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @srv = TCPServer.new('127.0.0.1', 0)
+    @port = @srv.addr[1]
+    @clients = []
+    @accepted = []
+  end
+
+  def teardown
+    (@clients + @accepted + [ @srv ]).each { |io| io.close unless io.closed? }
+  end
+
+  def connect(n)
+    n.times { @clients << TCPSocket.new('127.0.0.1', @port) }
+  end
+
+  def test_empty
+    assert_nil SleepyPenguin.accept_batch(@srv, 8)
+    assert_raise(ArgumentError) { SleepyPenguin.accept_batch(@srv, 0) }
+  end
+
+  def test_batch
+    connect(5)
+    @accepted = SleepyPenguin.accept_batch(@srv, 3)
+    assert_equal 3, @accepted.size
+    @accepted.each do |s|
+      assert_instance_of TCPSocket, s
+      check_cloexec(s)
+      assert_equal Fcntl::O_NONBLOCK, s.fcntl(Fcntl::F_GETFL) & Fcntl::O_NONBLOCK
+    end
+    more = SleepyPenguin.accept_batch(@srv, 8)
+    @accepted.concat(more)
+    assert_equal 2, more.size
+    assert_nil SleepyPenguin.accept_batch(@srv, 8)
+
+    peers = @accepted.map { |s| s.peeraddr[1] }.sort
+    assert_equal @clients.map { |c| c.addr[1] }.sort, peers
+    @clients[0].write('hi')
+    srv_side = @accepted.find { |s| s.peeraddr[1] == @clients[0].addr[1] }
+    assert_equal 'hi', srv_side.read(2)
+  end
+
+  def test_flags
+    connect(1)
+    @accepted = SleepyPenguin.accept_batch(@srv, 1, flags: 0)
+    s = @accepted[0]
+    assert_equal 0, s.fcntl(Fcntl::F_GETFD) & Fcntl::FD_CLOEXEC
+    assert_equal 0, s.fcntl(Fcntl::F_GETFL) & Fcntl::O_NONBLOCK
+  end
+
+  def test_unix
+    path = "#{Dir.tmpdir}/sp_accept_batch.#{$$}.#{rand}"
+    srv = UNIXServer.new(path)
+    c = UNIXSocket.new(path)
+    @accepted = SleepyPenguin.accept_batch(srv, 4)
+    assert_instance_of UNIXSocket, @accepted[0]
+  ensure
+    [ srv, c ].each { |io| io.close if io }
+    File.unlink(path) if path && File.exist?(path)
+  end
+
+  def test_epoll
+    ep = Epoll.new
+    ep.add(@srv, Epoll::IN)
+    connect(4)
+    ep.wait(1, 1000) do |_, srv|
+      @accepted.concat(SleepyPenguin.accept_batch(srv, 64, epoll: ep) || [])
+    end
+    assert_equal 4, @accepted.size, 'loopback connects are queued at once'
+    @accepted.each { |s| assert_equal Epoll::IN, ep.events_for(s) }
+    @clients.each { |c| c.write('.') }
+    got = []
+    while got.size < 4
+      ep.wait(8, 1000) { |_, io| got << io.read_nonblock(1) if io != @srv }
+    end
+    assert_equal %w(. . . .), got
+  ensure
+    ep.close if ep
+  end
+end if SleepyPenguin.respond_to?(:accept_batch)
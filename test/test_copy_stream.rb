@@ -0,0 +1,89 @@
+# -*- encoding: binary -*-
+require_relative 'helper'
+require 'tempfile'
+require 'socket'
+
+class TestCopyStream < Test::Unit::TestCase
+  def setup
+    @str = ('abcdefghijklmnopqrstuvwxyz' * 4096).freeze
+    @src = Tempfile.new('ruby_cs_src')
+    @src.syswrite(@str)
+    @src.sysseek(0)
+    @ios = []
+  end
+
+  def teardown
+    @src.close!
+    @ios.each { |io| io.close unless io.closed? }
+  end
+
+  def tcp_pair
+    srv = TCPServer.new('127.0.0.1', 0)
+    c = TCPSocket.new('127.0.0.1', srv.addr[1])
+    @ios.concat([ srv, c, a = srv.accept ])
+    [ a, c ]
+  end
+
+  def test_file_to_file
+    dst = Tempfile.new('ruby_cs_dst')
+    assert_equal @str.bytesize, SleepyPenguin.copy_stream(@src, dst)
+    assert_equal @str.bytesize, @src.sysseek(0, IO::SEEK_CUR)
+    dst.sysseek(0)
+    assert_equal @str, dst.sysread(@str.bytesize + 1)
+
+    dst.truncate(0)
+    dst.sysseek(0)
+    assert_equal 5, SleepyPenguin.copy_stream(@src, dst, 5, offset: 3)
+    assert_equal @str.bytesize, @src.sysseek(0, IO::SEEK_CUR), 'pos unchanged'
+    dst.sysseek(0)
+    assert_equal 'defgh', dst.sysread(10)
+  ensure
+    dst.close! if dst
+  end
+
+  def test_file_to_socket
+    rd, wr = tcp_pair
+    thr = Thread.new { rd.read(@str.bytesize - 1) }
+    assert_equal @str.bytesize - 1,
+                 SleepyPenguin.copy_stream(@src, wr, nil, offset: 1)
+    assert_equal 0, @src.sysseek(0, IO::SEEK_CUR)
+    assert_equal @str.byteslice(1..-1), thr.value
+  end
+
+  def test_socket_to_socket
+    a_rd, a_wr = tcp_pair
+    b_rd, b_wr = tcp_pair
+    writer = Thread.new do
+      a_wr.write(@str)
+      a_wr.close
+    end
+    reader = Thread.new { b_rd.read }
+    assert_equal @str.bytesize, SleepyPenguin.copy_stream(a_rd, b_wr)
+    b_wr.close
+    assert_equal @str, reader.value
+    writer.join
+  end
+
+  def test_pipe_to_file
+    rd, wr = IO.pipe
+    @ios.concat([ rd, wr ])
+    dst = Tempfile.new('ruby_cs_dst')
+    writer = Thread.new { wr.write(@str); wr.close }
+    assert_equal 1000, SleepyPenguin.copy_stream(rd, dst, 1000)
+    assert_equal @str.bytesize - 1000, SleepyPenguin.copy_stream(rd, dst)
+    writer.join
+    dst.sysseek(0)
+    assert_equal @str, dst.sysread(@str.bytesize)
+  ensure
+    dst.close! if dst
+  end
+
+  def test_chardev_to_pipe
+    rd, wr = IO.pipe
+    @ios.concat([ rd, wr ])
+    File.open('/dev/zero') do |zero|
+      assert_equal 4096, SleepyPenguin.copy_stream(zero, wr, 4096)
+    end
+    assert_equal "\0" * 4096, rd.read(4096)
+  end if File.readable?('/dev/zero')
+end if SleepyPenguin.respond_to?(:copy_stream)
@@ -0,0 +1,126 @@
+require_relative 'helper'
+require 'fcntl'
+
+class TestEventQueue < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @eq = EventQueue.new(4)
+  end
+
+  def teardown
+    @eq.close unless @eq.closed?
+  end
+
+  def readable?(io)
+    !!IO.select([ io ], nil, nil, 0)
+  end
+
+  def test_new
+    assert_kind_of EventFD, @eq
+    check_cloexec(@eq)
+    flags = @eq.fcntl(Fcntl::F_GETFL) & Fcntl::O_NONBLOCK
+    assert_equal Fcntl::O_NONBLOCK, flags
+    assert_equal 4, @eq.capacity
+    assert_equal 8, EventQueue.new(5).capacity
+    assert_equal 1024, EventQueue.new.capacity
+    assert_raise(ArgumentError) { EventQueue.new(0) }
+    assert_raise(NoMethodError) { @eq.incr(1) }
+    assert_raise(NoMethodError) { @eq.value }
+  end
+
+  def test_push_take
+    assert_nil @eq.take(true)
+    assert_nil @eq.take_all(true)
+    assert_equal true, @eq.push(:a)
+    assert_equal true, @eq.push(nil)
+    assert_equal 2, @eq.size
+    assert_equal :a, @eq.take
+    assert_nil @eq.take(true)
+    assert_equal 0, @eq.size
+  end
+
+  def test_full
+    4.times { |i| assert_equal true, @eq.push(i) }
+    assert_equal false, @eq.push(4)
+    assert_equal [ 0, 1, 2, 3 ], @eq.take_all
+    3.times do # wraps around the ring
+      6.times { |i| @eq.push(i) }
+      assert_equal [ 0, 1, 2, 3 ], @eq.take_all(true)
+    end
+  end
+
+  def test_wakeup_elided
+    assert_equal false, readable?(@eq)
+    @eq.push(:a)
+    assert_equal true, readable?(@eq), 'new queues start armed'
+    assert_equal :a, @eq.take
+    assert_equal false, readable?(@eq), 'doorbell not drained'
+
+    10.times { |i| @eq.push(i) }
+    assert_equal false, readable?(@eq), 'consumer never slept'
+    assert_equal [ 0, 1, 2, 3 ], @eq.take_all(true)
+
+    # the consumer stays armed after a nonblocking take_all
+    @eq.push(:x)
+    @eq.push(:y)
+    assert_equal true, readable?(@eq)
+    assert_equal [ :x, :y ], @eq.take_all(true)
+    assert_equal false, readable?(@eq), 'doorbell not drained'
+    assert_nil @eq.take_all(true)
+    assert_equal false, readable?(@eq)
+    @eq.push(:z)
+    assert_equal true, readable?(@eq)
+  end
+
+  def test_blocking_take
+    th = Thread.new { @eq.take_all }
+    Thread.pass until th.stop?
+    assert_raise(ThreadError) { @eq.take(true) }
+    @eq.push(:hi)
+    assert_equal [ :hi ], th.value
+  end
+
+  def test_epoll
+    ep = Epoll.new
+    ep.add(@eq, Epoll::IN)
+    th = Thread.new { 3.times { |i| @eq.push(i) } }
+    events = []
+    assert_equal 1, ep.wait(1, 1000) { |_, io| events << io.take_all(true) }
+    th.join
+    got = events.flatten
+    got.concat(@eq.take_all(true) || [])
+    assert_equal [ 0, 1, 2 ], got
+  ensure
+    ep.close if ep
+  end
+
+  def test_producers
+    eq = EventQueue.new(64)
+    nr = 4
+    each = 2000
+    producers = nr.times.map do |t|
+      Thread.new do
+        each.times do |i|
+          Thread.pass until eq.push([ t, i ])
+        end
+      end
+    end
+    seen = Hash.new { |h, k| h[k] = [] }
+    while seen.values.sum(&:size) < nr * each
+      eq.take_all.each { |t, i| seen[t] << i }
+    end
+    producers.each(&:join)
+    nr.times { |t| assert_equal (0...each).to_a, seen[t] }
+    assert_nil eq.take_all(true)
+  ensure
+    eq.close if eq
+  end
+
+  def test_gc
+    @eq.push('a' * 100)
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+    assert_equal [ 'a' * 100 ], @eq.take_all
+  end
+end if defined?(SleepyPenguin::EventQueue)
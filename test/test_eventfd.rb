@@ -61,4 +61,79 @@ class TestEventFD < Test::Unit::TestCase
     assert_equal true, efd.incr(1)
     assert_equal 1, efd.value
   end
+
+  def readable?(io)
+    !!IO.select([ io ], nil, nil, 0)
+  end
+
+  def test_shared
+    efd = EventFD.new(0, :SHARED)
+    flags = efd.fcntl(Fcntl::F_GETFL) & Fcntl::O_NONBLOCK
+    assert_equal(Fcntl::O_NONBLOCK, flags)
+    assert_equal true, efd.incr(1)
+    assert_equal 1, efd.value
+    assert_nil efd.value(true)
+    assert_equal true, efd.incr(9)
+    assert_equal 9, efd.value(true)
+    assert_equal true, efd.incr(0xfffffffffffffffe)
+    assert_equal false, efd.incr(1, true)
+    assert_equal 0xfffffffffffffffe, efd.value
+  end
+
+  def test_shared_semaphore
+    efd = EventFD.new(6, [ :SEMAPHORE, :SHARED ])
+    assert_equal true, readable?(efd)
+    6.times { assert_equal 1, efd.value }
+    assert_nil efd.value(true)
+    assert_equal false, readable?(efd)
+    assert_equal true, efd.incr(2)
+    assert_equal true, readable?(efd)
+    2.times { assert_equal 1, efd.value(true) }
+  end
+
+  def test_shared_doorbell
+    efd = EventFD.new(0, :SHARED)
+    assert_nil efd.value(true) # about to wait in Epoll or IO.select
+    assert_equal false, readable?(efd)
+    3.times { efd.incr(1) }
+    assert_equal true, readable?(efd)
+    assert_equal 3, efd.value(true)
+    assert_nil efd.value(true)
+    assert_equal false, readable?(efd), 'doorbell drained'
+
+    efd.incr(1)
+    assert_equal true, readable?(efd)
+    assert_equal 1, efd.value(true)
+
+    # the reader has not gone back to sleep, so these skip the doorbell
+    # and it stays readable from the last write
+    efd.incr(1)
+    efd.incr(1)
+    assert_equal 2, efd.value(true)
+  end
+
+  def test_shared_fork
+    efd = EventFD.new(0, :SHARED)
+    pid = fork do
+      n = efd.value
+      efd.incr(n + 1)
+      exit!(0)
+    end
+    sleep 0.05
+    efd.incr(41)
+    Process.waitpid(pid)
+    assert_predicate $?, :success?
+    assert_equal 42, efd.value
+  end
+
+  def test_shared_threads
+    efd = EventFD.new(0, :SHARED)
+    total = 0
+    th = Thread.new do
+      total += efd.value while total < 10000
+    end
+    4.times.map { Thread.new { 2500.times { efd.incr(1) } } }.each(&:join)
+    th.join
+    assert_equal 10000, total
+  end
 end if defined?(SleepyPenguin::EventFD)
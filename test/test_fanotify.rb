@@ -0,0 +1,114 @@
+require_relative 'helper'
+require 'fcntl'
+require 'tmpdir'
+require 'fileutils'
+
+class TestFanotify < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @dir = Dir.mktmpdir('fanotify')
+    @fan = nil
+  end
+
+  def teardown
+    @fan.close if @fan && !@fan.closed?
+    FileUtils.rm_rf(@dir)
+  end
+
+  def fanotify(*args)
+    @fan = Fanotify.new(*args)
+  rescue Errno::EPERM, Errno::EINVAL, Errno::ENOSYS => e
+    warn "fanotify unusable: #{e.message} (#{e.class})"
+    nil
+  end
+
+  # other processes may generate events on the same filesystem
+  def take_for(path)
+    begin
+      event = @fan.take
+    end until event.path == path
+    event
+  end
+
+  def test_new
+    fanotify or return
+    assert_kind_of IO, @fan
+    check_cloexec(@fan)
+    assert_raise(ArgumentError) { Fanotify.new(0x4) } # FAN_CLASS_CONTENT
+  end
+
+  def test_filesystem_mark
+    fanotify or return
+    begin
+      @fan.mark(@dir, [ :CREATE, :DELETE, :ONDIR ], :MARK_FILESYSTEM)
+    rescue Errno::ENODEV, Errno::EOPNOTSUPP, Errno::EXDEV => e
+      return warn("filesystem marks unsupported for #@dir: #{e.message}")
+    end
+
+    Dir.mkdir("#@dir/sub")
+    File.open("#@dir/sub/file", 'w').close
+    File.unlink("#@dir/sub/file")
+
+    event = take_for("#@dir/sub")
+    assert_kind_of Fanotify::Event, event
+    assert_equal [ :CREATE, :ONDIR ], event.events
+    assert_equal 'sub', event.name
+    assert_kind_of String, event.handle
+    assert_equal Process.pid, event.pid
+
+    seen = []
+    begin
+      event = take_for("#@dir/sub/file")
+      seen.concat(event.events)
+    end until seen.include?(:DELETE)
+    assert_equal [ :CREATE, :DELETE ], seen.sort
+    dir_handle = event.handle
+    assert_equal "#@dir/sub/x", @fan.resolve(dir_handle, 'x')
+
+    FileUtils.rm_rf("#@dir/sub")
+    assert_nil @fan.resolve(dir_handle)
+  end
+
+  def test_take_all_fd_mode
+    fanotify([ :CLOEXEC, :NONBLOCK ]) or return
+    @fan.mark(@dir, [ :OPEN, :CLOSE_WRITE, :EVENT_ON_CHILD ])
+    assert_nil @fan.take_all(true)
+    File.open("#@dir/a", 'w').close
+    events = @fan.take_all
+    # the kernel merges events on the same file
+    assert_equal [ :CLOSE_WRITE, :OPEN ], events.map(&:events).flatten.sort
+    events.each do |event|
+      assert_nil event.handle
+      assert_equal "#@dir/a", event.path
+    end
+    @fan.unmark(@dir, [ :OPEN, :CLOSE_WRITE, :EVENT_ON_CHILD ])
+    File.open("#@dir/a", 'w').close
+    assert_nil @fan.take(true)
+  end
+
+  def test_mark_unopenable
+    fanotify or return
+    require 'socket'
+    sock = UNIXServer.new("#@dir/sock")
+    # open(2) fails on sockets, so there is nothing to resolve with
+    assert_raise(Errno::ENXIO) { @fan.mark("#@dir/sock", :OPEN) }
+    assert_raise(Errno::ENOENT, 'no mark left behind') do
+      @fan.unmark("#@dir/sock", :OPEN)
+    end
+  ensure
+    sock.close if sock
+  end
+
+  def test_epoll
+    fanotify([ :CLOEXEC, :NONBLOCK ]) or return
+    @fan.mark(@dir, [ :CLOSE_WRITE, :EVENT_ON_CHILD ])
+    ep = Epoll.new
+    ep.add(@fan, Epoll::IN)
+    File.open("#@dir/b", 'w').close
+    ep.wait(1, 1000) { |_, io| assert_same @fan, io }
+    assert_equal "#@dir/b", @fan.take(true).path
+  ensure
+    ep.close if ep
+  end
+end if defined?(SleepyPenguin::Fanotify)
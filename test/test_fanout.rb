@@ -0,0 +1,158 @@
+# -*- encoding: binary -*-
+require_relative 'helper'
+
+class TestFanout < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @pipes = []
+  end
+
+  def teardown
+    @fanout.close if @fanout && !@fanout.closed?
+    @pipes.flatten.each { |io| io.close unless io.closed? }
+  end
+
+  def pipe
+    @pipes << IO.pipe
+    @pipes[-1]
+  end
+
+  def test_publish
+    src_rd, src_wr = pipe
+    subs = Array.new(3) { pipe }
+    @fanout = Fanout.new(src_rd)
+    subs.each { |_, wr| assert_same wr, @fanout.subscribe(wr) }
+
+    assert_equal :EAGAIN, @fanout.publish(nil, true)
+    src_wr.syswrite('hello')
+    assert_equal 5, @fanout.publish
+    subs.each { |rd, _| assert_equal 'hello', rd.read_nonblock(16) }
+    assert_equal :EAGAIN, @fanout.publish(nil, true)
+
+    src_wr.syswrite('world')
+    assert_equal 3, @fanout.publish(3)
+    assert_equal 2, @fanout.publish
+    subs.each { |rd, _| assert_equal 'world', rd.read_nonblock(16) }
+
+    src_wr.close
+    assert_nil @fanout.publish
+    @fanout.stats.each do |st|
+      assert_equal 10, st.bytes
+      assert_equal 0, st.skipped
+      assert_equal 0, st.lag
+      assert_equal false, st.dropped
+    end
+  end
+
+  def test_policies
+    src_rd, src_wr = pipe
+    fast_rd, fast_wr = pipe
+    skip_rd, skip_wr = pipe
+    drop_rd, drop_wr = pipe
+    @fanout = Fanout.new(src_rd)
+    @fanout.subscribe(fast_wr)
+    @fanout.subscribe(skip_wr, :skip)
+    @fanout.subscribe(drop_wr, :drop)
+    assert_raise(ArgumentError) { @fanout.subscribe(fast_wr, :bogus) }
+
+    # fill up the lagging subscribers
+    [ skip_wr, drop_wr ].each do |wr|
+      begin
+        wr.write_nonblock('.' * 4096)
+      rescue Errno::EAGAIN
+        break
+      end while true
+    end
+
+    src_wr.syswrite('abc')
+    assert_equal 3, @fanout.publish
+    assert_equal 'abc', fast_rd.read_nonblock(16)
+    fast, skip, drop = @fanout.stats
+    assert_equal [ :skip, 3, 0, false ],
+                 [ fast.policy, fast.bytes, fast.skipped, fast.dropped ]
+    assert_equal [ :skip, 0, 3, false ],
+                 [ skip.policy, skip.bytes, skip.skipped, skip.dropped ]
+    assert_equal [ :drop, 0, 3, true ],
+                 [ drop.policy, drop.bytes, drop.skipped, drop.dropped ]
+    assert_operator skip.lag, :>, 0
+
+    # drain the :skip subscriber, dropped subscribers stay dropped
+    begin
+      skip_rd.read_nonblock(65536)
+    rescue Errno::EAGAIN
+      break
+    end while true
+    src_wr.syswrite('def')
+    assert_equal 3, @fanout.publish
+    assert_equal 'def', skip_rd.read_nonblock(16)
+    assert_equal 3, @fanout.stats[2].skipped
+
+    assert_same drop_wr, @fanout.unsubscribe(drop_wr)
+    assert_nil @fanout.unsubscribe(drop_wr)
+    assert_equal 2, @fanout.stats.size
+  end
+
+  def test_block
+    src_rd, src_wr = pipe
+    slow_rd, slow_wr = pipe
+    @fanout = Fanout.new(src_rd)
+    @fanout.subscribe(slow_wr, :block)
+    filler = '.' * 4096
+    nr = 0
+    begin
+      nr += slow_wr.write_nonblock(filler)
+    rescue Errno::EAGAIN
+      break
+    end while true
+
+    src_wr.syswrite('blocked')
+    thr = Thread.new { @fanout.publish }
+    sleep 0.05
+    assert thr.alive?, 'publish blocks on a full :block subscriber'
+    assert_raise(RuntimeError) { @fanout.close }
+    assert_equal false, @fanout.closed?
+    assert_equal nr, slow_rd.read(nr).bytesize
+    assert_equal 7, thr.value
+    assert_equal 'blocked', slow_rd.read_nonblock(16)
+  end
+
+  def test_source_pipe_grows
+    src_rd, src_wr = pipe
+    slow_rd, slow_wr = pipe
+    @fanout = Fanout.new(src_rd)
+    @fanout.subscribe(slow_wr, :block)
+    src_wr.fcntl(SleepyPenguin::F_SETPIPE_SZ, 1 << 20)
+    data = (0...200_000).map { |i| (i % 251).chr }.join
+    assert_equal data.bytesize, src_wr.syswrite(data)
+    reader = Thread.new { slow_rd.read(data.bytesize) }
+    n = 0
+    while n < data.bytesize
+      n += @fanout.publish(1 << 20)
+    end
+    assert_equal data.bytesize, n
+    assert_equal data, reader.value
+    assert_equal data.bytesize, @fanout.stats[0].bytes
+  end if SleepyPenguin.const_defined?(:F_SETPIPE_SZ)
+
+  def test_epipe_drops
+    src_rd, src_wr = pipe
+    gone_rd, gone_wr = pipe
+    @fanout = Fanout.new(src_rd)
+    @fanout.subscribe(gone_wr, :block)
+    gone_rd.close
+    src_wr.syswrite('x')
+    assert_equal 1, @fanout.publish
+    assert_equal true, @fanout.stats[0].dropped
+  end
+
+  def test_close
+    src_rd, _ = pipe
+    @fanout = Fanout.new(src_rd)
+    assert_equal false, @fanout.closed?
+    assert_nil @fanout.close
+    assert_equal true, @fanout.closed?
+    assert_raise(IOError) { @fanout.publish }
+    assert_equal false, src_rd.closed?
+  end
+end if defined?(SleepyPenguin::Fanout)
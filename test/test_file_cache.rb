@@ -0,0 +1,175 @@
+require_relative 'helper'
+require 'fcntl'
+require 'tmpdir'
+require 'fileutils'
+
+class TestFileCache < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @dir = Dir.mktmpdir('file_cache')
+    @cache = FileCache.new(4)
+    @path = "#@dir/a"
+    File.write(@path, 'hello')
+  end
+
+  def teardown
+    @cache.close unless @cache.closed?
+    FileUtils.rm_rf(@dir)
+  end
+
+  def test_hit
+    check_cloexec(@cache)
+    entry = @cache.fetch(@path)
+    assert entry.frozen?
+    assert_equal @path, entry.path
+    assert_kind_of File, entry.io
+    assert_same entry.io, entry.to_io
+    check_cloexec(entry.io)
+    assert_equal 5, entry.stat.size
+    assert_same entry, @cache.fetch(@path)
+    assert_equal({ hits: 1, misses: 1, invalidated: 0, evicted: 0 },
+                 @cache.stats)
+    assert_equal 1, @cache.size
+  end
+
+  def test_sendfile
+    entry = @cache.fetch(@path)
+    r, w = IO.pipe
+    assert_equal 5, SleepyPenguin.linux_sendfile(w, entry, entry.stat.size,
+                                                 offset: 0)
+    assert_equal 'hello', r.read_nonblock(5)
+  ensure
+    r.close if r
+    w.close if w
+  end
+
+  def test_invalidate
+    entry = @cache.fetch(@path)
+    File.open(@path, 'ab') { |fp| fp.write(' world') }
+    assert_equal 1, @cache.sync(true)
+    tmp = @cache.fetch(@path)
+    assert_not_same entry, tmp
+    assert_equal 11, tmp.stat.size
+    assert_equal 1, @cache.stats[:invalidated]
+    assert_not_predicate entry.io, :closed?
+
+    File.chmod(0600, @path)
+    @cache.sync(true)
+    entry, tmp = tmp, @cache.fetch(@path)
+    assert_not_same entry, tmp
+
+    File.write("#@path.new", 'new')
+    File.rename("#@path.new", @path)
+    @cache.sync(true)
+    entry, tmp = tmp, @cache.fetch(@path)
+    assert_not_same entry, tmp
+    assert_equal 3, tmp.stat.size
+
+    File.unlink(@path)
+    @cache.sync(true)
+    assert_raise(Errno::ENOENT) { @cache.fetch(@path) }
+    assert_equal 0, @cache.size
+  end
+
+  def test_hardlink
+    File.link(@path, "#@dir/b")
+    a = @cache.fetch(@path)
+    b = @cache.fetch("#@dir/b")
+    File.open(@path, 'ab') { |fp| fp.write('!') }
+    assert_equal 2, @cache.sync(true)
+    assert_not_same a, @cache.fetch(@path)
+    assert_not_same b, @cache.fetch("#@dir/b")
+  end
+
+  def test_lru
+    paths = (0..4).map { |i| "#@dir/#{i}" }
+    paths.each { |path| File.write(path, path) }
+    entries = paths[0, 4].map { |path| @cache.fetch(path) }
+    @cache.fetch(paths[0]) # 1 is now the least recently used
+    @cache.fetch(paths[4])
+    assert_equal 4, @cache.size
+    assert_equal 1, @cache.stats[:evicted]
+    assert_same entries[0], @cache.fetch(paths[0])
+    assert_not_same entries[1], @cache.fetch(paths[1])
+
+    @cache.max_files = 2
+    assert_equal 2, @cache.size
+    assert_raise(ArgumentError) { @cache.max_files = 0 }
+    assert_equal 2, @cache.clear
+    assert_equal 0, @cache.size
+  end
+
+  def test_delete
+    entry = @cache.fetch(@path)
+    assert_same entry, @cache.delete(@path)
+    assert_nil @cache.delete(@path)
+    assert_not_same entry, @cache.fetch(@path)
+  end
+
+  def test_not_regular
+    assert_raise(Errno::EISDIR) { @cache.fetch(@dir) }
+    File.mkfifo("#@dir/fifo")
+    assert_raise(Errno::EINVAL) { @cache.fetch("#@dir/fifo") }
+    assert_equal 0, @cache.size
+  end
+
+  def test_epoll_sync
+    assert_equal false, @cache.autosync?
+    entry = @cache.fetch(@path)
+    File.open(@path, 'ab') { |fp| fp.write('!') }
+    assert_same entry, @cache.fetch(@path), 'hits read no events'
+    ep = Epoll.new
+    ep.add(@cache, Epoll::IN)
+    ep.wait(1, 1000) { |_, io| assert_same @cache, io }
+    assert_equal 1, @cache.sync(true)
+    assert_nil @cache.sync(true)
+    assert_not_same entry, @cache.fetch(@path)
+  ensure
+    ep.close if ep
+  end
+
+  def test_autosync
+    @cache.autosync = true
+    assert_equal true, @cache.autosync?
+    entry = @cache.fetch(@path)
+    File.open(@path, 'ab') { |fp| fp.write('!') }
+    assert_not_same entry, @cache.fetch(@path)
+    assert_equal 1, @cache.stats[:invalidated]
+  end
+
+  def test_shed
+    paths = (0..3).map { |i| "#@dir/#{i}" }
+    paths.each { |path| File.write(path, path) }
+    paths.each { |path| @cache.fetch(path) }
+    lim = Process.getrlimit(:NOFILE)
+    ios = []
+    begin
+      r, w = IO.pipe
+      Process.setrlimit(:NOFILE, w.fileno + 8, lim[1])
+      r.close
+      w.close
+      assert_raise(Errno::EMFILE, Errno::ENFILE) do
+        loop { ios << Inotify.new(:CLOEXEC) } # runs rb_sp_gc_for_fd
+      end
+    ensure
+      ios.each(&:close)
+      Process.setrlimit(:NOFILE, *lim)
+    end
+    assert_operator @cache.size, :<, 4
+    assert_operator @cache.stats[:evicted], :>=, 2
+
+    # watches of shed entries are released without events for them
+    @cache.sync(true)
+    fdinfo = "/proc/self/fdinfo/#{@cache.fileno}"
+    if File.readable?(fdinfo)
+      watches = File.readlines(fdinfo).grep(/\Ainotify wd:/).size
+      assert_equal @cache.size, watches
+    end
+  end
+
+  def test_undefined
+    assert_raise(NoMethodError) { @cache.add_watch(@dir, :CREATE) }
+    assert_raise(NoMethodError) { @cache.take }
+  end
+end if defined?(SleepyPenguin::FileCache)
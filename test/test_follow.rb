@@ -0,0 +1,123 @@
+require_relative 'helper'
+require 'tmpdir'
+require 'fileutils'
+
+class TestFollow < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @dir = Dir.mktmpdir('follow')
+    @path = "#@dir/log"
+    @r, @w = IO.pipe
+    @follow = Follow.new(@w, checkpoint: "#@dir/ckpt")
+  end
+
+  def teardown
+    @follow.close unless @follow.to_io.closed?
+    @r.close
+    @w.close
+    FileUtils.rm_rf(@dir)
+  end
+
+  def append(path, str)
+    File.open(path, 'ab') { |fp| fp.write(str) }
+  end
+
+  def drain
+    n = 0
+    while x = @follow.poll(true)
+      n += x
+    end
+    n
+  end
+
+  def test_from_end_and_start
+    File.write(@path, "old\n")
+    assert_equal 0, @follow.add(@path)
+    assert_equal({ @path => 4 }, @follow.offsets)
+    append(@path, "new\n")
+    assert_equal 4, drain
+    assert_equal "new\n", @r.read_nonblock(100)
+
+    File.write("#@dir/b", "hello")
+    assert_equal 5, @follow.add("#@dir/b", from: :start)
+    assert_equal "hello", @r.read_nonblock(100)
+    assert_raise(ArgumentError) { @follow.add(@path) }
+  end
+
+  def test_created_later
+    assert_equal 0, @follow.add(@path)
+    assert_equal({ @path => nil }, @follow.offsets)
+    append(@path, "hi\n")
+    drain
+    assert_equal "hi\n", @r.read_nonblock(100)
+  end
+
+  def test_rotate
+    File.write(@path, '')
+    @follow.add(@path)
+    append(@path, "a\n")
+    File.rename(@path, "#@path.1")
+    append("#@path.1", "b\n") # writer has not reopened, yet
+    File.chmod(0600, "#@path.1")
+    drain
+    assert_equal "a\nb\n", @r.read_nonblock(100)
+    append(@path, "c\n")
+    drain
+    assert_equal "c\n", @r.read_nonblock(100)
+    append("#@path.1", "lost\n") # old file is no longer followed
+    assert_equal 0, drain
+  end
+
+  def test_delete
+    File.write(@path, '')
+    @follow.add(@path)
+    File.open(@path, 'ab') do |fp| # writer keeps the deleted file open
+      fp.write("a\n")
+      fp.flush
+      File.unlink(@path)
+      drain
+      assert_equal "a\n", @r.read_nonblock(100)
+      assert_equal({ @path => nil }, @follow.offsets)
+      fds = Dir["/proc/self/fd/*"] - [ "/proc/self/fd/#{fp.fileno}" ]
+      open = fds.map { |fd| File.readlink(fd) rescue nil }
+      assert_not_include open, "#@path (deleted)", 'deleted file closed'
+    end
+    append(@path, "b\n")
+    drain
+    assert_equal "b\n", @r.read_nonblock(100)
+  end
+
+  def test_truncate
+    File.write(@path, '')
+    @follow.add(@path)
+    append(@path, "0123456789")
+    drain
+    File.truncate(@path, 0)
+    append(@path, "ab")
+    drain
+    assert_equal "0123456789ab", @r.read_nonblock(100)
+    assert_equal 2, @follow.offsets[@path]
+  end
+
+  def test_checkpoint
+    File.write(@path, "abc")
+    @follow.add(@path, from: :start)
+    @follow.close
+    assert_equal "abc", @r.read_nonblock(100)
+
+    append(@path, "def")
+    follow = Follow.new(@w, checkpoint: "#@dir/ckpt")
+    assert_equal 3, follow.add(@path)
+    assert_equal "def", @r.read_nonblock(100)
+    follow.close
+
+    # replaced file, checkpoint offset must not apply
+    File.write("#@path.new", "xyz")
+    File.rename("#@path.new", @path)
+    follow = Follow.new(@w, checkpoint: "#@dir/ckpt")
+    assert_equal 3, follow.add(@path, from: :start)
+    assert_equal "xyz", @r.read_nonblock(100)
+    follow.close
+  end
+end if defined?(SleepyPenguin::Follow)
@@ -2,6 +2,8 @@ require_relative 'helper'
 require 'fcntl'
 require 'tempfile'
 require 'set'
+require 'tmpdir'
+require 'fileutils'
 
 class TestInotify < Test::Unit::TestCase
   include SleepyPenguin
@@ -21,7 +23,7 @@ class TestInotify < Test::Unit::TestCase
   def test_constants
     (Inotify.constants - IO.constants).each do |const|
       case const.to_sym
-      when :Event, :Enumerator
+      when :Event, :Enumerator, :Tree, :Rename, :Batch, :Hub
       else
         nr = Inotify.const_get(const)
         assert nr <= 0xffffffff, "#{const}=#{nr}"
@@ -102,6 +104,103 @@ class TestInotify < Test::Unit::TestCase
     assert_equal 0, nr
   end
 
+  def test_take_all
+    ino = Inotify.new :CLOEXEC
+    tmp = Tempfile.new 'take_all'
+    wd = ino.add_watch tmp.path, [ :OPEN, :CLOSE_NOWRITE ]
+    3.times { File.open(tmp.path).close }
+    events = ino.take_all
+    assert_equal 6, events.size
+    events.each_slice(2) do |a, b|
+      assert_kind_of Inotify::Event, a
+      assert_equal wd, a.wd
+      assert_equal [:OPEN], a.events
+      assert_equal [:CLOSE_NOWRITE], b.events
+    end
+    assert_nil ino.take_all(true)
+    assert_equal [], ino.instance_variable_get(:@inotify_tmp)
+
+    # leftovers from take are returned first
+    File.open(tmp.path).close
+    assert_equal [:OPEN], ino.take.events
+    rest = ino.take_all(true)
+    assert_equal 1, rest.size
+    assert_equal [:CLOSE_NOWRITE], rest[0].events
+    assert_nil ino.take(true)
+  end
+
+  def test_each_batch
+    ino = Inotify.new :CLOEXEC
+    tmp = Tempfile.new 'each_batch'
+    ino.add_watch tmp.path, [ :OPEN, :CLOSE_NOWRITE ]
+    nr = 0
+    File.open(tmp.path).close
+    ino.each_batch do |events|
+      assert_kind_of Array, events
+      nr += events.size
+      break if nr >= 2
+    end
+    assert_equal 2, nr
+  end
+
+  def test_buffer_size
+    ino = Inotify.new :CLOEXEC
+    assert_equal 16384, ino.buffer_size
+    assert_raise(ArgumentError) { ino.buffer_size = 1 }
+    ino.buffer_size = 1 << 20
+    assert_equal 1 << 20, ino.buffer_size
+
+    # too small for the name, the buffer is grown as needed
+    ino.buffer_size = 16
+    dir = Dir.mktmpdir
+    ino.add_watch dir, :CREATE
+    File.open("#{dir}/#{'a' * 200}", 'w').close
+    event = ino.take
+    assert_equal 'a' * 200, event.name
+  ensure
+    FileUtils.rm_rf(dir) if dir
+  end
+
+  def test_take_batch
+    ino = Inotify.new :CLOEXEC
+    dir = Dir.mktmpdir('batch')
+    wd = ino.add_watch dir, [ :CREATE, :CLOSE_WRITE ]
+    %w(a b a).each { |name| File.open("#{dir}/#{name}", 'w').close }
+    batch = ino.take_batch
+    assert_kind_of Inotify::Batch, batch
+    assert_equal 5, batch.size
+    events = batch.each(:CREATE).to_a
+    assert_equal %w(a b), events.map(&:name)
+    assert_equal [ wd, wd ], events.map(&:wd)
+    assert_equal [ [:CREATE] ] * 2, events.map(&:events)
+    names = batch.map(&:name)
+    assert_equal %w(a a b b a), names
+    assert names.all?(&:frozen?)
+    assert_same names[0], names[4]
+    assert_nil ino.take_batch(true)
+
+    # leftovers from take are returned first
+    File.open("#{dir}/#{"long" * 20}", 'w').close
+    assert_equal [:CREATE], ino.take.events
+    batch = ino.take_batch(true)
+    assert_equal 1, batch.size
+    event = batch.first
+    assert_equal [:CLOSE_WRITE], event.events
+    assert_equal "long" * 20, event.name
+    assert_raise(TypeError) { Inotify::Batch.new }
+  ensure
+    FileUtils.rm_rf(dir) if dir
+  end
+
+  def test_events_cached
+    ev = Inotify::Event.new(1, Inotify::CREATE|Inotify::ISDIR, 0, nil)
+    a = ev.events
+    assert_equal [ :CREATE, :ISDIR ], a
+    a << :mutated
+    assert_equal [ :CREATE, :ISDIR ], ev.events
+    refute ev.events.frozen?
+  end
+
   def test_rm_watch
     ino = Inotify.new Inotify::CLOEXEC
     tmp = Tempfile.new 'a'
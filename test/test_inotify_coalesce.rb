@@ -0,0 +1,117 @@
+require_relative 'helper'
+require 'fcntl'
+require 'tmpdir'
+require 'fileutils'
+
+class TestInotifyCoalesce < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @dir = Dir.mktmpdir('coalesce')
+    @ino = Inotify.new(:CLOEXEC)
+  end
+
+  def teardown
+    @ino.close unless @ino.closed?
+    FileUtils.rm_rf(@dir)
+  end
+
+  def test_window
+    assert_nil @ino.coalesce_window
+    assert_nil @ino.coalesce_timer
+    @ino.coalesce_window = 0.25
+    assert_in_delta 0.25, @ino.coalesce_window, 0.000001
+    assert_kind_of TimerFD, @ino.coalesce_timer
+    check_cloexec(@ino.coalesce_timer)
+    assert_raise(ArgumentError) { @ino.coalesce_window = -1 }
+    timer = @ino.coalesce_timer
+    @ino.coalesce_window = nil
+    assert_nil @ino.coalesce_window
+    assert timer.closed?
+  end
+
+  def test_merge
+    @ino.add_watch(@dir, [ :CREATE, :MODIFY, :CLOSE_WRITE ])
+    @ino.coalesce_window = 0.1
+    t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    File.open("#@dir/a", 'w') { |fp| 3.times { fp.syswrite('.') } }
+    File.open("#@dir/b", 'w').close
+    assert_nil @ino.take(true)
+
+    events = @ino.take_all
+    elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+    assert_operator elapsed, :>=, 0.1
+    assert_equal %w(a b), events.map(&:name)
+    assert_equal [ :MODIFY, :CLOSE_WRITE, :CREATE ], events[0].events
+    assert_equal [ :CLOSE_WRITE, :CREATE ], events[1].events
+    assert_nil @ino.take(true)
+  end
+
+  def test_rename
+    File.open("#@dir/old", 'w').close
+    @ino.add_watch(@dir, :MOVE)
+    @ino.coalesce_window = 0.05
+    File.rename("#@dir/old", "#@dir/new")
+    event = @ino.take
+    assert_kind_of Inotify::Rename, event
+    assert_equal 'new', event.name
+    assert_equal 'old', event.from_name
+    assert_equal event.wd, event.from_wd
+    assert_equal [ :MOVED_FROM, :MOVED_TO ], event.events
+  end
+
+  def test_ignored_flushes
+    @ino.add_watch(@dir, :CLOSE_WRITE)
+    @ino.coalesce_window = 60
+    File.open("#@dir/a", 'w').close
+    FileUtils.rm_rf(@dir)
+    events = @ino.take_all
+    assert_equal [ 'a', nil ], events.map(&:name)
+    assert_equal [ :IGNORED ], events[1].events
+  end
+
+  def test_timer_epoll
+    @ino.add_watch(@dir, :CLOSE_WRITE)
+    @ino.coalesce_window = 0.05
+    ep = Epoll.new
+    ep.add(@ino, Epoll::IN)
+    ep.add(@ino.coalesce_timer, Epoll::IN)
+    File.open("#@dir/a", 'w').close
+    ep.wait(1, 1000) { |_, io| assert_same @ino, io }
+    assert_nil @ino.take_all(true)
+    ep.wait(1, 1000) { |_, io| assert_same @ino.coalesce_timer, io }
+    assert_equal [ 'a' ], @ino.take_all(true).map(&:name)
+    assert_equal 0, ep.wait(1, 100) { flunk 'timer still armed' }
+  ensure
+    ep.close if ep
+  end
+
+  def test_flush
+    @ino.add_watch(@dir, :CLOSE_WRITE)
+    @ino.coalesce_window = 60
+    File.open("#@dir/a", 'w').close
+    File.open("#@dir/b", 'w').close
+    assert_equal %w(a b), @ino.flush.map(&:name)
+    assert_equal [], @ino.flush
+  end
+
+  def test_disable_keeps_events
+    @ino.add_watch(@dir, :CLOSE_WRITE)
+    @ino.coalesce_window = 60
+    File.open("#@dir/a", 'w').close
+    File.open("#@dir/b", 'w').close
+    assert_nil @ino.take(true)
+    @ino.coalesce_window = nil
+    assert_equal 'a', @ino.take.name
+    assert_equal 'b', @ino.take.name
+    assert_nil @ino.take(true)
+  end
+
+  def test_tree
+    tree = Inotify::Tree.new
+    assert_raise(NoMethodError) { tree.coalesce_window = 1 }
+  ensure
+    tree.close if tree
+  end
+end if defined?(SleepyPenguin::Inotify) &&
+       SleepyPenguin::Inotify.method_defined?(:coalesce_window=)
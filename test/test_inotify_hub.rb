@@ -0,0 +1,179 @@
+require_relative 'helper'
+require 'fcntl'
+require 'tmpdir'
+require 'fileutils'
+
+class TestInotifyHub < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @dir = Dir.mktmpdir('hub')
+    @hub = Inotify::Hub.new(:CLOEXEC)
+  end
+
+  def teardown
+    @hub.close unless @hub.closed?
+    FileUtils.rm_rf(@dir)
+  end
+
+  def drain
+    n = 0
+    while x = @hub.dispatch(true)
+      n += x
+    end
+    n
+  end
+
+  def test_shared_watch
+    a, b = [], []
+    sub_a = @hub.subscribe { |event| a << event }
+    sub_b = @hub.subscribe { |event| b << event }
+    wd_a = sub_a.add_watch(@dir, :CREATE)
+    wd_b = sub_b.add_watch(@dir, [ :CREATE, :CLOSE_WRITE ])
+    assert_equal wd_a, wd_b
+    assert_equal 1, @hub.watches
+
+    File.open("#@dir/x", 'w').close
+    assert_equal 2, drain
+    assert_equal [ [ :CREATE ] ], a.map(&:events)
+    assert_equal [ [ :CREATE ], [ :CLOSE_WRITE ] ], b.map(&:events)
+    assert_same a[0], b[0]
+    assert a[0].frozen?
+    assert_equal 'x', a[0].name
+  end
+
+  def test_unwanted_dropped
+    got = []
+    sub = @hub.subscribe { |event| got << event }
+    sub.add_watch(@dir, :DELETE)
+    File.open("#@dir/x", 'w').close
+    assert_nil @hub.dispatch(true)
+    File.unlink("#@dir/x")
+    assert_equal 1, @hub.dispatch
+    assert_equal [ [ :DELETE ] ], got.map(&:events)
+  end
+
+  def test_replace_and_mask_add
+    got = []
+    sub = @hub.subscribe { |event| got << event.events }
+    sub.add_watch(@dir, :CREATE)
+    sub.add_watch(@dir, :CLOSE_WRITE)
+    File.open("#@dir/x", 'w').close
+    drain
+    assert_equal [ [ :CLOSE_WRITE ] ], got
+    got.clear
+    sub.add_watch(@dir, [ :CREATE, :MASK_ADD ])
+    File.open("#@dir/y", 'w').close
+    drain
+    assert_equal [ [ :CREATE ], [ :CLOSE_WRITE ] ], got
+  end
+
+  def test_rm_watch_and_close
+    a, b = [], []
+    sub_a = @hub.subscribe { |event| a << event }
+    sub_b = @hub.subscribe { |event| b << event }
+    wd = sub_a.add_watch(@dir, :CREATE)
+    sub_b.add_watch(@dir, :CREATE)
+    assert_equal 0, sub_a.rm_watch(wd)
+    assert_raise(Errno::EINVAL) { sub_a.rm_watch(wd) }
+    assert_equal 1, @hub.watches
+    File.open("#@dir/x", 'w').close
+    drain
+    assert_equal [], a
+    assert_equal 1, b.size
+
+    sub_b.close
+    assert sub_b.closed?
+    assert_raise(IOError) { sub_b.add_watch(@dir, :CREATE) }
+    assert_equal 0, @hub.watches
+    File.open("#@dir/y", 'w').close
+    drain
+    assert_equal 1, b.size
+  end
+
+  def test_reuse_closed_slot
+    old, a, b = [], [], []
+    sub_old = @hub.subscribe { |event| old << event }
+    sub_a = @hub.subscribe { |event| a << event }
+    sub_old.add_watch(@dir, :CREATE)
+    sub_old.close
+    100.times { @hub.subscribe { }.close }
+    sub_b = @hub.subscribe { |event| b << event } # takes the freed slot
+    sub_b.add_watch(@dir, :DELETE)
+    sub_a.add_watch(@dir, :CREATE)
+    File.open("#@dir/x", 'w').close
+    File.unlink("#@dir/x")
+    drain
+    assert_equal [], old
+    assert_equal [ [ :CREATE ] ], a.map(&:events)
+    assert_equal [ [ :DELETE ] ], b.map(&:events)
+    sub_a.close
+    File.open("#@dir/y", 'w').close
+    File.unlink("#@dir/y")
+    drain
+    assert_equal 1, a.size
+    assert_equal 2, b.size
+  end
+
+  def test_ignored
+    got = []
+    sub = @hub.subscribe { |event| got << event.events }
+    sub.add_watch("#@dir", :CREATE)
+    FileUtils.rm_rf(@dir)
+    drain
+    assert_equal [ [ :IGNORED ] ], got
+    assert_equal 0, @hub.watches
+  end
+
+  def test_raise_keeps_queue
+    calls = 0
+    sub = @hub.subscribe do |event|
+      calls += 1
+      raise 'boom' if calls == 1
+    end
+    sub.add_watch(@dir, :CREATE)
+    File.open("#@dir/x", 'w').close
+    File.open("#@dir/y", 'w').close
+    assert_raise(RuntimeError) { @hub.dispatch }
+    assert_equal 1, @hub.dispatch(true)
+    assert_equal 2, calls
+  end
+
+  def test_forbidden
+    sub = @hub.subscribe { }
+    assert_raise(ArgumentError) { sub.add_watch(@dir, [ :CREATE, :ONESHOT ]) }
+    assert_raise(NoMethodError) { @hub.add_watch(@dir, :CREATE) }
+    assert_raise(NoMethodError) { @hub.take }
+    assert_raise(LocalJumpError) { @hub.subscribe }
+  end
+
+  def test_default
+    hub = Inotify::Hub.default
+    assert_kind_of Inotify::Hub, hub
+    assert_same hub, Inotify::Hub.default
+    check_cloexec(hub)
+    r, w = IO.pipe
+    pid = fork do
+      w.write(Inotify::Hub.default.equal?(hub) ? 'same' : 'new')
+      exit!(0)
+    end
+    w.close
+    _, status = Process.waitpid2(pid)
+    assert status.success?
+    assert_equal 'new', r.read
+  ensure
+    r.close if r
+  end
+
+  def test_epoll
+    sub = @hub.subscribe { }
+    sub.add_watch(@dir, :CREATE)
+    ep = Epoll.new
+    ep.add(@hub, Epoll::IN)
+    File.open("#@dir/x", 'w').close
+    ep.wait(1, 1000) { |_, io| assert_same @hub, io }
+    assert_equal 1, @hub.dispatch(true)
+  ensure
+    ep.close if ep
+  end
+end if defined?(SleepyPenguin::Inotify::Hub)
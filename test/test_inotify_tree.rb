@@ -0,0 +1,165 @@
+require_relative 'helper'
+require 'tmpdir'
+require 'fileutils'
+
+class TestInotifyTree < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @dir = Dir.mktmpdir('tree')
+    @tree = Inotify::Tree.new(:CLOEXEC)
+  end
+
+  def teardown
+    @tree.close unless @tree.closed?
+    FileUtils.rm_rf(@dir)
+  end
+
+  def drain
+    events = []
+    while batch = @tree.take_all(true)
+      events.concat(batch)
+    end
+    events
+  end
+
+  def test_add_tree
+    FileUtils.mkdir_p("#{@dir}/a/b/c")
+    FileUtils.mkdir_p("#{@dir}/d")
+    File.open("#{@dir}/a/file", 'w').close
+    File.symlink("#{@dir}/a", "#{@dir}/link")
+    wd = @tree.add_tree("#{@dir}/", :CLOSE_WRITE)
+    assert_kind_of Integer, wd
+    assert_equal 5, @tree.watches
+    assert_equal @dir, @tree.path(wd)
+    assert_equal "#{@dir}/x", @tree.path(wd, 'x')
+    assert_nil @tree.path(wd + 1000)
+
+    File.open("#{@dir}/a/b/c/new", 'w').close
+    event = @tree.take
+    assert_kind_of Inotify::Tree::Event, event
+    assert_kind_of Inotify::Event, event
+    assert_equal [ :CLOSE_WRITE ], event.events
+    assert_equal "#{@dir}/a/b/c/new", event.path
+    assert_nil @tree.take(true)
+  end
+
+  def test_new_subdirectories
+    @tree.add_tree(@dir, [ :CREATE, :CLOSE_WRITE ])
+    Dir.mkdir("#{@dir}/sub")
+    event = @tree.take
+    assert_equal [ :CREATE, :ISDIR ], event.events
+    assert_equal "#{@dir}/sub", event.path
+    assert_equal 2, @tree.watches
+
+    File.open("#{@dir}/sub/file", 'w').close
+    paths = drain.map(&:path)
+    assert_equal [ "#{@dir}/sub/file" ] * 2, paths # CREATE + CLOSE_WRITE
+  end
+
+  def test_new_subdirectory_replaced_by_symlink
+    outside = Dir.mktmpdir('outside')
+    Dir.mkdir("#{outside}/deep")
+    @tree.add_tree(@dir, :CLOSE_WRITE)
+    Dir.mkdir("#{@dir}/sub")
+    Dir.rmdir("#{@dir}/sub") # before the tree sees the CREATE
+    File.symlink(outside, "#{@dir}/sub")
+    assert_nil @tree.take(true)
+    assert_equal 1, @tree.watches, 'symlink followed out of the tree'
+    File.open("#{outside}/deep/file", 'w').close
+    assert_nil @tree.take(true)
+  ensure
+    FileUtils.rm_rf(outside) if outside
+  end
+
+  def test_filtered
+    @tree.add_tree(@dir, :CLOSE_WRITE)
+    Dir.mkdir("#{@dir}/sub") # CREATE is only used internally
+    assert_nil @tree.take(true)
+    assert_equal 2, @tree.watches
+  end
+
+  def test_rename_and_move_out
+    FileUtils.mkdir_p("#{@dir}/in/old/deep")
+    out = Dir.mktmpdir('out')
+    @tree.add_tree("#{@dir}/in", :CLOSE_WRITE)
+    assert_equal 3, @tree.watches
+
+    File.rename("#{@dir}/in/old", "#{@dir}/in/new")
+    drain
+    assert_equal 3, @tree.watches
+    File.open("#{@dir}/in/new/deep/f", 'w').close
+    assert_equal [ "#{@dir}/in/new/deep/f" ], drain.map(&:path)
+
+    File.rename("#{@dir}/in/new", "#{out}/gone")
+    events = drain
+    assert_equal 1, @tree.watches
+    File.open("#{out}/gone/deep/f2", 'w').close
+    events.concat(drain)
+    assert_equal [], events.reject { |e| e.events == [ :IGNORED ] }
+  ensure
+    FileUtils.rm_rf(out) if out
+  end
+
+  def test_rm_watch
+    FileUtils.mkdir_p("#{@dir}/a/b")
+    wd = @tree.add_tree(@dir, :CLOSE_WRITE)
+    sub = @tree.add_tree("#{@dir}/a", :CLOSE_WRITE)
+    assert_equal 3, @tree.watches
+    assert_equal 0, @tree.rm_watch(sub)
+    assert_equal 1, @tree.watches
+    assert_equal @dir, @tree.path(wd)
+    assert_raise(Errno::EINVAL) { @tree.rm_watch(sub) }
+    assert_raise(NoMethodError) { @tree.add_watch(@dir, :OPEN) }
+    assert_raise(NoMethodError) { @tree.take_batch }
+  end
+
+  def test_rescan
+    FileUtils.mkdir_p("#{@dir}/a/b")
+    File.open("#{@dir}/a/f", 'w').close
+    File.open("#{@dir}/g", 'w').close
+    refute @tree.snapshot?
+    @tree.snapshot = true
+    assert @tree.snapshot?
+    @tree.add_tree(@dir, [ :CREATE, :DELETE, :MODIFY ])
+    assert_equal [], @tree.rescan
+
+    # changes nobody has read events for yet, as after IN_Q_OVERFLOW
+    File.open("#{@dir}/new", 'w').close
+    File.unlink("#{@dir}/a/f")
+    File.open("#{@dir}/tmp", 'w').close
+    File.rename("#{@dir}/tmp", "#{@dir}/g")
+    Dir.rmdir("#{@dir}/a/b")
+    FileUtils.mkdir_p("#{@dir}/c/d")
+
+    events = @tree.rescan
+    assert events.all? { |e| Inotify::Tree::Event === e }
+    got = events.map { |e| [ e.path, e.events ] }.sort
+    expect = [
+      [ "#{@dir}/a/b", [ :DELETE, :ISDIR ] ],
+      [ "#{@dir}/a/f", [ :DELETE ] ],
+      [ "#{@dir}/c", [ :CREATE, :ISDIR ] ],
+      [ "#{@dir}/g", [ :MODIFY ] ],
+      [ "#{@dir}/new", [ :CREATE ] ],
+    ]
+    assert_equal expect, got
+    assert_equal 4, @tree.watches # @dir, a, c, c/d
+    assert_equal [], @tree.rescan
+
+    # snapshots follow events as they are read
+    drain
+    File.open("#{@dir}/c/d/x", 'w').close
+    drain
+    assert_equal [], @tree.rescan
+  end
+
+  def test_rescan_without_snapshot
+    @tree.add_tree(@dir, :CREATE)
+    File.open("#{@dir}/x", 'w').close
+    assert_equal [], @tree.rescan
+  end
+
+  def test_missing
+    assert_raise(Errno::ENOENT) { @tree.add_tree("#{@dir}/nope", :OPEN) }
+  end
+end if defined?(SleepyPenguin::Inotify::Tree)
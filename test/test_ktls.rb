@@ -0,0 +1,64 @@
+# -*- encoding: binary -*-
+require_relative 'helper'
+require 'socket'
+require 'tempfile'
+
+class TestKTLS < Test::Unit::TestCase
+  PARAMS = {
+    cipher: :aes_gcm_128,
+    key: "\x01" * 16,
+    iv: "\x02" * 8,
+    salt: "\x03" * 4,
+    rec_seq: "\0" * 8,
+  }.freeze
+
+  def setup
+    @srv = TCPServer.new('127.0.0.1', 0)
+    @wr = TCPSocket.new('127.0.0.1', @srv.addr[1])
+    @rd = @srv.accept
+  end
+
+  def teardown
+    [ @srv, @wr, @rd ].each { |io| io.close unless io.closed? }
+  end
+
+  def ktls_enable(sock, **kw)
+    SleepyPenguin.ktls_enable(sock, **kw)
+  rescue Errno::ENOENT, Errno::ENOPROTOOPT => e
+    omit "kTLS not supported by kernel: #{e.message}"
+  end
+
+  def test_bad_params
+    bad = PARAMS.merge(key: 'short')
+    assert_raise(ArgumentError) do
+      SleepyPenguin.__ktls_set(@wr, SleepyPenguin::KTLS::TX,
+                               SleepyPenguin.__ktls_params(bad))
+    end
+    bad = PARAMS.reject { |k,_| k == :salt }
+    assert_raise(ArgumentError) do
+      SleepyPenguin.__ktls_set(@wr, SleepyPenguin::KTLS::TX,
+                               SleepyPenguin.__ktls_params(bad))
+    end
+  end
+
+  def test_round_trip
+    ktls_enable(@wr, tx: PARAMS)
+    assert_same @rd, ktls_enable(@rd, rx: PARAMS)
+
+    assert_equal 5, @wr.syswrite('hello')
+    assert_equal 'hello', @rd.readpartial(16)
+
+    tmp = Tempfile.new('ktls')
+    tmp.syswrite('sendfile over kTLS')
+    assert_equal 18, SleepyPenguin.linux_sendfile(@wr, tmp, 18, offset: 0)
+    assert_equal 'sendfile over kTLS', @rd.readpartial(32)
+
+    r, w = IO.pipe
+    w.syswrite('spliced')
+    assert_equal 7, SleepyPenguin.splice(r, @wr, 7)
+    assert_equal 'spliced', @rd.readpartial(16)
+  ensure
+    tmp.close! if tmp
+    [ r, w ].each { |io| io.close if io }
+  end
+end if SleepyPenguin.respond_to?(:ktls_enable)
@@ -0,0 +1,189 @@
+require_relative 'helper'
+require 'fcntl'
+require 'socket'
+
+class TestMemfd < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def test_new
+    fd = Memfd.new
+    assert_kind_of File, fd
+    check_cloexec(fd)
+    assert_equal 0, fd.size
+    assert_match %r{/memfd:sleepy_penguin}, File.readlink("/proc/self/fd/#{fd.fileno}")
+    fd.syswrite('hello')
+    assert_equal 5, fd.size
+    assert_equal 'hello', fd.pread(5, 0)
+  ensure
+    fd.close if fd
+  end
+
+  def test_seals
+    fd = Memfd.new('test', [ :CLOEXEC, :ALLOW_SEALING ])
+    assert_equal 0, fd.seals
+    fd.truncate(4096)
+    seals = fd.add_seals([ :SEAL_SHRINK, :SEAL_GROW ])
+    assert_equal Memfd::SEAL_SHRINK | Memfd::SEAL_GROW, seals
+    assert_equal seals, fd.seals
+    assert_raise(Errno::EPERM) { fd.truncate(0) }
+    assert_raise(Errno::EPERM) { fd.truncate(8192) }
+    fd.add_seals(Memfd::SEAL_SEAL)
+    assert_raise(Errno::EPERM) { fd.add_seals(:SEAL_WRITE) }
+  ensure
+    fd.close if fd
+  end
+
+  def test_seals_not_allowed
+    fd = Memfd.new('test', :CLOEXEC)
+    assert_equal Memfd::SEAL_SEAL, fd.seals
+    assert_raise(Errno::EPERM) { fd.add_seals(:SEAL_SHRINK) }
+  ensure
+    fd.close if fd
+  end
+end if defined?(SleepyPenguin::Memfd)
+
+class TestMemfdRing < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @ring = Memfd::Ring.new(128)
+  end
+
+  def teardown
+    @ring.ios.each { |io| io.close unless io.closed? }
+  end
+
+  def readable?(io)
+    !!IO.select([ io ], nil, nil, 0)
+  end
+
+  def test_new
+    assert_equal 128, @ring.capacity
+    assert_equal 65536, Memfd::Ring.new.capacity
+    memfd, data_io, space_io = @ring.ios
+    assert_kind_of Memfd, memfd
+    assert_kind_of EventFD, data_io
+    assert_kind_of EventFD, space_io
+    assert_same data_io, @ring.to_io
+    assert_same space_io, @ring.space_io
+    assert_equal 0, memfd.seals & Memfd::SEAL_SHRINK ^ Memfd::SEAL_SHRINK
+  end
+
+  def test_read_write
+    assert_nil @ring.read(true)
+    assert_equal true, @ring.write('hello')
+    assert_equal true, @ring.write('')
+    assert_equal 24, @ring.size # 4-byte length, 8-byte aligned
+    assert_equal 'hello', @ring.read
+    assert_equal '', @ring.read
+    assert_nil @ring.read(true)
+    assert_equal 0, @ring.size
+    assert_raise(ArgumentError) { @ring.write('x' * 125) }
+  end
+
+  def test_full_and_wrap
+    msg = 'x' * 20 # 24 bytes each in the ring
+    n = 0
+    n += 1 while @ring.write(msg, true)
+    assert_equal 5, n
+    assert_equal false, readable?(@ring.space_io)
+    assert_equal msg, @ring.read
+    assert_equal true, readable?(@ring.space_io), 'writer woken'
+
+    expect = [ msg ] * 4
+    500.times do |i|
+      str = i.to_s * (i % 13)
+      if @ring.write(str, true)
+        expect << str
+      else
+        assert_equal expect.shift, @ring.read(true)
+      end
+    end
+    expect.each { |str| assert_equal str, @ring.read(true) }
+    assert_nil @ring.read(true)
+  end
+
+  def test_doorbell_elided
+    assert_equal false, readable?(@ring.data_io)
+    @ring.write('x')
+    assert_equal true, readable?(@ring.data_io), 'new rings start armed'
+    assert_equal 'x', @ring.read
+    assert_equal false, readable?(@ring.data_io), 'doorbell not drained'
+
+    3.times { @ring.write('a') }
+    assert_equal false, readable?(@ring.data_io), 'reader never slept'
+    3.times { assert_equal 'a', @ring.read(true) }
+    assert_nil @ring.read(true)
+    @ring.write('b')
+    assert_equal true, readable?(@ring.data_io)
+    assert_equal 'b', @ring.read(true)
+  end
+
+  def test_fork
+    pid = fork do
+      sum = 0
+      while (msg = @ring.read) != 'quit'
+        sum += msg.to_i
+      end
+      @ring.write(sum.to_s)
+      exit!(0)
+    end
+    2000.times { |i| @ring.write(i.to_s) } # wraps and waits for space
+    @ring.write('quit')
+    Process.waitpid(pid)
+    assert_predicate $?, :success?
+    assert_equal (0...2000).sum.to_s, @ring.read
+  end
+
+  def test_send_io
+    a, b = UNIXSocket.pair
+    @ring.ios.each { |io| a.send_io(io) }
+    ios = 3.times.map { b.recv_io }
+    other = Memfd::Ring.open(*ios)
+    assert_equal 128, other.capacity
+    @ring.write('over a socket')
+    assert_equal 'over a socket', other.read
+    other.write('back')
+    assert_equal 'back', @ring.read(true)
+    ios.each(&:close)
+    assert_raise(ArgumentError) { Memfd::Ring.open(Memfd.new, *ios) }
+  ensure
+    [ a, b ].each { |s| s.close if s }
+  end
+
+  def test_epoll
+    ep = Epoll.new
+    ep.add(@ring, Epoll::IN)
+    th = Thread.new { 3.times { |i| @ring.write(i.to_s) } }
+    got = []
+    nr = ep.wait(1, 1000) do
+      while msg = @ring.read(true)
+        got << msg
+      end
+    end
+    assert_equal 1, nr
+    th.join
+    while msg = @ring.read(true)
+      got << msg
+    end
+    assert_equal %w(0 1 2), got
+  ensure
+    ep.close if ep
+  end
+
+  def test_epoll_one_per_wakeup
+    ep = Epoll.new
+    ep.add(@ring, Epoll::IN)
+    @ring.write('a')
+    @ring.write('b')
+    got = []
+    2.times do
+      assert_equal 1, ep.wait(1, 1000) { got << @ring.read(true) }
+    end
+    assert_equal %w(a b), got
+    assert_equal 0, @ring.size
+    assert_equal 0, ep.wait(1, 0) { flunk 'spurious wakeup' }
+  ensure
+    ep.close if ep
+  end
+end if defined?(SleepyPenguin::Memfd::Ring)
@@ -0,0 +1,119 @@
+require_relative 'helper'
+require 'socket'
+
+class TestMmsg < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @rd = UDPSocket.new
+    @rd.bind('127.0.0.1', 0)
+    @wr = UDPSocket.new
+    @wr.bind('127.0.0.1', 0)
+  end
+
+  def teardown
+    [ @rd, @wr ].each { |s| s.close unless s.closed? }
+  end
+
+  def recv_all(n, *args, **kw)
+    got = []
+    while got.size < n
+      IO.select([ @rd ], nil, nil, 5) or flunk 'timed out'
+      msgs = SleepyPenguin.recvmmsg(@rd, *args, **kw)
+      got.concat(msgs) if Array === msgs
+    end
+    got
+  end
+
+  def test_empty
+    assert_equal :wait_readable, SleepyPenguin.recvmmsg(@rd, 8, 1500)
+    assert_raise(ArgumentError) { SleepyPenguin.recvmmsg(@rd, 0, 1500) }
+    assert_raise(ArgumentError) { SleepyPenguin.recvmmsg(@rd, 8, 0) }
+    assert_equal 0, SleepyPenguin.sendmmsg(@wr, [])
+  end
+
+  def test_connected
+    @wr.connect(*@rd.addr.values_at(3, 1))
+    msgs = 10.times.map { |i| "msg #{i}" } << ''
+    assert_equal msgs.size, SleepyPenguin.sendmmsg(@wr, msgs)
+    assert_equal msgs, recv_all(msgs.size, 64, 1500)
+    assert_equal :wait_readable, SleepyPenguin.recvmmsg(@rd, 8, 1500)
+  end
+
+  def test_addrs
+    dst = Addrinfo.udp(*@rd.addr.values_at(3, 1))
+    msgs = %w(a bb ccc)
+    addrs = [ dst, dst.to_sockaddr, dst ]
+    assert_equal 3, SleepyPenguin.sendmmsg(@wr, msgs, addrs)
+    src = []
+    assert_equal msgs, recv_all(3, 8, 1500, addrs: src)
+    assert_equal 3, src.size
+    port, host = Socket.unpack_sockaddr_in(src[0])
+    assert_equal [ @wr.addr[1], '127.0.0.1' ], [ port, host ]
+    assert_raise(ArgumentError) { SleepyPenguin.sendmmsg(@wr, msgs, [ dst ]) }
+  end
+
+  def test_truncate_and_count
+    @wr.connect(*@rd.addr.values_at(3, 1))
+    assert_equal 4, SleepyPenguin.sendmmsg(@wr, [ 'x' * 100 ] * 4)
+    IO.select([ @rd ], nil, nil, 5)
+    got = SleepyPenguin.recvmmsg(@rd, 3, 10)
+    assert_equal [ 'x' * 10 ] * 3, got
+    assert_equal [ 'x' * 10 ], SleepyPenguin.recvmmsg(@rd, 3, 10)
+  end
+
+  def test_reuse_arrays
+    @wr.connect(*@rd.addr.values_at(3, 1))
+    addrs = [ :stale ]
+    segs = [ :stale ]
+    SleepyPenguin.sendmmsg(@wr, %w(a b))
+    assert_equal %w(a b), recv_all(2, 8, 1500, addrs: addrs, segments: segs)
+    assert_equal 2, addrs.size
+    assert_equal [ 0, 0 ], segs
+
+    ary_like = Object.new
+    def ary_like.to_ary; []; end
+    [ 'str', ary_like ].each do |bad|
+      assert_raise(TypeError) do
+        SleepyPenguin.recvmmsg(@rd, 8, 1500, addrs: bad)
+      end
+      assert_raise(TypeError) do
+        SleepyPenguin.recvmmsg(@rd, 8, 1500, segments: bad)
+      end
+    end
+  end
+
+  def test_gro
+    begin
+      @rd.setsockopt(Socket::SOL_UDP, UDP_GRO, 1)
+      @wr.setsockopt(Socket::SOL_UDP, UDP_SEGMENT, 100)
+    rescue Errno::ENOPROTOOPT, Errno::EINVAL
+      omit 'UDP GSO/GRO not supported'
+    end
+    @wr.connect(*@rd.addr.values_at(3, 1))
+    assert_equal 1, SleepyPenguin.sendmmsg(@wr, [ 'y' * 450 ])
+    segs = []
+    got = recv_all(1, 8, 65535, segments: segs)
+    assert_equal 'y' * 450, got.join
+    assert_include [ 0, 100 ], segs[0]
+  end
+
+  def test_epoll
+    ep = Epoll.new
+    ep.add(@rd, Epoll::IN)
+    @wr.connect(*@rd.addr.values_at(3, 1))
+    th = Thread.new { SleepyPenguin.sendmmsg(@wr, (0...32).map(&:to_s)) }
+    got = []
+    while got.size < 32
+      ep.wait(1, 5000) do |_, sock|
+        while Array === (msgs = SleepyPenguin.recvmmsg(sock, 64, 64))
+          got.concat(msgs)
+        end
+      end
+    end
+    assert_equal 32, th.value
+    assert_equal (0...32).map(&:to_s), got
+  ensure
+    ep.close if ep
+  end
+end if SleepyPenguin.respond_to?(:recvmmsg)
@@ -0,0 +1,101 @@
+require_relative 'helper'
+require 'fcntl'
+
+class TestPidFD < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @pidfd = nil
+  end
+
+  def teardown
+    @pidfd.close if @pidfd && !@pidfd.closed?
+  end
+
+  def spawn_pidfd(*args)
+    pid = fork do
+      trap(:TERM) { exit!(2) }
+      sleep
+    end
+    @pidfd = PidFD.new(pid, *args)
+  rescue Errno::ENOSYS
+    Process.kill(:KILL, pid)
+    Process.waitpid(pid)
+    omit 'pidfd_open(2) not supported'
+  end
+
+  def test_new
+    spawn_pidfd
+    assert_kind_of IO, @pidfd
+    check_cloexec(@pidfd)
+    assert_kind_of Integer, @pidfd.pid
+    assert_nil IO.select([ @pidfd ], nil, nil, 0)
+    assert_nil @pidfd.wait(true)
+    @pidfd.send_signal(:KILL)
+    assert_equal [ @pidfd ], IO.select([ @pidfd ], nil, nil, 10)[0]
+    status = @pidfd.wait
+    assert_kind_of Process::Status, status
+    assert_equal @pidfd.pid, status.pid
+    assert_equal Signal.list['KILL'], status.termsig
+    assert_same status, $?
+    assert_raise(Errno::ECHILD) { @pidfd.wait(true) }
+    assert_raise(Errno::ESRCH) { @pidfd.send_signal(0) }
+  end
+
+  def test_nonblock
+    spawn_pidfd(:NONBLOCK)
+    flags = @pidfd.fcntl(Fcntl::F_GETFL) & Fcntl::O_NONBLOCK
+    assert_equal Fcntl::O_NONBLOCK, flags
+    assert_nil @pidfd.wait(true)
+    @pidfd.send_signal('SIGTERM')
+    status = @pidfd.wait
+    assert_equal 2, status.exitstatus
+  rescue Errno::EINVAL
+    omit 'PIDFD_NONBLOCK not supported'
+  end
+
+  def test_send_signal_invalid
+    spawn_pidfd
+    assert_raise(ArgumentError) { @pidfd.send_signal(:NOSUCHSIG) }
+    @pidfd.send_signal(Signal.list['TERM'])
+    assert_equal 2, @pidfd.wait.exitstatus
+  end
+
+  def test_wait_in_thread
+    spawn_pidfd
+    th = Thread.new { @pidfd.wait }
+    Thread.pass until th.stop?
+    @pidfd.send_signal(:TERM)
+    assert_equal 2, th.value.exitstatus
+  end
+
+  def test_epoll
+    ep = Epoll.new
+    pidfds = 3.times.map do |i|
+      pid = fork { exit!(i) }
+      PidFD.new(pid)
+    end
+    pidfds.each { |pidfd| ep.add(pidfd, Epoll::IN) }
+    codes = []
+    while codes.size < pidfds.size
+      ep.wait(8, 10_000) do |_, pidfd|
+        codes << pidfd.wait(true).exitstatus
+        ep.del(pidfd)
+      end
+    end
+    assert_equal [ 0, 1, 2 ], codes.sort
+  rescue Errno::ENOSYS
+    omit 'pidfd_open(2) not supported'
+  ensure
+    ep.close if ep
+    pidfds.each(&:close) if pidfds
+  end
+
+  def test_not_child
+    @pidfd = PidFD.new(Process.pid)
+    assert_equal Process.pid, @pidfd.pid
+    assert_raise(Errno::ECHILD) { @pidfd.wait(true) }
+  rescue Errno::ENOSYS
+    omit 'pidfd_open(2) not supported'
+  end
+end if defined?(SleepyPenguin::PidFD)
@@ -0,0 +1,99 @@
+require_relative 'helper'
+require 'socket'
+
+class TestReuseport < Test::Unit::TestCase
+  include SleepyPenguin
+  BPF_RET_K = 0x06 # BPF_RET|BPF_K
+
+  def setup
+    @srvs = []
+    @clients = []
+    @accepted = []
+  end
+
+  def teardown
+    (@srvs + @clients + @accepted).each { |io| io.close unless io.closed? }
+  end
+
+  def group(n)
+    port = 0
+    n.times do
+      s = Socket.new(:INET, :STREAM)
+      s.setsockopt(:SOCKET, :REUSEPORT, true)
+      s.bind(Addrinfo.tcp('127.0.0.1', port))
+      s.listen(64)
+      port = s.local_address.ip_port
+      @srvs << s
+    end
+    port
+  rescue Errno::ENOPROTOOPT, SocketError
+    omit 'SO_REUSEPORT not supported'
+  end
+
+  # returns the index of the listener the connection was queued on
+  def connect_to(port)
+    @clients << TCPSocket.new('127.0.0.1', port)
+    ready = IO.select(@srvs, nil, nil, 5) or flunk 'nothing accepted'
+    assert_equal 1, ready[0].size
+    srv = ready[0][0]
+    @accepted << srv.accept[0]
+    @srvs.index(srv)
+  end
+
+  def in_thread
+    rv = Thread.new do
+      begin
+        [ yield ]
+      rescue => e
+        e
+      end
+    end.value
+    Exception === rv ? raise(rv) : rv[0]
+  end
+
+  def test_attach_cbpf
+    port = group(2)
+    assert_nil SleepyPenguin.reuseport_attach_cbpf(@srvs[0],
+                                                   [ [ BPF_RET_K, 0, 0, 1 ] ])
+    4.times { assert_equal 1, connect_to(port) }
+
+    packed = [ BPF_RET_K, 0, 0, 0 ].pack('SCCL')
+    SleepyPenguin.reuseport_attach_cbpf(@srvs[1], packed)
+    4.times { assert_equal 0, connect_to(port) }
+
+    assert_raise(ArgumentError) do
+      SleepyPenguin.reuseport_attach_cbpf(@srvs[0], 'bogus')
+    end
+    assert_raise(ArgumentError) do
+      SleepyPenguin.reuseport_attach_cbpf(@srvs[0], '')
+    end
+  end
+
+  def test_steer_by_cpu
+    port = group(2)
+    assert_nil SleepyPenguin.reuseport_steer_by_cpu(@srvs[0], 2)
+    assert_raise(ArgumentError) do
+      SleepyPenguin.reuseport_steer_by_cpu(@srvs[0], 0)
+    end
+    cpus = defined?(Sched) ? Sched.affinity.first(4) : [ nil ]
+    cpus.each do |cpu|
+      in_thread do
+        Sched.affinity = cpu if cpu
+        4.times do
+          idx = connect_to(port)
+          incoming = SleepyPenguin.incoming_cpu(@accepted[-1])
+          assert_equal cpu, incoming if cpu
+          assert_equal incoming % 2, idx
+        end
+      end
+    end
+  end
+
+  def test_incoming_cpu
+    port = group(1)
+    connect_to(port)
+    cpu = SleepyPenguin.incoming_cpu(@accepted[0])
+    assert_kind_of Integer, cpu
+    assert_operator cpu, :>=, -1
+  end
+end if SleepyPenguin.respond_to?(:reuseport_steer_by_cpu)
@@ -0,0 +1,85 @@
+require_relative 'helper'
+
+class TestSched < Test::Unit::TestCase
+  include SleepyPenguin
+
+  # every change happens in a new thread so it cannot leak into others
+  def in_thread
+    rv = Thread.new do
+      begin
+        [ yield ]
+      rescue => e
+        e
+      end
+    end.value
+    Exception === rv ? raise(rv) : rv[0]
+  end
+
+  def test_timerslack
+    orig = Sched.timerslack
+    assert_kind_of Integer, orig
+    assert_equal [ 1, 2_000 ], in_thread {
+      Sched.timerslack = 1
+      a = Sched.timerslack
+      Sched.timerslack = 2e-6
+      [ a, Sched.timerslack ]
+    }
+    assert_equal orig, Sched.timerslack
+    assert_raise(ArgumentError) { Sched.timerslack = -1 }
+  end
+
+  def test_affinity
+    orig = Sched.affinity
+    assert_kind_of Array, orig
+    assert_not_empty orig
+    cpu = orig.last
+    assert_equal [ [ cpu ], cpu ], in_thread {
+      Sched.affinity = cpu
+      [ Sched.affinity, Sched.getcpu ]
+    }
+    assert_equal orig, Sched.affinity
+    assert_equal orig, in_thread { Sched.affinity = orig; Sched.affinity }
+    assert_raise(ArgumentError) { Sched.affinity = [] }
+    assert_raise(ArgumentError) { Sched.affinity = -1 }
+  end
+
+  def test_getcpu
+    assert_include Sched.affinity, Sched.getcpu
+  end
+
+  def test_getattr
+    attr = Sched.getattr
+    assert_kind_of Sched::Attr, attr
+    assert_include [ Sched::OTHER, Sched::BATCH, Sched::IDLE ], attr.policy
+  end
+
+  def test_setattr_batch
+    nice = Sched.getattr.nice
+    attr = in_thread {
+      Sched.setattr(:batch, nice: nice)
+      Sched.getattr
+    }
+    assert_equal Sched::BATCH, attr.policy
+    assert_equal nice, attr.nice
+    assert_not_equal Sched::BATCH, Sched.getattr.policy
+  end
+
+  def test_setattr_fifo
+    attr = in_thread {
+      begin
+        Sched.setattr(:fifo, :reset_on_fork, priority: 1)
+        Sched.getattr
+      rescue Errno::EPERM
+      end
+    }
+    attr or return omit('no CAP_SYS_NICE for realtime policies')
+    assert_equal Sched::FIFO, attr.policy
+    assert_equal 1, attr.priority
+    assert_equal Sched::RESET_ON_FORK, attr.flags & Sched::RESET_ON_FORK
+  end
+
+  def test_setattr_invalid
+    assert_raise(Errno::EINVAL) { in_thread { Sched.setattr(:fifo) } }
+    assert_raise(NameError) { Sched.setattr(:bogus) }
+  end
+end if defined?(SleepyPenguin::Sched)
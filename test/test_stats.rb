@@ -0,0 +1,66 @@
+# -*- encoding: binary -*-
+require_relative 'helper'
+require 'tempfile'
+require 'socket'
+
+class TestStats < Test::Unit::TestCase
+  def delta(before, op, field)
+    SleepyPenguin.stats[op][field] - before[op][field]
+  end
+
+  def test_keys
+    stats = SleepyPenguin.stats
+    assert_equal [ :copy_file_range, :sendfile, :splice, :tee ],
+                 stats.keys.sort
+    stats.each_value do |h|
+      assert_equal [ :bytes, :calls, :eagain, :eintr, :fallback ], h.keys.sort
+      h.each_value { |v| assert_kind_of Integer, v }
+    end
+  end
+
+  def test_splice_tee
+    before = SleepyPenguin.stats
+    rda, wra = IO.pipe
+    rdb, wrb = IO.pipe
+    wra.syswrite('abcde')
+    assert_equal 5, SleepyPenguin.tee(rda, wrb, 5)
+    assert_equal 5, SleepyPenguin.splice(rdb, wra, 5)
+    assert_equal :EAGAIN, SleepyPenguin.splice(rdb, wra, 5, :nonblock,
+                                               exception: false)
+    assert_equal 1, delta(before, :tee, :calls)
+    assert_equal 5, delta(before, :tee, :bytes)
+    assert_equal 2, delta(before, :splice, :calls)
+    assert_equal 5, delta(before, :splice, :bytes)
+    assert_equal 1, delta(before, :splice, :eagain)
+  ensure
+    [ rda, wra, rdb, wrb ].each { |io| io.close if io }
+  end
+
+  def test_sendfile
+    before = SleepyPenguin.stats
+    rd, wr = UNIXSocket.pair
+    src = Tempfile.new('ruby_stats')
+    src.syswrite('hello')
+    assert_equal 5, SleepyPenguin.linux_sendfile(wr, src, 5, offset: 0)
+    assert_equal 1, delta(before, :sendfile, :calls)
+    assert_equal 5, delta(before, :sendfile, :bytes)
+  ensure
+    [ rd, wr ].each { |io| io.close if io }
+    src.close! if src
+  end
+
+  def test_threads_aggregate
+    before = SleepyPenguin.stats
+    Array.new(4) do
+      Thread.new do
+        ra, wa = IO.pipe
+        rb, wb = IO.pipe
+        wa.syswrite('x')
+        SleepyPenguin.splice(ra, wb, 1)
+        [ ra, wa, rb, wb ].each(&:close)
+      end
+    end.each(&:join)
+    assert_equal 4, delta(before, :splice, :calls)
+    assert_equal 4, delta(before, :splice, :bytes)
+  end
+end if SleepyPenguin.respond_to?(:stats)
@@ -0,0 +1,108 @@
+require_relative 'helper'
+require 'fcntl'
+
+class TestTimerWheel < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @wheel = TimerWheel.new(0.001)
+  end
+
+  def teardown
+    @wheel.close unless @wheel.closed?
+  end
+
+  def now
+    Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  end
+
+  def test_new
+    assert_kind_of TimerFD, @wheel
+    check_cloexec(@wheel)
+    assert_in_delta 0.001, @wheel.tick, 0.0000001
+    assert_equal 0, @wheel.size
+    assert_raise(ArgumentError) { TimerWheel.new(0) }
+    assert_raise(NoMethodError) { @wheel.settime(0, 0, 1) }
+  end
+
+  def test_expire_order
+    t0 = now
+    @wheel.add(0.03, :c)
+    @wheel.add(0.01, :a)
+    @wheel.add(0.01, :b)
+    timer = @wheel.add(0.02)
+    assert_equal 4, @wheel.size
+    assert_nil @wheel.expire(true)
+    got = []
+    got.concat(@wheel.expire) while got.size < 4
+    assert_operator now - t0, :>=, 0.03
+    assert_equal [ :a, :b, timer, :c ], got
+    assert_equal 0, @wheel.size
+    assert_not_predicate timer, :pending?
+  end
+
+  def test_batch
+    100.times { |i| @wheel.add(0.005, i) }
+    sleep 0.01
+    assert_equal (0...100).to_a, @wheel.expire(true)
+  end
+
+  def test_cancel_and_reset
+    a = @wheel.add(0.01, :a)
+    b = @wheel.add(0.02, :b)
+    assert a.pending?
+    assert_equal true, a.cancel
+    assert_equal false, a.cancel
+    assert_equal 1, @wheel.size
+    b.reset(0.05)
+    t0 = now
+    assert_equal [ :b ], @wheel.expire
+    assert_operator now - t0, :>=, 0.04
+    a.reset(0)
+    assert_equal [ :a ], @wheel.expire
+  end
+
+  def test_epoll
+    ep = Epoll.new
+    ep.add(@wheel, Epoll::IN)
+    @wheel.add(0.5, :late)
+    @wheel.add(0.01, :early) # rearms to an earlier deadline
+    t0 = now
+    ep.wait(1, 1000) { |_, io| assert_same @wheel, io }
+    assert_operator now - t0, :<, 0.4
+    assert_equal [ :early ], @wheel.expire(true)
+    assert_equal 0, ep.wait(1, 10) { flunk 'rearmed too early' }
+  ensure
+    ep.close if ep
+  end
+
+  # exercises cascading across levels without waiting, on a coarse wheel
+  def test_levels
+    @wheel.close
+    @wheel = TimerWheel.new(0.00001)
+    delays = [ 0.0001, 0.00064, 0.00065, 0.0041, 0.05, 0.0005, 0.03 ]
+    srand(1234)
+    20.times { delays << rand * 0.06 }
+    delays.each_with_index { |d, i| @wheel.add(d, [ d, i ]) }
+    got = []
+    got.concat(@wheel.expire) while got.size < delays.size
+    order = got.map(&:first)
+    # ticks are 10us, allow for rounding within one tick
+    order.each_cons(2) { |x, y| assert_operator x, :<=, y + 0.00001 }
+  end
+
+  def test_far_future
+    timer = @wheel.add(86400 * 365 * 5)
+    assert_nil @wheel.expire(true)
+    assert timer.pending?
+    assert timer.cancel
+  end
+
+  def test_gc
+    GC.start
+    @wheel.add(0.001, 'x' * 10)
+    GC.start
+    sleep 0.002
+    assert_equal [ 'x' * 10 ], @wheel.expire
+  end
+end if defined?(SleepyPenguin::TimerWheel)
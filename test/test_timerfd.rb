@@ -63,4 +63,58 @@ class TestTimerFD < Test::Unit::TestCase
     sleep 0.05
     assert_equal 1, tfd.expirations
   end
+
+  def test_rearm
+    tfd = TimerFD.new(:MONOTONIC)
+    assert_nil tfd.rearm(0.01)
+    assert_in_delta 0.01, tfd.gettime[1], 0.01
+    assert_nil tfd.rearm(10_000_000, 20_000_000) # nanoseconds
+    interval, value = tfd.gettime
+    assert_in_delta 0.02, interval, 0.001
+    assert_in_delta 0.01, value, 0.01
+    sleep 0.01
+    assert_equal 1, tfd.expirations
+    assert_nil tfd.rearm(0)
+    assert_equal [ 0, 0 ], tfd.gettime
+    assert_raise(ArgumentError) { tfd.rearm(-1) }
+  end
+
+  def test_rearm_abstime
+    tfd = TimerFD.new(:MONOTONIC)
+    now = Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+    assert_nil tfd.rearm(now + 10_000_000, abstime: true)
+    assert_in_delta 0.01, tfd.gettime[1], 0.01
+    sleep 0.01
+    assert_equal 1, tfd.expirations
+  end
+
+  def test_rearm_allocations
+    tfd = TimerFD.new(:MONOTONIC)
+    allocated = 2.times.map do # the first pass warms up call caches
+      before = GC.stat(:total_allocated_objects)
+      100.times { |i| tfd.rearm(1_000_000_000 + i, abstime: false) }
+      GC.stat(:total_allocated_objects) - before
+    end
+    assert_equal 0, allocated[1]
+  end
+
+  def test_expirations_batch
+    timers = Array.new(3) { TimerFD.new(:MONOTONIC) }
+    timers[0].rearm(1_000_000)
+    timers[2].rearm(1_000_000, 1_000_000)
+    assert_equal [ nil, nil, nil ], TimerFD.expirations_batch([ timers[1] ] * 3)
+    assert_equal Fcntl::O_NONBLOCK,
+                 timers[1].fcntl(Fcntl::F_GETFL) & Fcntl::O_NONBLOCK
+    sleep 0.01
+    res = TimerFD.expirations_batch(timers)
+    assert_equal 1, res[0]
+    assert_nil res[1]
+    assert_operator res[2], :>=, 1
+    assert_nil TimerFD.expirations_batch(timers)[0]
+    assert_equal [], TimerFD.expirations_batch([])
+    timers[1].close
+    assert_raise(IOError) { TimerFD.expirations_batch(timers) }
+  ensure
+    timers.each { |t| t.close unless t.closed? } if timers
+  end
 end if defined?(SleepyPenguin::TimerFD)
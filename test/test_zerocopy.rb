@@ -0,0 +1,82 @@
+# -*- encoding: binary -*-
+require_relative 'helper'
+require 'socket'
+require 'io/nonblock'
+
+class TestZerocopy < Test::Unit::TestCase
+  def setup
+    @srv = TCPServer.new('127.0.0.1', 0)
+    @wr = TCPSocket.new('127.0.0.1', @srv.addr[1])
+    @rd = @srv.accept
+  end
+
+  def teardown
+    [ @srv, @wr, @rd ].each { |io| io.close unless io.closed? }
+  end
+
+  def test_send_zerocopy
+    buf = 'x' * 65536
+    assert_equal 65536, SleepyPenguin.send_zerocopy(@wr, buf)
+    buf.replace('y' * 65536) # must not affect data in flight
+    assert_equal 'x' * 65536, @rd.read(65536)
+
+    pending = SleepyPenguin.zerocopy_pending(@wr)
+    assert_include [ 0, 1 ], pending, 'SO_ZEROCOPY may be unsupported'
+    ep = SleepyPenguin::Epoll.new
+    ep.add(@wr, :IN)
+    yielded = []
+    20.times do
+      break if SleepyPenguin.zerocopy_pending(@wr) == 0
+      ep.wait(8, 50) { |events, io| yielded << [ events, io ] }
+    end
+    assert_equal 0, SleepyPenguin.zerocopy_pending(@wr)
+    assert_equal [], yielded, 'completion-only EPOLLERR is hidden'
+
+    # loopback always copies, so the kernel tells us to stop bothering
+    assert_equal 65536, SleepyPenguin.send_zerocopy(@wr, buf)
+    assert_equal 0, SleepyPenguin.zerocopy_pending(@wr) if pending == 1
+    assert_equal buf, @rd.read(65536)
+    assert_equal 0, SleepyPenguin.zerocopy_reap(@wr)
+  ensure
+    ep.close if ep
+  end
+
+  def test_socket_error_with_completions
+    dead = UDPSocket.new
+    dead.bind('127.0.0.1', 0)
+    port = dead.addr[1]
+    dead.close
+    sock = UDPSocket.new
+    sock.connect('127.0.0.1', port)
+    assert_equal 32768, SleepyPenguin.send_zerocopy(sock, 'x' * 32768)
+    ep = SleepyPenguin::Epoll.new
+    ep.add(sock, SleepyPenguin::Epoll::ET)
+    yielded = []
+    ep.wait(8, 1000) { |events, io| yielded << [ events, io ] }
+    assert_equal [ [ SleepyPenguin::Epoll::ERR, sock ] ], yielded,
+                 'ECONNREFUSED is reported along with completions'
+    assert_equal Errno::ECONNREFUSED::Errno,
+                 sock.getsockopt(:SOCKET, :ERROR).int
+  ensure
+    ep.close if ep
+    sock.close if sock
+  end
+
+  def test_small_copies
+    assert_equal 5, SleepyPenguin.send_zerocopy(@wr, 'hello')
+    assert_equal 0, SleepyPenguin.zerocopy_pending(@wr)
+    assert_equal 'hello', @rd.read(5)
+  end
+
+  def test_nonblock
+    @wr.setsockopt(Socket::SOL_SOCKET, Socket::SO_SNDBUF, 4096)
+    buf = 'z' * 65536
+    rv = nil
+    @wr.nonblock = true
+    100.times do
+      rv = SleepyPenguin.send_zerocopy(@wr, buf, Socket::MSG_DONTWAIT)
+      break if rv == :wait_writable
+    end
+    assert_equal :wait_writable, rv
+  end
+end if SleepyPenguin.respond_to?(:send_zerocopy)
@@ -0,0 +1,358 @@
+#ifdef HAVE_SYS_EVENTFD_H
+#include "sleepy_penguin.h"
+#include <sys/eventfd.h>
+#include "sp_doorbell.h"
+
+/*
+ * A bounded multi-producer, single-consumer ring (Dmitry Vyukov's
+ * sequence-numbered cells) with the EventFD as its doorbell, so pushes
+ * to a busy consumer cost no syscalls.
+ */
+#define EQ_PAD 128 /* L1_CACHE_LINE_MAX in init.c */
+
+static ID id_ivar_queue;
+
+struct eq_cell {
+	size_t seq;
+	VALUE val;
+};
+
+struct event_queue {
+	struct eq_cell *cells;
+	size_t mask;
+
+	/* consumer-only */
+	size_t head;
+	struct sp_bell bell;
+	int waiting;
+	char pad0[EQ_PAD];
+
+	size_t tail; /* claimed by producers */
+	char pad1[EQ_PAD];
+
+	uint32_t sleeping;
+	char pad2[EQ_PAD];
+};
+
+/* producers hold the GVL, so no cell between head and tail is half-written */
+static void eq_mark(void *ptr)
+{
+	struct event_queue *q = ptr;
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	size_t i;
+
+	for (i = q->head; i != tail; i++)
+		rb_gc_mark(q->cells[i & q->mask].val);
+}
+
+static void eq_free(void *ptr)
+{
+	struct event_queue *q = ptr;
+
+	xfree(q->cells);
+	xfree(q);
+}
+
+static size_t eq_memsize(const void *ptr)
+{
+	const struct event_queue *q = ptr;
+
+	return sizeof(*q) + (q->mask + 1) * sizeof(struct eq_cell);
+}
+
+static const rb_data_type_t eq_type = {
+	"sleepy_penguin_event_queue",
+	{ eq_mark, eq_free, eq_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static struct event_queue *eq_get(VALUE self)
+{
+	return rb_check_typeddata(rb_ivar_get(self, id_ivar_queue), &eq_type);
+}
+
+static int eq_ready(struct event_queue *q)
+{
+	struct eq_cell *c = &q->cells[q->head & q->mask];
+
+	return __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) == q->head + 1;
+}
+
+static int eq_pop(struct event_queue *q, VALUE *val)
+{
+	struct eq_cell *c = &q->cells[q->head & q->mask];
+
+	if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != q->head + 1)
+		return 0;
+	*val = c->val;
+	c->val = Qnil;
+	__atomic_store_n(&c->seq, q->head + q->mask + 1, __ATOMIC_RELEASE);
+	q->head++;
+	return 1;
+}
+
+/*
+ * announces the consumer is about to sleep, returns false if a value
+ * was published before producers could have seen the announcement
+ */
+static int eq_arm(struct event_queue *q)
+{
+	sp_bell_arm(&q->bell, &q->sleeping);
+
+	return !eq_ready(q);
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::EventQueue.new([capacity[, flags]]) -> EventQueue
+ *
+ * Creates a queue holding up to +capacity+ (default: 1024, rounded up
+ * to a power of two) objects.  +flags+ may be :CLOEXEC as for
+ * EventFD.new, the descriptor is always non-blocking.
+ */
+static VALUE eq_s_new(int argc, VALUE *argv, VALUE klass)
+{
+	VALUE capa, flags, args[2], rv, tmp;
+	struct event_queue *q;
+	size_t n = 1024, i;
+
+	rb_scan_args(argc, argv, "02", &capa, &flags);
+	if (!NIL_P(capa)) {
+		long want = NUM2LONG(capa);
+
+		if (want <= 0 || want > (1L << 30))
+			rb_raise(rb_eArgError, "capacity out of range: %ld",
+				 want);
+		for (n = 2; n < (size_t)want; n <<= 1)
+			;
+	}
+
+	args[0] = INT2FIX(0);
+	args[1] = flags;
+	rv = rb_call_super(2, args);
+	rb_sp_set_nonblock(rb_sp_fileno(rv));
+
+	tmp = TypedData_Make_Struct(rb_cObject, struct event_queue,
+				    &eq_type, q);
+	q->cells = ALLOC_N(struct eq_cell, n);
+	q->mask = n - 1;
+	for (i = 0; i < n; i++) {
+		q->cells[i].seq = i;
+		q->cells[i].val = Qnil;
+	}
+
+	/* armed, so the first push wakes an Epoll waiting on a new queue */
+	q->sleeping = 1;
+	q->bell.armed = 1;
+	rb_ivar_set(rv, id_ivar_queue, tmp);
+
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	eq.push(obj) -> true or false
+ *
+ * Adds +obj+ to the queue, returns +false+ if the queue is full.  This
+ * never blocks, and only writes to the EventFD if the consumer is
+ * waiting for it.  Any number of threads may push concurrently.
+ */
+static VALUE eq_push(VALUE self, VALUE obj)
+{
+	struct event_queue *q = eq_get(self);
+	size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	struct eq_cell *c;
+
+	for (;;) {
+		size_t seq;
+		intptr_t diff;
+
+		c = &q->cells[pos & q->mask];
+		seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1,
+					1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return Qfalse;
+		} else {
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+	c->val = obj;
+	__atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+	sp_bell_ring(&q->sleeping, rb_sp_fileno(self));
+
+	return Qtrue;
+}
+
+struct eq_wait_args {
+	VALUE self;
+	struct event_queue *q;
+	int fd;
+};
+
+static VALUE eq_do_wait(VALUE p)
+{
+	struct eq_wait_args *a = (struct eq_wait_args *)p;
+
+	errno = EAGAIN;
+	if (!rb_sp_wait(rb_io_wait_readable, a->self, &a->fd))
+		rb_sys_fail("read(eventfd)");
+	return Qnil;
+}
+
+static VALUE eq_wait_done(VALUE p)
+{
+	((struct eq_wait_args *)p)->q->waiting = 0;
+	return Qnil;
+}
+
+static VALUE eq_take(VALUE self, VALUE nonblock, int all)
+{
+	struct eq_wait_args a;
+	VALUE rv, val;
+
+	a.self = self;
+	a.q = eq_get(self);
+	a.fd = rb_sp_fileno(self);
+	if (a.q->waiting)
+		rb_raise(rb_eThreadError, "another thread is waiting on %"
+			 PRIsVALUE", EventQueue has a single consumer", self);
+	for (;;) {
+		if (a.q->bell.armed)
+			sp_bell_disarm(&a.q->bell, &a.q->sleeping, a.fd);
+		rv = Qnil;
+		if (all) {
+			while (eq_pop(a.q, &val)) {
+				if (NIL_P(rv))
+					rv = rb_ary_new();
+				rb_ary_push(rv, val);
+			}
+		} else if (eq_pop(a.q, &val)) {
+			rv = val;
+		}
+
+		if (RTEST(nonblock)) {
+			/*
+			 * stay armed for Epoll, but a push may have been missed
+			 * between popping and arming
+			 */
+			if (eq_arm(a.q))
+				return rv;
+			if (NIL_P(rv))
+				continue;
+			sp_bell_self_ring(&a.q->bell, a.fd);
+			return rv;
+		}
+		if (!NIL_P(rv))
+			return rv;
+		if (!eq_arm(a.q))
+			continue;
+		a.q->waiting = 1;
+		rb_ensure(eq_do_wait, (VALUE)&a, eq_wait_done, (VALUE)&a);
+	}
+}
+
+/*
+ * call-seq:
+ *	eq.take([nonblock]) -> obj or nil
+ *
+ * Removes and returns the oldest object in the queue.  If the queue is
+ * empty, this blocks until an object is pushed unless +nonblock+ is
+ * +true+, in which case +nil+ is returned.  Since +nil+ may be pushed,
+ * EventQueue#take_all is needed to tell an empty queue apart.
+ *
+ * Only one thread may take from a queue at a time.
+ */
+static VALUE eq_take1(int argc, VALUE *argv, VALUE self)
+{
+	VALUE nonblock;
+
+	rb_scan_args(argc, argv, "01", &nonblock);
+	return eq_take(self, nonblock, 0);
+}
+
+/*
+ * call-seq:
+ *	eq.take_all([nonblock]) -> Array or nil
+ *
+ * Removes and returns every object in the queue as an Array, oldest
+ * first.  If the queue is empty, this blocks until an object is pushed
+ * unless +nonblock+ is +true+, in which case +nil+ is returned.
+ *
+ * When the queue is watched by Epoll, +nonblock+ must be +true+: it
+ * announces the consumer is about to sleep so the next push makes the
+ * descriptor readable, which a blocking call does not do.
+ */
+static VALUE eq_take_all(int argc, VALUE *argv, VALUE self)
+{
+	VALUE nonblock;
+
+	rb_scan_args(argc, argv, "01", &nonblock);
+	return eq_take(self, nonblock, 1);
+}
+
+/*
+ * call-seq:
+ *	eq.size -> Integer
+ *
+ * Returns the number of objects in the queue, which may be stale by
+ * the time it returns if other threads are pushing.
+ */
+static VALUE eq_size(VALUE self)
+{
+	struct event_queue *q = eq_get(self);
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+	return SIZET2NUM(tail - q->head);
+}
+
+/*
+ * call-seq:
+ *	eq.capacity -> Integer
+ *
+ * Returns the maximum number of objects the queue holds.
+ */
+static VALUE eq_capacity(VALUE self)
+{
+	return SIZET2NUM(eq_get(self)->mask + 1);
+}
+
+void sleepy_penguin_init_event_queue(void)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+	VALUE cEventFD = rb_const_get(mSleepyPenguin, rb_intern("EventFD"));
+	VALUE cEventQueue;
+
+	/*
+	 * Document-class: SleepyPenguin::EventQueue
+	 *
+	 * A bounded queue for handing objects to a single consumer thread,
+	 * usually one running an Epoll event loop.  Producers never take a
+	 * lock, and the EventFD only becomes readable when the consumer
+	 * has found the queue empty (or has not looked yet), so bursts of
+	 * pushes cost one wakeup.
+	 *
+	 *	eq = SleepyPenguin::EventQueue.new
+	 *	ep.add(eq, :IN)
+	 *	# in any thread:
+	 *	eq.push(job) or raise "queue full"
+	 *	# when ep reports eq readable:
+	 *	eq.take_all(true)&.each(&:call)
+	 */
+	cEventQueue = rb_define_class_under(mSleepyPenguin, "EventQueue",
+					    cEventFD);
+	rb_define_singleton_method(cEventQueue, "new", eq_s_new, -1);
+	rb_define_method(cEventQueue, "push", eq_push, 1);
+	rb_define_method(cEventQueue, "take", eq_take1, -1);
+	rb_define_method(cEventQueue, "take_all", eq_take_all, -1);
+	rb_define_method(cEventQueue, "size", eq_size, 0);
+	rb_define_method(cEventQueue, "capacity", eq_capacity, 0);
+	rb_undef_method(cEventQueue, "incr");
+	rb_undef_method(cEventQueue, "value");
+
+	id_ivar_queue = rb_intern("@__sp_queue");
+}
+#endif /* HAVE_SYS_EVENTFD_H */
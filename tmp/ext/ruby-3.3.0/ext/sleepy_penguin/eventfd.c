@@ -0,0 +1,348 @@
+#ifdef HAVE_SYS_EVENTFD_H
+#include "sleepy_penguin.h"
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include "sp_doorbell.h"
+
+/* not a kernel flag, keep it away from the EFD_* bits */
+#define EFD_SP_SHARED (1 << 30)
+#define EFD_SP_MAX 0xfffffffffffffffeULL
+#ifdef EFD_SEMAPHORE
+#  define EFD_SP_SEMAPHORE EFD_SEMAPHORE
+#else
+#  define EFD_SP_SEMAPHORE 0
+#endif
+
+static ID id_ivar_shm;
+
+/*
+ * Counter for EventFD::SHARED, in memory shared with forked children.
+ * The kernel eventfd is only a doorbell: a reader about to sleep drains
+ * it, sets +sleeping+ and rechecks +count+, and the writer which clears
+ * +sleeping+ rings it once.  The doorbell is only drained by readers
+ * about to sleep, so it stays readable for every sleeper until one of
+ * them goes back to sleep.
+ */
+struct efd_shm {
+	uint64_t count;
+	uint32_t sleeping;
+	uint32_t rung; /* doorbell writes, so readers may skip read(2) */
+	int semaphore; /* constant */
+};
+
+static void shm_free(void *ptr)
+{
+	munmap(ptr, sizeof(struct efd_shm));
+}
+
+static size_t shm_memsize(const void *ptr)
+{
+	return sizeof(struct efd_shm);
+}
+
+static const rb_data_type_t shm_type = {
+	"sleepy_penguin_eventfd_shm",
+	{ 0, shm_free, shm_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static struct efd_shm *shm_get(VALUE self)
+{
+	VALUE tmp = rb_attr_get(self, id_ivar_shm);
+
+	return NIL_P(tmp) ? 0 : rb_check_typeddata(tmp, &shm_type);
+}
+
+static VALUE shm_new(unsigned initval, int semaphore)
+{
+	void *ptr = mmap(NULL, sizeof(struct efd_shm), PROT_READ|PROT_WRITE,
+			 MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	struct efd_shm *shm;
+
+	if (ptr == MAP_FAILED)
+		rb_sys_fail("mmap");
+	shm = ptr;
+	shm->count = initval;
+	/* a non-zero initial count starts with the doorbell rung */
+	shm->sleeping = initval ? 0 : 1;
+	shm->rung = initval ? 1 : 0;
+	shm->semaphore = semaphore;
+
+	return TypedData_Wrap_Struct(rb_cObject, &shm_type, shm);
+}
+
+/*
+ * call-seq:
+ *	EventFD.new(initial_value [, flags])	-> EventFD IO object
+ *
+ * Creates an EventFD object.  +initial_value+ is a non-negative Integer
+ * to start the internal counter at.
+ *
+ * Starting with Linux 2.6.27, +flags+ may be a mask that consists of any
+ * of the following:
+ *
+ * - :CLOEXEC - set the close-on-exec flag on the new object
+ * - :NONBLOCK - set the non-blocking I/O flag on the new object
+ *
+ * Since Linux 2.6.30, +flags+ may also include:
+ * - :SEMAPHORE - provides semaphore-like semantics (see EventFD#value)
+ *
+ * +flags+ may also include :SHARED to keep the counter in memory shared
+ * with processes forked afterwards, where EventFD#incr and EventFD#value
+ * update it atomically without system calls.  The kernel eventfd is
+ * only written to when a reader is blocked in EventFD#value, or has
+ * found the counter zero with +nonblock+ and may be waiting in Epoll.
+ * The counter is not shared with processes started by exec(2), which
+ * only see the kernel eventfd.  The descriptor is always non-blocking
+ * with :SHARED.
+ */
+static VALUE s_new(int argc, VALUE *argv, VALUE klass)
+{
+	VALUE _initval, _flags, rv, shm = Qnil;
+	unsigned initval;
+	int flags;
+	int fd;
+
+	rb_scan_args(argc, argv, "11", &_initval, &_flags);
+	initval = NUM2UINT(_initval);
+	flags = rb_sp_get_flags(klass, _flags, RB_SP_CLOEXEC(EFD_CLOEXEC));
+	if (flags & EFD_SP_SHARED) {
+		flags &= ~EFD_SP_SHARED;
+		shm = shm_new(initval, flags & EFD_SP_SEMAPHORE);
+		flags &= ~EFD_SP_SEMAPHORE; /* the doorbell drains at once */
+		initval = initval ? 1 : 0;
+	}
+
+	fd = eventfd(initval, flags);
+	if (fd < 0) {
+		if (rb_sp_gc_for_fd(errno))
+			fd = eventfd(initval, flags);
+		if (fd < 0)
+			rb_sys_fail("eventfd");
+	}
+
+	rv = INT2FIX(fd);
+	rv = rb_call_super(1, &rv);
+	if (!NIL_P(shm)) {
+		rb_sp_set_nonblock(fd);
+		rb_ivar_set(rv, id_ivar_shm, shm);
+	}
+	return rv;
+}
+
+static void shm_ring(struct efd_shm *shm, int fd)
+{
+	/* after writing, so a reader seeing +rung+ always drains the write */
+	if (sp_bell_ring(&shm->sleeping, fd))
+		__atomic_add_fetch(&shm->rung, 1, __ATOMIC_RELEASE);
+}
+
+static VALUE shm_incr(VALUE self, struct efd_shm *shm, VALUE value,
+			VALUE nonblock)
+{
+	uint64_t n = (uint64_t)NUM2ULL(value);
+	uint64_t cur = __atomic_load_n(&shm->count, __ATOMIC_RELAXED);
+
+	do {
+		while (n > EFD_SP_MAX - cur) {
+			if (RTEST(nonblock))
+				return Qfalse;
+			/* nobody is woken by reads, poll for the rare overflow */
+			rb_thread_wait_for(rb_time_interval(DBL2NUM(0.001)));
+			cur = __atomic_load_n(&shm->count, __ATOMIC_RELAXED);
+		}
+	} while (!__atomic_compare_exchange_n(&shm->count, &cur, cur + n, 1,
+					__ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+	shm_ring(shm, rb_sp_fileno(self));
+
+	return Qtrue;
+}
+
+static uint64_t shm_take(struct efd_shm *shm)
+{
+	uint64_t cur = __atomic_load_n(&shm->count, __ATOMIC_ACQUIRE);
+
+	if (!shm->semaphore)
+		return cur ? __atomic_exchange_n(&shm->count, 0,
+						__ATOMIC_ACQ_REL) : 0;
+	do {
+		if (!cur)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&shm->count, &cur, cur - 1, 1,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	return 1;
+}
+
+/* drains the doorbell and announces sleep, then checks once more */
+static uint64_t shm_arm(struct efd_shm *shm, int fd)
+{
+	uint64_t buf;
+
+	if (__atomic_load_n(&shm->rung, __ATOMIC_ACQUIRE) &&
+	    __atomic_exchange_n(&shm->rung, 0, __ATOMIC_ACQ_REL) &&
+	    read(fd, &buf, sizeof(buf)) < 0 && errno != EAGAIN)
+		rb_sys_fail("read(eventfd)");
+	__atomic_store_n(&shm->sleeping, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	return shm_take(shm);
+}
+
+static VALUE shm_value(VALUE self, struct efd_shm *shm, VALUE nonblock)
+{
+	int fd = rb_sp_fileno(self);
+
+	for (;;) {
+		uint64_t n = shm_take(shm);
+
+		if (n || (n = shm_arm(shm, fd)))
+			return ULL2NUM(n);
+		if (RTEST(nonblock))
+			return Qnil;
+		errno = EAGAIN;
+		if (!rb_sp_wait(rb_io_wait_readable, self, &fd))
+			rb_sys_fail("read(eventfd)");
+	}
+}
+
+struct efd_args {
+	int fd;
+	uint64_t val;
+};
+
+static VALUE efd_write(void *_args)
+{
+	struct efd_args *args = _args;
+	ssize_t w = write(args->fd, &args->val, sizeof(uint64_t));
+
+	return (VALUE)w;
+}
+
+static VALUE efd_read(void *_args)
+{
+	struct efd_args *args = _args;
+	ssize_t r = read(args->fd, &args->val, sizeof(uint64_t));
+
+	return (VALUE)r;
+}
+
+/*
+ * call-seq:
+ *	efd.incr(integer_value[, nonblock ])	-> true or nil
+ *
+ * Increments the internal counter by +integer_value+ which is an unsigned
+ * Integer value.
+ *
+ * If +nonblock+ is specified and true, this will return +nil+ if the
+ * internal counter will overflow the value of EventFD::MAX.
+ * Otherwise it will block until the counter may be incremented without
+ * overflowing.
+ */
+static VALUE incr(int argc, VALUE *argv, VALUE self)
+{
+	struct efd_shm *shm;
+	struct efd_args x;
+	ssize_t w;
+	VALUE value, nonblock;
+
+	rb_scan_args(argc, argv, "11", &value, &nonblock);
+	if ((shm = shm_get(self)))
+		return shm_incr(self, shm, value, nonblock);
+	x.fd = rb_sp_fileno(self);
+	if (RTEST(nonblock))
+		rb_sp_set_nonblock(x.fd);
+
+	x.val = (uint64_t)NUM2ULL(value);
+retry:
+	w = (ssize_t)rb_sp_fd_region(efd_write, &x, x.fd);
+	if (w < 0) {
+		if (errno == EAGAIN && RTEST(nonblock))
+			return Qfalse;
+		if (rb_sp_wait(rb_io_wait_writable, self, &x.fd))
+			goto retry;
+		rb_sys_fail("write(eventfd)");
+	}
+
+	return Qtrue;
+}
+
+/*
+ * call-seq:
+ *	efd.value([nonblock])	-> Integer or nil
+ *
+ * If not created as a semaphore, returns the current value and resets
+ * the counter to zero.
+ *
+ * If created as a semaphore, this decrements the counter value by one
+ * and returns +1+.
+ *
+ * If the counter is zero at the time of the call, this will block until
+ * the counter becomes non-zero unless +nonblock+ is +true+, in which
+ * case it returns +nil+.
+ */
+static VALUE getvalue(int argc, VALUE *argv, VALUE self)
+{
+	struct efd_shm *shm;
+	struct efd_args x;
+	ssize_t w;
+	VALUE nonblock;
+
+	rb_scan_args(argc, argv, "01", &nonblock);
+	if ((shm = shm_get(self)))
+		return shm_value(self, shm, nonblock);
+	x.fd = rb_sp_fileno(self);
+	if (RTEST(nonblock))
+		rb_sp_set_nonblock(x.fd);
+retry:
+	w = (ssize_t)rb_sp_fd_region(efd_read, &x, x.fd);
+	if (w < 0) {
+		if (errno == EAGAIN && RTEST(nonblock))
+			return Qnil;
+		if (rb_sp_wait(rb_io_wait_readable, self, &x.fd))
+			goto retry;
+		rb_sys_fail("read(eventfd)");
+	}
+
+	return ULL2NUM(x.val);
+}
+
+void sleepy_penguin_init_eventfd(void)
+{
+	VALUE mSleepyPenguin, cEventFD;
+
+	mSleepyPenguin = rb_define_module("SleepyPenguin");
+
+	/*
+	 * Document-class: SleepyPenguin::EventFD
+	 *
+	 * Applications may use EventFD instead of a pipe in cases where
+	 * a pipe is only used to signal events.  The kernel overhead for
+	 * an EventFD descriptor is much lower than that of a pipe.
+	 *
+	 * As of Linux 2.6.30, an EventFD may also be used as a semaphore.
+	 */
+	cEventFD = rb_define_class_under(mSleepyPenguin, "EventFD", rb_cIO);
+	rb_define_singleton_method(cEventFD, "new", s_new, -1);
+
+	/*
+	 * the maximum value that may be stored in an EventFD,
+	 * currently 0xfffffffffffffffe
+	 */
+	rb_define_const(cEventFD, "MAX", ULL2NUM(EFD_SP_MAX));
+
+#ifdef EFD_NONBLOCK
+	NODOC_CONST(cEventFD, "NONBLOCK", INT2NUM(EFD_NONBLOCK));
+#endif
+#ifdef EFD_CLOEXEC
+	NODOC_CONST(cEventFD, "CLOEXEC", INT2NUM(EFD_CLOEXEC));
+#endif
+#ifdef EFD_SEMAPHORE
+	NODOC_CONST(cEventFD, "SEMAPHORE", INT2NUM(EFD_SEMAPHORE));
+#endif
+	NODOC_CONST(cEventFD, "SHARED", INT2NUM(EFD_SP_SHARED));
+	rb_define_method(cEventFD, "value", getvalue, -1);
+	rb_define_method(cEventFD, "incr", incr, -1);
+
+	id_ivar_shm = rb_intern("@__sp_shm");
+}
+#endif /* HAVE_SYS_EVENTFD_H */
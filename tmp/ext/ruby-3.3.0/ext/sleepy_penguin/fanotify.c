@@ -0,0 +1,675 @@
+#ifdef HAVE_SYS_FANOTIFY_H
+#include "sleepy_penguin.h"
+#include <sys/fanotify.h>
+#include <sys/vfs.h>
+#include <limits.h>
+#include <string.h>
+
+#ifndef FAN_REPORT_FID
+#  define FAN_REPORT_FID 0x00000200
+#endif
+#ifndef FAN_REPORT_DIR_FID
+#  define FAN_REPORT_DIR_FID 0x00000400
+#endif
+#ifndef FAN_REPORT_NAME
+#  define FAN_REPORT_NAME 0x00000800
+#endif
+#ifndef FAN_REPORT_DFID_NAME
+#  define FAN_REPORT_DFID_NAME (FAN_REPORT_DIR_FID|FAN_REPORT_NAME)
+#endif
+#ifndef FAN_EVENT_INFO_TYPE_FID
+#  define FAN_EVENT_INFO_TYPE_FID 1
+#endif
+#ifndef FAN_EVENT_INFO_TYPE_DFID_NAME
+#  define FAN_EVENT_INFO_TYPE_DFID_NAME 2
+#endif
+#ifndef FAN_EVENT_INFO_TYPE_DFID
+#  define FAN_EVENT_INFO_TYPE_DFID 3
+#endif
+#ifndef FAN_MARK_FILESYSTEM
+#  define FAN_MARK_FILESYSTEM 0x00000100
+#endif
+
+/* a few dozen events with file handles and names */
+#define FANOTIFY_BUFSIZE 16384
+
+/* file handles are opaque, but bounded */
+#ifndef MAX_HANDLE_SZ
+#  define MAX_HANDLE_SZ 128
+#endif
+
+static ID id_fanotify_tmp, id_fanotify_mounts, id_fanotify, id_mask;
+static VALUE cEvent, checks;
+
+/*
+ * the file handle Strings we return are the fsid followed by a
+ * struct file_handle, exactly as reported by the kernel
+ */
+struct fan_fid {
+	__kernel_fsid_t fsid;
+	struct file_handle fh;
+};
+
+/*
+ * call-seq:
+ *	Fanotify.new([flags[, event_flags]]) -> Fanotify IO object
+ *
+ * Flags may be any of the following as an Array of Symbols or Integer
+ * mask, the default is [ :CLOEXEC, :REPORT_DFID_NAME ]:
+ *
+ * - :NONBLOCK - sets the non-blocking flag on the descriptor watched.
+ * - :CLOEXEC - sets the close-on-exec flag
+ * - :REPORT_FID - identify objects by file handle (Linux 5.1+)
+ * - :REPORT_DIR_FID - identify directories by file handle (Linux 5.9+)
+ * - :REPORT_NAME - report the name of the directory entry (Linux 5.9+)
+ * - :REPORT_DFID_NAME - :REPORT_DIR_FID and :REPORT_NAME
+ * - :UNLIMITED_QUEUE - do not limit the event queue
+ * - :UNLIMITED_MARKS - do not limit the number of marks
+ *
+ * Without any of the :REPORT_* flags, the kernel opens each file an
+ * event is about; the Event#path of such events is resolved and the
+ * descriptor closed immediately.
+ *
+ * +event_flags+ are the open(2) flags used for those descriptors
+ * (default: File::RDONLY).
+ *
+ * Only notification events are supported, permission events
+ * (FAN_CLASS_CONTENT and FAN_CLASS_PRE_CONTENT) are not.
+ * Creating a Fanotify object requires the CAP_SYS_ADMIN capability.
+ */
+static VALUE s_new(int argc, VALUE *argv, VALUE klass)
+{
+	VALUE _flags, _eflags, rv;
+	unsigned flags;
+	unsigned eflags;
+	int fd;
+
+	rb_scan_args(argc, argv, "02", &_flags, &_eflags);
+	flags = NIL_P(_flags) ? FAN_REPORT_DFID_NAME | FAN_CLOEXEC :
+		rb_sp_get_uflags(klass, _flags);
+	eflags = NIL_P(_eflags) ? O_RDONLY : NUM2UINT(_eflags);
+	if (flags & (FAN_CLASS_CONTENT|FAN_CLASS_PRE_CONTENT))
+		rb_raise(rb_eArgError, "permission events are not supported");
+
+	fd = fanotify_init(flags, eflags | O_CLOEXEC);
+	if (fd < 0) {
+		if (rb_sp_gc_for_fd(errno))
+			fd = fanotify_init(flags, eflags | O_CLOEXEC);
+		if (fd < 0)
+			rb_sys_fail("fanotify_init");
+	}
+
+	rv = INT2FIX(fd);
+	rv = rb_call_super(1, &rv);
+	rb_ivar_set(rv, id_fanotify_tmp, rb_ary_new());
+	rb_ivar_set(rv, id_fanotify_mounts, rb_hash_new());
+
+	return rv;
+}
+
+/*
+ * opens a descriptor on the filesystem of +path+ for resolving, this
+ * happens before marking so a failure here leaves no mark behind
+ */
+static int mount_open(const char *path, struct statfs *sfs)
+{
+	int fd;
+
+	/* open_by_handle_at(2) does not accept O_PATH descriptors */
+	fd = open(path, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+	if (fd < 0 && rb_sp_gc_for_fd(errno))
+		fd = open(path, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+	if (fd < 0)
+		rb_sys_fail(path);
+	if (fstatfs(fd, sfs) < 0) {
+		close(fd);
+		rb_sys_fail("fstatfs");
+	}
+	return fd;
+}
+
+/* remembers +fd+ from mount_open unless its filesystem is known */
+static void add_mount(VALUE self, int fd, const struct statfs *sfs)
+{
+	VALUE mounts = rb_ivar_get(self, id_fanotify_mounts);
+	VALUE key, io;
+
+	key = rb_str_new((const char *)&sfs->f_fsid, sizeof(sfs->f_fsid));
+	if (!NIL_P(rb_hash_lookup(mounts, key))) {
+		close(fd);
+		return;
+	}
+	io = rb_funcall(rb_cIO, rb_intern("for_fd"), 1, INT2NUM(fd));
+	rb_hash_aset(mounts, key, io);
+}
+
+static VALUE do_mark(VALUE self, unsigned op, VALUE path,
+			VALUE vmask, VALUE vflags)
+{
+	int fd = rb_sp_fileno(self);
+	const char *pathname = StringValueCStr(path);
+	uint64_t mask = rb_sp_get_uflags(self, vmask);
+	unsigned flags = rb_sp_get_uflags(self, vflags);
+	struct statfs sfs;
+	int mfd = -1;
+
+	if (op == FAN_MARK_ADD)
+		mfd = mount_open(pathname, &sfs);
+	if (fanotify_mark(fd, op | flags, mask, AT_FDCWD, pathname) < 0) {
+		if (mfd >= 0) {
+			int err = errno;
+
+			close(mfd);
+			errno = err;
+		}
+		rb_sys_fail("fanotify_mark");
+	}
+	if (mfd >= 0)
+		add_mount(self, mfd, &sfs);
+
+	return self;
+}
+
+/*
+ * call-seq:
+ *	fan.mark(path, mask[, flags]) -> fan
+ *
+ * Adds the events in +mask+ to the mark on +path+.  +mask+ may be a mask
+ * of the following Fanotify constants or an Array of their symbolic names:
+ *
+ * - :ACCESS, :MODIFY, :CLOSE_WRITE, :CLOSE_NOWRITE, :OPEN, :OPEN_EXEC
+ * - :ATTRIB, :CREATE, :DELETE, :DELETE_SELF, :MOVED_FROM, :MOVED_TO,
+ *   :MOVE_SELF - require one of the :REPORT_*FID flags in Fanotify.new
+ * - :ONDIR - also report events on directories
+ * - :EVENT_ON_CHILD - also report events on children of a directory
+ *
+ * +flags+ selects what is marked:
+ *
+ * - :MARK_FILESYSTEM - the whole filesystem containing +path+
+ * - :MARK_MOUNT - the mount containing +path+
+ * - :MARK_ONLYDIR - fail if +path+ is not a directory
+ * - :MARK_DONT_FOLLOW - do not dereference +path+ if it is a symlink
+ *
+ * With no +flags+, only the inode at +path+ (and its children, with
+ * :EVENT_ON_CHILD) is marked.
+ *
+ * +path+ is also opened read-only to resolve file handles of later
+ * events, nothing is marked if that fails.
+ */
+static VALUE mark(int argc, VALUE *argv, VALUE self)
+{
+	VALUE path, mask, flags;
+
+	rb_scan_args(argc, argv, "21", &path, &mask, &flags);
+	return do_mark(self, FAN_MARK_ADD, path, mask, flags);
+}
+
+/*
+ * call-seq:
+ *	fan.unmark(path, mask[, flags]) -> fan
+ *
+ * Removes the events in +mask+ from the mark on +path+, +flags+ must
+ * be the same as the ones given to Fanotify#mark.
+ */
+static VALUE unmark(int argc, VALUE *argv, VALUE self)
+{
+	VALUE path, mask, flags;
+
+	rb_scan_args(argc, argv, "21", &path, &mask, &flags);
+	return do_mark(self, FAN_MARK_REMOVE, path, mask, flags);
+}
+
+static VALUE fd_path(int fd)
+{
+	char buf[PATH_MAX];
+	char proc[sizeof("/proc/self/fd/") + 11];
+	ssize_t n;
+
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	n = readlink(proc, buf, sizeof(buf));
+
+	return n < 0 ? Qnil : rb_str_new(buf, n);
+}
+
+static VALUE event_new(VALUE self, const struct fanotify_event_metadata *m)
+{
+	const char *p = (const char *)m + m->metadata_len;
+	const char *end = (const char *)m + m->event_len;
+	VALUE handle = Qnil;
+	VALUE name = Qnil;
+	VALUE path = Qnil;
+	VALUE rv;
+
+	while (NIL_P(handle) &&
+	       p + sizeof(struct fanotify_event_info_header) <= end) {
+		const struct fanotify_event_info_header *h = (const void *)p;
+		const struct fanotify_event_info_fid *info = (const void *)p;
+		const struct file_handle *fh;
+
+		if (h->len == 0 || p + h->len > end)
+			break;
+		p += h->len;
+
+		switch (h->info_type) {
+		case FAN_EVENT_INFO_TYPE_FID:
+		case FAN_EVENT_INFO_TYPE_DFID:
+		case FAN_EVENT_INFO_TYPE_DFID_NAME:
+			fh = (const struct file_handle *)info->handle;
+			handle = rb_str_new((const char *)&info->fsid,
+					    sizeof(info->fsid) + sizeof(*fh) +
+					    fh->handle_bytes);
+			if (h->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+				name = rb_str_new2((const char *)fh->f_handle +
+						   fh->handle_bytes);
+		}
+	}
+
+	/* not in a FID reporting mode, the kernel opened the file for us */
+	if (m->fd >= 0)
+		path = fd_path(m->fd);
+
+	rv = rb_struct_new(cEvent, ULL2NUM(m->mask), INT2NUM(m->pid),
+			   handle, name, path);
+	if (!NIL_P(handle))
+		rb_ivar_set(rv, id_fanotify, self);
+	return rv;
+}
+
+struct fanread_args {
+	VALUE self;
+	int fd;
+	int nonblock_p;
+	int all_p;
+	size_t size;
+	VALUE tmp;
+	void *buf;
+	const struct fanotify_event_metadata *pos;
+	ssize_t left;
+};
+
+static VALUE fanread(void *ptr)
+{
+	struct fanread_args *args = ptr;
+
+	return (VALUE)read(args->fd, args->buf, args->size);
+}
+
+static VALUE do_take(VALUE p)
+{
+	struct fanread_args *args = (struct fanread_args *)p;
+	VALUE rv = Qnil;
+
+	args->buf = rb_sp_gettlsbuf(&args->size);
+	do {
+		ssize_t r = (ssize_t)rb_sp_fd_region(fanread, args, args->fd);
+
+		if (r < 0) {
+			if (errno == EAGAIN && args->nonblock_p)
+				return Qnil;
+			if (!rb_sp_wait(rb_io_wait_readable, args->self,
+					&args->fd))
+				rb_sys_fail("read(fanotify)");
+			continue;
+		}
+		if (args->all_p)
+			rv = rb_ary_new();
+		args->pos = args->buf;
+		args->left = r;
+		while (FAN_EVENT_OK(args->pos, args->left)) {
+			const struct fanotify_event_metadata *m = args->pos;
+			VALUE event;
+
+			if (m->vers != FANOTIFY_METADATA_VERSION)
+				rb_raise(rb_eRuntimeError,
+					 "fanotify metadata version mismatch: "
+					 "%u != %u", (unsigned)m->vers,
+					 (unsigned)FANOTIFY_METADATA_VERSION);
+			event = event_new(args->self, m);
+			args->pos = FAN_EVENT_NEXT(args->pos, args->left);
+			if (m->fd >= 0)
+				close(m->fd);
+
+			if (args->all_p)
+				rb_ary_push(rv, event);
+			else if (NIL_P(rv))
+				rv = event;
+			else /* buffer in userspace for the next take */
+				rb_ary_push(args->tmp, event);
+		}
+	} while (NIL_P(rv));
+
+	return rv;
+}
+
+/* close descriptors of events we could not decode due to exceptions */
+static VALUE take_ensure(VALUE p)
+{
+	struct fanread_args *args = (struct fanread_args *)p;
+
+	while (args->pos && FAN_EVENT_OK(args->pos, args->left)) {
+		if (args->pos->fd >= 0)
+			close(args->pos->fd);
+		args->pos = FAN_EVENT_NEXT(args->pos, args->left);
+	}
+	return rb_sp_puttlsbuf((VALUE)args->buf);
+}
+
+static VALUE take_common(int argc, VALUE *argv, VALUE self, int all_p)
+{
+	struct fanread_args args;
+	VALUE nonblock;
+
+	args.tmp = rb_ivar_get(self, id_fanotify_tmp);
+	if (RARRAY_LEN(args.tmp) > 0) {
+		VALUE rv;
+
+		if (!all_p)
+			return rb_ary_shift(args.tmp);
+		rv = rb_ary_dup(args.tmp);
+		rb_ary_clear(args.tmp);
+		return rv;
+	}
+
+	rb_scan_args(argc, argv, "01", &nonblock);
+
+	args.self = self;
+	args.fd = rb_sp_fileno(self);
+	args.size = FANOTIFY_BUFSIZE;
+	args.nonblock_p = RTEST(nonblock);
+	args.all_p = all_p;
+	args.pos = NULL;
+	args.left = 0;
+
+	if (args.nonblock_p)
+		rb_sp_set_nonblock(args.fd);
+
+	args.buf = 0;
+	return rb_ensure(do_take, (VALUE)&args, take_ensure, (VALUE)&args);
+}
+
+/*
+ * call-seq:
+ *	fan.take([nonblock]) -> Fanotify::Event or nil
+ *
+ * Returns the next Fanotify::Event processed.  May return +nil+ if
+ * +nonblock+ is +true+.
+ */
+static VALUE take(int argc, VALUE *argv, VALUE self)
+{
+	return take_common(argc, argv, self, 0);
+}
+
+/*
+ * call-seq:
+ *	fan.take_all([nonblock]) -> [ Fanotify::Event, ... ] or nil
+ *
+ * Returns an Array of every Fanotify::Event decoded from a single
+ * read(2).  May return +nil+ if +nonblock+ is +true+.
+ */
+static VALUE take_all(int argc, VALUE *argv, VALUE self)
+{
+	return take_common(argc, argv, self, 1);
+}
+
+/*
+ * call-seq:
+ *	fan.each { |event| ... } -> fan
+ *
+ * Yields each Fanotify::Event received in a blocking fashion.
+ */
+static VALUE each(VALUE self)
+{
+	VALUE argv = Qfalse;
+
+	while (1)
+		rb_yield(take(0, &argv, self));
+
+	return self;
+}
+
+/*
+ * call-seq:
+ *	fan.each_batch { |events| ... } -> fan
+ *
+ * Yields an Array of every Fanotify::Event received by each read(2)
+ * in a blocking fashion.
+ */
+static VALUE each_batch(VALUE self)
+{
+	VALUE argv = Qfalse;
+
+	while (1)
+		rb_yield(take_all(0, &argv, self));
+
+	return self;
+}
+
+struct handle_args {
+	int mount_fd;
+	union {
+		struct fan_fid fid;
+		char bytes[sizeof(struct fan_fid) + MAX_HANDLE_SZ];
+	} as;
+};
+
+static VALUE nogvl_open_handle(void *ptr)
+{
+	struct handle_args *a = ptr;
+
+	return (VALUE)open_by_handle_at(a->mount_fd, &a->as.fid.fh,
+					O_PATH|O_CLOEXEC);
+}
+
+/*
+ * call-seq:
+ *	fan.resolve(handle[, name]) -> String or nil
+ *
+ * Returns the current path of the file +handle+ reported in a
+ * Fanotify::Event, with +name+ appended if given.  Returns +nil+ if
+ * the file no longer exists or is not on a filesystem marked by this
+ * object.  This uses open_by_handle_at(2) and requires the
+ * CAP_DAC_READ_SEARCH capability.
+ */
+static VALUE resolve(int argc, VALUE *argv, VALUE self)
+{
+	VALUE handle, name, mounts, io, rv;
+	struct handle_args a;
+	size_t len;
+	int fd;
+
+	rb_scan_args(argc, argv, "11", &handle, &name);
+	StringValue(handle);
+	len = RSTRING_LEN(handle);
+	if (len < sizeof(struct fan_fid) || len > sizeof(a.as.bytes))
+		rb_raise(rb_eArgError, "invalid file handle");
+	memcpy(a.as.bytes, RSTRING_PTR(handle), len); /* aligned copy */
+	if (sizeof(struct fan_fid) + a.as.fid.fh.handle_bytes != len)
+		rb_raise(rb_eArgError, "invalid file handle");
+
+	mounts = rb_ivar_get(self, id_fanotify_mounts);
+	io = rb_hash_lookup(mounts, rb_str_new((const char *)&a.as.fid.fsid,
+					      sizeof(a.as.fid.fsid)));
+	if (NIL_P(io))
+		return Qnil;
+
+	a.mount_fd = rb_sp_fileno(io);
+	fd = (int)rb_sp_fd_region(nogvl_open_handle, &a, a.mount_fd);
+	if (fd < 0) {
+		if (errno == ESTALE || errno == ENOENT)
+			return Qnil;
+		rb_sys_fail("open_by_handle_at");
+	}
+	rv = fd_path(fd);
+	close(fd);
+
+	if (!NIL_P(rv) && !NIL_P(name) && strcmp(StringValueCStr(name), "."))
+		rb_str_append(rb_str_cat(rv, "/", 1), name);
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	fanotify_event.path -> String or nil
+ *
+ * Returns the path of the object this event is about, resolving its
+ * file handle on the first call (see Fanotify#resolve).  Returns +nil+
+ * if it no longer exists.
+ */
+static VALUE event_path(VALUE self)
+{
+	VALUE path = rb_struct_aref(self, INT2FIX(4));
+	VALUE fan, argv[2];
+
+	if (!NIL_P(path))
+		return path;
+	fan = rb_attr_get(self, id_fanotify);
+	if (NIL_P(fan))
+		return Qnil;
+	argv[0] = rb_struct_aref(self, INT2FIX(2));
+	argv[1] = rb_struct_aref(self, INT2FIX(3));
+	path = resolve(2, argv, fan);
+
+	return rb_struct_aset(self, INT2FIX(4), path);
+}
+
+/*
+ * call-seq:
+ *	fanotify_event.events => [ :CREATE, ... ]
+ *
+ * Returns an array of symbolic event names based on the contents of
+ * the +mask+ field.
+ */
+static VALUE events(VALUE self)
+{
+	long len = RARRAY_LEN(checks);
+	long i;
+	VALUE sym;
+	VALUE rv = rb_ary_new();
+	uint64_t mask;
+	uint64_t event_mask = NUM2ULL(rb_funcall(self, id_mask, 0));
+
+	for (i = 0; i < len; ) {
+		sym = rb_ary_entry(checks, i++);
+		mask = NUM2ULL(rb_ary_entry(checks, i++));
+		if ((event_mask & mask) == mask)
+			rb_ary_push(rv, sym);
+	}
+
+	return rv;
+}
+
+void sleepy_penguin_init_fanotify(void)
+{
+	VALUE mSleepyPenguin, cFanotify;
+
+	mSleepyPenguin = rb_define_module("SleepyPenguin");
+
+	/*
+	 * Document-class: SleepyPenguin::Fanotify
+	 *
+	 * Fanotify objects monitor file system events like Inotify, but
+	 * one mark may cover an entire mount or filesystem instead of
+	 * needing one watch per directory.
+	 *
+	 * Fanotify IO objects can be watched using IO.select or Epoll.
+	 * IO#close may be called on the object when it is no longer needed.
+	 *
+	 * Fanotify requires Linux 2.6.37 or later, directory entry events
+	 * (:CREATE, :DELETE, :MOVED_FROM, ...) and :MARK_FILESYSTEM
+	 * require Linux 5.1, and names require Linux 5.9.  It also
+	 * requires the CAP_SYS_ADMIN capability.
+	 *
+	 *	require "sleepy_penguin/sp"
+	 *	fan = SP::Fanotify.new
+	 *	fan.mark("/", [ :CREATE, :DELETE, :ONDIR ], :MARK_FILESYSTEM)
+	 *	fan.each do |event|
+	 *	  p [ event.events, event.path ] # => [ [ :CREATE ], "/tmp/foo" ]
+	 *	end
+	 */
+	cFanotify = rb_define_class_under(mSleepyPenguin, "Fanotify", rb_cIO);
+	rb_define_singleton_method(cFanotify, "new", s_new, -1);
+	rb_define_method(cFanotify, "mark", mark, -1);
+	rb_define_method(cFanotify, "unmark", unmark, -1);
+	rb_define_method(cFanotify, "take", take, -1);
+	rb_define_method(cFanotify, "take_all", take_all, -1);
+	rb_define_method(cFanotify, "each", each, 0);
+	rb_define_method(cFanotify, "each_batch", each_batch, 0);
+	rb_define_method(cFanotify, "resolve", resolve, -1);
+
+	/*
+	 * Document-class: SleepyPenguin::Fanotify::Event
+	 *
+	 * Returned by SleepyPenguin::Fanotify#take.  It is a Struct with the
+	 * following elements:
+	 *
+	 * - mask - mask of events (unsigned Integer)
+	 * - pid - the process which caused the event
+	 * - handle - opaque file handle String of the object or its
+	 *   parent directory, +nil+ unless a :REPORT_*FID flag was used
+	 * - name - name of the directory entry (may be nil)
+	 * - path - resolved lazily by Event#path
+	 *
+	 * Use the Event#events method to get an array of symbols for the
+	 * matched events.
+	 */
+	cEvent = rb_struct_define_under(cFanotify, "Event", "mask", "pid",
+					"handle", "name", "path", NULL);
+	rb_define_method(cEvent, "events", events, 0);
+	rb_remove_method(cEvent, "path"); /* lazy, see event_path */
+	rb_define_method(cEvent, "path", event_path, 0);
+
+	id_fanotify_tmp = rb_intern("@fanotify_tmp");
+	id_fanotify_mounts = rb_intern("@fanotify_mounts");
+	id_fanotify = rb_intern("@fanotify");
+	id_mask = rb_intern("mask");
+	checks = rb_ary_new();
+	rb_global_variable(&checks);
+#define FAN(x) rb_define_const(cFanotify,#x,ULL2NUM(FAN_##x))
+#define FAN2(x) do { \
+	VALUE val = ULL2NUM(FAN_##x); \
+	rb_define_const(cFanotify,#x,val); \
+	rb_ary_push(checks, ID2SYM(rb_intern(#x))); \
+	rb_ary_push(checks, val); \
+} while (0)
+
+/* events */
+	FAN2(ACCESS);
+	FAN2(MODIFY);
+	FAN2(ATTRIB);
+	FAN2(CLOSE_WRITE);
+	FAN2(CLOSE_NOWRITE);
+	FAN2(OPEN);
+	FAN2(MOVED_FROM);
+	FAN2(MOVED_TO);
+	FAN2(CREATE);
+	FAN2(DELETE);
+	FAN2(DELETE_SELF);
+	FAN2(MOVE_SELF);
+#ifdef FAN_OPEN_EXEC
+	FAN2(OPEN_EXEC);
+#endif
+	FAN2(Q_OVERFLOW);
+	FAN2(ONDIR);
+	FAN(EVENT_ON_CHILD);
+
+/* helpers */
+	FAN(CLOSE);
+	FAN(MOVE);
+
+/* for fanotify_mark() */
+	FAN(MARK_DONT_FOLLOW);
+	FAN(MARK_ONLYDIR);
+	FAN(MARK_MOUNT);
+	FAN(MARK_FILESYSTEM);
+
+/* for fanotify_init() */
+	FAN(REPORT_FID);
+	FAN(REPORT_DIR_FID);
+	FAN(REPORT_NAME);
+	FAN(REPORT_DFID_NAME);
+	FAN(UNLIMITED_QUEUE);
+	FAN(UNLIMITED_MARKS);
+	NODOC_CONST(cFanotify, "NONBLOCK", INT2NUM(FAN_NONBLOCK));
+	NODOC_CONST(cFanotify, "CLOEXEC", INT2NUM(FAN_CLOEXEC));
+}
+#endif /* HAVE_SYS_FANOTIFY_H */
@@ -0,0 +1,558 @@
+#ifdef HAVE_SYS_INOTIFY_H
+#include "sleepy_penguin.h"
+#include <sys/inotify.h>
+#include <ruby/st.h>
+#include "missing_inotify.h"
+
+/*
+ * One Inotify descriptor shared by independent subscribers.  The
+ * kernel returns the same watch descriptor for every inotify_add_watch
+ * on the same inode, so each kernel watch is a hub_watch listing which
+ * subscribers want which events from it.  Kernel masks only grow (with
+ * IN_MASK_ADD) while a watch is shared, the per-subscriber masks are
+ * applied when events are dispatched.
+ */
+static ID id_ivar_hub, id_call;
+static VALUE cHub, cSubscriber, cEvent;
+static VALUE default_hub = Qnil;
+static rb_pid_t default_pid;
+
+#ifndef IN_MASK_CREATE
+#  define IN_MASK_CREATE 0
+#endif
+
+/* flags which would affect other subscribers of the same watch */
+#define HUB_FORBIDDEN (IN_ONESHOT|IN_MASK_CREATE)
+
+struct hub_entry {
+	long sub; /* index into hub->subs */
+	uint32_t mask;
+};
+
+struct hub_watch {
+	long nr;
+	long capa;
+	struct hub_entry *ents;
+};
+
+struct hub {
+	st_table *watches; /* wd => struct hub_watch * */
+	VALUE subs; /* Array of Subscriber, nil once closed */
+	VALUE queue; /* events read but not yet dispatched */
+	long *free_idx; /* nil slots of subs, reused by hub_subscribe */
+	long nfree;
+	long free_capa;
+};
+
+struct subscriber {
+	VALUE hub;
+	VALUE callback;
+	long idx;
+};
+
+static int watch_free_i(st_data_t key, st_data_t val, st_data_t arg)
+{
+	struct hub_watch *w = (struct hub_watch *)val;
+
+	xfree(w->ents);
+	xfree(w);
+	return ST_CONTINUE;
+}
+
+static void hub_mark(void *ptr)
+{
+	struct hub *hub = ptr;
+
+	rb_gc_mark(hub->subs);
+	rb_gc_mark(hub->queue);
+}
+
+static void hub_free(void *ptr)
+{
+	struct hub *hub = ptr;
+
+	st_foreach(hub->watches, watch_free_i, 0);
+	st_free_table(hub->watches);
+	xfree(hub->free_idx);
+	xfree(hub);
+}
+
+static size_t hub_memsize(const void *ptr)
+{
+	const struct hub *hub = ptr;
+
+	return sizeof(struct hub) + st_memsize(hub->watches) +
+		hub->free_capa * sizeof(long);
+}
+
+static const rb_data_type_t hub_type = {
+	"sleepy_penguin_inotify_hub",
+	{ hub_mark, hub_free, hub_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static void sub_mark(void *ptr)
+{
+	struct subscriber *sub = ptr;
+
+	rb_gc_mark(sub->hub);
+	rb_gc_mark(sub->callback);
+}
+
+static size_t sub_memsize(const void *ptr)
+{
+	return sizeof(struct subscriber);
+}
+
+static const rb_data_type_t sub_type = {
+	"sleepy_penguin_inotify_hub_subscriber",
+	{ sub_mark, RUBY_TYPED_DEFAULT_FREE, sub_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static struct hub *hub_get(VALUE self)
+{
+	VALUE tmp = rb_ivar_get(self, id_ivar_hub);
+	struct hub *hub;
+
+	if (!NIL_P(tmp))
+		return rb_check_typeddata(tmp, &hub_type);
+
+	tmp = TypedData_Make_Struct(rb_cObject, struct hub, &hub_type, hub);
+	hub->watches = st_init_numtable();
+	hub->subs = rb_ary_new();
+	hub->queue = rb_ary_new();
+	rb_ivar_set(self, id_ivar_hub, tmp);
+	return hub;
+}
+
+static struct hub_watch *watch_lookup(struct hub *hub, int wd)
+{
+	st_data_t val;
+
+	return st_lookup(hub->watches, (st_data_t)wd, &val) ?
+		(struct hub_watch *)val : NULL;
+}
+
+static void watch_delete(struct hub *hub, int wd)
+{
+	st_data_t key = (st_data_t)wd;
+	st_data_t val;
+
+	if (st_delete(hub->watches, &key, &val))
+		watch_free_i(key, val, 0);
+}
+
+static struct subscriber *sub_get(VALUE self)
+{
+	struct subscriber *sub = rb_check_typeddata(self, &sub_type);
+
+	if (sub->idx < 0)
+		rb_raise(rb_eIOError, "closed subscriber");
+	return sub;
+}
+
+/*
+ * call-seq:
+ *	hub.subscribe { |event| ... } -> Inotify::Hub::Subscriber
+ *
+ * Registers a new subscriber.  The block is called by Hub#dispatch with
+ * each Inotify::Event matching a watch added with Subscriber#add_watch.
+ */
+static VALUE hub_subscribe(VALUE self)
+{
+	struct hub *hub = hub_get(self);
+	struct subscriber *sub;
+	VALUE rv;
+
+	rb_need_block();
+	rv = TypedData_Make_Struct(cSubscriber, struct subscriber, &sub_type,
+				   sub);
+	sub->hub = self;
+	sub->callback = rb_block_proc();
+	if (hub->nfree > 0) {
+		sub->idx = hub->free_idx[--hub->nfree];
+		rb_ary_store(hub->subs, sub->idx, rv);
+	} else {
+		sub->idx = RARRAY_LEN(hub->subs);
+		rb_ary_push(hub->subs, rv);
+	}
+
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	sub.add_watch(path, flags) -> Integer
+ *
+ * Like Inotify#add_watch, but the watch is shared with any other
+ * subscriber of the hub watching the same inode.  Calling this again
+ * for the same inode replaces the events this subscriber receives,
+ * unless +flags+ includes :MASK_ADD.  :ONESHOT and :MASK_CREATE are
+ * not allowed since they would affect other subscribers.
+ */
+static VALUE sub_add_watch(VALUE self, VALUE path, VALUE vmask)
+{
+	struct subscriber *sub = sub_get(self);
+	struct hub *hub = hub_get(sub->hub);
+	uint32_t mask = rb_sp_get_uflags(cHub, vmask);
+	const char *pathname = StringValueCStr(path);
+	struct hub_watch *w;
+	long i;
+	int wd;
+
+	if (mask & HUB_FORBIDDEN)
+		rb_raise(rb_eArgError, "ONESHOT and MASK_CREATE not allowed");
+
+	wd = inotify_add_watch(rb_sp_fileno(sub->hub), pathname,
+			       mask | IN_MASK_ADD);
+	if (wd < 0)
+		rb_sys_fail("inotify_add_watch");
+
+	w = watch_lookup(hub, wd);
+	if (!w) {
+		w = ZALLOC(struct hub_watch);
+		st_insert(hub->watches, (st_data_t)wd, (st_data_t)w);
+	}
+	for (i = 0; i < w->nr; i++) {
+		if (w->ents[i].sub == sub->idx) {
+			if (mask & IN_MASK_ADD)
+				w->ents[i].mask |= mask;
+			else
+				w->ents[i].mask = mask;
+			return INT2NUM(wd);
+		}
+	}
+	if (w->nr == w->capa) {
+		w->capa = w->capa ? w->capa * 2 : 4;
+		REALLOC_N(w->ents, struct hub_entry, w->capa);
+	}
+	w->ents[w->nr].sub = sub->idx;
+	w->ents[w->nr++].mask = mask;
+
+	return INT2NUM(wd);
+}
+
+/* returns 1 if +idx+ had an entry in +w+ */
+static int watch_unsubscribe(struct hub_watch *w, long idx)
+{
+	long i;
+
+	for (i = 0; i < w->nr; i++) {
+		if (w->ents[i].sub == idx) {
+			w->ents[i] = w->ents[--w->nr];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * the kernel watch goes away with the last subscriber, its IN_IGNORED
+ * is not dispatched since nobody is left to want it
+ */
+static void watch_release(VALUE self, struct hub *hub, int wd)
+{
+	watch_delete(hub, wd);
+	if (inotify_rm_watch(rb_sp_fileno(self), wd) < 0 && errno != EINVAL)
+		rb_sys_fail("inotify_rm_watch");
+}
+
+/*
+ * call-seq:
+ *	sub.rm_watch(wd) -> 0
+ *
+ * Stops receiving events for +wd+.  The kernel watch is only removed
+ * once no other subscriber uses it, and no IN_IGNORED event is
+ * dispatched to this subscriber.
+ */
+static VALUE sub_rm_watch(VALUE self, VALUE vwd)
+{
+	struct subscriber *sub = sub_get(self);
+	struct hub *hub = hub_get(sub->hub);
+	int wd = NUM2INT(vwd);
+	struct hub_watch *w = watch_lookup(hub, wd);
+
+	if (!w || !watch_unsubscribe(w, sub->idx)) {
+		errno = EINVAL;
+		rb_sys_fail("inotify_rm_watch");
+	}
+	if (w->nr == 0)
+		watch_release(sub->hub, hub, wd);
+
+	return INT2FIX(0);
+}
+
+struct unsub_args {
+	long idx;
+	long nr;
+	int *unused; /* wds to release */
+};
+
+static int unsub_i(st_data_t key, st_data_t val, st_data_t arg)
+{
+	struct hub_watch *w = (struct hub_watch *)val;
+	struct unsub_args *a = (struct unsub_args *)arg;
+
+	if (watch_unsubscribe(w, a->idx) && w->nr == 0)
+		a->unused[a->nr++] = (int)key;
+	return ST_CONTINUE;
+}
+
+/*
+ * call-seq:
+ *	sub.close -> nil
+ *
+ * Removes every watch of this subscriber and unregisters it from
+ * the hub.
+ */
+static VALUE sub_close(VALUE self)
+{
+	struct subscriber *sub = sub_get(self);
+	struct hub *hub = hub_get(sub->hub);
+	struct unsub_args a;
+	VALUE tmp;
+	long i;
+
+	/* grown first, so the slot is always recorded as free */
+	if (hub->nfree == hub->free_capa) {
+		hub->free_capa = hub->free_capa ? hub->free_capa * 2 : 8;
+		REALLOC_N(hub->free_idx, long, hub->free_capa);
+	}
+	a.idx = sub->idx;
+	a.nr = 0;
+	a.unused = ALLOCV_N(int, tmp, hub->watches->num_entries);
+	st_foreach(hub->watches, unsub_i, (st_data_t)&a);
+
+	rb_ary_store(hub->subs, sub->idx, Qnil);
+	hub->free_idx[hub->nfree++] = sub->idx;
+	sub->idx = -1;
+	for (i = 0; i < a.nr; i++)
+		watch_release(sub->hub, hub, a.unused[i]);
+	ALLOCV_END(tmp);
+
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *	sub.closed? -> true or false
+ *
+ * Returns whether Subscriber#close was called.
+ */
+static VALUE sub_closed_p(VALUE self)
+{
+	struct subscriber *sub = rb_check_typeddata(self, &sub_type);
+
+	return sub->idx < 0 ? Qtrue : Qfalse;
+}
+
+/* decodes events for Hub#dispatch, see rb_sp_inotify_take */
+static VALUE hub_event(VALUE self, const struct inotify_event *e)
+{
+	struct hub_watch *w = NULL;
+	VALUE rv;
+	long i;
+
+	if (e->mask & (IN_Q_OVERFLOW|IN_IGNORED|IN_UNMOUNT))
+		goto wanted;
+	w = watch_lookup(hub_get(self), e->wd);
+	if (!w)
+		return Qundef;
+	for (i = 0; i < w->nr; i++)
+		if (w->ents[i].mask & e->mask & IN_ALL_EVENTS)
+			goto wanted;
+	return Qundef;
+wanted:
+	/* e->name is zero-padded, see event_new in inotify.c */
+	rv = rb_struct_new(cEvent, INT2NUM(e->wd), UINT2NUM(e->mask),
+			   UINT2NUM(e->cookie),
+			   e->len ? rb_str_new2(e->name) : Qnil);
+
+	/* shared by every subscriber it is dispatched to */
+	return rb_obj_freeze(rv);
+}
+
+/* returns the subscribers to call for +event+ */
+static VALUE recipients(struct hub *hub, VALUE event)
+{
+	int wd = NUM2INT(rb_struct_aref(event, INT2FIX(0)));
+	uint32_t mask = NUM2UINT(rb_struct_aref(event, INT2FIX(1)));
+	struct hub_watch *w;
+	VALUE rv = rb_ary_new();
+	long i;
+
+	if (mask & IN_Q_OVERFLOW) {
+		for (i = 0; i < RARRAY_LEN(hub->subs); i++) {
+			VALUE sub = rb_ary_entry(hub->subs, i);
+
+			if (!NIL_P(sub))
+				rb_ary_push(rv, sub);
+		}
+		return rv;
+	}
+	w = watch_lookup(hub, wd);
+	if (!w)
+		return rv;
+	for (i = 0; i < w->nr; i++) {
+		if ((w->ents[i].mask & mask & IN_ALL_EVENTS) ||
+		    (mask & (IN_IGNORED|IN_UNMOUNT)))
+			rb_ary_push(rv, rb_ary_entry(hub->subs, w->ents[i].sub));
+	}
+
+	/* the kernel removed the watch, no IN_IGNORED after IN_UNMOUNT */
+	if (mask & IN_IGNORED)
+		watch_delete(hub, wd);
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	hub.dispatch([nonblock]) -> Integer or nil
+ *
+ * Reads events with a single read(2) (see Inotify#take_all) and calls
+ * the block of every subscriber watching for each, returns the number
+ * of events dispatched.  Events nobody subscribed to are dropped
+ * without allocating.  May return +nil+ if +nonblock+ is +true+.
+ *
+ * Every subscriber is called with IN_Q_OVERFLOW, and every subscriber
+ * of the watch with IN_IGNORED and IN_UNMOUNT.  Event objects are
+ * frozen and shared between subscribers.  If a block raises, the
+ * remaining events are dispatched by the next call.
+ */
+static VALUE hub_dispatch(int argc, VALUE *argv, VALUE self)
+{
+	struct hub *hub = hub_get(self);
+	long n = 0;
+
+	if (RARRAY_LEN(hub->queue) == 0) {
+		VALUE events = rb_sp_inotify_take(self, argc, argv, 1,
+						  hub_event, self);
+
+		if (NIL_P(events))
+			return Qnil;
+		rb_ary_concat(hub->queue, events);
+	}
+	while (RARRAY_LEN(hub->queue) > 0) {
+		VALUE event = rb_ary_shift(hub->queue);
+		VALUE subs = recipients(hub, event);
+		long i;
+
+		n++;
+		for (i = 0; i < RARRAY_LEN(subs); i++) {
+			VALUE s = rb_ary_entry(subs, i);
+			struct subscriber *sub = DATA_PTR(s);
+
+			/* an earlier block may have closed it */
+			if (sub->idx >= 0)
+				rb_funcall(sub->callback, id_call, 1, event);
+		}
+	}
+
+	return LONG2NUM(n);
+}
+
+/*
+ * call-seq:
+ *	hub.run -> never returns
+ *
+ * Calls Hub#dispatch in a blocking fashion forever, usually in a
+ * dedicated Thread.
+ */
+static VALUE hub_run(VALUE self)
+{
+	VALUE argv = Qfalse;
+
+	while (1)
+		hub_dispatch(0, &argv, self);
+
+	return self;
+}
+
+/*
+ * call-seq:
+ *	hub.watches -> Integer
+ *
+ * Returns the number of kernel watches, which may be less than the
+ * number of Subscriber#add_watch calls.
+ */
+static VALUE hub_watches(VALUE self)
+{
+	return LONG2NUM((long)hub_get(self)->watches->num_entries);
+}
+
+/*
+ * call-seq:
+ *	Inotify::Hub.default -> Inotify::Hub
+ *
+ * Returns a process-wide Hub, creating it on first use and again in
+ * a child process after fork, since the parent's descriptor and
+ * subscribers are of no use there.
+ */
+static VALUE hub_s_default(VALUE klass)
+{
+	rb_pid_t pid = getpid();
+
+	if (NIL_P(default_hub) || default_pid != pid) {
+		VALUE flags = ID2SYM(rb_intern("CLOEXEC"));
+
+		default_hub = rb_funcall(cHub, rb_intern("new"), 1, flags);
+		default_pid = pid;
+	}
+	return default_hub;
+}
+
+void sleepy_penguin_init_inotify_hub(void)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+	VALUE cInotify = rb_const_get(mSleepyPenguin, rb_intern("Inotify"));
+
+	/*
+	 * Document-class: SleepyPenguin::Inotify::Hub
+	 *
+	 * An Inotify object shared by independent subscribers, so
+	 * libraries watching files in the same process need only one
+	 * descriptor (see the fs.inotify.max_user_instances sysctl), one
+	 * read loop and one kernel watch per inode.
+	 *
+	 *	hub = SleepyPenguin::Inotify::Hub.default
+	 *	sub = hub.subscribe { |event| p event.events }
+	 *	sub.add_watch("/path/to/foo", :CLOSE_WRITE)
+	 *	Thread.new { hub.run }
+	 *
+	 * A Hub may also be watched with Epoll or IO.select and
+	 * Hub#dispatch called with +nonblock+ when it is readable.
+	 */
+	cHub = rb_define_class_under(cInotify, "Hub", cInotify);
+	rb_define_singleton_method(cHub, "default", hub_s_default, 0);
+	rb_define_method(cHub, "subscribe", hub_subscribe, 0);
+	rb_define_method(cHub, "dispatch", hub_dispatch, -1);
+	rb_define_method(cHub, "run", hub_run, 0);
+	rb_define_method(cHub, "watches", hub_watches, 0);
+	rb_undef_method(cHub, "add_watch");
+	rb_undef_method(cHub, "rm_watch");
+	rb_undef_method(cHub, "take");
+	rb_undef_method(cHub, "take_all");
+	rb_undef_method(cHub, "take_batch");
+	rb_undef_method(cHub, "each");
+	rb_undef_method(cHub, "each_batch");
+
+	/*
+	 * Document-class: SleepyPenguin::Inotify::Hub::Subscriber
+	 *
+	 * Returned by Inotify::Hub#subscribe, it adds and removes watches
+	 * on behalf of one user of the Hub.
+	 */
+	cSubscriber = rb_define_class_under(cHub, "Subscriber", rb_cObject);
+	rb_undef_alloc_func(cSubscriber);
+	rb_define_method(cSubscriber, "add_watch", sub_add_watch, 2);
+	rb_define_method(cSubscriber, "rm_watch", sub_rm_watch, 1);
+	rb_define_method(cSubscriber, "close", sub_close, 0);
+	rb_define_method(cSubscriber, "closed?", sub_closed_p, 0);
+
+	cEvent = rb_const_get(cInotify, rb_intern("Event"));
+	rb_global_variable(&default_hub);
+	id_ivar_hub = rb_intern("@__sp_hub");
+	id_call = rb_intern("call");
+}
+#endif /* HAVE_SYS_INOTIFY_H */
@@ -0,0 +1,669 @@
+#ifdef __linux__
+#include "sleepy_penguin.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#  include <sys/eventfd.h>
+#  include "sp_doorbell.h"
+#endif
+
+#ifndef MFD_CLOEXEC
+#  define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#  define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef MFD_HUGETLB
+#  define MFD_HUGETLB 0x0004U
+#endif
+#ifndef F_ADD_SEALS
+#  define F_ADD_SEALS (1024 + 9)
+#  define F_GET_SEALS (1024 + 10)
+#endif
+#ifndef F_SEAL_SEAL
+#  define F_SEAL_SEAL 0x0001
+#  define F_SEAL_SHRINK 0x0002
+#  define F_SEAL_GROW 0x0004
+#  define F_SEAL_WRITE 0x0008
+#endif
+#ifndef F_SEAL_FUTURE_WRITE
+#  define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+#if !defined(HAVE_MEMFD_CREATE) && defined(__NR_memfd_create)
+static int memfd_create(const char *name, unsigned flags)
+{
+	return (int)syscall(__NR_memfd_create, name, flags);
+}
+#  define HAVE_MEMFD_CREATE 1
+#endif
+
+static VALUE cMemfd;
+
+static int memfd_open(const char *name, unsigned flags)
+{
+#ifdef HAVE_MEMFD_CREATE
+	int fd = memfd_create(name, flags);
+
+	if (fd < 0) {
+		if (rb_sp_gc_for_fd(errno))
+			fd = memfd_create(name, flags);
+		if (fd < 0)
+			rb_sys_fail("memfd_create");
+	}
+	return fd;
+#else
+	rb_notimplement();
+	return -1;
+#endif
+}
+
+/*
+ * call-seq:
+ *	Memfd.new([name[, flags]]) -> Memfd IO object
+ *
+ * Creates an anonymous file which lives in memory with memfd_create(2).
+ * +name+ (default: "sleepy_penguin") is only used for debugging, it
+ * shows up in /proc/$PID/fd.  The file starts empty and may be sized
+ * with File#truncate, then mmap(2)-ed by any process it is shared with
+ * by fork(2) or passed to with UNIXSocket#send_io.
+ *
+ * +flags+ may be a mask that consists of any of the following:
+ *
+ * - :CLOEXEC - set the close-on-exec flag on the new object
+ * - :ALLOW_SEALING - allow Memfd#add_seals
+ * - :HUGETLB - back the file with huge pages (sizes must be multiples
+ *   of the huge page size)
+ */
+static VALUE s_new(int argc, VALUE *argv, VALUE klass)
+{
+	VALUE name, _flags, rv;
+	unsigned flags;
+	int fd;
+
+	rb_scan_args(argc, argv, "02", &name, &_flags);
+	if (NIL_P(name))
+		name = rb_str_new_cstr("sleepy_penguin");
+	flags = NIL_P(_flags) ? RB_SP_CLOEXEC(MFD_CLOEXEC) :
+				rb_sp_get_uflags(klass, _flags);
+	fd = memfd_open(StringValueCStr(name), flags);
+
+	rv = INT2FIX(fd);
+	return rb_call_super(1, &rv);
+}
+
+static void add_seals(int fd, int seals)
+{
+	if (fcntl(fd, F_ADD_SEALS, seals) < 0)
+		rb_sys_fail("fcntl(F_ADD_SEALS)");
+}
+
+static int get_seals(int fd)
+{
+	int seals = fcntl(fd, F_GET_SEALS);
+
+	if (seals < 0)
+		rb_sys_fail("fcntl(F_GET_SEALS)");
+	return seals;
+}
+
+/*
+ * call-seq:
+ *	memfd.add_seals(seals) -> Integer
+ *
+ * Restricts further changes to the file, for all processes sharing it.
+ * +seals+ may be a mask or an Array of the following, and cannot be
+ * removed once added:
+ *
+ * - :SEAL_SHRINK - the file may not shrink, so it may be mapped safely
+ *   by processes which do not trust each other
+ * - :SEAL_GROW - the file may not grow
+ * - :SEAL_WRITE - the contents may no longer be written to, which
+ *   fails if any shared writable mappings exist
+ * - :SEAL_FUTURE_WRITE - no new writes or writable mappings, existing
+ *   shared mappings stay writable (Linux 5.1+)
+ * - :SEAL_SEAL - no further seals may be added
+ *
+ * The Memfd must have been created with :ALLOW_SEALING.  Returns every
+ * seal now set.
+ */
+static VALUE memfd_add_seals(VALUE self, VALUE seals)
+{
+	int fd = rb_sp_fileno(self);
+
+	add_seals(fd, (int)rb_sp_get_uflags(self, seals));
+	return INT2NUM(get_seals(fd));
+}
+
+/*
+ * call-seq:
+ *	memfd.seals -> Integer
+ *
+ * Returns the mask of seals set on the file, see Memfd#add_seals.
+ */
+static VALUE memfd_seals(VALUE self)
+{
+	return INT2NUM(get_seals(rb_sp_fileno(self)));
+}
+
+#ifdef HAVE_SYS_EVENTFD_H
+/*
+ * A single-producer, single-consumer ring of length-prefixed messages in
+ * a sealed Memfd, with EventFD doorbells to wait for data or space (see
+ * sp_doorbell.h).  Positions are free-running, messages never straddle
+ * the end of the ring: the rest is skipped with a RING_SKIP length.
+ */
+#define RING_MAGIC 0x31474e4952505355ULL /* "USPRING1" */
+#define RING_PAD 128 /* L1_CACHE_LINE_MAX in init.c */
+#define RING_SKIP UINT32_MAX
+#define RING_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+struct ring_hdr {
+	uint64_t magic;
+	uint64_t capa;
+	char pad0[RING_PAD - 2 * sizeof(uint64_t)];
+
+	uint64_t head; /* consumer */
+	uint32_t writer_sleeping;
+	char pad1[RING_PAD - sizeof(uint64_t) - sizeof(uint32_t)];
+
+	uint64_t tail; /* producer */
+	uint32_t reader_sleeping;
+	char pad2[RING_PAD - sizeof(uint64_t) - sizeof(uint32_t)];
+};
+
+struct ring {
+	struct ring_hdr *hdr;
+	unsigned char *data;
+	size_t map_len;
+	uint64_t capa; /* validated copy, the header is shared */
+	VALUE memfd;
+	VALUE data_io; /* readable when the reader may have data */
+	VALUE space_io; /* readable when the writer may have space */
+	struct sp_bell rbell;
+	struct sp_bell wbell;
+	int reading;
+	int writing;
+};
+
+static VALUE cRing;
+
+static void ring_mark(void *ptr)
+{
+	struct ring *r = ptr;
+
+	rb_gc_mark(r->memfd);
+	rb_gc_mark(r->data_io);
+	rb_gc_mark(r->space_io);
+}
+
+static void ring_free(void *ptr)
+{
+	struct ring *r = ptr;
+
+	if (r->hdr)
+		munmap(r->hdr, r->map_len);
+	xfree(r);
+}
+
+static size_t ring_memsize(const void *ptr)
+{
+	return sizeof(struct ring);
+}
+
+static const rb_data_type_t ring_type = {
+	"sleepy_penguin_memfd_ring",
+	{ ring_mark, ring_free, ring_memsize, },
+	/* parent, data, [ flags ] */
+};
+
+static struct ring *ring_get(VALUE self)
+{
+	struct ring *r = rb_check_typeddata(self, &ring_type);
+
+	if (!r->hdr)
+		rb_raise(rb_eIOError, "uninitialized ring");
+	return r;
+}
+
+static VALUE ring_alloc(VALUE klass)
+{
+	struct ring *r;
+	VALUE self = TypedData_Make_Struct(klass, struct ring, &ring_type, r);
+
+	r->memfd = r->data_io = r->space_io = Qnil;
+	return self;
+}
+
+static void ring_map(struct ring *r, int fd, size_t len)
+{
+	void *ptr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (ptr == MAP_FAILED)
+		rb_sys_fail("mmap");
+	r->hdr = ptr;
+	r->data = (unsigned char *)ptr + sizeof(struct ring_hdr);
+	r->map_len = len;
+	r->capa = len - sizeof(struct ring_hdr);
+}
+
+static VALUE ring_efd(void)
+{
+	VALUE cEventFD = rb_path2class("SleepyPenguin::EventFD");
+	VALUE flags = INT2NUM(RB_SP_CLOEXEC(EFD_CLOEXEC) | EFD_NONBLOCK);
+
+	return rb_funcall(cEventFD, rb_intern("new"), 2, INT2FIX(0), flags);
+}
+
+/*
+ * call-seq:
+ *	Memfd::Ring.new([capacity]) -> Memfd::Ring
+ *
+ * Creates a ring holding +capacity+ (default: 65536, rounded up to a
+ * power of two) bytes of messages in a new Memfd, which is sealed so
+ * its size never changes.  Processes forked afterwards share it, and
+ * it may be passed to other processes with Memfd::Ring#ios.
+ */
+static VALUE ring_init(int argc, VALUE *argv, VALUE self)
+{
+	struct ring *r = rb_check_typeddata(self, &ring_type);
+	uint64_t capa = 65536;
+	VALUE vcapa;
+	int fd;
+
+	rb_scan_args(argc, argv, "01", &vcapa);
+	if (r->hdr)
+		rb_raise(rb_eRuntimeError, "already initialized");
+	if (!NIL_P(vcapa)) {
+		long want = NUM2LONG(vcapa);
+
+		if (want <= 0 || want > (1L << 30))
+			rb_raise(rb_eArgError, "capacity out of range: %ld",
+				 want);
+		for (capa = 64; capa < (uint64_t)want; capa <<= 1)
+			;
+	}
+
+	r->memfd = rb_funcall(cMemfd, rb_intern("new"), 2,
+			rb_str_new_cstr("sleepy_penguin_ring"),
+			UINT2NUM(RB_SP_CLOEXEC(MFD_CLOEXEC)|MFD_ALLOW_SEALING));
+	fd = rb_sp_fileno(r->memfd);
+	if (ftruncate(fd, (off_t)(sizeof(struct ring_hdr) + capa)) < 0)
+		rb_sys_fail("ftruncate");
+	add_seals(fd, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL);
+	ring_map(r, fd, sizeof(struct ring_hdr) + capa);
+	r->hdr->capa = capa;
+	r->hdr->magic = RING_MAGIC;
+	/* armed, so the first write wakes an Epoll waiting on data_io */
+	r->hdr->reader_sleeping = 1;
+	r->rbell.armed = 1;
+	r->data_io = ring_efd();
+	r->space_io = ring_efd();
+
+	return self;
+}
+
+/*
+ * call-seq:
+ *	Memfd::Ring.open(memfd, data_io, space_io) -> Memfd::Ring
+ *
+ * Attaches to a ring created by another process, where the arguments
+ * are the IO objects from Memfd::Ring#ios, usually received with
+ * UNIXSocket#recv_io.  The Memfd must be sealed against shrinking.
+ */
+static VALUE ring_s_open(VALUE klass, VALUE memfd, VALUE data_io,
+			VALUE space_io)
+{
+	VALUE self = ring_alloc(klass);
+	struct ring *r = rb_check_typeddata(self, &ring_type);
+	int fd = rb_sp_fileno(memfd);
+	struct ring_hdr *hdr;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		rb_sys_fail("fstat");
+	if (!(get_seals(fd) & F_SEAL_SHRINK))
+		rb_raise(rb_eArgError, "memfd is not sealed against shrinking");
+	if (st.st_size <= (off_t)sizeof(struct ring_hdr))
+		rb_raise(rb_eArgError, "memfd too small for a ring");
+	ring_map(r, fd, (size_t)st.st_size);
+	hdr = r->hdr;
+	if (hdr->magic != RING_MAGIC ||
+	    hdr->capa + sizeof(struct ring_hdr) != (uint64_t)st.st_size ||
+	    (hdr->capa & (hdr->capa - 1)))
+		rb_raise(rb_eArgError, "memfd does not hold a ring");
+	r->memfd = memfd;
+	r->data_io = data_io;
+	r->space_io = space_io;
+	r->rbell.armed = 1; /* the first read drains the doorbell */
+	rb_sp_set_nonblock(rb_sp_fileno(data_io));
+	rb_sp_set_nonblock(rb_sp_fileno(space_io));
+
+	return self;
+}
+
+struct ring_wait {
+	VALUE io;
+	int *busy;
+};
+
+static VALUE ring_do_wait(VALUE p)
+{
+	struct ring_wait *w = (struct ring_wait *)p;
+	int fd;
+
+	errno = EAGAIN;
+	if (!rb_sp_wait(rb_io_wait_readable, w->io, &fd))
+		rb_sys_fail("read(eventfd)");
+	return Qnil;
+}
+
+static VALUE ring_wait_done(VALUE p)
+{
+	*((struct ring_wait *)p)->busy = 0;
+	return Qnil;
+}
+
+static void ring_wait(VALUE io, int *busy)
+{
+	struct ring_wait w;
+
+	w.io = io;
+	w.busy = busy;
+	*busy = 1;
+	rb_ensure(ring_do_wait, (VALUE)&w, ring_wait_done, (VALUE)&w);
+}
+
+static void ring_busy_check(VALUE self, int busy, const char *what)
+{
+	if (busy)
+		rb_raise(rb_eThreadError, "another thread is waiting to %s %"
+			 PRIsVALUE", Memfd::Ring is single-%s", what, self,
+			 *what == 'r' ? "consumer" : "producer");
+}
+
+/*
+ * call-seq:
+ *	ring.write(string[, nonblock]) -> true or false
+ *
+ * Copies +string+ into the ring as one message.  If there is not
+ * enough space, this blocks until the reader makes room unless
+ * +nonblock+ is +true+, in which case +false+ is returned and
+ * Memfd::Ring#space_io becomes readable once there may be space.
+ * The reader is only woken if it is waiting for data.
+ */
+static VALUE ring_write(int argc, VALUE *argv, VALUE self)
+{
+	struct ring *r = ring_get(self);
+	struct ring_hdr *hdr = r->hdr;
+	uint64_t capa = r->capa;
+	VALUE str, nonblock;
+	uint64_t rec;
+	long len;
+
+	rb_scan_args(argc, argv, "11", &str, &nonblock);
+	StringValue(str);
+	len = RSTRING_LEN(str);
+	rec = RING_ALIGN(sizeof(uint32_t) + (uint64_t)len);
+	if (rec > capa)
+		rb_raise(rb_eArgError, "message of %ld bytes too large for %"
+			 PRIu64"-byte ring", len, capa);
+	ring_busy_check(self, r->writing, "write");
+
+	for (;;) {
+		uint64_t tail, head, off, contig, need;
+
+		if (r->wbell.armed)
+			sp_bell_disarm(&r->wbell, &hdr->writer_sleeping,
+					rb_sp_fileno(r->space_io));
+		tail = hdr->tail;
+		head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		off = tail & (capa - 1);
+		contig = capa - off;
+		need = contig < rec ? contig : rec;
+		if (capa - (tail - head) >= need) {
+			uint32_t n = contig < rec ? RING_SKIP : (uint32_t)len;
+
+			memcpy(r->data + off, &n, sizeof(n));
+			if (n != RING_SKIP)
+				memcpy(r->data + off + sizeof(n),
+					RSTRING_PTR(str), len);
+			__atomic_store_n(&hdr->tail, tail + need,
+					__ATOMIC_RELEASE);
+			sp_bell_ring(&hdr->reader_sleeping,
+					rb_sp_fileno(r->data_io));
+			if (n == RING_SKIP)
+				continue;
+			return Qtrue;
+		}
+
+		/* full, wait for the reader to move head */
+		sp_bell_arm(&r->wbell, &hdr->writer_sleeping);
+		if (__atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) != head)
+			continue;
+		if (RTEST(nonblock))
+			return Qfalse;
+		ring_wait(r->space_io, &r->writing);
+	}
+}
+
+/*
+ * call-seq:
+ *	ring.read([nonblock]) -> String or nil
+ *
+ * Removes the oldest message from the ring and returns it as a new
+ * String.  If the ring is empty, this blocks until a message is
+ * written unless +nonblock+ is +true+, in which case +nil+ is returned.
+ * The writer is only woken if it is waiting for space.
+ *
+ * When the ring is watched by Epoll (see Memfd::Ring#to_io), +nonblock+
+ * must be +true+: it leaves the reader announced as sleeping so the next
+ * message makes Memfd::Ring#data_io readable.
+ */
+static VALUE ring_read(int argc, VALUE *argv, VALUE self)
+{
+	struct ring *r = ring_get(self);
+	struct ring_hdr *hdr = r->hdr;
+	uint64_t capa = r->capa;
+	VALUE nonblock, rv;
+	int data_fd;
+
+	rb_scan_args(argc, argv, "01", &nonblock);
+	ring_busy_check(self, r->reading, "read");
+
+	for (;;) {
+		uint64_t head = hdr->head;
+		uint64_t tail;
+
+		data_fd = rb_sp_fileno(r->data_io);
+		if (r->rbell.armed)
+			sp_bell_disarm(&r->rbell, &hdr->reader_sleeping,
+					data_fd);
+		rv = Qnil;
+		tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			uint64_t off = head & (capa - 1);
+			uint32_t n;
+
+			memcpy(&n, r->data + off, sizeof(n));
+			if (n == RING_SKIP) {
+				head += capa - off;
+				continue;
+			}
+			if (n > capa - off - sizeof(n) ||
+			    head + sizeof(n) + n > tail)
+				rb_raise(rb_eIOError, "corrupt ring");
+			rv = rb_str_new((const char *)r->data + off + sizeof(n),
+					n);
+			head += RING_ALIGN(sizeof(n) + n);
+			break;
+		}
+		if (head != hdr->head) {
+			__atomic_store_n(&hdr->head, head, __ATOMIC_RELEASE);
+			sp_bell_ring(&hdr->writer_sleeping,
+					rb_sp_fileno(r->space_io));
+		}
+
+		if (RTEST(nonblock)) {
+			/*
+			 * as with EventQueue#take, stay armed for Epoll, but
+			 * messages may remain or have been written before
+			 * arming, so the doorbell must be readable for them
+			 */
+			sp_bell_arm(&r->rbell, &hdr->reader_sleeping);
+			if (__atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE) ==
+			    head)
+				return rv;
+			if (NIL_P(rv))
+				continue;
+			sp_bell_self_ring(&r->rbell, data_fd);
+			return rv;
+		}
+		if (!NIL_P(rv))
+			return rv;
+		sp_bell_arm(&r->rbell, &hdr->reader_sleeping);
+		if (__atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE) != head)
+			continue;
+		ring_wait(r->data_io, &r->reading);
+	}
+}
+
+/*
+ * call-seq:
+ *	ring.ios -> [ memfd, data_io, space_io ]
+ *
+ * Returns the descriptors making up the ring, to pass to another
+ * process with UNIXSocket#send_io and Memfd::Ring.open.
+ */
+static VALUE ring_ios(VALUE self)
+{
+	struct ring *r = ring_get(self);
+
+	return rb_ary_new_from_args(3, r->memfd, r->data_io, r->space_io);
+}
+
+/*
+ * call-seq:
+ *	ring.data_io -> IO
+ *
+ * Returns the doorbell which becomes readable when a message is written
+ * while the reader waits, for use with Epoll by the reader.
+ */
+static VALUE ring_data_io(VALUE self)
+{
+	return ring_get(self)->data_io;
+}
+
+/*
+ * call-seq:
+ *	ring.space_io -> IO
+ *
+ * Returns the doorbell which becomes readable when a message is read
+ * while the writer waits for space, for use with Epoll by the writer.
+ */
+static VALUE ring_space_io(VALUE self)
+{
+	return ring_get(self)->space_io;
+}
+
+/*
+ * call-seq:
+ *	ring.capacity -> Integer
+ *
+ * Returns the size of the ring in bytes.  Every message takes four
+ * bytes more than its length, rounded up to a multiple of eight.
+ */
+static VALUE ring_capacity(VALUE self)
+{
+	return ULL2NUM(ring_get(self)->capa);
+}
+
+/*
+ * call-seq:
+ *	ring.size -> Integer
+ *
+ * Returns the number of bytes used by messages which have not been
+ * read yet.
+ */
+static VALUE ring_size(VALUE self)
+{
+	struct ring_hdr *hdr = ring_get(self)->hdr;
+	uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+
+	return ULL2NUM(tail - head);
+}
+#endif /* HAVE_SYS_EVENTFD_H */
+
+void sleepy_penguin_init_memfd(void)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+
+	/*
+	 * Document-class: SleepyPenguin::Memfd
+	 *
+	 * An anonymous file in memory (see memfd_create(2)), which may be
+	 * mapped by every process it is shared with.  Memfd#add_seals
+	 * prevents other processes from resizing or writing to it.
+	 */
+	cMemfd = rb_define_class_under(mSleepyPenguin, "Memfd", rb_cFile);
+	rb_define_singleton_method(cMemfd, "new", s_new, -1);
+	rb_define_method(cMemfd, "add_seals", memfd_add_seals, 1);
+	rb_define_method(cMemfd, "seals", memfd_seals, 0);
+
+	NODOC_CONST(cMemfd, "CLOEXEC", UINT2NUM(MFD_CLOEXEC));
+	NODOC_CONST(cMemfd, "ALLOW_SEALING", UINT2NUM(MFD_ALLOW_SEALING));
+	NODOC_CONST(cMemfd, "HUGETLB", UINT2NUM(MFD_HUGETLB));
+
+	/* prevents further seals from being added */
+	rb_define_const(cMemfd, "SEAL_SEAL", INT2NUM(F_SEAL_SEAL));
+
+	/* prevents the file from shrinking */
+	rb_define_const(cMemfd, "SEAL_SHRINK", INT2NUM(F_SEAL_SHRINK));
+
+	/* prevents the file from growing */
+	rb_define_const(cMemfd, "SEAL_GROW", INT2NUM(F_SEAL_GROW));
+
+	/* prevents writes to the file */
+	rb_define_const(cMemfd, "SEAL_WRITE", INT2NUM(F_SEAL_WRITE));
+
+	/* prevents new writes, existing shared mappings still work */
+	rb_define_const(cMemfd, "SEAL_FUTURE_WRITE",
+			INT2NUM(F_SEAL_FUTURE_WRITE));
+
+#ifdef HAVE_SYS_EVENTFD_H
+	/*
+	 * Document-class: SleepyPenguin::Memfd::Ring
+	 *
+	 * A ring of messages in a Memfd, for one process (or thread) to
+	 * write to and another to read from without pipes or sockets.
+	 * Each message is copied once in each direction, with no system
+	 * calls unless the reader or writer is waiting:
+	 *
+	 *	ring = SleepyPenguin::Memfd::Ring.new
+	 *	fork do
+	 *	  while msg = ring.read
+	 *	    ...
+	 *	  end
+	 *	end
+	 *	ring.write("hello")
+	 *
+	 * Unrelated processes may attach to a ring with Memfd::Ring.open
+	 * after receiving its descriptors over a UNIX socket.
+	 */
+	cRing = rb_define_class_under(cMemfd, "Ring", rb_cObject);
+	rb_define_alloc_func(cRing, ring_alloc);
+	rb_define_singleton_method(cRing, "open", ring_s_open, 3);
+	rb_define_method(cRing, "initialize", ring_init, -1);
+	rb_define_method(cRing, "write", ring_write, -1);
+	rb_define_method(cRing, "read", ring_read, -1);
+	rb_define_method(cRing, "ios", ring_ios, 0);
+	rb_define_method(cRing, "data_io", ring_data_io, 0);
+	rb_define_method(cRing, "to_io", ring_data_io, 0);
+	rb_define_method(cRing, "space_io", ring_space_io, 0);
+	rb_define_method(cRing, "capacity", ring_capacity, 0);
+	rb_define_method(cRing, "size", ring_size, 0);
+#endif /* HAVE_SYS_EVENTFD_H */
+}
+#endif /* __linux__ */
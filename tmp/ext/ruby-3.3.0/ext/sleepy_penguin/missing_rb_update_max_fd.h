@@ -0,0 +1,3 @@
+#ifndef HAVE_RB_UPDATE_MAX_FD
+#  define rb_update_max_fd(fd) for (;0;)
+#endif
@@ -0,0 +1,332 @@
+#include "sleepy_penguin.h"
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+#include "sp_copy.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#  define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#  define UDP_GRO 104
+#endif
+#ifndef SOL_UDP
+#  define SOL_UDP 17
+#endif
+#define MM_MAX 1024 /* UIO_MAXIOV, the kernel caps vlen to this */
+#define MM_CTL_LEN 64 /* room for UDP_GRO and a timestamp or two */
+
+static ID id_to_sockaddr;
+static VALUE sym_wait_readable, sym_wait_writable;
+
+union mm_ctl {
+	char buf[MM_CTL_LEN];
+	struct cmsghdr align;
+};
+
+/*
+ * everything lives in the TLS buffer: per-message arrays first (the
+ * kernel wants struct mmsghdr back-to-back), then the payloads at a
+ * cache-line aligned offset
+ */
+struct mm_args {
+	int fd;
+	int flags;
+	unsigned vlen;
+	struct mmsghdr *hdrs;
+	struct iovec *iovs;
+	struct sockaddr_storage *addrs;
+	union mm_ctl *ctls;
+	char *data;
+	size_t stride; /* cache-aligned distance between received payloads */
+};
+
+static size_t align_up(size_t n, size_t to)
+{
+	return (n + to - 1) & ~(to - 1);
+}
+
+/* lays out +vlen+ messages and +data_len+ bytes of payload */
+static void mm_buf_get(struct mm_args *a, size_t data_len)
+{
+	size_t l1 = rb_sp_l1_cache_line_size;
+	size_t per_msg = sizeof(struct mmsghdr) + sizeof(struct iovec) +
+			sizeof(struct sockaddr_storage) + sizeof(union mm_ctl);
+	size_t size = per_msg * a->vlen + data_len + l1;
+	char *ptr = rb_sp_gettlsbuf(&size);
+
+	/* sockaddr_storage and cmsghdr alignment is the strictest */
+	a->addrs = (struct sockaddr_storage *)ptr;
+	ptr += sizeof(struct sockaddr_storage) * a->vlen;
+	a->ctls = (union mm_ctl *)ptr;
+	ptr += sizeof(union mm_ctl) * a->vlen;
+	a->hdrs = (struct mmsghdr *)ptr;
+	ptr += sizeof(struct mmsghdr) * a->vlen;
+	a->iovs = (struct iovec *)ptr;
+	ptr += sizeof(struct iovec) * a->vlen;
+	a->data = (char *)align_up((uintptr_t)ptr, l1);
+}
+
+static unsigned mm_vlen(long n)
+{
+	if (n <= 0)
+		rb_raise(rb_eArgError, "count must be positive: %ld", n);
+	return n > MM_MAX ? MM_MAX : (unsigned)n;
+}
+
+static void *nogvl_recvmmsg(void *ptr)
+{
+	struct mm_args *a = ptr;
+
+	return (void *)(long)recvmmsg(a->fd, a->hdrs, a->vlen, a->flags, NULL);
+}
+
+static void *nogvl_sendmmsg(void *ptr)
+{
+	struct mm_args *a = ptr;
+
+	return (void *)(long)sendmmsg(a->fd, a->hdrs, a->vlen, a->flags);
+}
+
+/* points message +i+ at its buffers, +addr+ and +ctl+ are optional */
+static struct msghdr *
+mm_init(struct mm_args *a, unsigned i, void *base, size_t len,
+	int addr, int ctl)
+{
+	struct msghdr *m = &a->hdrs[i].msg_hdr;
+
+	memset(m, 0, sizeof(*m));
+	a->iovs[i].iov_base = base;
+	a->iovs[i].iov_len = len;
+	m->msg_iov = &a->iovs[i];
+	m->msg_iovlen = 1;
+	if (addr) {
+		m->msg_name = &a->addrs[i];
+		m->msg_namelen = sizeof(a->addrs[i]);
+	}
+	if (ctl) {
+		m->msg_control = a->ctls[i].buf;
+		m->msg_controllen = sizeof(a->ctls[i].buf);
+	}
+	return m;
+}
+
+static int gro_size(struct msghdr *msg)
+{
+	struct cmsghdr *cm;
+
+	for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+		if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+			int seg;
+
+			memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+			return seg;
+		}
+	}
+	return 0;
+}
+
+struct mm_recv {
+	struct mm_args a;
+	VALUE io;
+	VALUE addrs;
+	VALUE segs;
+	size_t buf_size;
+};
+
+static VALUE mm_recv(VALUE ptr)
+{
+	struct mm_recv *r = (struct mm_recv *)ptr;
+	struct mm_args *a = &r->a;
+	unsigned i;
+	long n;
+	VALUE rv;
+
+	for (i = 0; i < a->vlen; i++)
+		mm_init(a, i, a->data + a->stride * i, r->buf_size,
+			!NIL_P(r->addrs), !NIL_P(r->segs));
+retry:
+	n = (long)IO_RUN(nogvl_recvmmsg, a);
+	if (n < 0) {
+		if (errno == EINTR) {
+			rb_thread_check_ints();
+			a->fd = rb_sp_fileno(r->io);
+			goto retry;
+		}
+		if (errno == EAGAIN)
+			return sym_wait_readable;
+		rb_sys_fail("recvmmsg");
+	}
+
+	rv = rb_ary_new_capa(n);
+	for (i = 0; i < (unsigned)n; i++) {
+		struct msghdr *m = &a->hdrs[i].msg_hdr;
+
+		rb_ary_push(rv, rb_str_new(m->msg_iov->iov_base,
+					   a->hdrs[i].msg_len));
+		if (!NIL_P(r->addrs))
+			rb_ary_push(r->addrs, rb_str_new(m->msg_name,
+							 m->msg_namelen));
+		if (!NIL_P(r->segs))
+			rb_ary_push(r->segs, INT2FIX(gro_size(m)));
+	}
+	return rv;
+}
+
+/* :nodoc: */
+static VALUE sp_recvmmsg(VALUE mod, VALUE io, VALUE count, VALUE buf_size,
+			VALUE addrs, VALUE segs)
+{
+	struct mm_recv r;
+	long len = NUM2LONG(buf_size);
+
+	if (len <= 0 || len > 0x10000)
+		rb_raise(rb_eArgError, "buffer size out of range: %ld", len);
+	r.a.vlen = mm_vlen(NUM2LONG(count));
+	r.buf_size = (size_t)len;
+	r.a.stride = align_up(r.buf_size, rb_sp_l1_cache_line_size);
+	r.a.flags = MSG_DONTWAIT;
+	r.io = rb_io_get_io(io);
+	r.a.fd = rb_sp_fileno(r.io);
+	if (!NIL_P(addrs)) {
+		Check_Type(addrs, T_ARRAY);
+		rb_ary_clear(addrs);
+	}
+	if (!NIL_P(segs)) {
+		Check_Type(segs, T_ARRAY);
+		rb_ary_clear(segs);
+	}
+	r.addrs = addrs;
+	r.segs = segs;
+
+	mm_buf_get(&r.a, r.a.stride * r.a.vlen);
+	return rb_ensure(mm_recv, (VALUE)&r, rb_sp_puttlsbuf,
+			 (VALUE)r.a.addrs);
+}
+
+struct mm_send {
+	struct mm_args a;
+	VALUE io;
+	VALUE msgs;
+	VALUE addrs;
+	size_t total;
+};
+
+static VALUE addr_at(VALUE addrs, long i)
+{
+	VALUE addr = rb_ary_entry(addrs, i);
+
+	if (!RB_TYPE_P(addr, T_STRING))
+		addr = rb_funcall(addr, id_to_sockaddr, 0);
+	StringValue(addr);
+	if (RSTRING_LEN(addr) > (long)sizeof(struct sockaddr_storage))
+		rb_raise(rb_eArgError, "socket address too long");
+	return addr;
+}
+
+static VALUE mm_send(VALUE ptr)
+{
+	struct mm_send *s = (struct mm_send *)ptr;
+	struct mm_args *a = &s->a;
+	char *data = a->data;
+	size_t left = s->total;
+	unsigned i;
+	long n;
+
+	/* copied, so other threads may modify msgs while we're sending */
+	for (i = 0; i < a->vlen; i++) {
+		VALUE str = rb_ary_entry(s->msgs, i);
+		struct msghdr *m;
+		size_t len;
+
+		StringValue(str);
+		len = RSTRING_LEN(str);
+		if (len > left)
+			rb_raise(rb_eRuntimeError, "messages modified");
+		memcpy(data, RSTRING_PTR(str), len);
+		m = mm_init(a, i, data, len, 0, 0);
+		data += len;
+		left -= len;
+		if (!NIL_P(s->addrs)) {
+			VALUE addr = addr_at(s->addrs, i);
+
+			memcpy(&a->addrs[i], RSTRING_PTR(addr),
+				RSTRING_LEN(addr));
+			m->msg_name = &a->addrs[i];
+			m->msg_namelen = (socklen_t)RSTRING_LEN(addr);
+		}
+	}
+retry:
+	n = (long)IO_RUN(nogvl_sendmmsg, a);
+	if (n < 0) {
+		if (errno == EINTR) {
+			rb_thread_check_ints();
+			a->fd = rb_sp_fileno(s->io);
+			goto retry;
+		}
+		if (errno == EAGAIN)
+			return sym_wait_writable;
+		rb_sys_fail("sendmmsg");
+	}
+	return LONG2NUM(n);
+}
+
+/* :nodoc: */
+static VALUE sp_sendmmsg(VALUE mod, VALUE io, VALUE msgs, VALUE addrs)
+{
+	struct mm_send s;
+	size_t total = 0;
+	long i, n;
+
+	msgs = rb_convert_type(msgs, T_ARRAY, "Array", "to_ary");
+	n = RARRAY_LEN(msgs);
+	if (n == 0)
+		return INT2FIX(0);
+	s.a.vlen = mm_vlen(n);
+	if (!NIL_P(addrs)) {
+		addrs = rb_convert_type(addrs, T_ARRAY, "Array", "to_ary");
+		if (RARRAY_LEN(addrs) < (long)s.a.vlen)
+			rb_raise(rb_eArgError, "fewer addresses than messages");
+	}
+	for (i = 0; i < (long)s.a.vlen; i++) {
+		VALUE str = rb_ary_entry(msgs, i);
+
+		total += RSTRING_LEN(StringValue(str));
+	}
+	s.total = total;
+	s.a.flags = MSG_DONTWAIT;
+	s.io = rb_io_get_io(io);
+	s.a.fd = rb_sp_fileno(s.io);
+	s.msgs = msgs;
+	s.addrs = addrs;
+
+	mm_buf_get(&s.a, total);
+	return rb_ensure(mm_send, (VALUE)&s, rb_sp_puttlsbuf,
+			 (VALUE)s.a.addrs);
+}
+
+void sleepy_penguin_init_mmsg(void)
+{
+	VALUE mod = rb_define_module("SleepyPenguin");
+
+	rb_define_singleton_method(mod, "__recvmmsg", sp_recvmmsg, 5);
+	rb_define_singleton_method(mod, "__sendmmsg", sp_sendmmsg, 3);
+
+	/*
+	 * socket option (level Socket::SOL_UDP) which lets the kernel
+	 * coalesce received datagrams, see SleepyPenguin.recvmmsg
+	 */
+	rb_define_const(mod, "UDP_GRO", INT2NUM(UDP_GRO));
+
+	/*
+	 * socket option (level Socket::SOL_UDP) which makes the kernel
+	 * split each sent message into datagrams of the given size
+	 */
+	rb_define_const(mod, "UDP_SEGMENT", INT2NUM(UDP_SEGMENT));
+
+	id_to_sockaddr = rb_intern("to_sockaddr");
+	sym_wait_readable = ID2SYM(rb_intern("wait_readable"));
+	sym_wait_writable = ID2SYM(rb_intern("wait_writable"));
+}
+#endif /* HAVE_RECVMMSG && HAVE_SENDMMSG */
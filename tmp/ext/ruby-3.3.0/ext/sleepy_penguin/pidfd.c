@@ -0,0 +1,187 @@
+#ifdef __linux__
+#include "sleepy_penguin.h"
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/* syscall numbers are the same on every architecture since Linux 5.1 */
+#ifndef __NR_pidfd_send_signal
+#  define __NR_pidfd_send_signal 424
+#endif
+#ifndef __NR_pidfd_open
+#  define __NR_pidfd_open 434
+#endif
+#ifndef P_PIDFD
+#  define P_PIDFD 3
+#endif
+#ifndef PIDFD_NONBLOCK
+#  define PIDFD_NONBLOCK O_NONBLOCK
+#endif
+
+static ID id_ivar_pid;
+
+/*
+ * call-seq:
+ *	PidFD.new(pid [, flags])	-> PidFD IO object
+ *
+ * Opens a descriptor referring to the process +pid+ with
+ * pidfd_open(2), which requires Linux 5.3+.  The descriptor becomes
+ * readable once the process exits, so it may be watched with Epoll
+ * (or IO.select) instead of handling SIGCHLD.  It always has the
+ * close-on-exec flag set.
+ *
+ * +flags+ may be :NONBLOCK (Linux 5.10+) to set the non-blocking I/O
+ * flag on the new object, PidFD#wait behaves the same either way.
+ *
+ * Unlike a PID, the descriptor keeps referring to the same process
+ * even after it is reaped, so PidFD#send_signal never signals an
+ * unrelated process which reused the PID.  Open it before the child
+ * may be reaped (e.g. right after Process.spawn) to be sure it refers
+ * to the right process.
+ */
+static VALUE s_new(int argc, VALUE *argv, VALUE klass)
+{
+	VALUE _pid, _flags, rv;
+	pid_t pid;
+	int flags;
+	int fd;
+
+	rb_scan_args(argc, argv, "11", &_pid, &_flags);
+	pid = NUM2PIDT(_pid);
+	flags = rb_sp_get_flags(klass, _flags, 0);
+
+	fd = (int)syscall(__NR_pidfd_open, pid, flags);
+	if (fd < 0) {
+		if (rb_sp_gc_for_fd(errno))
+			fd = (int)syscall(__NR_pidfd_open, pid, flags);
+		if (fd < 0)
+			rb_sys_fail("pidfd_open");
+	}
+
+	rv = INT2FIX(fd);
+	rv = rb_call_super(1, &rv);
+	rb_ivar_set(rv, id_ivar_pid, _pid);
+
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	pidfd.pid	-> Integer
+ *
+ * Returns the PID the descriptor was opened for.
+ */
+static VALUE pidfd_pid(VALUE self)
+{
+	return rb_attr_get(self, id_ivar_pid);
+}
+
+/* :nodoc: */
+static VALUE pidfd_send_signal(VALUE self, VALUE sig)
+{
+	int signo = NUM2INT(sig);
+	int fd = rb_sp_fileno(self);
+
+	if (syscall(__NR_pidfd_send_signal, fd, signo, NULL, 0) < 0)
+		rb_sys_fail("pidfd_send_signal");
+
+	return Qnil;
+}
+
+/* converts siginfo_t from waitid(2) to the status waitpid(2) would give */
+static int si2status(const siginfo_t *si)
+{
+	switch (si->si_code) {
+	case CLD_EXITED: return (si->si_status & 0xff) << 8;
+	case CLD_KILLED: return si->si_status & 0x7f;
+	case CLD_DUMPED: return (si->si_status & 0x7f) | 0x80;
+	case CLD_TRAPPED:
+	case CLD_STOPPED: return ((si->si_status & 0xff) << 8) | 0x7f;
+	case CLD_CONTINUED: return 0xffff;
+	}
+	return 0;
+}
+
+/*
+ * call-seq:
+ *	pidfd.wait([nonblock])	-> Process::Status or nil
+ *
+ * Reaps the child process with waitid(2) using P_PIDFD (Linux 5.4+)
+ * and returns its status, which is also stored in <code>$?</code> as
+ * Process.wait does.  If the child has not exited, this waits for the
+ * descriptor to become readable without blocking other threads, unless
+ * +nonblock+ is +true+, in which case +nil+ is returned.
+ *
+ * Only the parent of the process may wait for it, others get
+ * Errno::ECHILD.  The descriptor stays readable after the child is
+ * reaped, so remove it from any Epoll it was added to (or close it)
+ * once this returns a status.
+ */
+static VALUE pidfd_wait(int argc, VALUE *argv, VALUE self)
+{
+	VALUE nonblock;
+	int fd = rb_sp_fileno(self);
+
+	rb_scan_args(argc, argv, "01", &nonblock);
+	for (;;) {
+		siginfo_t si;
+
+		si.si_pid = 0;
+		if (waitid(P_PIDFD, (id_t)fd, &si, WEXITED|WNOHANG) < 0) {
+			if (errno == EINTR)
+				continue;
+			/* a PIDFD_NONBLOCK descriptor for a running child */
+			if (errno != EAGAIN)
+				rb_sys_fail("waitid(P_PIDFD)");
+		} else if (si.si_pid) {
+			rb_last_status_set(si2status(&si), si.si_pid);
+			return rb_last_status_get();
+		}
+		if (RTEST(nonblock))
+			return Qnil;
+
+		errno = EAGAIN;
+		if (!rb_sp_wait(rb_io_wait_readable, self, &fd))
+			rb_sys_fail("waitid(P_PIDFD)");
+	}
+}
+
+void sleepy_penguin_init_pidfd(void)
+{
+	VALUE mSleepyPenguin, cPidFD;
+
+	mSleepyPenguin = rb_define_module("SleepyPenguin");
+
+	/*
+	 * Document-class: SleepyPenguin::PidFD
+	 *
+	 * A descriptor for a process, see pidfd_open(2).  It lets a parent
+	 * supervise any number of children from an Epoll loop without
+	 * SIGCHLD handlers or polling Process.wait, and signal them without
+	 * racing against PID reuse.
+	 *
+	 *	pid = Process.spawn(*cmd)
+	 *	pidfd = SleepyPenguin::PidFD.new(pid)
+	 *	ep.add(pidfd, :IN)
+	 *	# when ep reports pidfd readable:
+	 *	status = pidfd.wait(true)
+	 *	ep.del(pidfd)
+	 *	pidfd.close
+	 *
+	 * This requires Linux 5.3 or later, PidFD#wait requires 5.4.
+	 */
+	cPidFD = rb_define_class_under(mSleepyPenguin, "PidFD", rb_cIO);
+	rb_define_singleton_method(cPidFD, "new", s_new, -1);
+
+	/*
+	 * Set the non-blocking I/O flag on the descriptor, Linux 5.10+
+	 */
+	rb_define_const(cPidFD, "NONBLOCK", INT2NUM(PIDFD_NONBLOCK));
+
+	rb_define_method(cPidFD, "pid", pidfd_pid, 0);
+	rb_define_method(cPidFD, "__send_signal", pidfd_send_signal, 1);
+	rb_define_method(cPidFD, "wait", pidfd_wait, -1);
+
+	id_ivar_pid = rb_intern("@__sp_pid");
+}
+#endif /* __linux__ */
@@ -0,0 +1,116 @@
+#include "sleepy_penguin.h"
+#if defined(__linux__) && defined(HAVE_LINUX_FILTER_H)
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#ifndef SO_INCOMING_CPU
+#  define SO_INCOMING_CPU 49
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#  define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+#ifndef SKF_AD_CPU
+#  define SKF_AD_CPU 36
+#endif
+
+static void attach_cbpf(int fd, struct sock_filter *insns, size_t len)
+{
+	struct sock_fprog prog;
+
+	prog.len = (unsigned short)len;
+	prog.filter = insns;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+			&prog, sizeof(prog)) < 0)
+		rb_sys_fail("setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+}
+
+/* :nodoc: */
+static VALUE reuseport_attach_cbpf(VALUE mod, VALUE io, VALUE program)
+{
+	struct sock_filter *insns;
+	long len;
+	VALUE tmp;
+
+	StringValue(program);
+	len = RSTRING_LEN(program);
+	if (len == 0 || len % sizeof(struct sock_filter) ||
+	    len / sizeof(struct sock_filter) > BPF_MAXINSNS)
+		rb_raise(rb_eArgError, "invalid program length: %ld", len);
+
+	/* copied for alignment */
+	insns = ALLOCV(tmp, len);
+	memcpy(insns, RSTRING_PTR(program), len);
+	attach_cbpf(rb_sp_fileno(io), insns, len / sizeof(*insns));
+	ALLOCV_END(tmp);
+
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin.reuseport_steer_by_cpu(sock, nr_socks)	-> nil
+ *
+ * Attaches a classic BPF program to the SO_REUSEPORT group +sock+
+ * belongs to, which hands each new connection (or datagram) to the
+ * socket numbered <code>cpu % nr_socks</code>, where +cpu+ is the CPU
+ * the kernel processed the packet on.  Sockets are numbered in the
+ * order they joined the group (bound), starting at zero, and
+ * +nr_socks+ is normally the size of the group.
+ *
+ * With one worker per CPU, each pinned to it with Sched.affinity= and
+ * owning the socket with its CPU number, connections are served on
+ * the CPU which handled their interrupts, keeping their data in its
+ * caches (and NUMA node).  This requires Linux 4.5+, the program
+ * applies to the whole group and replaces any already attached.
+ */
+static VALUE reuseport_steer_by_cpu(VALUE mod, VALUE io, VALUE nr_socks)
+{
+	unsigned n = NUM2UINT(nr_socks);
+	struct sock_filter insns[] = {
+		/* A = raw_smp_processor_id() */
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_CPU),
+		/* A %= n */
+		BPF_STMT(BPF_ALU|BPF_MOD|BPF_K, n),
+		/* return A */
+		BPF_STMT(BPF_RET|BPF_A, 0),
+	};
+
+	if (n == 0)
+		rb_raise(rb_eArgError, "nr_socks must be positive");
+	attach_cbpf(rb_sp_fileno(io), insns, sizeof(insns) / sizeof(*insns));
+
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin.incoming_cpu(sock)	-> Integer
+ *
+ * Returns the CPU which last processed packets for +sock+ with
+ * getsockopt(SO_INCOMING_CPU), Linux 3.19+.  For a freshly accepted
+ * connection, this is the CPU its handshake was handled on, and -1
+ * if unknown.
+ */
+static VALUE incoming_cpu(VALUE mod, VALUE io)
+{
+	int cpu;
+	socklen_t len = sizeof(cpu);
+
+	if (getsockopt(rb_sp_fileno(io), SOL_SOCKET, SO_INCOMING_CPU,
+			&cpu, &len) < 0)
+		rb_sys_fail("getsockopt(SO_INCOMING_CPU)");
+
+	return INT2NUM(cpu);
+}
+
+void sleepy_penguin_init_reuseport(void)
+{
+	VALUE mod = rb_define_module("SleepyPenguin");
+
+	rb_define_singleton_method(mod, "__reuseport_attach_cbpf",
+				   reuseport_attach_cbpf, 2);
+	rb_define_singleton_method(mod, "reuseport_steer_by_cpu",
+				   reuseport_steer_by_cpu, 2);
+	rb_define_singleton_method(mod, "incoming_cpu", incoming_cpu, 1);
+}
+#endif /* __linux__ && HAVE_LINUX_FILTER_H */
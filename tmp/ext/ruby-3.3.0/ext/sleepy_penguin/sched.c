@@ -0,0 +1,328 @@
+#include "sleepy_penguin.h"
+#ifdef __linux__
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include "value2timespec.h"
+
+#ifndef SCHED_DEADLINE
+#  define SCHED_DEADLINE 6
+#endif
+#ifndef SCHED_FLAG_RESET_ON_FORK
+#  define SCHED_FLAG_RESET_ON_FORK 0x01
+#endif
+#ifndef SCHED_FLAG_RECLAIM
+#  define SCHED_FLAG_RECLAIM 0x02
+#endif
+#ifndef SCHED_FLAG_DL_OVERRUN
+#  define SCHED_FLAG_DL_OVERRUN 0x04
+#endif
+
+/*
+ * SCHED_ATTR_SIZE_VER0 layout of struct sched_attr, which only newer
+ * libcs declare (and have wrappers for)
+ */
+struct sp_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+static VALUE cAttr;
+
+/* for sched_attr and prctl, which take nanoseconds as 64-bit integers */
+static uint64_t num2ns(VALUE num)
+{
+	struct timespec ts;
+
+	value2timespec_ns(&ts, num);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::Sched.timerslack -> Integer
+ *
+ * Returns the timer slack of the calling thread in nanoseconds.
+ */
+static VALUE timerslack_get(VALUE mod)
+{
+	int rc = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+
+	if (rc < 0)
+		rb_sys_fail("prctl(PR_GET_TIMERSLACK)");
+	return INT2NUM(rc);
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::Sched.timerslack = nanoseconds
+ *
+ * Sets the timer slack of the calling thread, which is how late the
+ * kernel may fire timers (including those of Epoll#wait, TimerFD and
+ * sleep) in order to coalesce wakeups.  The default is 50 microseconds
+ * for normal threads, setting it to 1 makes wakeups as precise as the
+ * hardware allows.  Integers are nanoseconds, Floats are seconds.
+ * Zero restores the default slack.
+ *
+ * Timer slack does not apply to threads with a realtime policy
+ * (see Sched.setattr), nor is it inherited by existing threads.
+ */
+static VALUE timerslack_set(VALUE mod, VALUE ns)
+{
+	unsigned long slack = (unsigned long)num2ns(ns);
+
+	if (prctl(PR_SET_TIMERSLACK, slack, 0, 0, 0) < 0)
+		rb_sys_fail("prctl(PR_SET_TIMERSLACK)");
+	return ns;
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::Sched.getattr -> SleepyPenguin::Sched::Attr
+ *
+ * Returns the scheduling policy and parameters of the calling thread
+ * with sched_getattr(2).
+ */
+static VALUE getattr(VALUE mod)
+{
+#ifdef SYS_sched_getattr
+	struct sp_sched_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	if (syscall(SYS_sched_getattr, 0, &attr, sizeof(attr), 0) < 0)
+		rb_sys_fail("sched_getattr");
+
+	return rb_struct_new(cAttr,
+		UINT2NUM(attr.sched_policy),
+		ULL2NUM(attr.sched_flags),
+		INT2NUM(attr.sched_nice),
+		UINT2NUM(attr.sched_priority),
+		ULL2NUM(attr.sched_runtime),
+		ULL2NUM(attr.sched_deadline),
+		ULL2NUM(attr.sched_period));
+#else
+	rb_notimplement();
+	return Qnil;
+#endif
+}
+
+/* :nodoc: */
+static VALUE setattr(VALUE mod, VALUE policy, VALUE flags, VALUE nice,
+		VALUE priority, VALUE runtime, VALUE deadline, VALUE period)
+{
+#ifdef SYS_sched_setattr
+	struct sp_sched_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_policy = NUM2UINT(policy);
+	attr.sched_flags = NUM2ULL(flags);
+	attr.sched_nice = NUM2INT(nice);
+	attr.sched_priority = NUM2UINT(priority);
+	attr.sched_runtime = num2ns(runtime);
+	attr.sched_deadline = num2ns(deadline);
+	attr.sched_period = num2ns(period);
+
+	if (syscall(SYS_sched_setattr, 0, &attr, 0) < 0)
+		rb_sys_fail("sched_setattr");
+	return Qnil;
+#else
+	rb_notimplement();
+	return Qnil;
+#endif
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::Sched.affinity -> [ cpu, ... ]
+ *
+ * Returns an Array of the CPU numbers the calling thread may run on.
+ */
+static VALUE affinity_get(VALUE mod)
+{
+	int nr = 1024;
+	VALUE tmp, rv;
+	cpu_set_t *set;
+	size_t size;
+	int i, err;
+
+	for (;;) {
+		size = CPU_ALLOC_SIZE(nr);
+		set = ALLOCV(tmp, size);
+		if (sched_getaffinity(0, size, set) == 0)
+			break;
+		err = errno;
+		ALLOCV_END(tmp);
+		/* EINVAL: more CPUs than fit in +set+ */
+		if (err != EINVAL || nr >= (1 << 20)) {
+			errno = err;
+			rb_sys_fail("sched_getaffinity");
+		}
+		nr *= 2;
+	}
+	rv = rb_ary_new_capa(CPU_COUNT_S(size, set));
+	for (i = 0; i < nr; i++)
+		if (CPU_ISSET_S(i, size, set))
+			rb_ary_push(rv, INT2FIX(i));
+	ALLOCV_END(tmp);
+
+	return rv;
+}
+
+static int num2cpu(VALUE num)
+{
+	int cpu = NUM2INT(num);
+
+	if (cpu < 0)
+		rb_raise(rb_eArgError, "negative CPU: %d", cpu);
+	return cpu;
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::Sched.affinity = cpu or [ cpu, ... ]
+ *
+ * Restricts the calling thread to run on the given CPU number(s),
+ * with sched_setaffinity(2).  Pinning a reactor thread to one CPU
+ * avoids migrations and keeps its caches warm.
+ */
+static VALUE affinity_set(VALUE mod, VALUE cpus)
+{
+	VALUE ary = rb_check_array_type(cpus);
+	int max = 0;
+	cpu_set_t *set;
+	size_t size;
+	long i, n;
+	VALUE tmp;
+
+	if (NIL_P(ary))
+		ary = rb_ary_new_from_args(1, cpus);
+	n = RARRAY_LEN(ary);
+	if (n == 0)
+		rb_raise(rb_eArgError, "no CPUs given");
+	for (i = 0; i < n; i++) {
+		int cpu = num2cpu(rb_ary_entry(ary, i));
+
+		if (cpu > max)
+			max = cpu;
+	}
+	size = CPU_ALLOC_SIZE(max + 1);
+	set = ALLOCV(tmp, size);
+	CPU_ZERO_S(size, set);
+	for (i = 0; i < n; i++)
+		CPU_SET_S(NUM2INT(rb_ary_entry(ary, i)), size, set);
+	if (sched_setaffinity(0, size, set) < 0) {
+		int err = errno;
+
+		ALLOCV_END(tmp);
+		errno = err;
+		rb_sys_fail("sched_setaffinity");
+	}
+	ALLOCV_END(tmp);
+
+	return cpus;
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::Sched.getcpu -> Integer
+ *
+ * Returns the number of the CPU the calling thread is running on,
+ * which may change at any time unless it is pinned with
+ * Sched.affinity=.
+ */
+static VALUE current_cpu(VALUE mod)
+{
+	int cpu = sched_getcpu();
+
+	if (cpu < 0)
+		rb_sys_fail("sched_getcpu");
+	return INT2NUM(cpu);
+}
+
+void sleepy_penguin_init_sched(void)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+
+	/*
+	 * Document-module: SleepyPenguin::Sched
+	 *
+	 * Scheduling controls for latency-sensitive threads, such as those
+	 * running an Epoll or TimerFD event loop.  Every method applies to
+	 * the calling native thread only, so they should be called from
+	 * the Thread they are meant for:
+	 *
+	 *	Thread.new do
+	 *	  SleepyPenguin::Sched.timerslack = 1
+	 *	  SleepyPenguin::Sched.affinity = 3
+	 *	  reactor.run
+	 *	end
+	 *
+	 * This assumes each Ruby Thread has its own native thread, which is
+	 * not the case with RUBY_MN_THREADS=1 in Ruby 3.3+.
+	 */
+	VALUE mSched = rb_define_module_under(mSleepyPenguin, "Sched");
+
+	/*
+	 * Document-class: SleepyPenguin::Sched::Attr
+	 *
+	 * Returned by SleepyPenguin::Sched.getattr.  It is a Struct with
+	 * the following elements:
+	 *
+	 * - policy - one of the Sched policy constants
+	 * - flags - mask of Sched::RESET_ON_FORK, Sched::RECLAIM and
+	 *   Sched::DL_OVERRUN
+	 * - nice - nice value for OTHER and BATCH
+	 * - priority - static priority (1-99) for FIFO and RR
+	 * - runtime, deadline, period - in nanoseconds, for DEADLINE
+	 */
+	cAttr = rb_struct_define_under(mSched, "Attr", "policy", "flags",
+				"nice", "priority", "runtime", "deadline",
+				"period", NULL);
+
+	rb_define_singleton_method(mSched, "timerslack", timerslack_get, 0);
+	rb_define_singleton_method(mSched, "timerslack=", timerslack_set, 1);
+	rb_define_singleton_method(mSched, "getattr", getattr, 0);
+	rb_define_singleton_method(mSched, "__setattr", setattr, 7);
+	rb_define_singleton_method(mSched, "affinity", affinity_get, 0);
+	rb_define_singleton_method(mSched, "affinity=", affinity_set, 1);
+	rb_define_singleton_method(mSched, "getcpu", current_cpu, 0);
+
+	/* the default time-sharing policy */
+	rb_define_const(mSched, "OTHER", INT2NUM(SCHED_OTHER));
+
+	/* realtime first-in, first-out policy, requires +priority+ */
+	rb_define_const(mSched, "FIFO", INT2NUM(SCHED_FIFO));
+
+	/* realtime round-robin policy, requires +priority+ */
+	rb_define_const(mSched, "RR", INT2NUM(SCHED_RR));
+
+	/* time-sharing policy for CPU-bound, non-interactive work */
+	rb_define_const(mSched, "BATCH", INT2NUM(SCHED_BATCH));
+
+	/* lower than the lowest nice value */
+	rb_define_const(mSched, "IDLE", INT2NUM(SCHED_IDLE));
+
+	/*
+	 * earliest deadline first, requires +runtime+, +deadline+ and
+	 * +period+ (Linux 3.14+)
+	 */
+	rb_define_const(mSched, "DEADLINE", INT2NUM(SCHED_DEADLINE));
+
+	/* children created by fork(2) revert to the default policy */
+	rb_define_const(mSched, "RESET_ON_FORK",
+			INT2NUM(SCHED_FLAG_RESET_ON_FORK));
+
+	/* DEADLINE threads may reclaim unused bandwidth (Linux 4.13+) */
+	rb_define_const(mSched, "RECLAIM", INT2NUM(SCHED_FLAG_RECLAIM));
+
+	/* send SIGXCPU on DEADLINE runtime overruns (Linux 4.16+) */
+	rb_define_const(mSched, "DL_OVERRUN", INT2NUM(SCHED_FLAG_DL_OVERRUN));
+}
+#endif /* __linux__ */
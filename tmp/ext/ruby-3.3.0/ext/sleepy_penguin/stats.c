@@ -0,0 +1,201 @@
+#include "sleepy_penguin.h"
+#include <pthread.h>
+#include <string.h>
+
+/*
+ * Per-thread transfer counters.  Each thread updates its own block
+ * without atomics or locks; blocks are padded to the L1 cache line so
+ * threads never share a line.  The lock only protects the list of
+ * blocks, which is walked when SleepyPenguin.stats aggregates them.
+ */
+#define STATS_ALIGN 128 /* L1_CACHE_LINE_MAX in init.c */
+
+struct stats_tls {
+	struct stats_tls *prev;
+	struct stats_tls *next;
+	struct rb_sp_stat stat[RB_SP_STAT_MAX];
+};
+
+static pthread_key_t stats_key;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_tls stats_head = { &stats_head, &stats_head };
+
+/* counters from threads which already exited */
+static struct rb_sp_stat stats_retired[RB_SP_STAT_MAX];
+
+static void stats_add(struct rb_sp_stat *dst, const struct rb_sp_stat *src)
+{
+	dst->calls += src->calls;
+	dst->bytes += src->bytes;
+	dst->eagain += src->eagain;
+	dst->eintr += src->eintr;
+	dst->fallback += src->fallback;
+}
+
+static void stats_lock_or_die(void)
+{
+	int err = pthread_mutex_lock(&stats_lock);
+
+	if (err)
+		rb_bug("pthread_mutex_lock: %s", strerror(err));
+}
+
+static void stats_unlock(void)
+{
+	int err = pthread_mutex_unlock(&stats_lock);
+
+	if (err)
+		rb_bug("pthread_mutex_unlock: %s", strerror(err));
+}
+
+/* pthread key destructor, runs at thread exit without the GVL */
+static void stats_retire(void *ptr)
+{
+	struct stats_tls *tls = ptr;
+	int i;
+
+	if (pthread_mutex_lock(&stats_lock) != 0)
+		return; /* leak it, better than crashing at thread exit */
+	for (i = 0; i < RB_SP_STAT_MAX; i++)
+		stats_add(&stats_retired[i], &tls->stat[i]);
+	tls->prev->next = tls->next;
+	tls->next->prev = tls->prev;
+	pthread_mutex_unlock(&stats_lock);
+	free(tls);
+}
+
+static struct stats_tls *stats_tls_new(void)
+{
+	size_t size = sizeof(struct stats_tls);
+	struct stats_tls *tls;
+	void *ptr;
+	int err;
+
+	size = (size + STATS_ALIGN - 1) & ~(size_t)(STATS_ALIGN - 1);
+	if (posix_memalign(&ptr, STATS_ALIGN, size))
+		rb_memerror();
+	memset(ptr, 0, size);
+	tls = ptr;
+
+	err = pthread_setspecific(stats_key, tls);
+	if (err) {
+		free(tls);
+		errno = err;
+		rb_sys_fail("BUG: pthread_setspecific");
+	}
+
+	stats_lock_or_die();
+	tls->next = &stats_head;
+	tls->prev = stats_head.prev;
+	stats_head.prev->next = tls;
+	stats_head.prev = tls;
+	stats_unlock();
+
+	return tls;
+}
+
+struct rb_sp_stat *rb_sp_stat(enum rb_sp_stat_op op)
+{
+	struct stats_tls *tls = pthread_getspecific(stats_key);
+
+	if (!tls)
+		tls = stats_tls_new();
+	return &tls->stat[op];
+}
+
+/* records the result +n+ (and errno if negative) of one syscall */
+void rb_sp_stat_result(enum rb_sp_stat_op op, ssize_t n)
+{
+	int err = errno;
+	struct rb_sp_stat *st = rb_sp_stat(op);
+
+	st->calls++;
+	if (n > 0) {
+		st->bytes += (uint64_t)n;
+	} else if (n < 0) {
+		if (err == EAGAIN)
+			st->eagain++;
+		else if (err == EINTR)
+			st->eintr++;
+	}
+	errno = err;
+}
+
+static VALUE stat2hash(const struct rb_sp_stat *st)
+{
+	VALUE h = rb_hash_new();
+
+#define S(f) rb_hash_aset(h, ID2SYM(rb_intern(#f)), ULL2NUM(st->f))
+	S(calls);
+	S(bytes);
+	S(eagain);
+	S(eintr);
+	S(fallback);
+#undef S
+	return h;
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin.stats	-> Hash
+ *
+ * Returns process-wide counters for the zero-copy primitives, aggregated
+ * from every thread (including threads which exited).  The returned
+ * Hash is keyed by :splice, :tee, :sendfile and :copy_file_range,
+ * each value is a Hash with the following Integer counters:
+ *
+ * - :calls - number of system calls made
+ * - :bytes - bytes transferred
+ * - :eagain - system calls which failed with EAGAIN
+ * - :eintr - system calls interrupted by signals
+ * - :fallback - times a slower path was used: the GC-and-retry on
+ *   ENOMEM for sendfile, or SleepyPenguin.copy_stream giving up on
+ *   the primitive for the next method
+ *
+ * SleepyPenguin.copy_stream and SleepyPenguin::Fanout count towards
+ * the primitive they use.  Counters of running threads are read
+ * without synchronization, so they may lag slightly.
+ */
+static VALUE rb_sp_stats(VALUE mod)
+{
+	static const char *names[RB_SP_STAT_MAX] = {
+		"splice", "tee", "sendfile", "copy_file_range"
+	};
+	struct rb_sp_stat sum[RB_SP_STAT_MAX];
+	struct stats_tls *tls;
+	VALUE rv = rb_hash_new();
+	int i;
+
+	stats_lock_or_die();
+	MEMCPY(sum, stats_retired, struct rb_sp_stat, RB_SP_STAT_MAX);
+	for (tls = stats_head.next; tls != &stats_head; tls = tls->next)
+		for (i = 0; i < RB_SP_STAT_MAX; i++)
+			stats_add(&sum[i], &tls->stat[i]);
+	stats_unlock();
+
+	for (i = 0; i < RB_SP_STAT_MAX; i++)
+		rb_hash_aset(rv, ID2SYM(rb_intern(names[i])),
+			     stat2hash(&sum[i]));
+	return rv;
+}
+
+/* only the forking thread survives, but keep the others' counts */
+static void stats_atfork_child(void)
+{
+	pthread_mutex_init(&stats_lock, NULL);
+}
+
+void sleepy_penguin_init_stats(void)
+{
+	VALUE mod = rb_define_module("SleepyPenguin");
+	int err = pthread_key_create(&stats_key, stats_retire);
+
+	if (err == 0)
+		err = pthread_atfork(NULL, NULL, stats_atfork_child);
+	if (err) {
+		errno = err;
+		rb_sys_fail("pthread_key_create");
+	}
+
+	rb_define_singleton_method(mod, "stats", rb_sp_stats, 0);
+}